@@ -2,7 +2,7 @@
 # Build metalshader on Alpine Linux guest
 
 echo "Building metalshader..."
-gcc -I/usr/include/libdrm -o metalshader metalshader.c -ldrm -lvulkan -lgbm -lm
+gcc -I/usr/include/libdrm -o metalshader metalshader.c -ldrm -lvulkan -lgbm -lm -lpthread
 
 if [ $? -eq 0 ]; then
     echo "✓ Build successful: ./metalshader"
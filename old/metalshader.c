@@ -1,48 +1,474 @@
 /* Metalshader - Interactive shader viewer with keyboard navigation
- * Usage: ./metalshader <shader_name>
+ * Usage: ./metalshader [--copy] [--no-flip] [--max-fps F] [--outputs MODE] [--gpu SEL] [--split-frame]
+ *                     [--rgb565] [--blit-threads N]
+ *                     [--prewarm-all] [--compile] [--timestep F] [--seek T] [--quality TIER|auto]
+ *                     [--compute [--workgroup WxH]] [--scale S|auto [--target-fps F]] <shader_name>
+ *        ./metalshader --headless [--size WxH] [--frames N] [--fps F] [--output FILE] <shader_name>
+ *        ./metalshader --bench [--warmup N] [--measure M] [--csv FILE] [--headless ...]
+ *        ./metalshader --bench-blit [--size WxH] [--frames N] [--blit-threads N]
+ *        ./metalshader --make-bundle FILE [--compile] [--compute ...]
+ *        Any mode: [--telemetry SOCKET] [--bundle FILE]
+ *
+ * Options:
+ *   --copy:    Read frames back through host memory and memcpy into scanout (skip dma-buf import)
+ *   --no-flip: Update the CRTC in place instead of vsynced page flips (may tear)
+ *   --rgb565:  Scan out 16-bit RGB565, converted while copying (implies --copy)
+ *   --blit-threads: Threads copying frames into scanout on the copy path,
+ *                   default half the cores (at most 8)
+ *   --max-fps: Pace frames with a timer at F FPS, 0 for uncapped. Defaults to
+ *              uncapped with page flips (vblank paces the loop) and to the
+ *              fastest display's refresh rate with --no-flip.
+ *   --outputs: How connected displays are driven (up to 4, each on its own
+ *              CRTC and flipping at its own rate): "mirror" (default) draws
+ *              the current shader on every one, "span" lays them out left to
+ *              right as one canvas, "each" shows the shaders following the
+ *              current one on the other displays, "first" uses only one.
+ *   --gpu:     Render on the GPU with this index (loader order), device UUID
+ *              or name substring, instead of the first one. Lists the GPUs if
+ *              nothing matches.
+ *   --split-frame: Split every frame into horizontal bands, one per GPU of
+ *                  the selected GPU's Vulkan device group, composited into
+ *                  the render target (copy path; not with --compute/--scale)
+ *   --prewarm-all: Build every shader's pipeline in the background, not just
+ *                  the neighbours of the current one
+ *   --compile: Build missing or stale (older than the .frag) SPIR-V at startup
+ *              with glslangValidator, one build per core, wrapping ShaderToy
+ *              sources like the Rust ShaderCompiler. Without it, shaders
+ *              lacking SPIR-V are skipped and stale SPIR-V is used as is.
+ *   --compute: Render with a compute dispatch into a storage image instead of
+ *              a fullscreen draw. Needs <shader>.comp.spv next to the .frag
+ *              (the Rust ShaderCompiler generates it) and uses the copy path.
+ *   --workgroup: Compute workgroup size, default 8x8
+ *   --scale: Render at S (0.25-1) times the output size and upscale with a
+ *            linear blit. "auto" adjusts the scale every 30 frames so GPU
+ *            time stays within 90% of the --target-fps (default 60) budget.
+ *   --headless: Render offline without a display and write raw BGRA frames
+ *               (W*H*4 bytes each, top row first) to --output, default stdout.
+ *               iTime advances by exactly 1/fps per frame. Defaults:
+ *               --size 1280x720 --frames 300 --fps 60. Status goes to stderr.
+ *   --bench: Run every shader for N warm-up then M measured frames (default
+ *            60 + 300) and write min/median/p99 of GPU time (timestamps
+ *            around the render pass), CPU record+submit, copy and present
+ *            time per shader to --csv (default bench.csv). With --headless
+ *            frames go to /dev/null unless --output is given.
+ *   --bench-blit: Time the plain row copy against the SIMD and threaded blit
+ *                 into XRGB8888 and RGB565 (default 1280x720, 300 frames)
+ *   --timestep: Advance iTime in steps of 1/F seconds that follow the clock.
+ *               A frame is rendered once per step; when one runs late, the
+ *               steps it overran are skipped rather than played late, and
+ *               counted in the status line.
+ *   --seek:    Start the first shader at iTime T (headless too)
+ *   --telemetry: Serve frame timing histograms on a Unix socket at SOCKET:
+ *                every connection gets p50/p99/p99.9 (over the last one to
+ *                two minutes), sum, count and max of the fence wait, copy,
+ *                present, record+submit, GPU time, frame interval and
+ *                shader switch latency, in Prometheus text format, plus
+ *                how long the fence wait in progress (if any) has taken
+ *   --quality: Quality tier of the shaders' tunables (see Quality below):
+ *              low, medium, high or ultra (default). "auto" starts at ultra
+ *              and moves one tier every 30 frames that GPU time is over the
+ *              --target-fps budget or under half of it (after --scale
+ *              auto is at its floor or back at 1). --bench measures every
+ *              tier and prints the highest one that fits.
+ *   --make-bundle: Pack every shader found (SPIR-V, .channels, the texture
+ *                  files they name, .quality) into one bundle file, along
+ *                  with a pipeline cache of all their pipelines (every
+ *                  quality tier) built on this GPU with the options given,
+ *                  then exit
+ *   --bundle:  Take the shaders from a bundle instead of the search dirs.
+ *              It is mapped read-only at startup and SPIR-V goes to the
+ *              driver straight from the mapping, so loading and switching
+ *              never touch the filesystem. Its pipeline cache seeds the
+ *              driver's when it was built for this GPU and driver. No live
+ *              reload.
  *
  * Controls:
- *   Arrow Left/Right: Switch between shaders
+ *   Arrow Left/Right: Switch between shaders (in name order)
+ *   Space: Pause/resume. Paused, iTime, iFrame and iDate hold still and
+ *          slots stop rendering once they hold the paused frame (shaders
+ *          with buffer passes keep running, their buffers may still move).
+ *   Arrow Up/Down: Seek 5 seconds forward/back
+ *   Mouse/touch: iMouse, as in ShaderToy (xy while the button is down,
+ *                zw where it went down)
  *   ESC/Q: Quit
  *
+ * Input: an input thread reads every keyboard and pointer under /dev/input,
+ * picking up devices as they are plugged in, and wakes the render loop
+ * with each command.
+ *
+ * Startup: the shader scan and the DRM/GBM setup run on threads of their
+ * own while the Vulkan instance is created, and the first frame's
+ * pipelines are built on the pre-warm worker while the render targets,
+ * descriptors and textures are set up. A per-phase breakdown is printed
+ * once the first frame is presented (or written).
+ *
+ * Compiled pipelines are cached in $XDG_CACHE_HOME/metalshader (default
+ * ~/.cache/metalshader) and reused across runs and shader switches. A worker
+ * thread builds the previous/next shaders' pipelines ahead of time, so arrow
+ * key navigation usually just binds an already built pipeline. Shaders that
+ * aren't ready yet are built in the background while the current one keeps
+ * running.
+ *
+ * Live reload: saving the current shader's .frag (or .vert) recompiles it in
+ * the background with glslangValidator; new .spv files for it are picked up
+ * and swapped in without restarting the clock. Not in --headless or --bench.
+ *
+ * Multipass: <name>.bufa.frag to <name>.bufd.frag next to a shader's .frag
+ * are ShaderToy's Buffer A-D. They render in that order into RGBA16F
+ * targets of the output's size, kept across frames and zeroed when the
+ * shader is switched to, before the shader's own Image pass. Every pass
+ * reads Buffer A+k on iChannel k by default: a buffer drawn earlier in the
+ * frame as it is now, itself and later ones as of the previous frame.
+ * <name>.channels rewires that, one line per pass ("bufa: bufa tex",
+ * "image: bufb bufa"). Not with --compute, --split-frame, --scale or
+ * --outputs span, which run the Image pass alone.
+ *
+ * Textures: a channel can also name an image file next to the shader
+ * ("image: bufa textures/rock.png"): PNG, or uncompressed KTX2 for cube
+ * maps, volumes and float formats. Files are decoded on worker threads and
+ * uploaded into device-local images with a full mip chain (generated on
+ * the GPU unless the KTX2 has one); until then, or if loading fails, the
+ * channel reads the checkerboard (black for cube maps and volumes). Files
+ * with the same content share one image. --compile declares such channels
+ * as samplerCube or sampler3D as needed. --headless and --bench wait for a
+ * shader's textures before rendering it. Not with --compute.
+ *
+ * Quality: <name>.quality lists a shader's tunables, one per line with a
+ * value per tier, low to ultra ("MAX_ITER: 32 64 128 256", "AA: 1 1 2").
+ * The shader declares each as a specialization constant of the same name
+ * (--compile's wrapper declares them itself, constant_id 16 onwards in file
+ * order), and pipelines are specialized for the current tier. Changing
+ * tiers rebuilds the shader on screen in the background and swaps it in
+ * like a live reload; the pipeline cache keeps every variant built so far.
+ *
  * Provides:
- * - binding 0: UniformBufferObject (iResolution, iTime, iMouse)
- * - binding 1: sampler2D (256x256 procedural checkerboard texture)
+ * - binding 0: UniformBufferObject (iResolution, iTime, iMouse, then
+ *   iTimeDelta, iFrame, iDate), one entry of a persistently mapped ring per
+ *   frame in flight, bound by dynamic offset. --compile's wrapper also
+ *   provides them as plain names.
+ * - binding 1: sampler2D iChannel0 (256x256 procedural checkerboard texture)
+ * - bindings 3-5: sampler2D iChannel1-3 (the same texture unless wired to a buffer or a file)
  */
-#define _POSIX_C_SOURCE 199309L
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 #include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+#include <spawn.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
 #include <linux/input.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include <drm_fourcc.h>
 #include <gbm.h>
 #include <vulkan/vulkan.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
-#define MAX_SHADERS 256
+#define FRAMES_IN_FLIGHT 3  // Render targets in the ring: GPU draws N+1 while N is copied out
+#define PIPELINE_LRU_SIZE 8  // Built pipelines kept around for instant shader switches
+#define MAX_RETIRED 64       // Evicted pipelines waiting for their last frame to finish
+#define SEARCH_DIR_COUNT 3
+#define LIVE_RELOAD_DELAY 0.1  // Seconds of quiet after a SPIR-V write before rebuilding
+#define MIN_RENDER_SCALE 0.25f
+#define SCALE_WINDOW 30      // Frames of GPU time averaged per --scale auto adjustment
+#define MAX_OUTPUTS 4        // Connected displays driven at once (each keeps a pipeline bound)
+// Room past PIPELINE_LRU_SIZE for when every entry is on screen, just bound or current+-1
+#define PIPELINE_LRU_CAPACITY (PIPELINE_LRU_SIZE + 2 * MAX_OUTPUTS + 3)
+#define MEMORY_BLOCK_SIZE (32u << 20)  // Device memory is allocated in blocks of this and sub-allocated
+#define MAX_MEMORY_BLOCKS 64
+#define MAX_BLIT_WORKERS 7   // Helper threads of the copy path's blit, besides the main thread
+#define BUFFER_PASSES 4      // ShaderToy Buffer A-D, rendered in order before the Image pass
+#define IMAGE_PASS BUFFER_PASSES
+#define PASS_COUNT (BUFFER_PASSES + 1)
+#define CHANNEL_TEXTURE BUFFER_PASSES  // A channel reading the checkerboard instead of a buffer
+#define CHANNEL_FILE (CHANNEL_TEXTURE + 1)  // CHANNEL_FILE + j: the shader's j-th texture file
+#define SHADER_TEXTURES 4    // Texture files one shader's channels can name
+#define QUALITY_CONSTANTS 8  // Tunables one shader's .quality can list
+#define QUALITY_CONSTANT_ID 16  // --compile's wrapper: constant_id of the first tunable
+#define QUALITY_HOLD 4       // --quality auto: windows skipped after a tier change
+#define MAX_TEXTURES 64      // Distinct texture files loaded at once (never unloaded)
+#define TEXTURE_WORKERS 2    // Threads decoding texture files
+#define TEXTURE_STAGING_SIZE (64u << 20)  // Upload buffer; larger textures are rejected
+#define MAX_TEXTURE_LEVELS 16
+#define MAX_TEXTURE_SIZE 16384
 
+// Quality tiers a shader's tunables (<name>.quality) have values for
+enum { QUALITY_LOW, QUALITY_MEDIUM, QUALITY_HIGH, QUALITY_ULTRA, QUALITY_TIERS };
+static const char *quality_tier_names[QUALITY_TIERS] = {"low", "medium", "high", "ultra"};
+
+// One entry of the UBO ring: everything that changes per frame, so a
+// slot's command buffer can be submitted again as it is. The first three
+// fields are the original wrapper's block, which existing SPIR-V expects.
 typedef struct {
     float iResolution[3];
     float iTime;
     float iMouse[4];
+    float iTimeDelta;
+    int32_t iFrame;
+    float pad[2];
+    float iDate[4];      // Year, month (0-11), day (1-31), seconds since midnight
 } ShaderToyUBO;
 
+// Catalog entry. Strings live in shader_arena; the SPIR-V paths are
+// <dir>/<name>.vert.spv etc. and built on demand.
 typedef struct {
-    char name[256];  // Base name without extension
-    char vert_path[512];
-    char frag_path[512];
+    uint32_t name;     // Arena offset of the base name, without extension
+    uint32_t dir;      // Arena offset of the search directory
+    uint8_t has_comp;  // <name>.comp.spv exists (compute variant)
+    uint8_t buffers;   // Bit k: <name>.buf<a+k>.frag exists (Buffer A-D pass)
+    uint8_t channels[PASS_COUNT][4];  // What each pass's iChannel0-3 read: a buffer, CHANNEL_TEXTURE or CHANNEL_FILE + j
+    uint8_t texture_count;
+    uint8_t texture_kinds[SHADER_TEXTURES];  // TEXTURE_2D/CUBE/3D: the sampler type the wrapper declares
+    uint8_t texture_ids[SHADER_TEXTURES];    // Main thread: 1 + entry of textures.entries, 0 if not yet resolved
+    uint32_t textures[SHADER_TEXTURES];      // Arena offsets of the file names, relative to dir
+    uint8_t quality_count;                   // Tunables in <name>.quality
+    uint8_t quality_float;                   // Bit k: tunable k has fractional values (float for the wrapper)
+    uint32_t quality_names[QUALITY_CONSTANTS];             // Arena offsets
+    float quality_values[QUALITY_CONSTANTS][QUALITY_TIERS];  // Per tier, low to ultra
 } ShaderInfo;
 
-static ShaderInfo shaders[MAX_SHADERS];
-static int shader_count = 0;
+// One entry of the frame ring. Each slot owns everything a frame in flight
+// touches, so the CPU can copy out one slot while the GPU renders another.
+typedef struct {
+    VkImage rtImg;
+    VkDeviceMemory rtMem;     // Zero-copy only: the imported dma-buf
+    VkBuffer readBuf;         // Copy path: host-visible copy of the finished frame
+    VkCommandBuffer xferCmd;  // Transfer queue: the pre-recorded readback_copy
+    VkSemaphore rendered;     // Signalled by the frame's render, waited for by xferCmd
+    void *rtPtr;              // Its mapping, W*4 bytes per row
+    VkImageView rtView;
+    VkImageView storageView;  // Compute backend: RGBA storage view of rtImg
+    VkFramebuffer framebuffer;
+    VkImage lowImg;           // Render scale < 1: offscreen target, blitted up into rtImg
+    VkImageView lowView;
+    VkFramebuffer lowFramebuffer;
+    uint32_t uboOffset;       // Its entry of the UBO ring, the descriptor sets' dynamic offset
+    void *uboPtr;             // Mapping of that entry
+    VkDescriptorSet descSet;
+    VkDescriptorSet passSets[BUFFER_PASSES];  // Multipass: the buffer passes' sets, same UBO
+    VkImageView channelViews[PASS_COUNT][4];  // What each pass's channels point at right now
+    VkCommandBuffer cmd;
+    VkFence fence;
+    int pending;  // Submitted but not yet presented
+    struct gbm_bo *bo;   // Zero-copy only: scanout BO the image is imported from
+    uint32_t fb_id;
+    uint64_t frame;  // frame_index this slot was last submitted as
+    int bench;       // Submitted as a measured --bench frame
+    double cpu_ms;   // Record + submit time of that frame
+    VkPipeline recorded;           // What cmd holds: its pipeline, VK_NULL_HANDLE to record anew
+    uint32_t recorded_w, recorded_h;  // Its render size
+    uint64_t recorded_generation;  // pipeline_generation when it was recorded
+    ShaderToyUBO ubo;              // What its UBO entry holds
+} FrameSlot;
+
+// Page-flip bookkeeping. Latency is measured from queueing the flip to the
+// vblank it landed on, as reported by the kernel's flip event.
+typedef struct {
+    int pending;         // Flip queued, completion event not yet received
+    double queued_at;    // CLOCK_MONOTONIC seconds
+    double latency_sum;  // Over the current stats window
+    int count;
+} FlipState;
+
+// Multipass: one of a buffer's two ping-pong images, with the layout it is
+// left in by the last recorded command buffer (all go to the one queue, in
+// recording order), from which the next barrier follows
+typedef struct {
+    VkImage image;
+    VkImageView view;
+    VkFramebuffer framebuffer;
+    VkImageLayout layout;
+} PassImage;
+
+// One display being driven: a connector, the CRTC scanning out to it and
+// its own frame ring, so every output flips at its own refresh rate.
+// Headless renders a single output without a connector.
+typedef struct {
+    drmModeConnector *conn;
+    drmModeModeInfo *mode;
+    uint32_t crtc_id;
+    uint32_t W, H;
+    uint32_t x;           // --outputs span: left edge on the shared canvas
+    FrameSlot slots[FRAMES_IN_FLIGHT];
+    struct gbm_bo *copy_bo[2];  // Copy path scanout BOs (second one for page flips)
+    uint32_t copy_fb[2];
+    int copy_back;
+    uint32_t screen_fb;
+    VkDeviceSize rowPitch;  // Copy path: of the slots' readback buffers
+    FlipState flip;
+    uint64_t frame;       // Frames submitted for this output; picks the ring slot
+    int render_next;      // Zero-copy: presented, render once the flip has landed
+    int shader;           // Entry of shaders[] it draws
+    int frames;           // Since the last shader switch, for the FPS line
+    int iframe;           // iFrame: frames rendered since the switch while playing
+    float last_time;      // iTime of its previous frame, for iTimeDelta
+    // Multipass: Buffer A-D targets at the output's size, created as shaders
+    // need them. Pass k writes images[k][frame & 1]; passes after it read that,
+    // passes up to and including it the other one, the previous frame's.
+    struct {
+        PassImage images[BUFFER_PASSES][2];
+        uint8_t created;  // Bit k: Buffer k's images exist
+        int clear;        // Zero every buffer first: new targets or a new shader
+        uint64_t frame;   // Frames rendered through the buffers
+    } graph;
+} Output;
+
+// The built pipelines for shaders[shader]
+typedef struct {
+    int shader;
+    int tier;                           // Quality tier its tunables were specialized for
+    VkPipeline pipeline;                // Image pass (or the compute variant)
+    uint64_t last_used;                 // frame_index of the last frame that bound it
+    VkPipeline buffers[BUFFER_PASSES];  // Multipass: Buffer A-D, where the shader has them
+} CachedPipeline;
+
+// Everything needed to build a pipeline; shared read-only with the worker.
+// Viewport and scissor are dynamic, so one pipeline serves every render scale.
+typedef struct {
+    VkDevice device;
+    VkPipelineCache cache;
+    VkPipelineLayout layout;
+    VkRenderPass renderPass;
+    int compute;             // Build the compute variant instead
+    uint32_t workgroup[2];   // Its local size, via specialization constants 0 and 1
+    VkRenderPass bufferPass; // Multipass: buffer passes' render pass, VK_NULL_HANDLE when disabled
+} PipelineBuilder;
+
+static const char *search_dirs[SEARCH_DIR_COUNT] = {
+    ".",                           // Current directory
+    "./shaders",                   // ./shaders subdirectory
+    "/root/metalshade/shaders",    // Default metalshade location
+};
+
+// Shader catalog, sorted by name so the arrow keys walk it alphabetically
+static ShaderInfo *shaders;
+static int shader_count = 0, shader_cap = 0;
+static char *shader_arena;  // NUL-terminated names and directories
+static size_t arena_len = 0, arena_cap = 0;
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;  // Scan threads append concurrently
+static int *shader_index;   // Open-addressed by name hash: entry of shaders[], or -1
+static uint32_t shader_index_mask;
 static int current_shader = 0;
 static int reload_requested = 0;
+static volatile sig_atomic_t quit_requested = 0;
+static uint64_t timestamp_mask = ~0ull;  // timestampValidBits of the queue
+
+// Connected displays. Mirror draws the current shader on each at its own
+// size, span lays them out left to right as one canvas, each gives output
+// n the n-th shader after the current one.
+enum { OUTPUTS_MIRROR, OUTPUTS_SPAN, OUTPUTS_EACH, OUTPUTS_FIRST };
+static Output outputs[MAX_OUTPUTS];
+static int output_count = 0;
+static int output_mode = OUTPUTS_MIRROR;
+
+// Ready-to-bind pipelines, owned by the main thread
+static CachedPipeline pipeline_lru[PIPELINE_LRU_CAPACITY];
+static int lru_count = 0;
+
+// Pipelines dropped from the LRU, destroyed once the last frame that bound
+// them has completed
+static CachedPipeline retired[MAX_RETIRED];
+static int retired_count = 0;
+// Bumped on every retirement: a destroyed pipeline's handle may come back
+// for another one, so a slot's recording can't be matched by handle alone
+static uint64_t pipeline_generation = 0;
+static uint64_t recordings = 0;  // Frame command buffers recorded, see the render loop
+
+// Background pipeline builder. The main thread posts the shaders it is
+// likely to need next; the worker builds them one at a time and leaves the
+// results in `ready` for the main thread to adopt between frames.
+static struct {
+    PipelineBuilder builder;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t built;  // Signalled with every result, for startup to wait on
+    int *queue;  // Most urgent first; shader_count entries, as is ready
+    int queue_len;
+    CachedPipeline *ready;
+    int ready_len;
+    int building;  // Shader being built right now, or -1
+    int stop;
+} prewarm = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER,
+             .built = PTHREAD_COND_INITIALIZER, .building = -1};
+
+// --quality: the tier tunables are specialized for. Written by the main
+// thread (--quality auto and --bench change it as they go), read by the
+// pre-warm worker for each build.
+static struct {
+    int tier;
+    int automatic;  // --quality auto: follow GPU time, as --scale auto does
+    int hold;       // Its windows left to skip after a change
+} quality = {.tier = QUALITY_ULTRA};
+
+static int quality_tier(void) {
+    return __atomic_load_n(&quality.tier, __ATOMIC_RELAXED);
+}
+
+// --bench: per-frame samples of each stage for the shader being measured
+enum { STAGE_GPU, STAGE_CPU, STAGE_COPY, STAGE_PRESENT, STAGE_COUNT };
+static const char *stage_names[STAGE_COUNT] = {"gpu", "cpu", "copy", "present"};
+static struct {
+    int active;
+    int warmup, measure;
+    int shader;      // Entry of shaders[] being measured
+    int submitted;   // Frames submitted with it bound
+    int collected;   // Measured frames retired so far
+    double *samples[STAGE_COUNT];  // `measure` ms values each
+    double tier_ms[QUALITY_TIERS]; // Median GPU time of the shader at each tier run so far
+    double budget_ms;              // GPU time per frame that fits --target-fps
+    FILE *csv;
+} bench = {.warmup = 60, .measure = 300};
+
+static const char *arena_str(uint32_t offset) {
+    return shader_arena + offset;
+}
+
+static const char *shader_name(int index) {
+    return arena_str(shaders[index].name);
+}
+
+// <dir>/<name><suffix>, e.g. suffix ".frag.spv"
+static void shader_path(const ShaderInfo *s, const char *suffix, char *out, size_t len) {
+    snprintf(out, len, "%s/%s%s", arena_str(s->dir), arena_str(s->name), suffix);
+}
+
+// Suffix of a pass's files: buffer passes are <name>.bufa.frag etc., the
+// Image pass is the shader's own <name>.frag
+static void pass_suffix(int pass, const char *ext, char *out, size_t len) {
+    if (pass < BUFFER_PASSES) snprintf(out, len, ".buf%c%s", 'a' + pass, ext);
+    else snprintf(out, len, "%s", ext);
+}
+
+// Length of `name` without a buffer pass's ".bufa"-".bufd"
+static size_t pass_base_len(const char *name, size_t len) {
+    if (len > 5 && strncmp(name + len - 5, ".buf", 4) == 0 && name[len - 1] >= 'a' &&
+        name[len - 1] < 'a' + BUFFER_PASSES)
+        return len - 5;
+    return len;
+}
 
 static uint32_t *load_spv(const char *p, size_t *sz) {
     FILE *f=fopen(p,"rb"); if(!f) return NULL;
@@ -50,6 +476,119 @@ static uint32_t *load_spv(const char *p, size_t *sz) {
     uint32_t *d=malloc(*sz); fread(d,1,*sz,f); fclose(f); return d;
 }
 
+// Shader bundle (--bundle, written by --make-bundle): every file a set of
+// shaders needs in one read-only file, mapped once at startup, so loading
+// and switching shaders never touches the filesystem. Little-endian:
+//   header:  "MSBUNDL1", uint32 entry count, uint32 zero
+//   entries: count x {uint64 offset, uint64 size, uint32 name offset, uint32 name length},
+//            sorted by name
+//   names:   NUL-terminated, as the files are named in a search dir
+//            ("plasma.frag.spv", "plasma.channels", "textures/rock.png"),
+//            plus BUNDLE_CACHE, the pipeline cache of the GPU that built it
+//   data:    each file BUNDLE_ALIGN-aligned, so SPIR-V goes to
+//            vkCreateShaderModule straight from the mapping
+#define BUNDLE_MAGIC "MSBUNDL1"
+#define BUNDLE_CACHE "pipeline.cache"
+#define BUNDLE_ALIGN 16
+#define BUNDLE_HEADER 16
+#define BUNDLE_ENTRY 24
+
+static struct {
+    const uint8_t *data;  // The whole file
+    size_t size;
+    uint32_t count;
+    char prefix[PATH_MAX];  // "<file>/": paths under it are the bundle's files
+    size_t prefix_len;
+} bundle;
+
+static uint32_t read_le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t read_le64(const uint8_t *p) {
+    return read_le32(p) | (uint64_t)read_le32(p + 4) << 32;
+}
+
+static const char *bundle_entry(uint32_t i, size_t *size, const uint8_t **data) {
+    const uint8_t *e = bundle.data + BUNDLE_HEADER + (size_t)i * BUNDLE_ENTRY;
+    if (size) *size = read_le64(e + 8);
+    if (data) *data = bundle.data + read_le64(e);
+    return (const char*)bundle.data + read_le32(e + 16);
+}
+
+// Binary search of the index, NULL if the bundle has no such file
+static const void *bundle_find(const char *name, size_t *size) {
+    uint32_t lo = 0, hi = bundle.data ? bundle.count : 0;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        const uint8_t *data;
+        int c = strcmp(name, bundle_entry(mid, size, &data));
+        if (c == 0) return data;
+        if (c < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return NULL;
+}
+
+// Map `path` and check that every entry lies inside it, names in order
+static int bundle_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        printf("Bundle '%s': %s\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    void *map = st.st_size >= BUNDLE_HEADER ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    const char *error = map == MAP_FAILED ? "too short or not mappable" : NULL;
+    if (!error) {
+        bundle.data = map;
+        bundle.size = st.st_size;
+        bundle.count = read_le32(bundle.data + 8);
+        if (memcmp(bundle.data, BUNDLE_MAGIC, 8) != 0) error = "not a shader bundle";
+        else if (bundle.count > (bundle.size - BUNDLE_HEADER) / BUNDLE_ENTRY) error = "truncated index";
+    }
+    for (uint32_t i = 0; !error && i < bundle.count; i++) {
+        const uint8_t *e = bundle.data + BUNDLE_HEADER + (size_t)i * BUNDLE_ENTRY;
+        uint64_t offset = read_le64(e), size = read_le64(e + 8);
+        uint64_t name = read_le32(e + 16), len = read_le32(e + 20);
+        if (offset > bundle.size || size > bundle.size - offset || offset % BUNDLE_ALIGN ||
+            name + len >= bundle.size || bundle.data[name + len] != '\0' ||
+            strlen((const char*)bundle.data + name) != len)
+            error = "entry out of bounds";
+        else if (i > 0 && strcmp(bundle_entry(i - 1, NULL, NULL), (const char*)bundle.data + name) >= 0)
+            error = "index not sorted";
+    }
+    if (error) {
+        printf("Bundle '%s': %s\n", path, error);
+        if (map != MAP_FAILED) munmap(map, st.st_size);
+        bundle.data = NULL;
+        return -1;
+    }
+    bundle.prefix_len = snprintf(bundle.prefix, sizeof(bundle.prefix), "%s/", path);
+    // Fault in the index and everything else sequentially, ahead of its use
+    posix_madvise(map, bundle.size, POSIX_MADV_WILLNEED);
+    printf("Bundle: %u files, %zu bytes from %s\n", bundle.count, bundle.size, path);
+    return 0;
+}
+
+// A file's contents: in place for paths inside the bundle, otherwise read
+// into memory. Either way the caller hands it back to release_file.
+static const void *load_file(const char *path, size_t *size) {
+    if (bundle.data && strncmp(path, bundle.prefix, bundle.prefix_len) == 0) {
+        const void *data = bundle_find(path + bundle.prefix_len, size);
+        if (!data) errno = ENOENT;
+        return data;
+    }
+    return load_spv(path, size);
+}
+
+static void release_file(const void *data) {
+    const uint8_t *p = data;
+    if (!bundle.data || p < bundle.data || p > bundle.data + bundle.size) free((void*)data);
+}
+
 static uint32_t find_mem(VkPhysicalDeviceMemoryProperties *p, uint32_t bits, VkMemoryPropertyFlags flags) {
     for(uint32_t i=0; i<p->memoryTypeCount; i++)
         if((bits&(1<<i)) && (p->memoryTypes[i].propertyFlags&flags)==flags) return i;
@@ -58,6 +597,373 @@ static uint32_t find_mem(VkPhysicalDeviceMemoryProperties *p, uint32_t bits, VkM
 
 #define VK_CHECK(x) do{VkResult r=(x);if(r){printf("VK err %d @ %d\n",r,__LINE__);exit(1);}}while(0)
 
+// Sub-allocator: resources are placed front to back in a few large
+// vkAllocateMemory blocks of one memory type each. Buffers and optimally
+// tiled images never share a block, so bufferImageGranularity doesn't
+// apply. Everything lives until exit, so nothing is ever freed.
+typedef struct {
+    VkDeviceMemory memory;
+    uint32_t type;
+    int optimal;            // Holds optimally tiled images
+    VkDeviceSize size, used;
+    void *mapped;           // Host-visible blocks are mapped once, whole
+} MemoryBlock;
+
+static struct {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties props;
+    MemoryBlock blocks[MAX_MEMORY_BLOCKS];
+    int block_count;
+    int allocations;
+} gpu_memory;
+
+// Place req in a block of the first memory type with `flags | preferred`,
+// or just `flags`, opening a new block when none has room. Requests larger
+// than a block get one of their own. Returns the CPU address for
+// host-visible memory, NULL otherwise.
+static void *memory_alloc(const VkMemoryRequirements *req, VkMemoryPropertyFlags flags,
+                          VkMemoryPropertyFlags preferred, int optimal,
+                          VkDeviceMemory *memory, VkDeviceSize *offset) {
+    uint32_t type = find_mem(&gpu_memory.props, req->memoryTypeBits, flags | preferred);
+    if (type == UINT32_MAX) type = find_mem(&gpu_memory.props, req->memoryTypeBits, flags);
+    if (type == UINT32_MAX) {
+        printf("No memory type with flags 0x%x for a %llu byte resource\n", flags, (unsigned long long)req->size);
+        exit(1);
+    }
+    MemoryBlock *b = NULL;
+    VkDeviceSize start = 0;
+    for (int i = 0; i < gpu_memory.block_count && !b; i++) {
+        MemoryBlock *c = &gpu_memory.blocks[i];
+        start = (c->used + req->alignment - 1) / req->alignment * req->alignment;
+        if (c->type == type && c->optimal == optimal && start + req->size <= c->size) b = c;
+    }
+    if (!b) {
+        if (gpu_memory.block_count == MAX_MEMORY_BLOCKS) {
+            printf("Out of memory blocks (%d)\n", MAX_MEMORY_BLOCKS);
+            exit(1);
+        }
+        b = &gpu_memory.blocks[gpu_memory.block_count++];
+        *b = (MemoryBlock){.type = type, .optimal = optimal,
+                           .size = req->size > MEMORY_BLOCK_SIZE ? req->size : MEMORY_BLOCK_SIZE};
+        VK_CHECK(vkAllocateMemory(gpu_memory.device, &(VkMemoryAllocateInfo){
+            .sType=VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+            .allocationSize=b->size,.memoryTypeIndex=type
+        }, NULL, &b->memory));
+        if (gpu_memory.props.memoryTypes[type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+            VK_CHECK(vkMapMemory(gpu_memory.device, b->memory, 0, VK_WHOLE_SIZE, 0, &b->mapped));
+        start = 0;
+    }
+    b->used = start + req->size;
+    gpu_memory.allocations++;
+    *memory = b->memory;
+    *offset = start;
+    return b->mapped ? (char*)b->mapped + start : NULL;
+}
+
+// Optimally tiled images only; linear ones would need a block kind of their own
+static void *memory_bind_image(VkImage image, VkMemoryPropertyFlags flags) {
+    VkMemoryRequirements req;
+    vkGetImageMemoryRequirements(gpu_memory.device, image, &req);
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    void *ptr = memory_alloc(&req, flags, 0, 1, &memory, &offset);
+    VK_CHECK(vkBindImageMemory(gpu_memory.device, image, memory, offset));
+    return ptr;
+}
+
+static void *memory_bind_buffer(VkBuffer buffer, VkMemoryPropertyFlags flags, VkMemoryPropertyFlags preferred) {
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(gpu_memory.device, buffer, &req);
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    void *ptr = memory_alloc(&req, flags, preferred, 0, &memory, &offset);
+    VK_CHECK(vkBindBufferMemory(gpu_memory.device, buffer, memory, offset));
+    return ptr;
+}
+
+static void memory_report(void) {
+    double device_mb = 0, host_mb = 0, used_mb = 0;
+    for (int i = 0; i < gpu_memory.block_count; i++) {
+        const MemoryBlock *b = &gpu_memory.blocks[i];
+        if (b->mapped) host_mb += b->size / 1048576.0;
+        else device_mb += b->size / 1048576.0;
+        used_mb += b->used / 1048576.0;
+    }
+    printf("Memory: %d allocations in %d blocks, %.1f MiB device-local + %.1f MiB host-visible, %.1f MiB used\n",
+           gpu_memory.allocations, gpu_memory.block_count, device_mb, host_mb, used_mb);
+}
+
+// Lowercased name and hex device UUID, for --gpu
+static void gpu_identity(VkPhysicalDevice gpu, char name[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE],
+                         char uuid[2 * VK_UUID_SIZE + 1]) {
+    VkPhysicalDeviceIDProperties id = {.sType=VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES};
+    VkPhysicalDeviceProperties2 props = {.sType=VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,.pNext=&id};
+    vkGetPhysicalDeviceProperties2(gpu, &props);
+    size_t n = 0;
+    for (; props.properties.deviceName[n] && n + 1 < VK_MAX_PHYSICAL_DEVICE_NAME_SIZE; n++)
+        name[n] = tolower((unsigned char)props.properties.deviceName[n]);
+    name[n] = '\0';
+    for (int i = 0; i < VK_UUID_SIZE; i++)
+        snprintf(uuid + 2 * i, 3, "%02x", id.deviceUUID[i]);
+}
+
+// --gpu: pick a GPU by its index in loader order, its device UUID (dashes
+// optional) or part of its name, ignoring case. NULL takes the first one.
+// Lists them all when nothing matches.
+static int select_gpu(VkInstance instance, const char *want, VkPhysicalDevice *out) {
+    uint32_t count = 0;
+    vkEnumeratePhysicalDevices(instance, &count, NULL);
+    if (count == 0) {
+        printf("No Vulkan device found\n");
+        return -1;
+    }
+    VkPhysicalDevice *gpus = calloc(count, sizeof(*gpus));
+    vkEnumeratePhysicalDevices(instance, &count, gpus);
+
+    char key[256], hex[256];
+    size_t n = 0, h = 0;
+    for (const char *p = want ? want : ""; *p && n + 1 < sizeof(key); p++) {
+        key[n++] = tolower((unsigned char)*p);
+        if (*p != '-') hex[h++] = key[n - 1];
+    }
+    key[n] = hex[h] = '\0';
+    char *end = NULL;
+    long index = want ? strtol(want, &end, 10) : 0;
+    int by_index = !want || (*want && *end == '\0' && strlen(want) < 2 * VK_UUID_SIZE);
+
+    int found = -1;
+    char name[VK_MAX_PHYSICAL_DEVICE_NAME_SIZE], uuid[2 * VK_UUID_SIZE + 1];
+    for (uint32_t i = 0; i < count && found < 0; i++) {
+        gpu_identity(gpus[i], name, uuid);
+        if (by_index ? index == (long)i : strcmp(uuid, hex) == 0 || strstr(name, key)) found = i;
+    }
+    if (found < 0) {
+        printf("No GPU matches '%s'. Available:\n", want);
+        for (uint32_t i = 0; i < count; i++) {
+            VkPhysicalDeviceProperties props;
+            vkGetPhysicalDeviceProperties(gpus[i], &props);
+            gpu_identity(gpus[i], name, uuid);
+            printf("  [%u] %s (%s)\n", i, props.deviceName, uuid);
+        }
+    } else {
+        *out = gpus[found];
+    }
+    free(gpus);
+    return found < 0 ? -1 : 0;
+}
+
+// --split-frame: every GPU of the group renders its band into its own
+// instance of device-local memory, while the host-visible readback buffers,
+// UBOs and staging have to be a single shared instance to be mappable
+static int split_memory_ok(const VkPhysicalDeviceMemoryProperties *p) {
+    int host = -1, per_gpu = 0;
+    for (uint32_t i = 0; i < p->memoryTypeCount; i++) {
+        VkMemoryPropertyFlags flags = p->memoryTypes[i].propertyFlags;
+        VkMemoryHeapFlags heap = p->memoryHeaps[p->memoryTypes[i].heapIndex].flags;
+        VkMemoryPropertyFlags mapped = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        if (host < 0 && (flags & mapped) == mapped) host = !(heap & VK_MEMORY_HEAP_MULTI_INSTANCE_BIT);
+        if ((flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) && (heap & VK_MEMORY_HEAP_MULTI_INSTANCE_BIT)) per_gpu = 1;
+    }
+    return host > 0 && per_gpu;
+}
+
+static int has_device_ext(const VkExtensionProperties *exts, uint32_t count, const char *name) {
+    for (uint32_t i = 0; i < count; i++)
+        if (strcmp(exts[i].extensionName, name) == 0) return 1;
+    return 0;
+}
+
+// Single-plane modifiers the GPU can render B8G8R8A8 into. GBM picks one of
+// these, so whatever BO it hands back can be imported as a color attachment.
+static uint32_t query_render_modifiers(VkPhysicalDevice gpu, VkFormatFeatureFlags required,
+                                       uint64_t *mods, uint32_t max) {
+    VkDrmFormatModifierPropertiesListEXT list = {
+        .sType=VK_STRUCTURE_TYPE_DRM_FORMAT_MODIFIER_PROPERTIES_LIST_EXT};
+    VkFormatProperties2 fmt = {.sType=VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2,.pNext=&list};
+    vkGetPhysicalDeviceFormatProperties2(gpu, VK_FORMAT_B8G8R8A8_UNORM, &fmt);
+    if (list.drmFormatModifierCount == 0) return 0;
+
+    VkDrmFormatModifierPropertiesEXT *p = calloc(list.drmFormatModifierCount, sizeof(*p));
+    list.pDrmFormatModifierProperties = p;
+    vkGetPhysicalDeviceFormatProperties2(gpu, VK_FORMAT_B8G8R8A8_UNORM, &fmt);
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < list.drmFormatModifierCount && n < max; i++) {
+        if (p[i].drmFormatModifierPlaneCount == 1 &&
+            (p[i].drmFormatModifierTilingFeatures & required) == required)
+            mods[n++] = p[i].drmFormatModifier;
+    }
+    free(p);
+    return n;
+}
+
+// Allocate a scanout BO and import it as the slot's color attachment through
+// dma-buf, so the GPU renders straight into the buffer the CRTC scans out.
+// Returns 0 on success; on failure nothing is leaked and the slot is untouched.
+static int import_scanout_slot(VkDevice device, VkPhysicalDeviceMemoryProperties *memProps,
+                               PFN_vkGetMemoryFdPropertiesKHR getMemoryFdProperties,
+                               struct gbm_device *gbm, int drm_fd, uint32_t W, uint32_t H,
+                               const uint64_t *mods, uint32_t mod_count, VkImageUsageFlags usage,
+                               FrameSlot *s) {
+    struct gbm_bo *bo = gbm_bo_create_with_modifiers(gbm, W, H, GBM_FORMAT_XRGB8888, mods, mod_count);
+    if (!bo) return -1;
+
+    VkImage img = VK_NULL_HANDLE;
+    VkDeviceMemory mem = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    uint32_t fb_id = 0;
+    int fd = -1;
+    uint64_t modifier = gbm_bo_get_modifier(bo);
+    uint32_t stride = gbm_bo_get_stride(bo);
+    uint32_t offset = gbm_bo_get_offset(bo, 0);
+    if (modifier == DRM_FORMAT_MOD_INVALID || gbm_bo_get_plane_count(bo) != 1) goto fail;
+
+    if (vkCreateImage(device, &(VkImageCreateInfo){
+        .sType=VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext=&(VkExternalMemoryImageCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+            .pNext=&(VkImageDrmFormatModifierExplicitCreateInfoEXT){
+                .sType=VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT,
+                .drmFormatModifier=modifier,.drmFormatModifierPlaneCount=1,
+                .pPlaneLayouts=&(VkSubresourceLayout){.offset=offset,.rowPitch=stride}
+            },
+            .handleTypes=VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT
+        },
+        .imageType=VK_IMAGE_TYPE_2D,.format=VK_FORMAT_B8G8R8A8_UNORM,
+        .extent={W,H,1},.mipLevels=1,.arrayLayers=1,
+        .samples=VK_SAMPLE_COUNT_1_BIT,.tiling=VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT,
+        .usage=usage
+    }, NULL, &img)) goto fail;
+
+    fd = gbm_bo_get_fd(bo);
+    if (fd < 0) goto fail;
+    VkMemoryFdPropertiesKHR fdProps = {.sType=VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR};
+    if (getMemoryFdProperties(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT, fd, &fdProps)) goto fail;
+    VkMemoryRequirements req;
+    vkGetImageMemoryRequirements(device, img, &req);
+    uint32_t memType = find_mem(memProps, req.memoryTypeBits & fdProps.memoryTypeBits, 0);
+    if (memType == UINT32_MAX) goto fail;
+
+    if (vkAllocateMemory(device, &(VkMemoryAllocateInfo){
+        .sType=VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext=&(VkImportMemoryFdInfoKHR){
+            .sType=VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+            .pNext=&(VkMemoryDedicatedAllocateInfo){
+                .sType=VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,.image=img},
+            .handleType=VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,.fd=fd
+        },
+        .allocationSize=req.size,.memoryTypeIndex=memType
+    }, NULL, &mem)) goto fail;
+    fd = -1;  // A successful import takes ownership of the fd
+    if (vkBindImageMemory(device, img, mem, 0)) goto fail;
+
+    if (vkCreateImageView(device, &(VkImageViewCreateInfo){
+        .sType=VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image=img,.viewType=VK_IMAGE_VIEW_TYPE_2D,
+        .format=VK_FORMAT_B8G8R8A8_UNORM,
+        .subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+    }, NULL, &view)) goto fail;
+
+    uint32_t handles[4] = {gbm_bo_get_handle(bo).u32, 0, 0, 0};
+    uint32_t strides[4] = {stride, 0, 0, 0};
+    uint32_t offsets[4] = {offset, 0, 0, 0};
+    uint64_t modifiers[4] = {modifier, 0, 0, 0};
+    if (drmModeAddFB2WithModifiers(drm_fd, W, H, GBM_FORMAT_XRGB8888, handles, strides, offsets,
+                                   modifiers, &fb_id, DRM_MODE_FB_MODIFIERS)) goto fail;
+
+    s->bo = bo; s->fb_id = fb_id;
+    s->rtImg = img; s->rtMem = mem; s->rtView = view; s->rtPtr = NULL;
+    return 0;
+
+fail:
+    if (view != VK_NULL_HANDLE) vkDestroyImageView(device, view, NULL);
+    if (img != VK_NULL_HANDLE) vkDestroyImage(device, img, NULL);
+    if (mem != VK_NULL_HANDLE) vkFreeMemory(device, mem, NULL);
+    if (fd >= 0) close(fd);
+    gbm_bo_destroy(bo);
+    return -1;
+}
+
+static void release_scanout_slot(VkDevice device, int drm_fd, FrameSlot *s) {
+    drmModeRmFB(drm_fd, s->fb_id);
+    vkDestroyImageView(device, s->rtView, NULL);
+    vkDestroyImage(device, s->rtImg, NULL);
+    vkFreeMemory(device, s->rtMem, NULL);
+    gbm_bo_destroy(s->bo);
+    s->bo = NULL; s->fb_id = 0;
+    s->rtImg = VK_NULL_HANDLE; s->rtMem = VK_NULL_HANDLE; s->rtView = VK_NULL_HANDLE;
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Startup phases, for the breakdown printed with the first frame. The scan
+// and display threads run theirs while the main thread sets up Vulkan, so
+// they overlap and don't add up to the total.
+enum { PHASE_SCAN, PHASE_DISPLAY, PHASE_INSTANCE, PHASE_DEVICE, PHASE_RESOURCES, PHASE_PIPELINES,
+       PHASE_FIRST_FRAME, PHASE_COUNT };
+static const char *phase_names[PHASE_COUNT] = {"shader scan", "display", "instance", "device",
+                                               "resources", "pipelines", "first frame"};
+static struct {
+    double t0;                                    // main() entered, monotonic seconds
+    double begin[PHASE_COUNT], end[PHASE_COUNT];  // ms since t0, written by the phase's thread
+    int reported;
+} startup;
+
+static void phase_begin(int phase) {
+    startup.begin[phase] = (monotonic_seconds() - startup.t0) * 1000.0;
+}
+
+static void phase_end(int phase) {
+    startup.end[phase] = (monotonic_seconds() - startup.t0) * 1000.0;
+}
+
+// Once the first frame is on screen (or written out); phases that didn't
+// run in this mode are left out
+static void startup_report(void) {
+    if (startup.reported) return;
+    startup.reported = 1;
+    phase_end(PHASE_FIRST_FRAME);
+    printf("Startup: %.1f ms to the first frame\n", startup.end[PHASE_FIRST_FRAME]);
+    for (int i = 0; i < PHASE_COUNT; i++)
+        if (startup.end[i] > 0)
+            printf("  %-12s %7.1f - %7.1f ms  (%.1f ms)\n", phase_names[i],
+                   startup.begin[i], startup.end[i], startup.end[i] - startup.begin[i]);
+}
+
+static void page_flip_handler(int fd, unsigned int sequence, unsigned int tv_sec,
+                              unsigned int tv_usec, void *user_data) {
+    (void)fd; (void)sequence;
+    FlipState *flip = user_data;
+    // Event timestamps are CLOCK_MONOTONIC (DRM_CAP_TIMESTAMP_MONOTONIC)
+    flip->latency_sum += (tv_sec + tv_usec / 1e6) - flip->queued_at;
+    flip->count++;
+    flip->pending = 0;
+}
+
+// Hand an imported scanout image between our queue and the display engine
+static void scanout_ownership_barrier(VkCommandBuffer cmd, VkImage img, uint32_t family, int acquire) {
+    // The image is written either by the render pass or by the upscale blit
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT|VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkAccessFlags writes = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT|VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd,
+        acquire ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : stages,
+        acquire ? stages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        0, 0, NULL, 0, NULL, 1, &(VkImageMemoryBarrier){
+            .sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask=acquire ? 0 : writes,
+            .dstAccessMask=acquire ? writes : 0,
+            .oldLayout=VK_IMAGE_LAYOUT_GENERAL,.newLayout=VK_IMAGE_LAYOUT_GENERAL,
+            .srcQueueFamilyIndex=acquire ? VK_QUEUE_FAMILY_FOREIGN_EXT : family,
+            .dstQueueFamilyIndex=acquire ? family : VK_QUEUE_FAMILY_FOREIGN_EXT,
+            .image=img,
+            .subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+        });
+}
+
 static void generate_texture(uint8_t *data) {
     for (int y = 0; y < 256; y++) {
         for (int x = 0; x < 256; x++) {
@@ -71,312 +977,3963 @@ static void generate_texture(uint8_t *data) {
     }
 }
 
-// Extract basename from path (e.g., "shaders/plasma" -> "plasma")
-static const char *get_basename(const char *path) {
-    const char *last_slash = strrchr(path, '/');
-    return last_slash ? last_slash + 1 : path;
+// Texture channels: image files named in a shader's .channels, decoded by
+// worker threads and uploaded by the main thread through a staging buffer
+// into optimally tiled device-local images, with the mip chain generated on
+// the GPU. Entries are keyed by path and share the image with any entry of
+// identical content; like all device memory, they live until exit.
+enum { TEXTURE_2D, TEXTURE_CUBE, TEXTURE_3D, TEXTURE_KINDS };
+enum { TEX_QUEUED, TEX_DECODING, TEX_DECODED, TEX_READY, TEX_FAILED };
+
+// Decoded texture: mip levels back to back, each level's layers (cube
+// faces) one after the other, rows tightly packed
+typedef struct {
+    VkFormat format;
+    uint32_t texel_size;
+    uint32_t width, height, depth, layers;
+    uint32_t levels;          // Stored in `data`
+    int generate_mips;        // Complete the chain on the GPU (PNG, KTX2 with levelCount 0)
+    size_t level_offsets[MAX_TEXTURE_LEVELS];
+    uint8_t *data;
+    size_t size;
+} TextureData;
+
+typedef struct {
+    char *path;
+    uint8_t kind;             // What the shaders sample it as (TEXTURE_*)
+    int state;                // TEX_*, under textures.lock
+    uint64_t hash;            // FNV-1a of the file, once decoded
+    TextureData data;         // Decoded, until uploaded
+    VkImageView view;         // Ready: what its channels read
+} Texture;
+
+static struct {
+    Texture entries[MAX_TEXTURES];
+    int count;
+    pthread_t threads[TEXTURE_WORKERS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t wake, decoded;
+    int stop;
+    // Uploads, main thread only
+    VkDevice device;
+    VkPhysicalDevice gpu;
+    VkQueue queue;
+    VkCommandBuffer cmd;
+    VkFence fence;
+    int uploading;            // cmd submitted, staging busy until the fence signals
+    uint32_t device_mask;     // Split frame: the device group's GPUs, 0 otherwise
+    VkBuffer staging;         // TEXTURE_STAGING_SIZE bytes, created with the first upload
+    uint8_t *staging_ptr;
+    VkImageView fallback[TEXTURE_KINDS];  // Until a texture is ready, or if it fails: the checkerboard, black otherwise
+} textures = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER,
+              .decoded = PTHREAD_COND_INITIALIZER};
+
+// Inflate (RFC 1950/1951), as much as PNG's zlib streams need: canonical
+// Huffman codes decoded a bit at a time, like zlib's puff.c
+typedef struct {
+    const uint8_t *in;
+    size_t in_len, pos;
+    uint32_t bits;
+    int bit_count;
+    int failed;       // Ran past the input
+    uint8_t *out;
+    size_t out_len, out_cap;
+} Inflate;
+
+typedef struct {
+    uint16_t count[16];   // Codes of each length
+    uint16_t symbol[320]; // Ordered by code
+} Huffman;
+
+static uint32_t inflate_bits(Inflate *z, int need) {
+    uint32_t val = z->bits;
+    while (z->bit_count < need) {
+        if (z->pos == z->in_len) {
+            z->failed = 1;
+            return 0;
+        }
+        val |= (uint32_t)z->in[z->pos++] << z->bit_count;
+        z->bit_count += 8;
+    }
+    z->bits = val >> need;
+    z->bit_count -= need;
+    return val & ((1u << need) - 1);
 }
 
-// Find QEMU display control port dynamically
-static const char *find_display_port() {
-    static char port_path[64] = {0};
-    if (port_path[0]) return port_path;  // Cached
+static void huffman_build(Huffman *h, const uint8_t *lengths, int n) {
+    uint16_t offsets[16];
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++) h->count[lengths[i]]++;
+    h->count[0] = 0;
+    offsets[1] = 0;
+    for (int len = 1; len < 15; len++) offsets[len + 1] = offsets[len] + h->count[len];
+    for (int i = 0; i < n; i++)
+        if (lengths[i]) h->symbol[offsets[lengths[i]]++] = i;
+}
 
-    // Search for org.qemu.display port
-    for (int i = 0; i < 10; i++) {
-        char name_path[128];
-        snprintf(name_path, sizeof(name_path), "/sys/class/virtio-ports/vport%dp1/name", i);
-        FILE *f = fopen(name_path, "r");
-        if (f) {
-            char name[64];
-            if (fgets(name, sizeof(name), f)) {
-                if (strstr(name, "org.qemu.display")) {
-                    snprintf(port_path, sizeof(port_path), "/dev/vport%dp1", i);
-                    fclose(f);
-                    return port_path;
+static int huffman_decode(Inflate *z, const Huffman *h) {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16; len++) {
+        code |= inflate_bits(z, 1);
+        if (z->failed) return -1;
+        int count = h->count[len];
+        if (code - count < first) return h->symbol[index + (code - first)];
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+static int inflate_codes(Inflate *z, const Huffman *lit, const Huffman *dist) {
+    static const uint16_t len_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                          35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                          3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                           257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                           8193, 12289, 16385, 24577};
+    static const uint8_t dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                           7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    for (;;) {
+        int sym = huffman_decode(z, lit);
+        if (sym < 0) return -1;
+        if (sym < 256) {
+            if (z->out_len == z->out_cap) return -1;
+            z->out[z->out_len++] = sym;
+        } else if (sym == 256) {
+            return 0;
+        } else {
+            if ((sym -= 257) >= 29) return -1;
+            size_t len = len_base[sym] + inflate_bits(z, len_extra[sym]);
+            int d = huffman_decode(z, dist);
+            if (d < 0 || d >= 30) return -1;
+            size_t back = dist_base[d] + inflate_bits(z, dist_extra[d]);
+            if (z->failed || back > z->out_len || len > z->out_cap - z->out_len) return -1;
+            for (; len; len--, z->out_len++) z->out[z->out_len] = z->out[z->out_len - back];
+        }
+    }
+}
+
+// Inflate a zlib stream into exactly `out_cap` bytes
+static int inflate_zlib(const uint8_t *in, size_t in_len, uint8_t *out, size_t out_cap) {
+    if (in_len < 2 || (in[0] & 15) != 8 || ((in[0] << 8) | in[1]) % 31 || (in[1] & 0x20)) return -1;
+    Inflate z = {.in = in, .in_len = in_len, .pos = 2, .out = out, .out_cap = out_cap};
+    Huffman lit, dist;
+    uint8_t lengths[320];
+    int last;
+    do {
+        last = inflate_bits(&z, 1);
+        int type = inflate_bits(&z, 2);
+        if (type == 0) {
+            // Stored: byte aligned, length and its complement
+            z.bits = 0;
+            z.bit_count = 0;
+            if (z.pos + 4 > in_len) return -1;
+            size_t len = in[z.pos] | in[z.pos + 1] << 8;
+            if ((len ^ (in[z.pos + 2] | in[z.pos + 3] << 8)) != 0xffff) return -1;
+            z.pos += 4;
+            if (len > in_len - z.pos || len > out_cap - z.out_len) return -1;
+            memcpy(out + z.out_len, in + z.pos, len);
+            z.pos += len;
+            z.out_len += len;
+            continue;
+        }
+        if (type == 1) {
+            for (int i = 0; i < 288; i++) lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            for (int i = 0; i < 30; i++) lengths[288 + i] = 5;
+            huffman_build(&lit, lengths, 288);
+            huffman_build(&dist, lengths + 288, 30);
+        } else if (type == 2) {
+            static const uint8_t order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+            int nlit = inflate_bits(&z, 5) + 257, ndist = inflate_bits(&z, 5) + 1, nlen = inflate_bits(&z, 4) + 4;
+            uint8_t code_lengths[19] = {0};
+            for (int i = 0; i < nlen; i++) code_lengths[order[i]] = inflate_bits(&z, 3);
+            Huffman code;
+            huffman_build(&code, code_lengths, 19);
+            for (int n = 0; n < nlit + ndist; ) {
+                int sym = huffman_decode(&z, &code);
+                if (sym < 0) return -1;
+                if (sym < 16) {
+                    lengths[n++] = sym;
+                    continue;
+                }
+                int value = 0, repeat;
+                if (sym == 16) {
+                    if (n == 0) return -1;
+                    value = lengths[n - 1];
+                    repeat = 3 + inflate_bits(&z, 2);
+                } else {
+                    repeat = sym == 17 ? 3 + inflate_bits(&z, 3) : 11 + inflate_bits(&z, 7);
+                }
+                if (n + repeat > nlit + ndist) return -1;
+                while (repeat--) lengths[n++] = value;
+            }
+            huffman_build(&lit, lengths, nlit);
+            huffman_build(&dist, lengths + nlit, ndist);
+        } else {
+            return -1;
+        }
+        if (z.failed || inflate_codes(&z, &lit, &dist) != 0) return -1;
+    } while (!last && !z.failed);
+    return z.failed || z.out_len != out_cap ? -1 : 0;
+}
+
+static uint32_t read_be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int paeth(int a, int b, int c) {
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+// PNG: any colour type at 8 or 16 bits, palette and grey also at 1-4 bits,
+// expanded to RGBA8 (16 bits keep their high byte). Not interlaced.
+static const char *decode_png(const uint8_t *file, size_t size, TextureData *out) {
+    static const uint8_t signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+    if (size < 33 || memcmp(file, signature, 8) != 0 || memcmp(file + 12, "IHDR", 4) != 0) return "not a PNG file";
+    uint32_t w = read_be32(file + 16), h = read_be32(file + 20);
+    int depth = file[24], color = file[25];
+    if (file[28]) return "interlaced PNGs are not supported";
+    int channels = color == 0 ? 1 : color == 2 ? 3 : color == 3 ? 1 : color == 4 ? 2 : color == 6 ? 4 : 0;
+    int depth_ok = depth == 8 || (depth == 16 && color != 3) || ((color == 0 || color == 3) && depth < 8 && !(depth & (depth - 1)));
+    if (!channels || !depth_ok) return "unsupported PNG colour type or bit depth";
+    if (w == 0 || h == 0 || w > MAX_TEXTURE_SIZE || h > MAX_TEXTURE_SIZE) return "PNG size out of range";
+
+    // Gather the IDAT chunks and the palette
+    uint8_t palette[256][4];
+    memset(palette, 255, sizeof(palette));
+    uint8_t *idat = NULL;
+    size_t idat_len = 0;
+    for (size_t pos = 8; pos + 12 <= size; ) {
+        uint32_t len = read_be32(file + pos);
+        const uint8_t *type = file + pos + 4, *data = file + pos + 8;
+        if (len > size - pos - 12) break;
+        if (memcmp(type, "IDAT", 4) == 0) {
+            uint8_t *grown = realloc(idat, idat_len + len);
+            if (!grown) break;
+            idat = grown;
+            memcpy(idat + idat_len, data, len);
+            idat_len += len;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            for (uint32_t i = 0; i < len / 3 && i < 256; i++) memcpy(palette[i], data + 3 * i, 3);
+        } else if (memcmp(type, "tRNS", 4) == 0 && color == 3) {
+            for (uint32_t i = 0; i < len && i < 256; i++) palette[i][3] = data[i];
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+        pos += 12 + len;
+    }
+
+    size_t pixel_bits = (size_t)channels * depth, stride = (w * pixel_bits + 7) / 8;
+    size_t bpp = pixel_bits < 8 ? 1 : pixel_bits / 8;
+    uint8_t *raw = malloc(h * (stride + 1));
+    if (!raw || !idat || inflate_zlib(idat, idat_len, raw, h * (stride + 1)) != 0) {
+        free(idat);
+        free(raw);
+        return "corrupt PNG image data";
+    }
+    free(idat);
+
+    // Undo the row filters in place, then expand to RGBA
+    uint8_t *rgba = malloc((size_t)w * h * 4);
+    if (!rgba) {
+        free(raw);
+        return "out of memory";
+    }
+    for (uint32_t y = 0; y < h; y++) {
+        uint8_t *row = raw + y * (stride + 1) + 1;
+        const uint8_t *prior = y ? row - (stride + 1) : NULL;
+        int filter = row[-1];
+        for (size_t i = 0; i < stride; i++) {
+            int a = i >= bpp ? row[i - bpp] : 0, b = prior ? prior[i] : 0, c = prior && i >= bpp ? prior[i - bpp] : 0;
+            row[i] += filter == 1 ? a : filter == 2 ? b : filter == 3 ? (a + b) >> 1 : filter == 4 ? paeth(a, b, c) : 0;
+        }
+        uint8_t *dst = rgba + (size_t)y * w * 4;
+        for (uint32_t x = 0; x < w; x++, dst += 4) {
+            uint8_t v[4];
+            for (int k = 0; k < channels; k++) {
+                if (depth >= 8) {
+                    v[k] = row[(x * channels + k) * (depth / 8)];
+                    continue;
+                }
+                size_t bit = (size_t)x * depth;
+                int sample = (row[bit / 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1);
+                v[k] = color == 3 ? sample : sample * 255 / ((1 << depth) - 1);
+            }
+            if (color == 3) memcpy(dst, palette[v[0]], 4);
+            else if (channels <= 2) dst[0] = dst[1] = dst[2] = v[0], dst[3] = channels == 2 ? v[1] : 255;
+            else dst[0] = v[0], dst[1] = v[1], dst[2] = v[2], dst[3] = channels == 4 ? v[3] : 255;
+        }
+    }
+    free(raw);
+    *out = (TextureData){VK_FORMAT_R8G8B8A8_UNORM, 4, w, h, 1, 1, 1, 1, {0}, rgba, (size_t)w * h * 4};
+    return NULL;
+}
+
+// Uncompressed formats a KTX2 texture may use, with their texel size
+static uint32_t ktx2_texel_size(uint32_t format) {
+    switch (format) {
+    case VK_FORMAT_R8_UNORM: return 1;
+    case VK_FORMAT_R8G8_UNORM: case VK_FORMAT_R16_SFLOAT: return 2;
+    case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_B8G8R8A8_UNORM: case VK_FORMAT_B8G8R8A8_SRGB: case VK_FORMAT_R32_SFLOAT: return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT: return 8;
+    case VK_FORMAT_R32G32B32A32_SFLOAT: return 16;
+    default: return 0;
+    }
+}
+
+// KTX2 without supercompression: 2D, cube maps (6 faces) and volumes
+// (pixelDepth > 0), with or without their mip levels
+static const char *decode_ktx2(const uint8_t *file, size_t size, TextureData *out) {
+    if (size < 80 || memcmp(file, "\xabKTX 20\xbb\r\n\x1a\n", 12) != 0) return "not a KTX2 file";
+    uint32_t format = read_le32(file + 12), w = read_le32(file + 20), h = read_le32(file + 24);
+    uint32_t d = read_le32(file + 28), layers = read_le32(file + 32), faces = read_le32(file + 36);
+    uint32_t stored = read_le32(file + 40), texel = ktx2_texel_size(format);
+    if (read_le32(file + 44) != 0) return "supercompressed KTX2 is not supported";
+    if (!texel) return "unsupported KTX2 vkFormat (uncompressed 8, 16 and 32-bit formats only)";
+    if (layers > 1) return "KTX2 texture arrays are not supported";
+    if ((faces != 1 && faces != 6) || (faces == 6 && (d || w != h))) return "bad KTX2 face count";
+    if (w == 0 || h == 0 || w > MAX_TEXTURE_SIZE || h > MAX_TEXTURE_SIZE || d > MAX_TEXTURE_SIZE)
+        return "KTX2 size out of range";
+    uint32_t levels = stored ? stored : 1;
+    if (levels > MAX_TEXTURE_LEVELS || size < 80 + 24 * (size_t)levels) return "bad KTX2 level count";
+
+    // Levels go into `data` 16-byte aligned, as buffer to image copies want
+    *out = (TextureData){(VkFormat)format, texel, w, h, d ? d : 1, faces, levels, stored == 0};
+    size_t lengths[MAX_TEXTURE_LEVELS];
+    for (uint32_t i = 0; i < levels; i++) {
+        lengths[i] = (size_t)(w >> i ? w >> i : 1) * (h >> i ? h >> i : 1) * (d >> i ? d >> i : 1) * faces * texel;
+        out->level_offsets[i] = out->size;
+        out->size += (lengths[i] + 15) & ~(size_t)15;
+    }
+    if (!(out->data = calloc(1, out->size))) return "out of memory";
+    for (uint32_t i = 0; i < levels; i++) {
+        const uint8_t *entry = file + 80 + 24 * i;
+        uint64_t offset = read_le64(entry), len = read_le64(entry + 8);
+        if (offset > size || len > size - offset || len != lengths[i]) {
+            free(out->data);
+            out->data = NULL;
+            return "KTX2 level data is truncated or the wrong size";
+        }
+        memcpy(out->data + out->level_offsets[i], file + offset, len);
+    }
+    return NULL;
+}
+
+static int texture_data_kind(const TextureData *t) {
+    return t->layers == 6 ? TEXTURE_CUBE : t->depth > 1 ? TEXTURE_3D : TEXTURE_2D;
+}
+
+// What a texture file is sampled as, from its header: only KTX2 has cube
+// maps and volumes. Read by the scan threads, for the wrapper's sampler
+// types; dfd < 0 looks in the bundle.
+static int texture_file_kind(int dfd, const char *name) {
+    size_t len = strlen(name);
+    if (len < 5 || strcmp(name + len - 5, ".ktx2") != 0) return TEXTURE_2D;
+    uint8_t header[48];
+    size_t size = 0;
+    const void *bundled = dfd < 0 ? bundle_find(name, &size) : NULL;
+    ssize_t got = -1;
+    if (bundled) {
+        got = size < sizeof(header) ? 0 : sizeof(header);
+        memcpy(header, bundled, got);
+    } else {
+        int fd = openat(dfd < 0 ? AT_FDCWD : dfd, name, O_RDONLY | O_CLOEXEC);
+        got = fd >= 0 ? read(fd, header, sizeof(header)) : -1;
+        if (fd >= 0) close(fd);
+    }
+    if (got != (ssize_t)sizeof(header)) return TEXTURE_2D;
+    return read_le32(header + 36) == 6 ? TEXTURE_CUBE : read_le32(header + 28) ? TEXTURE_3D : TEXTURE_2D;
+}
+
+static void *texture_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&textures.lock);
+    for (;;) {
+        Texture *t = NULL;
+        for (int i = 0; i < textures.count && !t; i++)
+            if (textures.entries[i].state == TEX_QUEUED) t = &textures.entries[i];
+        if (textures.stop) break;
+        if (!t) {
+            pthread_cond_wait(&textures.wake, &textures.lock);
+            continue;
+        }
+        t->state = TEX_DECODING;
+        pthread_mutex_unlock(&textures.lock);
+
+        size_t size = 0;
+        const uint8_t *file = load_file(t->path, &size);
+        const char *error = file ? NULL : strerror(errno);
+        uint64_t hash = 14695981039346656037ull;
+        for (size_t i = 0; file && i < size; i++) hash = (hash ^ file[i]) * 1099511628211ull;
+        TextureData data = {0};
+        if (!error) {
+            size_t len = strlen(t->path);
+            error = len >= 5 && strcmp(t->path + len - 5, ".ktx2") == 0 ? decode_ktx2(file, size, &data)
+                                                                         : decode_png(file, size, &data);
+        }
+        if (!error && texture_data_kind(&data) != t->kind) error = "changed type since the shader was compiled";
+        release_file(file);
+        if (error) {
+            free(data.data);
+            printf("Texture %s: %s\n", t->path, error);
+        }
+
+        pthread_mutex_lock(&textures.lock);
+        t->hash = hash;
+        t->data = data;
+        t->state = error ? TEX_FAILED : TEX_DECODED;
+        pthread_cond_broadcast(&textures.decoded);
+    }
+    pthread_mutex_unlock(&textures.lock);
+    return NULL;
+}
+
+static void textures_stop(void) {
+    pthread_mutex_lock(&textures.lock);
+    textures.stop = 1;
+    pthread_cond_broadcast(&textures.wake);
+    pthread_mutex_unlock(&textures.lock);
+    for (int i = 0; i < textures.thread_count; i++) pthread_join(textures.threads[i], NULL);
+    textures.thread_count = 0;
+}
+
+// Resolve `shader`'s texture files to entries, queueing the ones nobody
+// asked for yet. Cheap once resolved; the main thread calls it whenever a
+// shader is about to be needed.
+static void textures_request(int shader) {
+    ShaderInfo *s = &shaders[shader];
+    for (int j = 0; j < s->texture_count; j++) {
+        if (s->texture_ids[j]) continue;
+        const char *name = arena_str(s->textures[j]);
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s%s%s", name[0] == '/' ? "" : arena_str(s->dir), name[0] == '/' ? "" : "/", name);
+        int i = 0;
+        while (i < textures.count && strcmp(textures.entries[i].path, path) != 0) i++;
+        if (i == MAX_TEXTURES) {
+            printf("Texture %s: more than %d textures, using the fallback\n", path, MAX_TEXTURES);
+            s->texture_ids[j] = UINT8_MAX;
+            continue;
+        }
+        s->texture_ids[j] = i + 1;
+        if (i < textures.count) continue;
+        pthread_mutex_lock(&textures.lock);
+        textures.entries[i] = (Texture){.path = strdup(path), .kind = s->texture_kinds[j], .state = TEX_QUEUED};
+        textures.count++;
+        pthread_cond_signal(&textures.wake);
+        pthread_mutex_unlock(&textures.lock);
+        if (textures.thread_count < TEXTURE_WORKERS &&
+            pthread_create(&textures.threads[textures.thread_count], NULL, texture_worker, NULL) == 0)
+            textures.thread_count++;
+    }
+}
+
+// What a channel reading `source` (CHANNEL_TEXTURE or CHANNEL_FILE + j)
+// samples: the file's image once it is ready, a stand-in of the same type
+// until then
+static VkImageView texture_view(int shader, int source) {
+    int j = source - CHANNEL_FILE;
+    if (j < 0) return textures.fallback[TEXTURE_2D];
+    ShaderInfo *s = &shaders[shader];
+    if (!s->texture_ids[j]) textures_request(shader);
+    int id = s->texture_ids[j];
+    if (id == UINT8_MAX) return textures.fallback[s->texture_kinds[j]];
+    Texture *t = &textures.entries[id - 1];
+    pthread_mutex_lock(&textures.lock);
+    int ready = t->state == TEX_READY;
+    pthread_mutex_unlock(&textures.lock);
+    return ready ? t->view : textures.fallback[s->texture_kinds[j]];
+}
+
+static void texture_submit(void) {
+    vkEndCommandBuffer(textures.cmd);
+    VK_CHECK(vkQueueSubmit(textures.queue, 1, &(VkSubmitInfo){
+        .sType=VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext=textures.device_mask ? &(VkDeviceGroupSubmitInfo){
+            .sType=VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO,
+            .commandBufferCount=1,.pCommandBufferDeviceMasks=&textures.device_mask
+        } : NULL,
+        .commandBufferCount=1,.pCommandBuffers=&textures.cmd
+    }, textures.fence));
+    textures.uploading = 1;
+}
+
+static void texture_barrier(VkCommandBuffer cmd, VkImage image, uint32_t level, uint32_t levels, uint32_t layers,
+                            VkImageLayout from, VkImageLayout to) {
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT|VK_PIPELINE_STAGE_TRANSFER_BIT,
+        to == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT,
+        0, 0, NULL, 0, NULL, 1, &(VkImageMemoryBarrier){
+            .sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask=from == VK_IMAGE_LAYOUT_UNDEFINED ? 0 : VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask=to == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL ? VK_ACCESS_SHADER_READ_BIT :
+                           to == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL ? VK_ACCESS_TRANSFER_READ_BIT : VK_ACCESS_TRANSFER_WRITE_BIT,
+            .oldLayout=from,.newLayout=to,
+            .srcQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,.dstQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,
+            .image=image,.subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,level,levels,0,layers}
+        });
+}
+
+// Done with an entry's decoded data without uploading it: it shares another
+// entry's image, or failed (`error`) and its channels keep the fallback
+static void texture_settle(Texture *t, const char *error) {
+    if (error) printf("Texture %s: %s\n", t->path, error);
+    free(t->data.data);
+    t->data.data = NULL;
+    pthread_mutex_lock(&textures.lock);
+    t->state = error ? TEX_FAILED : TEX_READY;
+    pthread_mutex_unlock(&textures.lock);
+}
+
+// Upload one decoded texture, if the staging buffer is free: copy the
+// stored levels, blit each further level from the one above, and leave the
+// image readable by fragment shaders. Later frames are submitted after it
+// on the same queue, so the final barrier is all they need. A texture with
+// the same content as one already uploaded just shares its image.
+static void textures_upload(void) {
+    if (textures.uploading) {
+        if (vkGetFenceStatus(textures.device, textures.fence) != VK_SUCCESS) return;
+        vkResetFences(textures.device, 1, &textures.fence);
+        textures.uploading = 0;
+    }
+    Texture *t = NULL;
+    pthread_mutex_lock(&textures.lock);
+    for (int i = 0; i < textures.count && !t; i++)
+        if (textures.entries[i].state == TEX_DECODED) t = &textures.entries[i];
+    pthread_mutex_unlock(&textures.lock);
+    if (!t) return;
+
+    TextureData *d = &t->data;
+    const Texture *same = NULL;
+    pthread_mutex_lock(&textures.lock);
+    for (int i = 0; i < textures.count && !same; i++) {
+        const Texture *o = &textures.entries[i];
+        if (o != t && o->state == TEX_READY && o->hash == t->hash && o->kind == t->kind) same = o;
+    }
+    pthread_mutex_unlock(&textures.lock);
+    VkFormatProperties fp;
+    vkGetPhysicalDeviceFormatProperties(textures.gpu, d->format, &fp);
+    const char *error = NULL;
+    if (same) {
+        t->view = same->view;
+        printf("Texture %s: same as %s\n", t->path, same->path);
+    } else if (!(fp.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+        error = "format can't be sampled on this GPU";
+    } else if (d->size > TEXTURE_STAGING_SIZE) {
+        error = "larger than the upload buffer";
+    }
+    if (same || error) {
+        texture_settle(t, error);
+        return;
+    }
+
+    // Full mip chain where the file doesn't bring one, if the format can be
+    // blitted with linear filtering
+    VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT|VK_FORMAT_FEATURE_BLIT_DST_BIT|
+                                VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    uint32_t levels = d->levels;
+    if (d->generate_mips && (fp.optimalTilingFeatures & blit) == blit) {
+        uint32_t largest = d->width > d->height ? d->width : d->height;
+        if (d->depth > largest) largest = d->depth;
+        for (levels = 1; largest >> levels; levels++) {}
+    }
+    // The GPU's own limits for the format, usage and type (maxImageDimension*
+    // and below), which may well be under MAX_TEXTURE_SIZE
+    int kind = texture_data_kind(d);
+    VkImageType type = kind == TEXTURE_3D ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D;
+    VkImageCreateFlags flags = kind == TEXTURE_CUBE ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0;
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT|VK_IMAGE_USAGE_TRANSFER_DST_BIT|VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    VkImageFormatProperties limits;
+    if (vkGetPhysicalDeviceImageFormatProperties(textures.gpu, d->format, type, VK_IMAGE_TILING_OPTIMAL,
+                                                 usage, flags, &limits) != VK_SUCCESS) {
+        texture_settle(t, "format unsupported for this kind of texture on this GPU");
+        return;
+    }
+    if (d->width > limits.maxExtent.width || d->height > limits.maxExtent.height ||
+        d->depth > limits.maxExtent.depth || d->layers > limits.maxArrayLayers || d->levels > limits.maxMipLevels) {
+        texture_settle(t, "larger than this GPU supports");
+        return;
+    }
+    if (levels > limits.maxMipLevels) levels = limits.maxMipLevels;
+    VkImage image;
+    VK_CHECK(vkCreateImage(textures.device, &(VkImageCreateInfo){
+        .sType=VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .flags=flags,.imageType=type,.format=d->format,
+        .extent={d->width,d->height,d->depth},.mipLevels=levels,.arrayLayers=d->layers,
+        .samples=VK_SAMPLE_COUNT_1_BIT,.tiling=VK_IMAGE_TILING_OPTIMAL,.usage=usage
+    }, NULL, &image));
+    memory_bind_image(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VK_CHECK(vkCreateImageView(textures.device, &(VkImageViewCreateInfo){
+        .sType=VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image=image,.viewType=kind == TEXTURE_CUBE ? VK_IMAGE_VIEW_TYPE_CUBE : kind == TEXTURE_3D ? VK_IMAGE_VIEW_TYPE_3D : VK_IMAGE_VIEW_TYPE_2D,
+        .format=d->format,.subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,levels,0,d->layers}
+    }, NULL, &t->view));
+
+    if (!textures.staging) {
+        VK_CHECK(vkCreateBuffer(textures.device, &(VkBufferCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size=TEXTURE_STAGING_SIZE,.usage=VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+        }, NULL, &textures.staging));
+        textures.staging_ptr = memory_bind_buffer(textures.staging,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0);
+    }
+    memcpy(textures.staging_ptr, d->data, d->size);
+
+    VkCommandBuffer cmd = textures.cmd;
+    vkBeginCommandBuffer(cmd, &(VkCommandBufferBeginInfo){
+        .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags=VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT});
+    texture_barrier(cmd, image, 0, levels, d->layers, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    VkBufferImageCopy copies[MAX_TEXTURE_LEVELS];
+    for (uint32_t i = 0; i < d->levels; i++) {
+        copies[i] = (VkBufferImageCopy){
+            .bufferOffset=d->level_offsets[i],
+            .imageSubresource={VK_IMAGE_ASPECT_COLOR_BIT,i,0,d->layers},
+            .imageExtent={d->width >> i ? d->width >> i : 1, d->height >> i ? d->height >> i : 1,
+                          d->depth >> i ? d->depth >> i : 1}
+        };
+    }
+    vkCmdCopyBufferToImage(cmd, textures.staging, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, d->levels, copies);
+    texture_barrier(cmd, image, 0, d->levels, d->layers, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    for (uint32_t i = d->levels; i < levels; i++) {
+        VkImageBlit region = {
+            .srcSubresource={VK_IMAGE_ASPECT_COLOR_BIT,i - 1,0,d->layers},
+            .srcOffsets={{0,0,0},{(int32_t)(d->width >> (i - 1) ? d->width >> (i - 1) : 1),
+                                  (int32_t)(d->height >> (i - 1) ? d->height >> (i - 1) : 1),
+                                  (int32_t)(d->depth >> (i - 1) ? d->depth >> (i - 1) : 1)}},
+            .dstSubresource={VK_IMAGE_ASPECT_COLOR_BIT,i,0,d->layers},
+            .dstOffsets={{0,0,0},{(int32_t)(d->width >> i ? d->width >> i : 1),
+                                  (int32_t)(d->height >> i ? d->height >> i : 1),
+                                  (int32_t)(d->depth >> i ? d->depth >> i : 1)}}
+        };
+        vkCmdBlitImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       1, &region, VK_FILTER_LINEAR);
+        texture_barrier(cmd, image, i, 1, d->layers, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    }
+    texture_barrier(cmd, image, 0, levels, d->layers, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    texture_submit();
+
+    printf("Texture %s: %ux%u", t->path, d->width, d->height);
+    if (kind == TEXTURE_3D) printf("x%u", d->depth);
+    printf("%s, %u mip level%s\n", kind == TEXTURE_CUBE ? " cube" : "", levels, levels == 1 ? "" : "s");
+    free(d->data);
+    d->data = NULL;
+    pthread_mutex_lock(&textures.lock);
+    t->state = TEX_READY;
+    pthread_mutex_unlock(&textures.lock);
+}
+
+// --headless and --bench: render with every texture of `shader` in place
+// rather than the stand-ins, so frames don't depend on decode timing
+static void textures_finish(int shader) {
+    textures_request(shader);
+    const ShaderInfo *s = &shaders[shader];
+    for (;;) {
+        int pending = 0;
+        pthread_mutex_lock(&textures.lock);
+        for (int j = 0; j < s->texture_count; j++) {
+            int id = s->texture_ids[j];
+            if (id != UINT8_MAX && textures.entries[id - 1].state != TEX_READY &&
+                textures.entries[id - 1].state != TEX_FAILED) pending = 1;
+        }
+        int decoded = 0;
+        for (int i = 0; i < textures.count; i++) decoded |= textures.entries[i].state == TEX_DECODED;
+        if (pending && !decoded && !textures.uploading) pthread_cond_wait(&textures.decoded, &textures.lock);
+        pthread_mutex_unlock(&textures.lock);
+        if (!pending) break;
+        if (textures.uploading) vkWaitForFences(textures.device, 1, &textures.fence, VK_TRUE, UINT64_MAX);
+        textures_upload();
+    }
+}
+
+// Stand-ins and the upload command buffer. The cube and volume stand-ins
+// are single black texels, cleared with the setup commands in `setup`.
+static void textures_init(VkDevice device, VkPhysicalDevice gpu, VkQueue queue, VkCommandPool pool,
+                          uint32_t device_mask, VkImageView checkerboard, VkCommandBuffer setup) {
+    textures.device = device;
+    textures.gpu = gpu;
+    textures.queue = queue;
+    textures.device_mask = device_mask;
+    textures.fallback[TEXTURE_2D] = checkerboard;
+    VK_CHECK(vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo){
+        .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool=pool,.level=VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount=1
+    }, &textures.cmd));
+    VK_CHECK(vkCreateFence(device, &(VkFenceCreateInfo){
+        .sType=VK_STRUCTURE_TYPE_FENCE_CREATE_INFO}, NULL, &textures.fence));
+    for (int kind = TEXTURE_CUBE; kind < TEXTURE_KINDS; kind++) {
+        uint32_t layers = kind == TEXTURE_CUBE ? 6 : 1;
+        VkImage image;
+        VK_CHECK(vkCreateImage(device, &(VkImageCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .flags=kind == TEXTURE_CUBE ? VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT : 0,
+            .imageType=kind == TEXTURE_3D ? VK_IMAGE_TYPE_3D : VK_IMAGE_TYPE_2D,.format=VK_FORMAT_R8G8B8A8_UNORM,
+            .extent={1,1,1},.mipLevels=1,.arrayLayers=layers,
+            .samples=VK_SAMPLE_COUNT_1_BIT,.tiling=VK_IMAGE_TILING_OPTIMAL,
+            .usage=VK_IMAGE_USAGE_SAMPLED_BIT|VK_IMAGE_USAGE_TRANSFER_DST_BIT
+        }, NULL, &image));
+        memory_bind_image(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK(vkCreateImageView(device, &(VkImageViewCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image=image,.viewType=kind == TEXTURE_CUBE ? VK_IMAGE_VIEW_TYPE_CUBE : VK_IMAGE_VIEW_TYPE_3D,
+            .format=VK_FORMAT_R8G8B8A8_UNORM,.subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,layers}
+        }, NULL, &textures.fallback[kind]));
+        texture_barrier(setup, image, 0, 1, layers, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        vkCmdClearColorImage(setup, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             &(VkClearColorValue){.float32={0,0,0,1}}, 1,
+                             &(VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,layers});
+        texture_barrier(setup, image, 0, 1, layers, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+}
+
+// Extract basename from path (e.g., "shaders/plasma" -> "plasma")
+static const char *get_basename(const char *path) {
+    const char *last_slash = strrchr(path, '/');
+    return last_slash ? last_slash + 1 : path;
+}
+
+static void handle_quit_signal(int sig) {
+    (void)sig;
+    quit_requested = 1;
+}
+
+// Pipeline cache file for this device. Vendor, device, driver version and
+// cache UUID are all in the name, so a driver update starts a fresh file.
+// Same location and naming as the Rust port (src/pipeline_cache.rs).
+static int pipeline_cache_path(const VkPhysicalDeviceProperties *props, char *out, size_t len) {
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char base[512];
+    if (xdg && *xdg) snprintf(base, sizeof(base), "%s/metalshader", xdg);
+    else if (home && *home) snprintf(base, sizeof(base), "%s/.cache/metalshader", home);
+    else return -1;
+
+    char uuid[2 * VK_UUID_SIZE + 1];
+    for (int i = 0; i < VK_UUID_SIZE; i++)
+        snprintf(uuid + 2 * i, 3, "%02x", props->pipelineCacheUUID[i]);
+    snprintf(out, len, "%s/pipeline-%04x-%04x-%08x-%s.bin", base,
+             props->vendorID, props->deviceID, props->driverVersion, uuid);
+    return 0;
+}
+
+// Drivers should reject foreign cache data themselves, but not all do
+static int pipeline_cache_matches(const VkPhysicalDeviceProperties *props, const void *data, size_t size) {
+    VkPipelineCacheHeaderVersionOne header;
+    if (!data || size < sizeof(header)) return 0;
+    memcpy(&header, data, sizeof(header));
+    return header.headerSize >= sizeof(header) && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == props->vendorID && header.deviceID == props->deviceID &&
+           memcmp(header.pipelineCacheUUID, props->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+// Create the pipeline cache, seeded from the bundle's when it was built on
+// this kind of device, else from disk when the file matches it
+static VkPipelineCache load_pipeline_cache(VkDevice device, const VkPhysicalDeviceProperties *props,
+                                           const char *path) {
+    size_t size = 0;
+    const void *data = bundle_find(BUNDLE_CACHE, &size);
+    if (pipeline_cache_matches(props, data, size)) {
+        printf("Pipeline cache: %zu bytes from the bundle\n", size);
+    } else {
+        if (data) printf("Pipeline cache: the bundle's was built for another GPU or driver\n");
+        data = NULL;
+        FILE *f = path[0] ? fopen(path, "rb") : NULL;
+        if (f) {
+            fseek(f, 0, SEEK_END); size = ftell(f); fseek(f, 0, SEEK_SET);
+            data = malloc(size);
+            if (fread((void*)data, 1, size, f) != size) size = 0;
+            fclose(f);
+        }
+        if (!pipeline_cache_matches(props, data, size)) size = 0;
+        if (size) printf("Pipeline cache: %zu bytes from %s\n", size, path);
+    }
+
+    VkPipelineCache cache;
+    VK_CHECK(vkCreatePipelineCache(device, &(VkPipelineCacheCreateInfo){
+        .sType=VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize=size,.pInitialData=size ? data : NULL
+    }, NULL, &cache));
+    release_file(data);
+    return cache;
+}
+
+// Write the cache back via a temp file + rename, so a crash mid-write never
+// leaves a truncated cache behind
+static void save_pipeline_cache(VkDevice device, VkPipelineCache cache, const char *path) {
+    size_t size = 0;
+    if (!path[0] || vkGetPipelineCacheData(device, cache, &size, NULL) != VK_SUCCESS || size == 0) return;
+    void *data = malloc(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data) == VK_SUCCESS) {
+        // mkdir -p the cache directory
+        char dir[512];
+        snprintf(dir, sizeof(dir), "%s", path);
+        for (char *p = dir + 1; *p; p++) {
+            if (*p != '/') continue;
+            *p = '\0'; mkdir(dir, 0755); *p = '/';
+        }
+
+        char tmp[600];
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        FILE *f = fopen(tmp, "wb");
+        if (f) {
+            int ok = fwrite(data, 1, size, f) == size;
+            if (fclose(f) == 0 && ok && rename(tmp, path) == 0)
+                printf("Pipeline cache: saved %zu bytes to %s\n", size, path);
+            else
+                unlink(tmp);
+        }
+    }
+    free(data);
+}
+
+// Specialize `code` for the .quality tunables of shaders[index] at `tier`:
+// each one the module declares as a 32-bit specialization constant of that
+// name gets an entry, with the module's SpecId and its type's encoding of
+// the value. Entries go into map/data from `n` on; returns the new count.
+static uint32_t quality_specialization(int index, int tier, const uint32_t *code, size_t size,
+                                       VkSpecializationMapEntry *map, uint32_t *data, uint32_t n) {
+    enum { KIND_NONE, KIND_INT, KIND_FLOAT, KIND_BOOL };
+    const ShaderInfo *s = &shaders[index];
+    size_t words = size / 4;
+    if (!s->quality_count || words < 5 || code[0] != 0x07230203) return n;
+    uint32_t ids[QUALITY_CONSTANTS] = {0}, spec_ids[QUALITY_CONSTANTS];
+    uint8_t kinds[QUALITY_CONSTANTS] = {0}, has_spec_id = 0;
+    uint32_t types[16];  // Result ids of the 32-bit scalar types, and bool
+    uint8_t type_kinds[16];
+    int type_count = 0;
+    for (size_t i = 5; i < words; ) {
+        const uint32_t *w = code + i;
+        uint32_t count = w[0] >> 16, op = w[0] & 0xffff;
+        if (count == 0 || count > words - i) break;
+        if (op == 5 && count >= 3) {  // OpName
+            size_t max = (count - 2) * 4;
+            const char *str = (const char*)(w + 2);
+            for (int k = 0; k < s->quality_count; k++)
+                if (strnlen(str, max) < max && strcmp(str, arena_str(s->quality_names[k])) == 0) ids[k] = w[1];
+        } else if (op == 71 && count >= 4 && w[2] == 1) {  // OpDecorate SpecId
+            for (int k = 0; k < s->quality_count; k++)
+                if (ids[k] && ids[k] == w[1]) {
+                    spec_ids[k] = w[3];
+                    has_spec_id |= 1u << k;
+                }
+        } else if ((op == 20 || ((op == 21 || op == 22) && count >= 3 && w[2] == 32)) && type_count < 16) {
+            types[type_count] = w[1];  // OpTypeBool, OpTypeInt 32, OpTypeFloat 32
+            type_kinds[type_count++] = op == 20 ? KIND_BOOL : op == 21 ? KIND_INT : KIND_FLOAT;
+        } else if (op >= 48 && op <= 50 && count >= 3) {  // OpSpecConstantTrue/False, OpSpecConstant
+            for (int k = 0; k < s->quality_count; k++)
+                for (int t = 0; t < type_count && ids[k] == w[2]; t++)
+                    if (types[t] == w[1]) kinds[k] = type_kinds[t];
+        }
+        i += count;
+    }
+    for (int k = 0; k < s->quality_count; k++) {
+        if (!(has_spec_id & (1u << k)) || kinds[k] == KIND_NONE) continue;
+        float v = s->quality_values[k][tier];
+        if (kinds[k] == KIND_FLOAT) memcpy(&data[n], &v, sizeof(v));
+        else if (kinds[k] == KIND_INT) data[n] = (uint32_t)(int32_t)lroundf(v);
+        else data[n] = v != 0.0f;
+        map[n] = (VkSpecializationMapEntry){spec_ids[k], n * sizeof(uint32_t), sizeof(uint32_t)};
+        n++;
+    }
+    return n;
+}
+
+static VkPipeline build_compute_pipeline(const PipelineBuilder *b, int index, int tier) {
+    if (!shaders[index].has_comp) return VK_NULL_HANDLE;
+    char path[PATH_MAX];
+    shader_path(&shaders[index], ".comp.spv", path, sizeof(path));
+    size_t sz;
+    const uint32_t *code = load_file(path, &sz);
+    VkShaderModule module = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    // Workgroup size first, then the tunables
+    VkSpecializationMapEntry entries[2 + QUALITY_CONSTANTS] = {
+        {0, 0, sizeof(uint32_t)},
+        {1, sizeof(uint32_t), sizeof(uint32_t)}
+    };
+    uint32_t data[2 + QUALITY_CONSTANTS] = {b->workgroup[0], b->workgroup[1]};
+    uint32_t n = code ? quality_specialization(index, tier, code, sz, entries, data, 2) : 2;
+    if (code &&
+        vkCreateShaderModule(b->device, &(VkShaderModuleCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,.codeSize=sz,.pCode=code}, NULL, &module) == VK_SUCCESS) {
+        VkResult r = vkCreateComputePipelines(b->device, b->cache, 1, &(VkComputePipelineCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+            .stage={.sType=VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                    .stage=VK_SHADER_STAGE_COMPUTE_BIT,.module=module,.pName="main",
+                    .pSpecializationInfo=&(VkSpecializationInfo){n, entries, n * sizeof(uint32_t), data}},
+            .layout=b->layout
+        }, NULL, &pipeline);
+        if (r != VK_SUCCESS) pipeline = VK_NULL_HANDLE;
+    }
+    if (module != VK_NULL_HANDLE) vkDestroyShaderModule(b->device, module, NULL);
+    release_file(code);
+    return pipeline;
+}
+
+// Fullscreen draw of one pass (fragment stage `frag_suffix`) into renderPass
+static VkPipeline build_graphics_pipeline(const PipelineBuilder *b, int index, const char *frag_suffix,
+                                          VkRenderPass renderPass, int tier) {
+    char vert_path[PATH_MAX], frag_path[PATH_MAX];
+    shader_path(&shaders[index], ".vert.spv", vert_path, sizeof(vert_path));
+    shader_path(&shaders[index], frag_suffix, frag_path, sizeof(frag_path));
+    size_t vsz, fsz;
+    const uint32_t *vc = load_file(vert_path, &vsz);
+    const uint32_t *fc = load_file(frag_path, &fsz);
+    VkShaderModule vm = VK_NULL_HANDLE, fm = VK_NULL_HANDLE;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    VkSpecializationMapEntry entries[QUALITY_CONSTANTS];
+    uint32_t data[QUALITY_CONSTANTS];
+    uint32_t n = fc ? quality_specialization(index, tier, fc, fsz, entries, data, 0) : 0;
+    if (vc && fc &&
+        vkCreateShaderModule(b->device, &(VkShaderModuleCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,.codeSize=vsz,.pCode=vc}, NULL, &vm) == VK_SUCCESS &&
+        vkCreateShaderModule(b->device, &(VkShaderModuleCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,.codeSize=fsz,.pCode=fc}, NULL, &fm) == VK_SUCCESS) {
+        VkResult r = vkCreateGraphicsPipelines(b->device, b->cache, 1, &(VkGraphicsPipelineCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+            .stageCount=2,
+            .pStages=(VkPipelineShaderStageCreateInfo[]){
+                {.sType=VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                 .stage=VK_SHADER_STAGE_VERTEX_BIT,.module=vm,.pName="main"},
+                {.sType=VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                 .stage=VK_SHADER_STAGE_FRAGMENT_BIT,.module=fm,.pName="main",
+                 .pSpecializationInfo=n ? &(VkSpecializationInfo){n, entries, n * sizeof(uint32_t), data} : NULL}
+            },
+            .pVertexInputState=&(VkPipelineVertexInputStateCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
+            },
+            .pInputAssemblyState=&(VkPipelineInputAssemblyStateCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+                .topology=VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST
+            },
+            .pViewportState=&(VkPipelineViewportStateCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+                .viewportCount=1,.scissorCount=1
+            },
+            .pDynamicState=&(VkPipelineDynamicStateCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+                .dynamicStateCount=2,
+                .pDynamicStates=(VkDynamicState[]){VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR}
+            },
+            .pRasterizationState=&(VkPipelineRasterizationStateCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+                .polygonMode=VK_POLYGON_MODE_FILL,.cullMode=VK_CULL_MODE_NONE,.lineWidth=1.0f
+            },
+            .pMultisampleState=&(VkPipelineMultisampleStateCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+                .rasterizationSamples=VK_SAMPLE_COUNT_1_BIT
+            },
+            .pColorBlendState=&(VkPipelineColorBlendStateCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+                .attachmentCount=1,
+                .pAttachments=&(VkPipelineColorBlendAttachmentState){.colorWriteMask=0xF}
+            },
+            .layout=b->layout,.renderPass=renderPass
+        }, NULL, &pipeline);
+        if (r != VK_SUCCESS) pipeline = VK_NULL_HANDLE;
+    }
+    // Modules are only needed while the pipeline is being created
+    if (vm != VK_NULL_HANDLE) vkDestroyShaderModule(b->device, vm, NULL);
+    if (fm != VK_NULL_HANDLE) vkDestroyShaderModule(b->device, fm, NULL);
+    release_file(vc); release_file(fc);
+    return pipeline;
+}
+
+static void destroy_pipelines(VkDevice device, const CachedPipeline *c) {
+    vkDestroyPipeline(device, c->pipeline, NULL);
+    for (int k = 0; k < BUFFER_PASSES; k++) vkDestroyPipeline(device, c->buffers[k], NULL);
+}
+
+// Build the pipelines for shaders[index]: its Image pass and, with
+// multipass, one per buffer pass. Safe to call from any thread:
+// VkPipelineCache is internally synchronized. All of them or none: the
+// result's pipeline is VK_NULL_HANDLE if any SPIR-V is missing or the
+// driver rejects it. Tunables get their values for quality `tier`.
+static CachedPipeline build_pipeline(const PipelineBuilder *b, int index, int tier) {
+    CachedPipeline c = {.shader = index, .tier = tier};
+    if (b->compute) {
+        c.pipeline = build_compute_pipeline(b, index, tier);
+        return c;
+    }
+    c.pipeline = build_graphics_pipeline(b, index, ".frag.spv", b->renderPass, tier);
+    for (int k = 0; k < BUFFER_PASSES && c.pipeline != VK_NULL_HANDLE && b->bufferPass != VK_NULL_HANDLE; k++) {
+        if (!(shaders[index].buffers & (1u << k))) continue;
+        char suffix[16];
+        pass_suffix(k, ".frag.spv", suffix, sizeof(suffix));
+        c.buffers[k] = build_graphics_pipeline(b, index, suffix, b->bufferPass, tier);
+        if (c.buffers[k] == VK_NULL_HANDLE) {
+            destroy_pipelines(b->device, &c);
+            c = (CachedPipeline){.shader = index, .tier = tier};
+        }
+    }
+    return c;
+}
+
+// --make-bundle: one file to pack, read whole up front
+typedef struct {
+    char *name;  // In the bundle
+    int order;   // Of adding, so the first file of a name wins
+    const void *data;
+    size_t size;
+} BundleFile;
+
+static struct {
+    BundleFile *files;
+    int count, cap;
+} packing;
+
+static int compare_bundle_files(const void *a, const void *b) {
+    const BundleFile *x = a, *y = b;
+    int c = strcmp(x->name, y->name);
+    return c ? c : x->order - y->order;
+}
+
+static void pack_data(const char *name, const void *data, size_t size) {
+    if (packing.count == packing.cap) {
+        packing.cap = packing.cap ? packing.cap * 2 : 256;
+        packing.files = realloc(packing.files, packing.cap * sizeof(BundleFile));
+    }
+    packing.files[packing.count] = (BundleFile){strdup(name), packing.count, data, size};
+    packing.count++;
+}
+
+// `name` of shader `s`'s directory (which may be a bundle itself). A
+// missing optional file is left out; a missing required one fails.
+static int pack_file(const ShaderInfo *s, const char *name, int optional) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", arena_str(s->dir), name);
+    size_t size = 0;
+    const void *data = load_file(path, &size);
+    if (!data) {
+        if (!optional) printf("  %s: %s\n", path, strerror(errno));
+        return optional ? 0 : -1;
+    }
+    pack_data(name, data, size);
+    return 0;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+// Pack the catalog into a bundle at `path`: every shader's SPIR-V and
+// .channels, the texture files they name (absolute paths stay on disk) and
+// the pipeline cache, after building every shader's pipelines into it with
+// the options given. Written via a temp file + rename like the cache.
+static int make_bundle(const char *path, const PipelineBuilder *b) {
+    double start = monotonic_seconds();
+    int built = 0, failed = 0;
+    char name[PATH_MAX], suffix[16];
+    for (int i = 0; i < shader_count && !failed; i++) {
+        const ShaderInfo *s = &shaders[i];
+        // Every tier's variant, so changing tiers is a cache hit as well
+        int ok = 1;
+        for (int t = 0; t < (s->quality_count ? QUALITY_TIERS : 1); t++) {
+            CachedPipeline c = build_pipeline(b, i, s->quality_count ? t : quality_tier());
+            ok &= c.pipeline != VK_NULL_HANDLE;
+            destroy_pipelines(b->device, &c);  // Only the cache is kept
+        }
+        if (ok) built++;
+        else printf("  %s: pipelines failed to build, packing its SPIR-V anyway\n", shader_name(i));
+        for (int p = 0; p < PASS_COUNT && !failed; p++) {
+            if (p < BUFFER_PASSES && !(s->buffers & (1u << p))) continue;
+            pass_suffix(p, ".frag.spv", suffix, sizeof(suffix));
+            snprintf(name, sizeof(name), "%s%s", shader_name(i), suffix);
+            failed = pack_file(s, name, 0) != 0;
+        }
+        snprintf(name, sizeof(name), "%s.vert.spv", shader_name(i));
+        failed |= pack_file(s, name, 0) != 0;
+        snprintf(name, sizeof(name), "%s.comp.spv", shader_name(i));
+        if (s->has_comp) failed |= pack_file(s, name, 0) != 0;
+        snprintf(name, sizeof(name), "%s.channels", shader_name(i));
+        pack_file(s, name, 1);
+        snprintf(name, sizeof(name), "%s.quality", shader_name(i));
+        pack_file(s, name, 1);
+        for (int j = 0; j < s->texture_count; j++)
+            if (arena_str(s->textures[j])[0] != '/') pack_file(s, arena_str(s->textures[j]), 1);
+    }
+
+    size_t cache_size = 0;
+    void *cache = NULL;
+    if (!failed && vkGetPipelineCacheData(b->device, b->cache, &cache_size, NULL) == VK_SUCCESS && cache_size &&
+        vkGetPipelineCacheData(b->device, b->cache, &cache_size, cache = malloc(cache_size)) == VK_SUCCESS)
+        pack_data(BUNDLE_CACHE, cache, cache_size);
+    else
+        free(cache);
+
+    // Sorted for bundle_find, then laid out: header, index, names, data.
+    // Names are relative to the shader's directory, so one texture named by
+    // several shaders is packed once; the first packed wins, and a
+    // different file of the same name (another search dir) is left out.
+    qsort(packing.files, packing.count, sizeof(BundleFile), compare_bundle_files);
+    int count = 0;
+    for (int i = 0; i < packing.count; i++) {
+        BundleFile *f = &packing.files[i];
+        if (count && strcmp(f->name, packing.files[count - 1].name) == 0) {
+            const BundleFile *kept = &packing.files[count - 1];
+            if (f->size != kept->size || memcmp(f->data, kept->data, f->size) != 0)
+                printf("  %s: a different file of this name is already packed, skipping this one\n", f->name);
+            release_file(f->data);
+            free(f->name);
+            continue;
+        }
+        packing.files[count++] = *f;
+    }
+    size_t index_size = BUNDLE_HEADER + (size_t)count * BUNDLE_ENTRY, names_size = 0;
+    for (int i = 0; i < count; i++) names_size += strlen(packing.files[i].name) + 1;
+    uint8_t *index = calloc(1, index_size + names_size);
+    memcpy(index, BUNDLE_MAGIC, 8);
+    put_le32(index + 8, count);
+    uint64_t offset = (index_size + names_size + BUNDLE_ALIGN - 1) & ~(uint64_t)(BUNDLE_ALIGN - 1);
+    size_t name_offset = index_size;
+    uint64_t total = offset;
+    for (int i = 0; i < count; i++) {
+        BundleFile *f = &packing.files[i];
+        uint8_t *e = index + BUNDLE_HEADER + (size_t)i * BUNDLE_ENTRY;
+        size_t len = strlen(f->name);
+        put_le64(e, offset);
+        put_le64(e + 8, f->size);
+        put_le32(e + 16, name_offset);
+        put_le32(e + 20, len);
+        memcpy(index + name_offset, f->name, len + 1);
+        name_offset += len + 1;
+        total = offset + f->size;
+        offset = (offset + f->size + BUNDLE_ALIGN - 1) & ~(uint64_t)(BUNDLE_ALIGN - 1);
+    }
+
+    char tmp[PATH_MAX + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *out = failed ? NULL : fopen(tmp, "wb");
+    int ok = out && fwrite(index, 1, index_size + names_size, out) == index_size + names_size;
+    static const uint8_t zeros[BUNDLE_ALIGN];
+    for (int i = 0; i < count && ok; i++) {
+        BundleFile *f = &packing.files[i];
+        size_t pad = (BUNDLE_ALIGN - ftell(out) % BUNDLE_ALIGN) % BUNDLE_ALIGN;
+        ok = fwrite(zeros, 1, pad, out) == pad && fwrite(f->data, 1, f->size, out) == f->size;
+    }
+    if (out && (fclose(out) != 0 || !ok || rename(tmp, path) != 0)) {
+        ok = 0;
+        unlink(tmp);
+    }
+    if (ok)
+        printf("Bundle: %d files, %llu bytes, %d of %d shaders' pipelines cached -> %s (%.2fs)\n", count,
+               (unsigned long long)total, built, shader_count, path, monotonic_seconds() - start);
+    else
+        printf("Bundle '%s' not written%s%s\n", path, failed ? "" : ": ", failed ? "" : strerror(errno));
+
+    for (int i = 0; i < count; i++) {
+        release_file(packing.files[i].data);
+        free(packing.files[i].name);
+    }
+    free(packing.files);
+    free(index);
+    return ok ? 0 : -1;
+}
+
+static void *prewarm_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&prewarm.lock);
+    while (!prewarm.stop) {
+        if (prewarm.queue_len == 0) {
+            pthread_cond_wait(&prewarm.wake, &prewarm.lock);
+            continue;
+        }
+        int shader = prewarm.queue[0];
+        prewarm.queue_len--;
+        memmove(prewarm.queue, prewarm.queue + 1, prewarm.queue_len * sizeof(int));
+        prewarm.building = shader;
+        pthread_mutex_unlock(&prewarm.lock);
+
+        CachedPipeline built = build_pipeline(&prewarm.builder, shader, quality_tier());
+
+        pthread_mutex_lock(&prewarm.lock);
+        prewarm.building = -1;
+        // A live reload can rebuild a shader whose previous result hasn't
+        // been collected yet; that one was never bound, so drop it here
+        int i = 0;
+        while (i < prewarm.ready_len && prewarm.ready[i].shader != shader) i++;
+        if (i < prewarm.ready_len) destroy_pipelines(prewarm.builder.device, &prewarm.ready[i]);
+        if (i == prewarm.ready_len) prewarm.ready_len++;
+        prewarm.ready[i] = built;
+        pthread_cond_signal(&prewarm.built);
+    }
+    pthread_mutex_unlock(&prewarm.lock);
+    return NULL;
+}
+
+// Startup: sleep until the worker has left something to collect
+static void prewarm_wait(void) {
+    pthread_mutex_lock(&prewarm.lock);
+    while (prewarm.ready_len == 0) pthread_cond_wait(&prewarm.built, &prewarm.lock);
+    pthread_mutex_unlock(&prewarm.lock);
+}
+
+static void stop_prewarm(void) {
+    pthread_mutex_lock(&prewarm.lock);
+    prewarm.stop = 1;
+    pthread_cond_signal(&prewarm.wake);
+    pthread_mutex_unlock(&prewarm.lock);
+    pthread_join(prewarm.thread, NULL);
+}
+
+// Shader output `output` draws when `base` is the current one
+static int output_shader(int output, int base) {
+    return output_mode == OUTPUTS_EACH ? (base + output) % shader_count : base;
+}
+
+// Whether an output draws `shader` right now; its pipeline must stay in the LRU
+static int shader_on_screen(int shader) {
+    for (int i = 0; i < output_count; i++)
+        if (outputs[i].shader == shader) return 1;
+    return 0;
+}
+
+static int lru_find(int shader) {
+    for (int i = 0; i < lru_count; i++)
+        if (pipeline_lru[i].shader == shader) return i;
+    return -1;
+}
+
+// Whether the LRU holds `shader` built for the current quality tier (any
+// tier without tunables). An entry of another tier still renders until
+// its rebuild replaces it.
+static int lru_ready(int shader) {
+    int i = lru_find(shader);
+    return i >= 0 && (!shaders[shader].quality_count || pipeline_lru[i].tier == quality_tier());
+}
+
+// Steps between two shaders when navigating with the arrow keys (wraps)
+static int shader_distance(int a, int b) {
+    int d = abs(a - b);
+    return d < shader_count - d ? d : shader_count - d;
+}
+
+static void retire_pipeline(VkDevice device, CachedPipeline c, uint64_t last_used) {
+    if (retired_count == MAX_RETIRED) {
+        // Never expected in practice; wait rather than leak
+        vkDeviceWaitIdle(device);
+        for (int i = 0; i < retired_count; i++) destroy_pipelines(device, &retired[i]);
+        retired_count = 0;
+    }
+    c.shader = -1;
+    c.last_used = last_used;
+    retired[retired_count++] = c;
+    pipeline_generation++;
+}
+
+// Destroy retired pipelines whose last frame is among the first
+// `frames_completed` frames, all of which have finished on the GPU
+static void destroy_retired(VkDevice device, uint64_t frames_completed) {
+    for (int i = 0; i < retired_count; ) {
+        if (retired[i].last_used < frames_completed) {
+            destroy_pipelines(device, &retired[i]);
+            retired[i] = retired[--retired_count];
+        } else {
+            i++;
+        }
+    }
+}
+
+// The least recently used entry that isn't on screen, bound recently, the
+// current shader or one of its neighbours; -1 when every entry is one of those
+static int lru_victim(uint64_t now) {
+    int slot = -1;
+    for (int i = 0; i < lru_count; i++) {
+        if (pipeline_lru[i].last_used + 1 >= now || shader_on_screen(pipeline_lru[i].shader) ||
+            shader_distance(pipeline_lru[i].shader, current_shader) <= 1) continue;
+        if (slot < 0 || pipeline_lru[i].last_used < pipeline_lru[slot].last_used) slot = i;
+    }
+    return slot;
+}
+
+// Adopt a built pipeline. A rebuild (live reload) replaces the shader's
+// entry; the render loop binds whatever the entry holds, so it switches on
+// the next frame. When full, evict lru_victim(). With none, the cache grows
+// past PIPELINE_LRU_SIZE rather than throw the new pipeline away, and sheds
+// the extra entries on later inserts once they can go.
+static void lru_insert(VkDevice device, CachedPipeline built, uint64_t now) {
+    int existing = lru_find(built.shader);
+    if (existing >= 0) {
+        CachedPipeline *c = &pipeline_lru[existing];
+        retire_pipeline(device, *c, c->last_used);
+        built.last_used = c->last_used;
+        *c = built;
+        return;
+    }
+    while (lru_count >= PIPELINE_LRU_SIZE) {
+        int slot = lru_victim(now);
+        if (slot < 0) break;
+        retire_pipeline(device, pipeline_lru[slot], pipeline_lru[slot].last_used);
+        pipeline_lru[slot] = pipeline_lru[--lru_count];
+    }
+    if (lru_count == PIPELINE_LRU_CAPACITY) {
+        // Never expected: more entries are protected than there are outputs
+        retire_pipeline(device, built, 0);
+        return;
+    }
+    built.last_used = now;
+    pipeline_lru[lru_count++] = built;
+}
+
+// Forget a cached pipeline whose SPIR-V changed; it is rebuilt from the
+// new files if the shader comes up again
+static void lru_drop(VkDevice device, int shader) {
+    int i = lru_find(shader);
+    if (i < 0) return;
+    retire_pipeline(device, pipeline_lru[i], pipeline_lru[i].last_used);
+    pipeline_lru[i] = pipeline_lru[--lru_count];
+}
+
+static int prewarm_pending(int shader) {
+    if (shader == prewarm.building) return 1;
+    for (int i = 0; i < prewarm.queue_len; i++)
+        if (prewarm.queue[i] == shader) return 1;
+    for (int i = 0; i < prewarm.ready_len; i++)
+        if (prewarm.ready[i].shader == shader) return 1;
+    return 0;
+}
+
+// Replace the worker's queue with the neighbours of current_shader that
+// aren't built yet, nearest first (with --outputs each, of the run of
+// shaders on screen). `all` extends it to the whole list; the ones that
+// don't fit in the LRU still end up in the pipeline cache.
+static void prewarm_neighbours(int all) {
+    pthread_mutex_lock(&prewarm.lock);
+    prewarm.queue_len = 0;
+    int reach = all ? shader_count / 2 : 1;
+    int last = output_shader(output_count - 1, current_shader);
+    for (int d = 1; d <= reach; d++) {
+        int next = (last + d) % shader_count;
+        int prev = (current_shader - d + shader_count) % shader_count;
+        int candidates[2] = {next, prev};
+        for (int k = 0; k < 2; k++) {
+            int s = candidates[k];
+            textures_request(s);
+            if (s == current_shader || shader_on_screen(s) || lru_ready(s) || prewarm_pending(s)) continue;
+            prewarm.queue[prewarm.queue_len++] = s;
+        }
+    }
+    pthread_cond_signal(&prewarm.wake);
+    pthread_mutex_unlock(&prewarm.lock);
+}
+
+// Ask for `shader` ahead of everything else queued
+static void prewarm_urgent(int shader) {
+    textures_request(shader);
+    pthread_mutex_lock(&prewarm.lock);
+    int i = 0;
+    while (i < prewarm.queue_len && prewarm.queue[i] != shader) i++;
+    if (i < prewarm.queue_len || !prewarm_pending(shader)) {
+        if (i == prewarm.queue_len) prewarm.queue_len++;
+        memmove(prewarm.queue + 1, prewarm.queue, i * sizeof(int));
+        prewarm.queue[0] = shader;
+        pthread_cond_signal(&prewarm.wake);
+    }
+    pthread_mutex_unlock(&prewarm.lock);
+}
+
+// Live reload: build `shader` again from its current files, ahead of
+// everything else, even if an older build of it is running or done
+static void prewarm_rebuild(int shader) {
+    pthread_mutex_lock(&prewarm.lock);
+    int i = 0;
+    while (i < prewarm.queue_len && prewarm.queue[i] != shader) i++;
+    if (i == prewarm.queue_len) prewarm.queue_len++;
+    memmove(prewarm.queue + 1, prewarm.queue, i * sizeof(int));
+    prewarm.queue[0] = shader;
+    pthread_cond_signal(&prewarm.wake);
+    pthread_mutex_unlock(&prewarm.lock);
+}
+
+// Switch the quality tier. Shaders on screen that have tunables are rebuilt
+// in the background and swapped in like a live reload, and the neighbours
+// pre-warmed again; other entries of the old tier are rebuilt when needed.
+static void set_quality_tier(int tier, int all) {
+    if (tier == quality.tier) return;
+    __atomic_store_n(&quality.tier, tier, __ATOMIC_RELAXED);
+    printf("Quality: %s\n", quality_tier_names[tier]);
+    for (int i = 0; i < output_count; i++)
+        if (shaders[outputs[i].shader].quality_count) prewarm_rebuild(outputs[i].shader);
+    prewarm_neighbours(all);
+}
+
+// Move whatever the worker finished into the LRU. Returns a shader some
+// output needs for current_shader whose build failed, or -1.
+static int prewarm_collect(VkDevice device, uint64_t now) {
+    int failed = -1;
+    pthread_mutex_lock(&prewarm.lock);
+    for (int i = 0; i < prewarm.ready_len; i++) {
+        CachedPipeline *c = &prewarm.ready[i];
+        int wanted = 0;
+        for (int k = 0; k < output_count; k++) wanted |= c->shader == output_shader(k, current_shader);
+        if (c->pipeline != VK_NULL_HANDLE) lru_insert(device, *c, now);
+        else if (wanted) failed = c->shader;
+        else printf("Pre-warm failed for '%s'\n", shader_name(c->shader));
+    }
+    prewarm.ready_len = 0;
+    pthread_mutex_unlock(&prewarm.lock);
+    return failed;
+}
+
+// Copy path blit engine: each frame is copied from the readback buffer into
+// the scanout BO by the main thread and up to MAX_BLIT_WORKERS helpers, one
+// band of rows each. Readback memory may be uncached and scanout BOs are
+// write-combined, so the row copy streams past the caches: SSE4.1 streaming
+// loads (movntdqa) and non-temporal stores on x86, LDNP/STNP on AArch64.
+// The render targets are BGRA, which is XRGB8888's byte order, so only
+// RGB565 scanout needs an actual conversion, done in the same pass.
+typedef enum { BLIT_XRGB8888, BLIT_RGB565 } BlitFormat;
+
+typedef struct {
+    uint8_t *dst;
+    const uint8_t *src;
+    size_t dst_stride, src_stride;
+    uint32_t W, H;
+    BlitFormat format;
+} BlitJob;
+
+typedef void (*BlitRowFn)(uint8_t *dst, const uint8_t *src, uint32_t W, BlitFormat format);
+
+static void blit_row_plain(uint8_t *dst, const uint8_t *src, uint32_t W, BlitFormat format) {
+    if (format == BLIT_XRGB8888) {
+        memcpy(dst, src, (size_t)W * 4);
+        return;
+    }
+    for (uint32_t x = 0; x < W; x++) {
+        const uint8_t *p = src + x * 4;
+        uint16_t v = (uint16_t)((p[2] >> 3) << 11 | (p[1] >> 2) << 5 | p[0] >> 3);
+        memcpy(dst + x * 2, &v, 2);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.1")))
+static void blit_row_simd(uint8_t *dst, const uint8_t *src, uint32_t W, BlitFormat format) {
+    // Streaming accesses need 16-byte alignment, which mapped rows have
+    if (((uintptr_t)src | (uintptr_t)dst) & 15) {
+        blit_row_plain(dst, src, W, format);
+        return;
+    }
+    uint32_t x = 0;
+    if (format == BLIT_XRGB8888) {
+        for (; x + 16 <= W; x += 16) {  // One cache line per iteration
+            __m128i *s = (__m128i*)(src + x * 4), *d = (__m128i*)(dst + x * 4);
+            __m128i a = _mm_stream_load_si128(s), b = _mm_stream_load_si128(s + 1);
+            __m128i c = _mm_stream_load_si128(s + 2), e = _mm_stream_load_si128(s + 3);
+            _mm_stream_si128(d, a); _mm_stream_si128(d + 1, b);
+            _mm_stream_si128(d + 2, c); _mm_stream_si128(d + 3, e);
+        }
+    } else {
+        const __m128i r = _mm_set1_epi32(0xf800), g = _mm_set1_epi32(0x07e0), b = _mm_set1_epi32(0x001f);
+        for (; x + 8 <= W; x += 8) {
+            __m128i p[2];
+            for (int i = 0; i < 2; i++) {
+                __m128i px = _mm_stream_load_si128((__m128i*)(src + x * 4) + i);
+                p[i] = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(px, 8), r),
+                                                 _mm_and_si128(_mm_srli_epi32(px, 5), g)),
+                                    _mm_and_si128(_mm_srli_epi32(px, 3), b));
+            }
+            _mm_stream_si128((__m128i*)(dst + x * 2), _mm_packus_epi32(p[0], p[1]));
+        }
+    }
+    if (x < W) blit_row_plain(dst + x * (format == BLIT_RGB565 ? 2 : 4), src + x * 4, W - x, format);
+}
+#elif defined(__aarch64__)
+static void blit_row_simd(uint8_t *dst, const uint8_t *src, uint32_t W, BlitFormat format) {
+    uint32_t x = 0;
+    if (format == BLIT_XRGB8888) {
+        for (; x + 16 <= W; x += 16)  // One cache line per iteration
+            __asm__ volatile("ldnp q0, q1, [%0]\n\tldnp q2, q3, [%0, #32]\n\t"
+                             "stnp q0, q1, [%1]\n\tstnp q2, q3, [%1, #32]"
+                             :: "r"(src + x * 4), "r"(dst + x * 4) : "v0", "v1", "v2", "v3", "memory");
+    } else {
+        for (; x + 8 <= W; x += 8) {
+            uint8x8x4_t p = vld4_u8(src + x * 4);  // Deinterleaved B, G, R, A
+            uint16x8_t v = vshlq_n_u16(vmovl_u8(vshr_n_u8(p.val[2], 3)), 11);
+            v = vorrq_u16(v, vshlq_n_u16(vmovl_u8(vshr_n_u8(p.val[1], 2)), 5));
+            v = vorrq_u16(v, vmovl_u8(vshr_n_u8(p.val[0], 3)));
+            vst1q_u16((uint16_t*)(dst + x * 2), v);
+        }
+    }
+    if (x < W) blit_row_plain(dst + x * (format == BLIT_RGB565 ? 2 : 4), src + x * 4, W - x, format);
+}
+#endif
+
+static struct {
+    BlitRowFn row;
+    pthread_t threads[MAX_BLIT_WORKERS];
+    int count;  // Helper threads; the caller always does band 0
+    pthread_mutex_t lock;
+    pthread_cond_t wake, done;
+    BlitJob job;
+    uint64_t generation;  // Bumped for every job
+    int remaining;        // Helpers still busy with it
+    int stop;
+} blit = {.row = blit_row_plain, .lock = PTHREAD_MUTEX_INITIALIZER,
+          .wake = PTHREAD_COND_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+static void blit_band(const BlitJob *job, BlitRowFn row, int band, int bands) {
+    uint32_t y0 = job->H * band / bands, y1 = job->H * (band + 1) / bands;
+    for (uint32_t y = y0; y < y1; y++)
+        row(job->dst + y * job->dst_stride, job->src + y * job->src_stride, job->W, job->format);
+#if defined(__x86_64__) || defined(__i386__)
+    if (row != blit_row_plain) _mm_sfence();  // Non-temporal stores are weakly ordered
+#endif
+}
+
+static void *blit_worker(void *arg) {
+    int band = (int)(intptr_t)arg;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&blit.lock);
+    for (;;) {
+        while (blit.generation == seen && !blit.stop)
+            pthread_cond_wait(&blit.wake, &blit.lock);
+        if (blit.stop) break;
+        seen = blit.generation;
+        BlitJob job = blit.job;
+        pthread_mutex_unlock(&blit.lock);
+        blit_band(&job, blit.row, band, blit.count + 1);
+        pthread_mutex_lock(&blit.lock);
+        if (--blit.remaining == 0) pthread_cond_signal(&blit.done);
+    }
+    pthread_mutex_unlock(&blit.lock);
+    return NULL;
+}
+
+// threads: bands per frame, including the caller's. 0 picks half the cores,
+// since a few threads already saturate the memory bus.
+static void blit_start(int threads) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("sse4.1")) blit.row = blit_row_simd;
+#elif defined(__aarch64__)
+    blit.row = blit_row_simd;
+#endif
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores < 2 ? 1 : (int)(cores / 2);
+    }
+    int helpers = threads - 1 > MAX_BLIT_WORKERS ? MAX_BLIT_WORKERS : threads - 1;
+    for (blit.count = 0; blit.count < helpers; blit.count++)
+        if (pthread_create(&blit.threads[blit.count], NULL, blit_worker, (void*)(intptr_t)(blit.count + 1)) != 0)
+            break;
+}
+
+static void blit_stop(void) {
+    pthread_mutex_lock(&blit.lock);
+    blit.stop = 1;
+    pthread_cond_broadcast(&blit.wake);
+    pthread_mutex_unlock(&blit.lock);
+    for (int i = 0; i < blit.count; i++) pthread_join(blit.threads[i], NULL);
+    blit.count = 0;
+}
+
+static void blit_frame(const BlitJob *job) {
+    if (blit.count == 0) {
+        blit_band(job, blit.row, 0, 1);
+        return;
+    }
+    pthread_mutex_lock(&blit.lock);
+    blit.job = *job;
+    blit.generation++;
+    blit.remaining = blit.count;
+    pthread_cond_broadcast(&blit.wake);
+    pthread_mutex_unlock(&blit.lock);
+    blit_band(job, blit.row, 0, blit.count + 1);
+    pthread_mutex_lock(&blit.lock);
+    while (blit.remaining) pthread_cond_wait(&blit.done, &blit.lock);
+    pthread_mutex_unlock(&blit.lock);
+}
+
+// --bench-blit: time the plain row copy against the blit engine, single
+// threaded and with all bands, on a WxH frame in ordinary memory. Uncached
+// or write-combined mappings favour the streaming version even more.
+static int bench_blit(uint32_t W, uint32_t H, int iterations) {
+    size_t src_stride = (size_t)W * 4;
+    size_t size = (((size_t)W * 4 + 63) & ~(size_t)63) * H;
+    uint8_t *src = aligned_alloc(64, size), *dst = aligned_alloc(64, size);
+    if (!src || !dst) {
+        printf("Cannot allocate two %zu byte frames for the blit benchmark\n", size);
+        free(src);
+        free(dst);
+        return -1;
+    }
+    for (size_t i = 0; i < src_stride * H; i++) src[i] = (uint8_t)(i * 2654435761u >> 24);
+    printf("Blit benchmark: %ux%u, %d iterations, %d thread(s), %s rows\n", W, H, iterations, blit.count + 1,
+           blit.row == blit_row_plain ? "plain" : "SIMD");
+    for (int f = 0; f < 2; f++) {
+        BlitFormat format = f ? BLIT_RGB565 : BLIT_XRGB8888;
+        BlitJob job = {dst, src, ((size_t)W * (f ? 2 : 4) + 63) & ~(size_t)63, src_stride, W, H, format};
+        for (int run = 0; run < 3; run++) {
+            static const char *names[] = {"plain", "simd", "simd+threads"};
+            double start = 0;
+            for (int i = -3; i < iterations; i++) {  // 3 warm-up rounds
+                if (i == 0) start = monotonic_seconds();
+                if (run == 2) blit_frame(&job);
+                else blit_band(&job, run ? blit.row : blit_row_plain, 0, 1);
+            }
+            double ms = (monotonic_seconds() - start) * 1000.0 / iterations;
+            printf("  %-8s %-13s %7.3f ms/frame  %6.2f GB/s\n", f ? "rgb565" : "xrgb8888", names[run],
+                   ms, src_stride * H / (ms * 1e6));
+        }
+    }
+    free(src);
+    free(dst);
+    return 0;
+}
+
+// Headless: append one finished frame to the output, dropping the row padding
+static int write_frame(FILE *out, const FrameSlot *s, VkDeviceSize rowPitch, uint32_t W, uint32_t H) {
+    if (rowPitch == W * 4)
+        return fwrite(s->rtPtr, (size_t)W * 4, H, out) == H ? 0 : -1;
+    for (uint32_t y = 0; y < H; y++)
+        if (fwrite((char*)s->rtPtr + y * rowPitch, W * 4, 1, out) != 1) return -1;
+    return 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// GPU time of a retired slot from the two timestamps around its work, NAN
+// without timestamps. The slot's fence has signalled, so they are available.
+static double slot_gpu_ms(VkDevice device, VkQueryPool pool, uint32_t slot, float period) {
+    uint64_t ts[2];
+    if (pool == VK_NULL_HANDLE ||
+        vkGetQueryPoolResults(device, pool, slot * 2, 2, sizeof(ts), ts, sizeof(ts[0]),
+                              VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+        return NAN;
+    return ((ts[1] - ts[0]) & timestamp_mask) * period / 1e6;
+}
+
+// --bench: store the timings of a retired measured frame
+static void bench_record(double gpu_ms, double cpu_ms, double copy_ms, double present_ms) {
+    int i = bench.collected++;
+    bench.samples[STAGE_GPU][i] = gpu_ms;
+    bench.samples[STAGE_CPU][i] = cpu_ms;
+    bench.samples[STAGE_COPY][i] = copy_ms;
+    bench.samples[STAGE_PRESENT][i] = present_ms;
+}
+
+// --bench: write the current shader's row (empty fields if it failed to
+// build) and move on to the next one, or quit after the last. Shaders with
+// tunables get a row per quality tier, low to ultra, and the highest tier
+// that fits the --target-fps budget is printed.
+static void bench_next_shader(int failed) {
+    int tiered = shaders[bench.shader].quality_count != 0, tier = quality_tier();
+    double gpu_ms = NAN;
+    fprintf(bench.csv, "%s", shader_name(bench.shader));
+    printf(tiered ? "Bench %s (%s):" : "Bench %s:", shader_name(bench.shader), quality_tier_names[tier]);
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        double *v = bench.samples[s];
+        int n = bench.collected;
+        qsort(v, n, sizeof(double), compare_doubles);
+        if (failed || n == 0 || isnan(v[0])) {
+            fprintf(bench.csv, ",,,");
+            continue;
+        }
+        fprintf(bench.csv, ",%.4f,%.4f,%.4f", v[0], v[n / 2], v[(int)ceil(0.99 * n) - 1]);
+        printf(" %s %.3f", stage_names[s], v[n / 2]);
+        if (s == STAGE_GPU) gpu_ms = v[n / 2];
+    }
+    fprintf(bench.csv, ",%s\n", tiered ? quality_tier_names[tier] : "");
+    fflush(bench.csv);
+    printf(failed ? " failed to build\n" : " ms (median)\n");
+
+    bench.submitted = 0;
+    bench.collected = 0;
+    if (tiered) {
+        bench.tier_ms[tier] = failed ? NAN : gpu_ms;
+        if (!failed && tier < QUALITY_ULTRA) {
+            // Same shader, next tier: measured once its variant is bound
+            set_quality_tier(tier + 1, 0);
+            reload_requested = 1;
+            return;
+        }
+        int best = -1;
+        for (int t = 0; t <= tier; t++)
+            if (bench.tier_ms[t] <= bench.budget_ms) best = t;
+        if (best >= 0)
+            printf("Bench %s: --quality %s fits %.2f ms\n", shader_name(bench.shader), quality_tier_names[best],
+                   bench.budget_ms);
+        else
+            printf("Bench %s: no quality tier fits %.2f ms\n", shader_name(bench.shader), bench.budget_ms);
+        set_quality_tier(QUALITY_LOW, 0);
+    }
+    if (++bench.shader < shader_count) {
+        current_shader = bench.shader;
+        reload_requested = 1;
+    } else {
+        quit_requested = 1;
+    }
+}
+
+// --telemetry: per-stage frame timings, served as text on a Unix socket so
+// a scraper gets quantiles without a profiler attached. Each stage keeps a
+// log-linear histogram of microseconds (HdrHistogram-style: exact below
+// 64, then 32 buckets per power of two, about 3% wide). Only the main
+// thread writes, so plain atomic stores suffice and the loop never takes a
+// lock; the server thread reads whatever is there. Quantiles cover the
+// current and the previous TELEMETRY_WINDOW, count/sum/max all of the run.
+// A fence wait still in progress is exported as a gauge, since its sample
+// only lands once the wait returns: a hung GPU shows up while it hangs.
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS ((33 - HIST_SUB_BITS) << HIST_SUB_BITS)
+#define TELEMETRY_WINDOW 60.0  // Seconds
+
+enum { TM_FENCE, TM_COPY, TM_PRESENT, TM_RECORD, TM_GPU, TM_FRAME, TM_RELOAD, TM_COUNT };
+static const char *telemetry_names[TM_COUNT] = {
+    "fence", "copy", "present", "record", "gpu", "frame", "reload"};
+
+typedef struct {
+    uint64_t buckets[2][HIST_BUCKETS];
+    uint64_t count, sum_us, max_us;
+} StageHistogram;
+
+static struct {
+    int fd;              // Listening socket, -1 without --telemetry
+    const char *path;
+    pthread_t thread;
+    int stopping;        // Set by telemetry_stop() before it shuts the socket down
+    int window;          // buckets[] being filled
+    double window_start;
+    double last_frame;   // First output's previous submit, for TM_FRAME
+    uint64_t fence_since_us;  // Start of the fence wait in progress (monotonic), 0 when none
+    StageHistogram stages[TM_COUNT];
+} telemetry = {.fd = -1};
+
+static int hist_bucket(uint32_t us) {
+    if (us < 2u << HIST_SUB_BITS) return us;
+    int shift = 31 - __builtin_clz(us) - HIST_SUB_BITS;
+    return (shift << HIST_SUB_BITS) + (us >> shift);
+}
+
+// Highest value that lands in the bucket
+static uint64_t hist_value(int bucket) {
+    if (bucket < 2 << HIST_SUB_BITS) return bucket;
+    int shift = (bucket >> HIST_SUB_BITS) - 1;
+    return ((uint64_t)(bucket - (shift << HIST_SUB_BITS)) << shift) + (1ull << shift) - 1;
+}
+
+static void counter_set(uint64_t *c, uint64_t v) {
+    __atomic_store_n(c, v, __ATOMIC_RELAXED);
+}
+
+static void telemetry_record(int stage, double ms) {
+    if (telemetry.fd < 0 || !(ms >= 0)) return;
+    StageHistogram *h = &telemetry.stages[stage];
+    uint32_t us = ms * 1000.0 >= UINT32_MAX ? UINT32_MAX : (uint32_t)(ms * 1000.0 + 0.5);
+    uint64_t *b = &h->buckets[telemetry.window][hist_bucket(us)];
+    counter_set(b, *b + 1);
+    counter_set(&h->count, h->count + 1);
+    counter_set(&h->sum_us, h->sum_us + us);
+    if (us > h->max_us) counter_set(&h->max_us, us);
+}
+
+// Around the loop's fence wait, for the in-progress gauge
+static void telemetry_wait(int waiting) {
+    if (telemetry.fd < 0) return;
+    counter_set(&telemetry.fence_since_us, waiting ? (uint64_t)(monotonic_seconds() * 1e6) : 0);
+}
+
+// Once per loop: retire the older window when the current one is full
+static void telemetry_tick(double now) {
+    if (telemetry.fd < 0 || now - telemetry.window_start < TELEMETRY_WINDOW) return;
+    int older = telemetry.window ^ 1;
+    for (int s = 0; s < TM_COUNT; s++)
+        for (int i = 0; i < HIST_BUCKETS; i++) counter_set(&telemetry.stages[s].buckets[older][i], 0);
+    __atomic_store_n(&telemetry.window, older, __ATOMIC_RELEASE);
+    telemetry.window_start = now;
+}
+
+// Prometheus text format, one summary per stage
+static size_t telemetry_report(char *out, size_t len) {
+    static const double quantiles[] = {0.5, 0.99, 0.999};
+    static uint64_t merged[HIST_BUCKETS];
+    size_t n = snprintf(out, len, "# TYPE metalshader_stage_ms summary\n");
+    for (int s = 0; s < TM_COUNT && n < len; s++) {
+        const StageHistogram *h = &telemetry.stages[s];
+        uint64_t total = 0, max_us = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            merged[i] = __atomic_load_n(&h->buckets[0][i], __ATOMIC_RELAXED) +
+                        __atomic_load_n(&h->buckets[1][i], __ATOMIC_RELAXED);
+            total += merged[i];
+        }
+        for (int q = 0; q < 3 && n < len; q++) {
+            uint64_t rank = (uint64_t)ceil(quantiles[q] * total), seen = 0;
+            int i = 0;
+            while (i < HIST_BUCKETS - 1 && (seen += merged[i]) < rank) i++;
+            if (total) n += snprintf(out + n, len - n, "metalshader_stage_ms{stage=\"%s\",quantile=\"%g\"} %.3f\n",
+                                     telemetry_names[s], quantiles[q], (hist_value(i) < max_us ? hist_value(i) : max_us) / 1000.0);
+            else n += snprintf(out + n, len - n, "metalshader_stage_ms{stage=\"%s\",quantile=\"%g\"} NaN\n",
+                               telemetry_names[s], quantiles[q]);
+        }
+        if (n >= len) break;
+        n += snprintf(out + n, len - n,
+                      "metalshader_stage_ms_sum{stage=\"%s\"} %.3f\n"
+                      "metalshader_stage_ms_count{stage=\"%s\"} %llu\n"
+                      "metalshader_stage_ms_max{stage=\"%s\"} %.3f\n",
+                      telemetry_names[s], __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED) / 1000.0,
+                      telemetry_names[s], (unsigned long long)__atomic_load_n(&h->count, __ATOMIC_RELAXED),
+                      telemetry_names[s], max_us / 1000.0);
+    }
+    uint64_t since = __atomic_load_n(&telemetry.fence_since_us, __ATOMIC_RELAXED);
+    uint64_t now_us = (uint64_t)(monotonic_seconds() * 1e6);
+    if (n < len)
+        n += snprintf(out + n, len - n, "# TYPE metalshader_fence_waiting_ms gauge\nmetalshader_fence_waiting_ms %.3f\n",
+                      since && now_us > since ? (now_us - since) / 1000.0 : 0.0);
+    return n < len ? n : len;
+}
+
+// One report per connection, then close: `socat - UNIX-CONNECT:<path>`
+static void *telemetry_server(void *arg) {
+    (void)arg;
+    static char report[8192];
+    for (;;) {
+        int client = accept(telemetry.fd, NULL, NULL);
+        if (client < 0) {
+            if (__atomic_load_n(&telemetry.stopping, __ATOMIC_ACQUIRE)) break;
+            // EMFILE, ECONNABORTED and the like pass: back off, keep serving
+            if (errno != EINTR) nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+            continue;
+        }
+        size_t len = telemetry_report(report, sizeof(report)), sent = 0;
+        ssize_t w;
+        while (sent < len && (w = send(client, report + sent, len - sent, MSG_NOSIGNAL)) > 0) sent += w;
+        close(client);
+    }
+    return NULL;
+}
+
+static int telemetry_start(const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    unlink(path);  // A previous run's socket
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        close(fd);
+        return -1;
+    }
+    telemetry.fd = fd;
+    telemetry.path = path;
+    telemetry.window_start = monotonic_seconds();
+    if (pthread_create(&telemetry.thread, NULL, telemetry_server, NULL) != 0) {
+        close(fd);
+        unlink(path);
+        telemetry.fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+// Shutting the socket down wakes the server out of accept()
+static void telemetry_stop(void) {
+    if (telemetry.fd < 0) return;
+    __atomic_store_n(&telemetry.stopping, 1, __ATOMIC_RELEASE);
+    shutdown(telemetry.fd, SHUT_RDWR);
+    pthread_join(telemetry.thread, NULL);
+    close(telemetry.fd);
+    unlink(telemetry.path);
+    telemetry.fd = -1;
+}
+
+// --scale auto: step the render scale towards the target GPU time. Pixel
+// count, and roughly GPU time, goes with the square of the scale. Steps are
+// limited and quantized so the resolution doesn't hunt.
+static float adjust_render_scale(float scale, double gpu_ms, double target_ms) {
+    if (!(gpu_ms > 0) || (gpu_ms < target_ms && gpu_ms > 0.85 * target_ms)) return scale;
+    float next = scale * sqrtf(target_ms / gpu_ms);
+    if (next < scale * 0.8f) next = scale * 0.8f;
+    if (next > scale * 1.1f) next = scale * 1.1f;
+    next = roundf(next * 32.0f) / 32.0f;
+    if (next < MIN_RENDER_SCALE) next = MIN_RENDER_SCALE;
+    if (next > 1.0f) next = 1.0f;
+    return next;
+}
+
+// --quality auto: one tier down when GPU time is over the target, one up
+// when it is under half of it, since a tier may well double the cost. With
+// --scale auto the scale moves first: tiers change only once it is at its
+// floor (down) or back at 1 (up). After a change, QUALITY_HOLD windows are
+// skipped while the new variants are built and bound.
+static void adjust_quality(double gpu_ms, double target_ms, int can_lower, int can_raise, int prewarm_all) {
+    int tunable = 0;
+    for (int i = 0; i < output_count; i++) tunable |= shaders[outputs[i].shader].quality_count != 0;
+    if (quality.hold > 0) {
+        quality.hold--;
+        return;
+    }
+    if (!tunable || !(gpu_ms > 0)) return;
+    int tier = quality.tier;
+    if (gpu_ms > target_ms && can_lower && tier > QUALITY_LOW) tier--;
+    else if (gpu_ms < 0.5 * target_ms && can_raise && tier < QUALITY_ULTRA) tier++;
+    if (tier == quality.tier) return;
+    set_quality_tier(tier, prewarm_all);
+    quality.hold = QUALITY_HOLD;
+}
+
+// Multipass render graph: a shader's Buffer A-D passes render into the
+// output's RGBA16F ping-pong targets ahead of its Image pass, each reading
+// the others (or itself, a frame behind) as iChannel0-3. Set up by main.
+static struct {
+    int enabled;                 // Not with --compute, --split-frame, --scale or spanned outputs
+    VkDevice device;
+    VkRenderPass renderPass;     // Buffer passes: one RGBA16F attachment, kept in COLOR_ATTACHMENT_OPTIMAL
+    VkSampler sampler;           // Of the textures: mipmapped, repeating
+    VkSampler bufferSampler;     // Of the buffers, clamped at the edges as in ShaderToy
+} multipass;
+
+// Descriptor bindings of iChannel0-3 (binding 2 is the compute backend's output)
+static const uint32_t channel_bindings[4] = {1, 3, 4, 5};
+
+// Stage and access an image is used with in a layout. Buffers are only
+// ever cleared, drawn into or sampled by fragment shaders.
+static VkPipelineStageFlags pass_stage(VkImageLayout layout) {
+    return layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL ? VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT :
+           layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL ? VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT :
+           layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL ? VK_PIPELINE_STAGE_TRANSFER_BIT :
+           VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+}
+
+static VkAccessFlags pass_access(VkImageLayout layout) {
+    return layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL ? VK_ACCESS_SHADER_READ_BIT :
+           layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT :
+           layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+}
+
+// Bring `count` images into the layouts they are used in next, with one
+// barrier for all of them. Reads wait for the write before them, writes
+// for every use before them; the old contents of an image about to be
+// overwritten are discarded. Images already readable are left alone.
+static void pass_barriers(VkCommandBuffer cmd, PassImage **images, const VkImageLayout *layouts, int count) {
+    VkImageMemoryBarrier barriers[2 * BUFFER_PASSES];
+    VkPipelineStageFlags src = 0, dst = 0;
+    int n = 0;
+    for (int i = 0; i < count; i++) {
+        PassImage *img = images[i];
+        int write = layouts[i] != VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        if (!write && img->layout == layouts[i]) continue;
+        src |= pass_stage(img->layout);
+        dst |= pass_stage(layouts[i]);
+        barriers[n++] = (VkImageMemoryBarrier){
+            .sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask=img->layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL ? 0 : pass_access(img->layout),
+            .dstAccessMask=pass_access(layouts[i]),
+            .oldLayout=write ? VK_IMAGE_LAYOUT_UNDEFINED : img->layout,.newLayout=layouts[i],
+            .srcQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,.dstQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,
+            .image=img->image,.subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+        };
+        img->layout = layouts[i];
+    }
+    if (n) vkCmdPipelineBarrier(cmd, src, dst, 0, 0, NULL, 0, NULL, n, barriers);
+}
+
+// The image `pass` reads on `channel`, or NULL for a texture. Buffers
+// rendered before the pass hold this frame's result, the rest (the pass's
+// own buffer included) the previous frame's.
+static PassImage *channel_image(Output *o, const ShaderInfo *info, int pass, int channel) {
+    int b = info->channels[pass][channel];
+    if (!multipass.enabled || b == CHANNEL_TEXTURE || !(info->buffers & (1u << b))) return NULL;
+    return &o->graph.images[b][(o->graph.frame + (b >= pass)) & 1];
+}
+
+// Point a pass's iChannel0-3 at `images`, or where that is NULL at the
+// shader's texture for the channel. Only what changed is written; the
+// slot's previous frame has finished with the set.
+static int bind_channels(VkDescriptorSet set, VkImageView bound[4], PassImage **images, int shader, int pass) {
+    VkWriteDescriptorSet writes[4];
+    VkDescriptorImageInfo infos[4];
+    int n = 0;
+    for (int c = 0; c < 4; c++) {
+        VkImageView view = images[c] ? images[c]->view : texture_view(shader, shaders[shader].channels[pass][c]);
+        if (view == bound[c]) continue;
+        bound[c] = view;
+        infos[n] = (VkDescriptorImageInfo){images[c] ? multipass.bufferSampler : multipass.sampler,
+                                           view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        writes[n] = (VkWriteDescriptorSet){
+            .sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet=set,.dstBinding=channel_bindings[c],.descriptorCount=1,
+            .descriptorType=VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,.pImageInfo=&infos[n]
+        };
+        n++;
+    }
+    if (n) vkUpdateDescriptorSets(multipass.device, n, writes, 0, NULL);
+    return n;
+}
+
+// Single-pass shaders: bind the Image pass's channels ahead of recording.
+// Nonzero if the set changed, which invalidates the slot's recording.
+static int bind_image_channels(FrameSlot *s, int shader) {
+    PassImage *none[4] = {NULL};
+    return bind_channels(s->descSet, s->channelViews[IMAGE_PASS], none, shader, IMAGE_PASS);
+}
+
+// Create the output's ping-pong images for the buffers in `mask` that
+// don't exist yet. Like ShaderToy's, buffers start out zeroed.
+static void create_pass_targets(Output *o, uint32_t mask) {
+    for (int k = 0; k < BUFFER_PASSES; k++) {
+        if (!(mask & (1u << k)) || (o->graph.created & (1u << k))) continue;
+        for (int i = 0; i < 2; i++) {
+            PassImage *img = &o->graph.images[k][i];
+            VK_CHECK(vkCreateImage(multipass.device, &(VkImageCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                .imageType=VK_IMAGE_TYPE_2D,.format=VK_FORMAT_R16G16B16A16_SFLOAT,
+                .extent={o->W,o->H,1},.mipLevels=1,.arrayLayers=1,
+                .samples=VK_SAMPLE_COUNT_1_BIT,.tiling=VK_IMAGE_TILING_OPTIMAL,
+                .usage=VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT|VK_IMAGE_USAGE_SAMPLED_BIT|VK_IMAGE_USAGE_TRANSFER_DST_BIT
+            }, NULL, &img->image));
+            memory_bind_image(img->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            VK_CHECK(vkCreateImageView(multipass.device, &(VkImageViewCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                .image=img->image,.viewType=VK_IMAGE_VIEW_TYPE_2D,
+                .format=VK_FORMAT_R16G16B16A16_SFLOAT,
+                .subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+            }, NULL, &img->view));
+            VK_CHECK(vkCreateFramebuffer(multipass.device, &(VkFramebufferCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+                .renderPass=multipass.renderPass,.attachmentCount=1,.pAttachments=&img->view,
+                .width=o->W,.height=o->H,.layers=1
+            }, NULL, &img->framebuffer));
+            img->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+        o->graph.created |= 1u << k;
+        o->graph.clear = 1;
+    }
+}
+
+// Record the passes leading up to the Image pass and wire every pass's
+// channels: zero the buffers if this is a fresh start, then Buffer A-D in
+// order, each after the barriers its reads and its write need. Leaves the
+// Image pass's channels bound to slot->descSet and readable.
+static void record_buffer_passes(VkCommandBuffer cmd, Output *o, FrameSlot *s, const CachedPipeline *c,
+                                 VkPipelineLayout layout) {
+    const ShaderInfo *info = &shaders[c->shader];
+    uint32_t mask = multipass.enabled ? info->buffers : 0;
+    create_pass_targets(o, mask);
+    if (mask && o->graph.clear) {
+        PassImage *all[2 * BUFFER_PASSES];
+        VkImageLayout layouts[2 * BUFFER_PASSES];
+        int n = 0;
+        for (int k = 0; k < BUFFER_PASSES; k++)
+            for (int i = 0; i < 2 && (o->graph.created & (1u << k)); i++) {
+                all[n] = &o->graph.images[k][i];
+                layouts[n++] = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            }
+        pass_barriers(cmd, all, layouts, n);
+        for (int i = 0; i < n; i++)
+            vkCmdClearColorImage(cmd, all[i]->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                 &(VkClearColorValue){.float32={0,0,0,0}}, 1,
+                                 &(VkImageSubresourceRange){VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1});
+        o->graph.clear = 0;
+    }
+
+    for (int p = 0; p < PASS_COUNT; p++) {
+        if (p < BUFFER_PASSES && !(mask & (1u << p))) continue;
+        PassImage *reads[4], *use[5];
+        VkImageLayout layouts[5];
+        int n = 0;
+        for (int ch = 0; ch < 4; ch++) {
+            reads[ch] = channel_image(o, info, p, ch);
+            if (!reads[ch]) continue;
+            use[n] = reads[ch];
+            layouts[n++] = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+        PassImage *target = p < BUFFER_PASSES ? &o->graph.images[p][o->graph.frame & 1] : NULL;
+        if (target) {
+            use[n] = target;
+            layouts[n++] = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        }
+        pass_barriers(cmd, use, layouts, n);
+        VkDescriptorSet set = target ? s->passSets[p] : s->descSet;
+        bind_channels(set, s->channelViews[p], reads, c->shader, p);
+        if (!target) break;
+
+        vkCmdBeginRenderPass(cmd, &(VkRenderPassBeginInfo){
+            .sType=VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+            .renderPass=multipass.renderPass,.framebuffer=target->framebuffer,
+            .renderArea={{0,0},{o->W,o->H}},.clearValueCount=1,
+            .pClearValues=&(VkClearValue){.color={.float32={0,0,0,0}}}
+        }, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdSetViewport(cmd, 0, 1, &(VkViewport){0, 0, o->W, o->H, 0, 1});
+        vkCmdSetScissor(cmd, 0, 1, &(VkRect2D){{0,0},{o->W,o->H}});
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, c->buffers[p]);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &set, 1, &s->uboOffset);
+        vkCmdDraw(cmd, 6, 1, 0, 0);
+        vkCmdEndRenderPass(cmd);
+    }
+    if (mask) o->graph.frame++;
+}
+
+// Render scale < 1: stretch the rw x rh corner of the offscreen target over
+// the whole W x H render target. Zero-copy images were already put in
+// GENERAL by the ownership barrier; the copy path discards the old contents.
+static void upscale_blit(VkCommandBuffer cmd, const FrameSlot *s, uint32_t rw, uint32_t rh,
+                         uint32_t W, uint32_t H, int zero_copy) {
+    VkImageMemoryBarrier barriers[2] = {
+        {.sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+         .srcAccessMask=VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,.dstAccessMask=VK_ACCESS_TRANSFER_READ_BIT,
+         .oldLayout=VK_IMAGE_LAYOUT_GENERAL,.newLayout=VK_IMAGE_LAYOUT_GENERAL,
+         .srcQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,.dstQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,
+         .image=s->lowImg,.subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}},
+        {.sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+         .dstAccessMask=VK_ACCESS_TRANSFER_WRITE_BIT,
+         .oldLayout=zero_copy ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_UNDEFINED,
+         .newLayout=VK_IMAGE_LAYOUT_GENERAL,
+         .srcQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,.dstQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,
+         .image=s->rtImg,.subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}}
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, NULL, 0, NULL, 2, barriers);
+    vkCmdBlitImage(cmd, s->lowImg, VK_IMAGE_LAYOUT_GENERAL, s->rtImg, VK_IMAGE_LAYOUT_GENERAL, 1,
+        &(VkImageBlit){
+            .srcSubresource={VK_IMAGE_ASPECT_COLOR_BIT,0,0,1},
+            .srcOffsets={{0,0,0},{(int32_t)rw,(int32_t)rh,1}},
+            .dstSubresource={VK_IMAGE_ASPECT_COLOR_BIT,0,0,1},
+            .dstOffsets={{0,0,0},{(int32_t)W,(int32_t)H,1}}
+        }, VK_FILTER_LINEAR);
+}
+
+// Copy path: copy the finished frame into the slot's host-visible readback
+// buffer, where the CPU picks it up once the fence has signalled. Split
+// frame: each GPU copies the band it rendered, out of its own instance of
+// the render target. after_render: the frame was recorded into cmd just
+// before; on the transfer queue the render's semaphore orders the copy.
+static void readback_copy(VkCommandBuffer cmd, const FrameSlot *s, uint32_t W,
+                          const VkRect2D *bands, uint32_t count, int after_render) {
+    if (after_render)
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT|VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT|
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, NULL, 0, NULL, 1, &(VkImageMemoryBarrier){
+                .sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                .srcAccessMask=VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT|VK_ACCESS_SHADER_WRITE_BIT|VK_ACCESS_TRANSFER_WRITE_BIT,
+                .dstAccessMask=VK_ACCESS_TRANSFER_READ_BIT,
+                .oldLayout=VK_IMAGE_LAYOUT_GENERAL,.newLayout=VK_IMAGE_LAYOUT_GENERAL,
+                .srcQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,.dstQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,
+                .image=s->rtImg,.subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+            });
+    for (uint32_t k = 0; k < count; k++) {
+        if (count > 1) vkCmdSetDeviceMask(cmd, 1u << k);
+        vkCmdCopyImageToBuffer(cmd, s->rtImg, VK_IMAGE_LAYOUT_GENERAL, s->readBuf, 1, &(VkBufferImageCopy){
+            .bufferOffset=((VkDeviceSize)bands[k].offset.y * W + bands[k].offset.x) * 4,
+            .bufferRowLength=W,
+            .imageSubresource={VK_IMAGE_ASPECT_COLOR_BIT,0,0,1},
+            .imageOffset={bands[k].offset.x,bands[k].offset.y,0},
+            .imageExtent={bands[k].extent.width,bands[k].extent.height,1}
+        });
+    }
+    if (count > 1) vkCmdSetDeviceMask(cmd, (1u << count) - 1);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+        1, &(VkMemoryBarrier){
+            .sType=VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask=VK_ACCESS_TRANSFER_WRITE_BIT,.dstAccessMask=VK_ACCESS_HOST_READ_BIT
+        }, 0, NULL, 0, NULL);
+}
+
+// Find QEMU display control port dynamically
+static const char *find_display_port() {
+    static char port_path[64] = {0};
+    if (port_path[0]) return port_path;  // Cached
+
+    // Search for org.qemu.display port
+    for (int i = 0; i < 10; i++) {
+        char name_path[128];
+        snprintf(name_path, sizeof(name_path), "/sys/class/virtio-ports/vport%dp1/name", i);
+        FILE *f = fopen(name_path, "r");
+        if (f) {
+            char name[64];
+            if (fgets(name, sizeof(name), f)) {
+                if (strstr(name, "org.qemu.display")) {
+                    snprintf(port_path, sizeof(port_path), "/dev/vport%dp1", i);
+                    fclose(f);
+                    return port_path;
+                }
+            }
+            fclose(f);
+        }
+    }
+    return NULL;
+}
+
+// Append a string to the catalog arena, returning its offset
+static uint32_t arena_add(const char *s, size_t len) {
+    pthread_mutex_lock(&arena_lock);
+    if (arena_len + len + 1 > arena_cap) {
+        arena_cap = arena_cap ? arena_cap * 2 : 64 * 1024;
+        while (arena_len + len + 1 > arena_cap) arena_cap *= 2;
+        shader_arena = realloc(shader_arena, arena_cap);
+    }
+    uint32_t offset = arena_len;
+    memcpy(shader_arena + offset, s, len);
+    shader_arena[offset + len] = '\0';
+    arena_len += len + 1;
+    pthread_mutex_unlock(&arena_lock);
+    return offset;
+}
+
+// FNV-1a, for the name index
+static uint32_t hash_name(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+// Order by name; the same name in several directories keeps search order,
+// since directory strings enter the arena in that order
+static int compare_shaders(const void *a, const void *b) {
+    const ShaderInfo *x = a, *y = b;
+    int c = strcmp(arena_str(x->name), arena_str(y->name));
+    return c ? c : (x->dir > y->dir) - (x->dir < y->dir);
+}
+
+static void build_shader_index(void) {
+    uint32_t size = 16;
+    while (size < 2u * shader_count) size <<= 1;
+    free(shader_index);
+    shader_index = malloc(size * sizeof(int));
+    memset(shader_index, 0xff, size * sizeof(int));
+    shader_index_mask = size - 1;
+    for (int i = 0; i < shader_count; i++) {
+        uint32_t h = hash_name(shader_name(i)) & shader_index_mask;
+        while (shader_index[h] >= 0) h = (h + 1) & shader_index_mask;
+        shader_index[h] = i;
+    }
+}
+
+// Scan shaders directory and build list
+// One search directory's .frag sources, filled by its own scan thread
+typedef struct {
+    ShaderInfo info;
+    int needs_build;  // SPIR-V missing, or older than the .frag
+    double build_ms;  // --compile: build time, negative if it failed
+} ScanEntry;
+
+typedef struct {
+    uint32_t dir;      // Arena offset
+    const char *path;  // Its search_dirs[] entry: the arena may move under other scan threads
+    ScanEntry *entries;
+    int count, cap;
+} DirScan;
+
+// Fragment wrapper and vertex shader: copies of wrap_glsl() and
+// generate_fullscreen_vertex_shader() in src/shader_compiler.rs, so change
+// both together. Only this viewer has the UBO's later fields and iChannel1-3.
+// The wrapper is followed by the iChannel declarations, see
+// channel_declarations, then `#line 1`, the source and frag_wrapper_tail,
+// whose main() copies the UBO into the plain names (the block keeps its
+// `ubo` name for sources that use it). Binding 2 is the compute backend's
+// output image.
+static const char frag_wrapper[] =
+    "#version 450\n\n"
+    "layout(location = 0) in vec2 fragCoord;\n"
+    "layout(location = 0) out vec4 fragColor;\n\n"
+    "layout(binding = 0, set = 0) uniform UniformBufferObject {\n"
+    "    vec3 iResolution;\n"
+    "    float iTime;\n"
+    "    vec4 iMouse;\n"
+    "    float iTimeDelta;\n"
+    "    int iFrame;\n"
+    "    vec4 iDate;\n"
+    "} ubo;\n\n"
+    "vec3 iResolution;\n"
+    "float iTime;\n"
+    "float iTimeDelta;\n"
+    "int iFrame;\n"
+    "vec4 iMouse;\n"
+    "vec4 iDate;\n\n";
+static const char frag_wrapper_tail[] =
+    "\n#undef main\n"
+    "void main() {\n"
+    "    iResolution = ubo.iResolution;\n"
+    "    iTime = ubo.iTime;\n"
+    "    iTimeDelta = ubo.iTimeDelta;\n"
+    "    iFrame = ubo.iFrame;\n"
+    "    iMouse = ubo.iMouse;\n"
+    "    iDate = ubo.iDate;\n"
+    "    shadertoy_main();\n"
+    "}\n";
+static const char fullscreen_vert[] =
+    "#version 450\n\n"
+    "layout(location = 0) out vec2 fragCoord;\n\n"
+    "layout(binding = 0, set = 0) uniform UniformBufferObject {\n"
+    "    vec3 iResolution;\n"
+    "    float iTime;\n"
+    "    vec4 iMouse;\n"
+    "} ubo;\n\n"
+    "void main() {\n"
+    "    vec2 positions[6] = vec2[](\n"
+    "        vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),\n"
+    "        vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0)\n"
+    "    );\n"
+    "    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);\n"
+    "    fragCoord = (positions[gl_VertexIndex] * 0.5 + 0.5) * ubo.iResolution.xy;\n"
+    "}\n";
+
+extern char **environ;
+static pthread_mutex_t build_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Missing SPIR-V counts as older than any source
+static int spirv_stale(int dfd, const char *spv, const struct stat *src) {
+    struct stat st;
+    if (fstatat(dfd, spv, &st, 0) != 0) return 1;
+    return st.st_mtim.tv_sec < src->st_mtim.tv_sec ||
+           (st.st_mtim.tv_sec == src->st_mtim.tv_sec && st.st_mtim.tv_nsec < src->st_mtim.tv_nsec);
+}
+
+// Buffer named in a .channels file, bufa-bufd, or -1
+static int buffer_by_name(const char *s) {
+    if (strncmp(s, "buf", 3) == 0 && s[3] >= 'a' && s[3] < 'a' + BUFFER_PASSES && s[4] == '\0')
+        return s[3] - 'a';
+    return -1;
+}
+
+// <name><ext> next to a shader, for reading; dfd < 0 reads the bundle's copy
+static FILE *open_sidecar(int dfd, const char *name, const char *ext) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s%s", name, ext);
+    size_t size = 0;
+    const void *bundled = dfd < 0 ? bundle_find(path, &size) : NULL;
+    if (bundled) return size ? fmemopen((void*)bundled, size, "r") : NULL;
+    int fd = dfd < 0 ? -1 : openat(dfd, path, O_RDONLY | O_CLOEXEC);
+    FILE *f = fd >= 0 ? fdopen(fd, "r") : NULL;
+    if (!f && fd >= 0) close(fd);
+    return f;
+}
+
+// Channel wiring. By default iChannel k reads Buffer A+k in every pass, the
+// checkerboard where the shader has no such buffer. <name>.channels
+// overrides that per pass, one line each, e.g. a feedback buffer that the
+// Image pass reads along with the checkerboard and a texture file (a name
+// with a '.', relative to the shader's directory). '#' starts a comment:
+//   bufa: bufa                        # feedback
+//   image: bufa tex textures/rock.png
+static void load_channels(int dfd, const char *name, ShaderInfo *info) {
+    for (int p = 0; p < PASS_COUNT; p++)
+        for (int c = 0; c < 4; c++) info->channels[p][c] = c;
+    FILE *f = open_sidecar(dfd, name, ".channels");
+    if (!f) return;
+    // The arena may move under other scan threads, so names are compared here
+    char line[512], pass[16], ch[4][100], files[SHADER_TEXTURES][100];
+    while (fgets(line, sizeof(line), f)) {
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+        int n = sscanf(line, " %15[a-z] : %99s %99s %99s %99s", pass, ch[0], ch[1], ch[2], ch[3]);
+        int p = n < 1 ? -1 : strcmp(pass, "image") == 0 ? IMAGE_PASS : buffer_by_name(pass);
+        if (p < 0) continue;
+        // Unlisted channels and anything but a buffer or a file ("tex") read
+        // the checkerboard
+        for (int c = 0; c < 4; c++) {
+            int source = c < n - 1 ? buffer_by_name(ch[c]) : -1;
+            if (source < 0 && c < n - 1 && strchr(ch[c], '.')) {
+                int j = 0;
+                while (j < info->texture_count && strcmp(files[j], ch[c]) != 0) j++;
+                if (j == info->texture_count && j < SHADER_TEXTURES) {
+                    memcpy(files[j], ch[c], sizeof(files[j]));
+                    info->textures[j] = arena_add(ch[c], strlen(ch[c]));
+                    info->texture_kinds[j] = texture_file_kind(dfd, ch[c]);
+                    info->texture_count++;
+                }
+                if (j < info->texture_count) source = CHANNEL_FILE + j;
+            }
+            info->channels[p][c] = source >= 0 ? source : CHANNEL_TEXTURE;
+        }
+    }
+    fclose(f);
+}
+
+// Quality tunables: <name>.quality lists, one per line, a specialization
+// constant the shader declares and its value per tier, low to ultra (the
+// last value given repeats):
+//   MAX_ITER: 32 64 128 256
+//   AA: 1 1 2
+//   STEP: 0.05 0.02 0.01 0.005
+// Pipelines get the current tier's values. The shader declares them as it
+// likes (matched by name, see quality_specialization); --compile's wrapper
+// declares them itself, at constant_id QUALITY_CONSTANT_ID onwards in file
+// order, ultra values as defaults, float if any value has a fraction.
+static void load_quality(int dfd, const char *name, ShaderInfo *info) {
+    FILE *f = open_sidecar(dfd, name, ".quality");
+    if (!f) return;
+    char line[512], constant[64];
+    while (fgets(line, sizeof(line), f) && info->quality_count < QUALITY_CONSTANTS) {
+        int n = 0;
+        if (sscanf(line, " %63[A-Za-z0-9_] : %n", constant, &n) != 1 || n == 0) continue;
+        int k = info->quality_count, tiers = 0;
+        char *p = line + n, *end;
+        for (; tiers < QUALITY_TIERS; tiers++, p = end) {
+            float v = strtof(p, &end);
+            if (end == p) break;
+            info->quality_values[k][tiers] = v;
+            if (v != floorf(v)) info->quality_float |= 1u << k;
+        }
+        if (tiers == 0) continue;
+        for (; tiers < QUALITY_TIERS; tiers++) info->quality_values[k][tiers] = info->quality_values[k][tiers - 1];
+        info->quality_names[k] = arena_add(constant, strlen(constant));
+        info->quality_count++;
+    }
+    fclose(f);
+}
+
+static void *scan_shaders(void *arg) {
+    DirScan *scan = arg;
+    DIR *dir = opendir(scan->path);
+    if (!dir) {
+        return NULL;
+    }
+    int dfd = dirfd(dir);
+
+    // Names relative to dfd, so each check is one fstatat without path walks
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) continue;
+
+        char *ext = strrchr(entry->d_name, '.');
+        if (!ext || strcmp(ext, ".frag") != 0) continue;
+
+        // Extract base name (remove .frag extension). Buffer passes are
+        // picked up with the shader they belong to.
+        size_t base_len = ext - entry->d_name;
+        char name[256];
+        if (base_len >= sizeof(name) || pass_base_len(entry->d_name, base_len) != base_len) continue;
+
+        struct stat src;
+        if (fstatat(dfd, entry->d_name, &src, 0) != 0 || !S_ISREG(src.st_mode)) continue;
+
+        memcpy(name, entry->d_name, base_len);
+        name[base_len] = '\0';
+
+        char spv[300];
+        int stale = 0;
+        snprintf(spv, sizeof(spv), "%s.vert.spv", name);
+        stale |= spirv_stale(dfd, spv, &src);
+        snprintf(spv, sizeof(spv), "%s.frag.spv", name);
+        stale |= spirv_stale(dfd, spv, &src);
+        snprintf(spv, sizeof(spv), "%s.comp.spv", name);
+        int has_comp = !spirv_stale(dfd, spv, &src);
+
+        ShaderInfo info = {arena_add(name, base_len), scan->dir, has_comp};
+        for (int k = 0; k < BUFFER_PASSES; k++) {
+            struct stat buf_src;
+            snprintf(spv, sizeof(spv), "%s.buf%c.frag", name, 'a' + k);
+            if (fstatat(dfd, spv, &buf_src, 0) != 0) continue;
+            info.buffers |= 1u << k;
+            snprintf(spv, sizeof(spv), "%s.buf%c.frag.spv", name, 'a' + k);
+            stale |= spirv_stale(dfd, spv, &buf_src);
+        }
+        load_channels(dfd, name, &info);
+        load_quality(dfd, name, &info);
+        // New tunables change what --compile's wrapper declares
+        struct stat quality_src;
+        snprintf(spv, sizeof(spv), "%s.quality", name);
+        if (fstatat(dfd, spv, &quality_src, 0) == 0) {
+            snprintf(spv, sizeof(spv), "%s.frag.spv", name);
+            stale |= spirv_stale(dfd, spv, &quality_src);
+        }
+
+        if (scan->count == scan->cap) {
+            scan->cap = scan->cap ? scan->cap * 2 : 64;
+            scan->entries = realloc(scan->entries, scan->cap * sizeof(ScanEntry));
+        }
+        scan->entries[scan->count++] = (ScanEntry){info, stale, 0};
+    }
+    closedir(dir);
+    return NULL;
+}
+
+// Run glslangValidator on one stage. Its output is collected and printed
+// in one piece, so parallel builds don't interleave their errors.
+static int run_glslang(const char *stage, const char *input, const char *output) {
+    int fds[2];
+    if (pipe(fds) != 0) return -1;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    char *args[] = {"glslangValidator", "-V", "-S", (char*)stage, (char*)input, "-o", (char*)output, NULL};
+    pid_t pid;
+    int err = posix_spawnp(&pid, "glslangValidator", &actions, NULL, args, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    // Keep the start of the output, drain the rest so the child never blocks
+    char log[4096], discard[256];
+    size_t len = 0;
+    ssize_t n;
+    while ((n = read(fds[0], len < sizeof(log) - 1 ? log + len : discard,
+                     len < sizeof(log) - 1 ? sizeof(log) - 1 - len : sizeof(discard))) > 0)
+        if (len < sizeof(log) - 1) len += n;
+    close(fds[0]);
+    log[len] = '\0';
+
+    int status = 0;
+    if (err != 0) {
+        pthread_mutex_lock(&build_log_lock);
+        printf("  glslangValidator: %s\n", strerror(err));
+        pthread_mutex_unlock(&build_log_lock);
+        return -1;
+    }
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        pthread_mutex_lock(&build_log_lock);
+        printf("  %s", log);
+        pthread_mutex_unlock(&build_log_lock);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_text(const char *path, const char *a, size_t a_len, const char *b, size_t b_len,
+                      const char *c, size_t c_len) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    int ok = fwrite(a, 1, a_len, f) == a_len && fwrite(b, 1, b_len, f) == b_len &&
+             fwrite(c, 1, c_len, f) == c_len;
+    return (fclose(f) == 0 && ok) ? 0 : -1;
+}
+
+// iChannel0-3 of `pass`: sampler2D, or what its texture file holds
+static int channel_declarations(const ShaderInfo *s, int pass, char *out, size_t len) {
+    static const char *types[TEXTURE_KINDS] = {"sampler2D", "samplerCube", "sampler3D"};
+    int n = 0;
+    for (int c = 0; c < 4; c++) {
+        int j = s->channels[pass][c] - CHANNEL_FILE;
+        n += snprintf(out + n, len - n, "layout(binding = %u, set = 0) uniform %s iChannel%d;\n",
+                      channel_bindings[c], types[j >= 0 ? s->texture_kinds[j] : TEXTURE_2D], c);
+    }
+    return n + snprintf(out + n, len - n, "\n");
+}
+
+// The shader's .quality tunables as specialization constants
+static int quality_declarations(const ShaderInfo *s, char *out, size_t len) {
+    int n = 0;
+    for (int k = 0; k < s->quality_count; k++) {
+        float v = s->quality_values[k][QUALITY_ULTRA];
+        char value[32];
+        if (s->quality_float & (1u << k)) {
+            int digits = snprintf(value, sizeof(value), "%.7g", v);
+            if (!strpbrk(value, ".e")) snprintf(value + digits, sizeof(value) - digits, ".0");
+        } else {
+            snprintf(value, sizeof(value), "%ld", lroundf(v));
+        }
+        n += snprintf(out + n, len - n, "layout(constant_id = %d) const %s %s = %s;\n", QUALITY_CONSTANT_ID + k,
+                      s->quality_float & (1u << k) ? "float" : "int", arena_str(s->quality_names[k]), value);
+    }
+    return n + snprintf(out + n, len - n, s->quality_count ? "\n" : "");
+}
+
+// --compile: build one shader's SPIR-V the way the Rust ShaderCompiler does.
+// ShaderToy-style sources get the fragment wrapper, written to <name>.glsl
+// (<name>.bufa.glsl etc. for buffer passes); sources with their own
+// #version 450 compile as they are.
+static int build_fragment(const ShaderInfo *s, int pass) {
+    char suffix[16], src_path[PATH_MAX], glsl_path[PATH_MAX], frag_spv[PATH_MAX];
+    pass_suffix(pass, ".frag", suffix, sizeof(suffix));
+    shader_path(s, suffix, src_path, sizeof(src_path));
+    pass_suffix(pass, ".glsl", suffix, sizeof(suffix));
+    shader_path(s, suffix, glsl_path, sizeof(glsl_path));
+    pass_suffix(pass, ".frag.spv", suffix, sizeof(suffix));
+    shader_path(s, suffix, frag_spv, sizeof(frag_spv));
+
+    size_t len;
+    char *src = (char*)load_spv(src_path, &len);
+    if (!src || !(src = realloc(src, len + 1))) return -1;
+    src[len] = '\0';
+    const char *frag_input = src_path;
+    int ok = 1;
+    if (!strstr(src, "#version 450")) {
+        char header[sizeof(frag_wrapper) + 512 + QUALITY_CONSTANTS * 128];
+        size_t header_len = sizeof(frag_wrapper) - 1;
+        memcpy(header, frag_wrapper, header_len);
+        header_len += channel_declarations(s, pass, header + header_len, sizeof(header) - header_len);
+        header_len += quality_declarations(s, header + header_len, sizeof(header) - header_len);
+        header_len += snprintf(header + header_len, sizeof(header) - header_len, "#define main shadertoy_main\n#line 1\n");
+        ok = write_text(glsl_path, header, header_len, src, len,
+                        frag_wrapper_tail, sizeof(frag_wrapper_tail) - 1) == 0;
+        frag_input = glsl_path;
+    }
+    free(src);
+    return ok && run_glslang("frag", frag_input, frag_spv) == 0 ? 0 : -1;
+}
+
+// Every pass shares the shader's vertex stage
+static int build_shader(const ShaderInfo *s) {
+    char vert_path[PATH_MAX], vert_spv[PATH_MAX];
+    shader_path(s, ".vert", vert_path, sizeof(vert_path));
+    shader_path(s, ".vert.spv", vert_spv, sizeof(vert_spv));
+    int ok = build_fragment(s, IMAGE_PASS) == 0;
+    for (int k = 0; k < BUFFER_PASSES && ok; k++)
+        if (s->buffers & (1u << k)) ok = build_fragment(s, k) == 0;
+
+    struct stat st;
+    if (ok && stat(vert_path, &st) != 0)
+        ok = write_text(vert_path, fullscreen_vert, sizeof(fullscreen_vert) - 1, "", 0, "", 0) == 0;
+    return ok && run_glslang("vert", vert_path, vert_spv) == 0 ? 0 : -1;
+}
+
+// --compile thread pool: workers pull the next shader needing a build
+static struct {
+    DirScan *scans;
+    int scan_count;
+    int next_scan, next_entry;
+    pthread_mutex_t lock;
+} build_queue = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void *build_worker(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&build_queue.lock);
+        DirScan *scan = NULL;
+        int i = -1;
+        while (build_queue.next_scan < build_queue.scan_count) {
+            DirScan *d = &build_queue.scans[build_queue.next_scan];
+            if (build_queue.next_entry >= d->count) {
+                build_queue.next_scan++;
+                build_queue.next_entry = 0;
+                continue;
+            }
+            i = build_queue.next_entry++;
+            if (d->entries[i].needs_build) { scan = d; break; }
+        }
+        pthread_mutex_unlock(&build_queue.lock);
+        if (!scan) return NULL;
+
+        ScanEntry *e = &scan->entries[i];
+        double start = monotonic_seconds();
+        int failed = build_shader(&e->info);
+        double ms = (monotonic_seconds() - start) * 1000.0;
+        e->build_ms = failed ? -1 : ms;
+        pthread_mutex_lock(&build_log_lock);
+        printf(failed ? "  Failed %s/%s.frag (%.0f ms)\n" : "  Built %s/%s.frag in %.0f ms\n",
+               arena_str(e->info.dir), arena_str(e->info.name), ms);
+        pthread_mutex_unlock(&build_log_lock);
+    }
+}
+
+static void add_shader(const ShaderInfo *info) {
+    if (shader_count == shader_cap) {
+        shader_cap = shader_cap ? shader_cap * 2 : 256;
+        shaders = realloc(shaders, shader_cap * sizeof(ShaderInfo));
+    }
+    shaders[shader_count++] = *info;
+}
+
+// Sort the catalog by name, keep the first of each name and list it
+static void index_catalog(void) {
+    qsort(shaders, shader_count, sizeof(ShaderInfo), compare_shaders);
+    int unique = 0;
+    for (int i = 0; i < shader_count; i++)
+        if (unique == 0 || strcmp(shader_name(i), shader_name(unique - 1)) != 0)
+            shaders[unique++] = shaders[i];
+    shader_count = unique;
+    build_shader_index();
+
+    printf("Found %d compiled shader(s)\n", shader_count);
+    for (int i = 0; i < shader_count; i++) {
+        printf("  [%d] %s\n", i, shader_name(i));
+    }
+}
+
+// --bundle: the catalog is the bundle's index, one shader per
+// <name>.frag.spv with a <name>.vert.spv, so nothing is scanned or stat'ed
+static void scan_bundle(const char *path) {
+    uint32_t dir = arena_add(path, strlen(path));
+    for (uint32_t i = 0; i < bundle.count; i++) {
+        const char *file = bundle_entry(i, NULL, NULL);
+        size_t len = strlen(file), base_len = len - 9;
+        char name[256], spv[300];
+        if (len <= 9 || strcmp(file + base_len, ".frag.spv") != 0 || strchr(file, '/') ||
+            base_len >= sizeof(name) || pass_base_len(file, base_len) != base_len)
+            continue;
+        memcpy(name, file, base_len);
+        name[base_len] = '\0';
+        size_t size;
+        snprintf(spv, sizeof(spv), "%s.vert.spv", name);
+        if (!bundle_find(spv, &size)) continue;
+        snprintf(spv, sizeof(spv), "%s.comp.spv", name);
+        ShaderInfo info = {arena_add(name, base_len), dir, bundle_find(spv, &size) != NULL};
+        for (int k = 0; k < BUFFER_PASSES; k++) {
+            snprintf(spv, sizeof(spv), "%s.buf%c.frag.spv", name, 'a' + k);
+            if (bundle_find(spv, &size)) info.buffers |= 1u << k;
+        }
+        load_channels(-1, name, &info);
+        load_quality(-1, name, &info);
+        add_shader(&info);
+    }
+    index_catalog();
+}
+
+// Scan multiple directories for shaders, each on its own thread. With
+// compile set, missing or stale SPIR-V is rebuilt on one worker per core.
+static void scan_all_shaders(int compile) {
+
+    DirScan scans[SEARCH_DIR_COUNT];
+    pthread_t threads[SEARCH_DIR_COUNT];
+    for (int i = 0; i < SEARCH_DIR_COUNT; i++) {
+        scans[i] = (DirScan){arena_add(search_dirs[i], strlen(search_dirs[i])), search_dirs[i], NULL, 0, 0};
+    }
+    for (int i = 0; i < SEARCH_DIR_COUNT; i++)
+        pthread_create(&threads[i], NULL, scan_shaders, &scans[i]);
+    int pending = 0;
+    for (int i = 0; i < SEARCH_DIR_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+        for (int j = 0; j < scans[i].count; j++) pending += scans[i].entries[j].needs_build;
+    }
+
+    if (compile && pending) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int workers = cores < 1 ? 1 : cores > pending ? pending : (int)cores;
+        printf("Compiling %d shader(s) on %d thread(s)\n", pending, workers);
+        double start = monotonic_seconds();
+        build_queue.scans = scans;
+        build_queue.scan_count = SEARCH_DIR_COUNT;
+        pthread_t *pool = malloc(workers * sizeof(pthread_t));
+        for (int i = 0; i < workers; i++) pthread_create(&pool[i], NULL, build_worker, NULL);
+        for (int i = 0; i < workers; i++) pthread_join(pool[i], NULL);
+        free(pool);
+        printf("Compiled in %.2fs\n", monotonic_seconds() - start);
+    }
+
+    // Merge, sort by name and drop names already found in an earlier search
+    // dir. Without --compile, stale SPIR-V is still loaded; missing is skipped.
+    shader_count = 0;
+    int skipped = 0, stale = 0;
+    struct stat st;
+    char vert_path[PATH_MAX], frag_path[PATH_MAX];
+    for (int i = 0; i < SEARCH_DIR_COUNT; i++) {
+        for (int j = 0; j < scans[i].count; j++) {
+            ScanEntry *e = &scans[i].entries[j];
+            if (e->needs_build && (!compile || e->build_ms < 0)) {
+                shader_path(&e->info, ".vert.spv", vert_path, sizeof(vert_path));
+                int missing = stat(vert_path, &st) != 0;
+                for (int p = 0; p < PASS_COUNT && !missing; p++) {
+                    char suffix[16];
+                    if (p < BUFFER_PASSES && !(e->info.buffers & (1u << p))) continue;
+                    pass_suffix(p, ".frag.spv", suffix, sizeof(suffix));
+                    shader_path(&e->info, suffix, frag_path, sizeof(frag_path));
+                    missing = stat(frag_path, &st) != 0;
+                }
+                if (missing) {
+                    skipped++;
+                    continue;
+                }
+                stale++;
+            }
+            add_shader(&e->info);
+        }
+        free(scans[i].entries);
+    }
+    index_catalog();
+    if (skipped || stale)
+        printf("%d shader(s) without SPIR-V skipped, %d with stale SPIR-V%s\n", skipped, stale,
+               compile ? "" : "; run with --compile to build them");
+}
+
+// Find shader by name
+static int find_shader_by_name(const char *name) {
+    for (uint32_t h = hash_name(name) & shader_index_mask; shader_index[h] >= 0;
+         h = (h + 1) & shader_index_mask) {
+        if (strcmp(shader_name(shader_index[h]), name) == 0) return shader_index[h];
+    }
+    return -1;
+}
+
+// Live reload: inotify on the search directories. A changed .frag/.vert of
+// the shader on screen is recompiled by a worker thread; changed SPIR-V is
+// rebuilt by the pre-warm worker and swapped in without touching the clock.
+static struct {
+    int fd;                      // inotify, -1 when unavailable
+    int wd[SEARCH_DIR_COUNT];
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int compile;                 // Shader whose source changed, or -1
+    int stop;
+    int rebuild;                 // Shader whose SPIR-V changed, or -1
+    double rebuild_at;           // glslangValidator writes the stages one by one
+} live = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER,
+          .compile = -1, .rebuild = -1};
+
+static void *live_compile_thread(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&live.lock);
+    while (!live.stop) {
+        if (live.compile < 0) {
+            pthread_cond_wait(&live.wake, &live.lock);
+            continue;
+        }
+        int shader = live.compile;
+        live.compile = -1;
+        pthread_mutex_unlock(&live.lock);
+
+        double start = monotonic_seconds();
+        int failed = build_shader(&shaders[shader]);
+        pthread_mutex_lock(&build_log_lock);
+        if (failed) printf("Recompile of '%s' failed, keeping the running version\n", shader_name(shader));
+        else printf("Recompiled '%s' in %.0f ms\n", shader_name(shader), (monotonic_seconds() - start) * 1000.0);
+        pthread_mutex_unlock(&build_log_lock);
+
+        pthread_mutex_lock(&live.lock);
+    }
+    pthread_mutex_unlock(&live.lock);
+    return NULL;
+}
+
+static void start_live_reload(void) {
+    live.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (live.fd < 0) {
+        printf("Live reload: inotify unavailable (%s)\n", strerror(errno));
+        return;
+    }
+    int watched = 0;
+    for (int i = 0; i < SEARCH_DIR_COUNT; i++) {
+        live.wd[i] = inotify_add_watch(live.fd, search_dirs[i], IN_CLOSE_WRITE | IN_MOVED_TO);
+        watched += live.wd[i] >= 0;
+    }
+    pthread_create(&live.thread, NULL, live_compile_thread, NULL);
+    printf("Live reload: watching %d director%s\n", watched, watched == 1 ? "y" : "ies");
+}
+
+static void stop_live_reload(void) {
+    if (live.fd < 0) return;
+    pthread_mutex_lock(&live.lock);
+    live.stop = 1;
+    pthread_cond_signal(&live.wake);
+    pthread_mutex_unlock(&live.lock);
+    pthread_join(live.thread, NULL);
+    close(live.fd);
+}
+
+// Drain pending inotify events. Only files of catalogued shaders count, and
+// only in the directory each was loaded from, and only the ones on screen
+// get rebuilt. Editors that save by rename show up as IN_MOVED_TO.
+static void live_poll(VkDevice device, double now) {
+    static const char *sources[] = {".frag", ".vert"};
+    static const char *spirv[] = {".vert.spv", ".frag.spv", ".comp.spv"};
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while (live.fd >= 0 && (n = read(live.fd, buf, sizeof(buf))) > 0) {
+        const struct inotify_event *ev;
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            int dir = 0;
+            while (dir < SEARCH_DIR_COUNT && live.wd[dir] != ev->wd) dir++;
+            if (!ev->len || dir == SEARCH_DIR_COUNT) continue;
+
+            // Split <name><suffix>, longest suffixes first
+            size_t len = strlen(ev->name);
+            int is_source = -1;
+            char name[256];
+            for (int k = 0; k < 5 && is_source < 0; k++) {
+                const char *suffix = k < 3 ? spirv[k] : sources[k - 3];
+                size_t sl = strlen(suffix);
+                if (len <= sl || len - sl >= sizeof(name) || strcmp(ev->name + len - sl, suffix) != 0) continue;
+                memcpy(name, ev->name, len - sl);
+                name[len - sl] = '\0';
+                is_source = k >= 3;
+            }
+            if (is_source < 0) continue;
+            // A buffer pass's files belong to the shader it is a pass of
+            name[pass_base_len(name, strlen(name))] = '\0';
+            int shader = find_shader_by_name(name);
+            if (shader < 0 || strcmp(arena_str(shaders[shader].dir), search_dirs[dir]) != 0) continue;
+
+            if (is_source) {
+                if (!shader_on_screen(shader)) continue;
+                pthread_mutex_lock(&live.lock);
+                live.compile = shader;
+                pthread_cond_signal(&live.wake);
+                pthread_mutex_unlock(&live.lock);
+            } else if (shader_on_screen(shader)) {
+                live.rebuild = shader;
+                live.rebuild_at = now + LIVE_RELOAD_DELAY;
+            } else {
+                lru_drop(device, shader);
+            }
+        }
+    }
+    if (live.rebuild >= 0 && now >= live.rebuild_at) {
+        printf("Reloading '%s'\n", shader_name(live.rebuild));
+        prewarm_rebuild(live.rebuild);
+        live.rebuild = -1;
+    }
+}
+
+// Shader playback clock. While playing, iTime is `base` plus the time since
+// `anchor` (monotonic seconds); paused, it stays at `base`. --timestep F
+// puts it on a grid of 1/F: a frame is due once the clock reaches the next
+// step, and one that comes late jumps to the step the clock is at, so a
+// slow frame drops the steps it overran instead of the shader falling
+// further and further behind. Headless and --bench don't use it: their
+// time is a function of the frame number.
+#define SEEK_STEP 5.0  // Seconds per Up/Down press
+
+static struct {
+    double base, anchor;
+    double step;       // --timestep: grid spacing, 0 for continuous time
+    int paused;
+    int offline;       // Headless or --bench: no pausing or seeking
+    int started;       // Grid: `tick` holds the step of a frame shown
+    uint64_t tick;
+    uint64_t skipped;  // Grid steps dropped since the last status line
+} playback;
+
+static double playback_time(double now) {
+    return playback.paused ? playback.base : playback.base + (now - playback.anchor);
+}
+
+static void playback_seek(double t, double now) {
+    playback.base = t > 0 ? t : 0;
+    playback.anchor = now;
+    playback.started = 0;
+}
+
+static void playback_pause(int paused, double now) {
+    playback.base = playback_time(now);
+    playback.anchor = now;
+    playback.paused = paused;
+    playback.started = 0;
+}
+
+// Whether a frame is due now, and if so its iTime
+static int playback_due(double now, double *time) {
+    double t = playback_time(now);
+    if (playback.step <= 0 || playback.paused) {
+        *time = t;
+        return 1;
+    }
+    uint64_t k = (uint64_t)(t / playback.step);
+    if (playback.started && k == playback.tick) return 0;
+    if (playback.started && k > playback.tick + 1) playback.skipped += k - playback.tick - 1;
+    playback.tick = k;
+    playback.started = 1;
+    *time = k * playback.step;
+    return 1;
+}
+
+// How long the loop may sleep when it had nothing to render: until the next
+// grid step, or a while when paused (live reload and pipeline builds finish
+// without waking the event loop)
+static int playback_idle_ms(double now) {
+    if (playback.paused) return 100;
+    if (playback.step <= 0 || !playback.started) return 0;
+    double left = (playback.tick + 1) * playback.step - playback_time(now);
+    return left > 0 ? (int)ceil(left * 1000.0) : 0;
+}
+
+// Input thread: owns every keyboard and pointer under /dev/input, picks up
+// devices as they appear (inotify; IN_ATTRIB too, since udev fixes up the
+// permissions after creating the node) and drops them when they go away.
+// It turns their events into commands on a single-producer, single-consumer
+// ring and wakes the render loop's epoll through an eventfd, so a key press
+// is handled as soon as the loop is free instead of when it next polls.
+#define INPUT_QUEUE 256  // Commands, a power of two
+#define MAX_INPUT_DEVICES 16
+
+enum { INPUT_PREV, INPUT_NEXT, INPUT_FULLSCREEN, INPUT_QUIT, INPUT_PAUSE, INPUT_SEEK,
+       INPUT_MOUSE_REL, INPUT_MOUSE_ABS, INPUT_MOUSE_BUTTON };
+enum { DEVICE_KEYBOARD = 1, DEVICE_POINTER = 2 };
+
+typedef struct {
+    int type;
+    float x, y;  // Seek: seconds. REL: pixels moved. ABS: 0-1 across the device. BUTTON: x = pressed.
+} InputCommand;
+
+typedef struct {
+    int fd;                 // -1: free
+    int kinds;              // DEVICE_KEYBOARD | DEVICE_POINTER
+    int number;             // N of /dev/input/eventN
+    int abs_min[2], abs_max[2];
+    int abs[2], dx, dy;     // Pointer state since the last SYN_REPORT
+    int abs_moved;
+} InputDevice;
+
+static struct {
+    int wake_fd;            // eventfd: commands are waiting, watched by the render loop
+    int stop_fd;            // eventfd: the thread should exit
+    int inotify_fd;
+    int epfd;
+    pthread_t thread;
+    int running;            // thread was started
+    InputCommand queue[INPUT_QUEUE];
+    uint32_t head, tail;    // Written only by the input thread / the render loop
+    InputDevice devices[MAX_INPUT_DEVICES];
+} input = {.wake_fd = -1, .stop_fd = -1, .inotify_fd = -1, .epfd = -1};
+
+// Input thread: full queue drops the command (only a burst nobody reads)
+static void input_post(int type, float x, float y) {
+    uint32_t head = input.head;
+    if (head - __atomic_load_n(&input.tail, __ATOMIC_ACQUIRE) == INPUT_QUEUE) return;
+    input.queue[head % INPUT_QUEUE] = (InputCommand){type, x, y};
+    __atomic_store_n(&input.head, head + 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    if (write(input.wake_fd, &one, sizeof(one)) < 0) { /* Counter full: already awake */ }
+}
+
+// Render loop: next command, 0 if there is none
+static int input_pop(InputCommand *c) {
+    uint32_t tail = input.tail;
+    if (tail == __atomic_load_n(&input.head, __ATOMIC_ACQUIRE)) return 0;
+    *c = input.queue[tail % INPUT_QUEUE];
+    __atomic_store_n(&input.tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int test_bit(const unsigned long *bits, int bit) {
+    return (bits[bit / (8 * sizeof(long))] >> (bit % (8 * sizeof(long)))) & 1;
+}
+
+// Open /dev/input/event<number> if it is a keyboard or a pointer
+static void input_add(int number) {
+    InputDevice *d = NULL;
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        if (input.devices[i].fd >= 0 && input.devices[i].number == number) return;
+        if (!d && input.devices[i].fd < 0) d = &input.devices[i];
+    }
+    if (!d) return;
+    char path[64], name[256] = {0};
+    snprintf(path, sizeof(path), "/dev/input/event%d", number);
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) return;  // Not accessible (yet): IN_ATTRIB brings it back
+    unsigned long ev[1] = {0}, keys[KEY_MAX / (8 * sizeof(long)) + 1] = {0};
+    unsigned long rel[1] = {0}, abs[ABS_MAX / (8 * sizeof(long)) + 1] = {0};
+    ioctl(fd, EVIOCGBIT(0, sizeof(ev)), ev);
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys);
+    ioctl(fd, EVIOCGBIT(EV_REL, sizeof(rel)), rel);
+    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs)), abs);
+    int kinds = 0;
+    if (test_bit(keys, KEY_ESC) && test_bit(keys, KEY_Q)) kinds |= DEVICE_KEYBOARD;
+    if ((test_bit(keys, BTN_LEFT) || test_bit(keys, BTN_TOUCH)) &&
+        ((test_bit(ev, EV_REL) && test_bit(rel, REL_X)) || (test_bit(ev, EV_ABS) && test_bit(abs, ABS_X))))
+        kinds |= DEVICE_POINTER;
+    if (!kinds) {
+        close(fd);
+        return;
+    }
+    *d = (InputDevice){.fd = fd, .kinds = kinds, .number = number, .abs_max = {1, 1}};
+    for (int a = 0; a < 2 && test_bit(abs, ABS_X); a++) {
+        struct input_absinfo info;
+        if (ioctl(fd, EVIOCGABS(ABS_X + a), &info) == 0 && info.maximum > info.minimum) {
+            d->abs_min[a] = info.minimum;
+            d->abs_max[a] = info.maximum;
+        }
+    }
+    ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+    printf("Input: %s (%s, %s)\n", path, name,
+           kinds == (DEVICE_KEYBOARD | DEVICE_POINTER) ? "keyboard and pointer" :
+           kinds == DEVICE_KEYBOARD ? "keyboard" : "pointer");
+    epoll_ctl(input.epfd, EPOLL_CTL_ADD, fd, &(struct epoll_event){.events = EPOLLIN, .data.u32 = d - input.devices});
+}
+
+static void input_remove(InputDevice *d) {
+    printf("Input: /dev/input/event%d removed\n", d->number);
+    epoll_ctl(input.epfd, EPOLL_CTL_DEL, d->fd, NULL);
+    close(d->fd);
+    d->fd = -1;
+}
+
+static void input_key(int code) {
+    switch (code) {
+        case KEY_LEFT: input_post(INPUT_PREV, 0, 0); break;
+        case KEY_RIGHT: input_post(INPUT_NEXT, 0, 0); break;
+        case KEY_UP: input_post(INPUT_SEEK, SEEK_STEP, 0); break;
+        case KEY_DOWN: input_post(INPUT_SEEK, -SEEK_STEP, 0); break;
+        case KEY_SPACE: input_post(INPUT_PAUSE, 0, 0); break;
+        case KEY_F: input_post(INPUT_FULLSCREEN, 0, 0); break;
+        case KEY_ESC:
+        case KEY_Q: input_post(INPUT_QUIT, 0, 0); break;
+    }
+}
+
+static void input_read(InputDevice *d) {
+    struct input_event ev[64];
+    ssize_t n;
+    while ((n = read(d->fd, ev, sizeof(ev))) > 0) {
+        for (int i = 0; i < n / (ssize_t)sizeof(ev[0]); i++) {
+            const struct input_event *e = &ev[i];
+            if (e->type == EV_KEY && (e->code == BTN_LEFT || e->code == BTN_TOUCH) && e->value != 2) {
+                if (d->kinds & DEVICE_POINTER) input_post(INPUT_MOUSE_BUTTON, e->value, 0);
+            } else if (e->type == EV_KEY && e->value == 1) {  // Presses, not repeats
+                if (d->kinds & DEVICE_KEYBOARD) input_key(e->code);
+            } else if (e->type == EV_REL && e->code == REL_X) {
+                d->dx += e->value;
+            } else if (e->type == EV_REL && e->code == REL_Y) {
+                d->dy += e->value;
+            } else if (e->type == EV_ABS && (e->code == ABS_X || e->code == ABS_Y)) {
+                d->abs[e->code - ABS_X] = e->value;
+                d->abs_moved = 1;
+            } else if (e->type == EV_SYN && e->code == SYN_REPORT && (d->kinds & DEVICE_POINTER)) {
+                // One command per report, however many axes it moved
+                if (d->dx || d->dy) input_post(INPUT_MOUSE_REL, d->dx, d->dy);
+                if (d->abs_moved)
+                    input_post(INPUT_MOUSE_ABS,
+                               (float)(d->abs[0] - d->abs_min[0]) / (d->abs_max[0] - d->abs_min[0]),
+                               (float)(d->abs[1] - d->abs_min[1]) / (d->abs_max[1] - d->abs_min[1]));
+                d->dx = d->dy = d->abs_moved = 0;
+            }
+        }
+    }
+    if (n < 0 && errno == ENODEV) input_remove(d);
+}
+
+static void input_scan_dir(void) {
+    DIR *dir = opendir("/dev/input");
+    struct dirent *entry;
+    while (dir && (entry = readdir(dir))) {
+        int number;
+        if (sscanf(entry->d_name, "event%d", &number) == 1) input_add(number);
+    }
+    if (dir) closedir(dir);
+}
+
+static void *input_thread(void *arg) {
+    (void)arg;
+    input_scan_dir();
+    for (;;) {
+        struct epoll_event ready[8];
+        int n = epoll_wait(input.epfd, ready, 8, -1);
+        if (n < 0 && errno != EINTR) break;
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = ready[i].data.u32;
+            if (tag == MAX_INPUT_DEVICES + 1) return NULL;  // stop_fd
+            if (tag == MAX_INPUT_DEVICES) {
+                char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+                ssize_t len;
+                while ((len = read(input.inotify_fd, buf, sizeof(buf))) > 0)
+                    for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event*)p)->len) {
+                        const struct inotify_event *ie = (const struct inotify_event*)p;
+                        int number;
+                        if (ie->len && sscanf(ie->name, "event%d", &number) == 1) input_add(number);
+                    }
+                continue;
+            }
+            InputDevice *d = &input.devices[tag];
+            if (d->fd < 0) continue;
+            if (ready[i].events & (EPOLLERR | EPOLLHUP)) input_remove(d);
+            else input_read(d);
+        }
+    }
+    return NULL;
+}
+
+static int input_start(void) {
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) input.devices[i].fd = -1;
+    input.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    input.stop_fd = eventfd(0, EFD_CLOEXEC);
+    input.epfd = epoll_create1(EPOLL_CLOEXEC);
+    input.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (input.wake_fd < 0 || input.stop_fd < 0 || input.epfd < 0) return -1;
+    if (input.inotify_fd >= 0 && inotify_add_watch(input.inotify_fd, "/dev/input", IN_CREATE | IN_ATTRIB) >= 0)
+        epoll_ctl(input.epfd, EPOLL_CTL_ADD, input.inotify_fd,
+                  &(struct epoll_event){.events = EPOLLIN, .data.u32 = MAX_INPUT_DEVICES});
+    else
+        printf("Input hotplug unavailable (%s)\n", strerror(errno));
+    epoll_ctl(input.epfd, EPOLL_CTL_ADD, input.stop_fd,
+              &(struct epoll_event){.events = EPOLLIN, .data.u32 = MAX_INPUT_DEVICES + 1});
+    input.running = pthread_create(&input.thread, NULL, input_thread, NULL) == 0;
+    return input.running ? 0 : -1;
+}
+
+static void input_stop(void) {
+    int *fds[] = {&input.stop_fd, &input.wake_fd, &input.epfd, &input.inotify_fd};
+    if (input.stop_fd < 0 && input.wake_fd < 0 && input.epfd < 0 && input.inotify_fd < 0) return;  // Never started
+    uint64_t one = 1;
+    if (input.running && write(input.stop_fd, &one, sizeof(one)) == sizeof(one)) pthread_join(input.thread, NULL);
+    input.running = 0;
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        if (input.devices[i].fd >= 0) close(input.devices[i].fd);
+        input.devices[i].fd = -1;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (*fds[i] >= 0) close(*fds[i]);
+        *fds[i] = -1;
+    }
+}
+
+// Pointer position and the last press, 0-1 across the render area from its
+// top left (the same way up as fragCoord). ShaderToy's iMouse: xy follows
+// the pointer while the button is down, zw is where it went down, z
+// negative once it is released and w negative after the press's first frame.
+static struct {
+    float x, y, click_x, click_y;
+    int down, clicked;
+    uint32_t w, h;  // Pixels a relative move is measured against
+} mouse;
+
+static void mouse_ubo(float out[4], float w, float h) {
+    out[0] = mouse.down ? mouse.x * w : mouse.click_x * w;
+    out[1] = mouse.down ? mouse.y * h : mouse.click_y * h;
+    out[2] = (mouse.down ? 1 : -1) * mouse.click_x * w;
+    out[3] = (mouse.clicked ? 1 : -1) * mouse.click_y * h;
+}
+
+// Render loop: act on everything the input thread has posted
+static void input_drain(void) {
+    uint64_t pending;
+    if (read(input.wake_fd, &pending, sizeof(pending)) < 0) { /* Nothing posted */ }
+    InputCommand c;
+    while (input_pop(&c)) {
+        double now = monotonic_seconds();
+        switch (c.type) {
+            case INPUT_PREV:
+            case INPUT_NEXT:
+                current_shader = (current_shader + (c.type == INPUT_NEXT ? 1 : shader_count - 1)) % shader_count;
+                reload_requested = 1;
+                printf("\n%s shader: %s\n", c.type == INPUT_NEXT ? ">> Next" : "<< Previous", shader_name(current_shader));
+                break;
+            case INPUT_PAUSE:
+                if (playback.offline) break;
+                playback_pause(!playback.paused, now);
+                printf("\n%s at %.2fs\n", playback.paused ? "Paused" : "Playing", playback.base);
+                break;
+            case INPUT_SEEK:
+                if (playback.offline) break;
+                playback_seek(playback_time(now) + c.x, now);
+                printf("\nSeek to %.2fs\n", playback.base);
+                break;
+            case INPUT_FULLSCREEN: {
+                // Signal host to toggle fullscreen via virtio-serial
+                printf("\n[F] Toggling host fullscreen...\n");
+                const char *port = find_display_port();
+                FILE *f = port ? fopen(port, "w") : NULL;
+                if (f) {
+                    fprintf(f, "FULLSCREEN\n");
+                    fclose(f);
+                } else if (port) {
+                    printf("    (Can't open %s, press Ctrl+Alt+F on Mac host)\n", port);
+                } else {
+                    printf("    (No display port found, press Ctrl+Alt+F on Mac host)\n");
+                }
+                break;
+            }
+            case INPUT_QUIT:
+                printf("\nExiting...\n");
+                quit_requested = 1;
+                break;
+            case INPUT_MOUSE_REL:
+                mouse.x = fminf(fmaxf(mouse.x + c.x / mouse.w, 0), 1);
+                mouse.y = fminf(fmaxf(mouse.y + c.y / mouse.h, 0), 1);
+                break;
+            case INPUT_MOUSE_ABS:
+                mouse.x = fminf(fmaxf(c.x, 0), 1);
+                mouse.y = fminf(fmaxf(c.y, 0), 1);
+                break;
+            case INPUT_MOUSE_BUTTON:
+                if (c.x && !mouse.down) {
+                    mouse.click_x = mouse.x;
+                    mouse.click_y = mouse.y;
+                    mouse.clicked = 1;
                 }
+                mouse.down = c.x != 0;
+                break;
+        }
+    }
+}
+
+// The render loop sleeps in a single epoll set: the input thread's
+// commands, DRM events (flip completion), inotify (live reload) and the
+// --max-fps frame timer
+enum { EVENT_INPUT, EVENT_DRM, EVENT_INOTIFY, EVENT_TIMER };
+static struct {
+    int epfd;
+    int drm_fd, timer_fd;
+    int ticked;  // Frame timer expired since the last frame started
+} events = {.epfd = -1, .drm_fd = -1, .timer_fd = -1};
+
+static void watch_event_fd(int fd, int tag, uint32_t flags) {
+    if (fd < 0) return;
+    epoll_ctl(events.epfd, EPOLL_CTL_ADD, fd, &(struct epoll_event){.events = flags, .data.u32 = tag});
+}
+
+// Handle whatever is ready, waiting up to timeout_ms for something to be
+// (-1: no limit). Returns -1 on errors other than a signal.
+static int wait_events(int timeout_ms) {
+    struct epoll_event ready[4];
+    int n = epoll_wait(events.epfd, ready, 4, timeout_ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    for (int i = 0; i < n; i++) {
+        switch (ready[i].data.u32) {
+            case EVENT_INPUT:
+                input_drain();
+                break;
+            case EVENT_DRM:
+                drmHandleEvent(events.drm_fd, &(drmEventContext){
+                    .version=2,.page_flip_handler=page_flip_handler});
+                break;
+            case EVENT_INOTIFY:
+                // Edge-triggered: only wakes the loop, live_poll drains it every frame
+                break;
+            case EVENT_TIMER: {
+                uint64_t expirations;
+                if (read(events.timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+                    events.ticked = 1;
+                break;
             }
-            fclose(f);
         }
     }
-    return NULL;
+    return 0;
 }
 
-// Scan shaders directory and build list
-static void scan_shaders(const char *shader_dir) {
-    DIR *dir = opendir(shader_dir);
-    if (!dir) {
+// --max-fps: a periodic timer the loop waits on before each frame. Missed
+// ticks are dropped rather than caught up, so pacing stays even.
+static void start_frame_timer(double fps) {
+    if (events.timer_fd >= 0 || fps <= 0) return;
+    events.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (events.timer_fd < 0) {
+        printf("Frame timer unavailable (%s), running uncapped\n", strerror(errno));
         return;
     }
+    long period = (long)(1e9 / fps);
+    struct timespec interval = {period / 1000000000L, period % 1000000000L};
+    timerfd_settime(events.timer_fd, 0, &(struct itimerspec){interval, interval}, NULL);
+    watch_event_fd(events.timer_fd, EVENT_TIMER, EPOLLIN);
+    printf("Frame cap: %.1f FPS\n", fps);
+}
 
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL && shader_count < MAX_SHADERS) {
-        if (entry->d_type != DT_REG) continue;
+// Queue a flip of the output to fb on its next vblank. The output takes no
+// new frame until the flip event arrives, which paces it to its own refresh
+// rate and frees the buffer that was on screen. Returns -1 (errno set) if
+// the driver refuses the flip.
+static int page_flip(int drm_fd, Output *o, uint32_t fb) {
+    o->flip.queued_at = monotonic_seconds();
+    if (drmModePageFlip(drm_fd, o->crtc_id, fb, DRM_MODE_PAGE_FLIP_EVENT, &o->flip)) return -1;
+    o->flip.pending = 1;
+    return 0;
+}
 
-        char *ext = strrchr(entry->d_name, '.');
-        if (!ext || strcmp(ext, ".frag") != 0) continue;
+// Page flips: sleep in the event loop until some output can take a frame.
+// Input keeps being handled meanwhile.
+static void wait_for_output(void) {
+    for (;;) {
+        for (int i = 0; i < output_count; i++)
+            if (!outputs[i].flip.pending) return;
+        if (quit_requested) return;
+        if (wait_events(-1) < 0) {
+            for (int i = 0; i < output_count; i++) outputs[i].flip.pending = 0;
+            return;
+        }
+    }
+}
 
-        // Extract base name (remove .frag extension)
-        size_t base_len = ext - entry->d_name;
-        if (base_len >= sizeof(shaders[0].name)) continue;
+// A CRTC for conn that no other output has taken, preferring the one
+// already driving it. Returns its index in res->crtcs, or -1.
+static int pick_crtc(int drm_fd, const drmModeRes *res, const drmModeConnector *conn, uint32_t taken) {
+    int found = -1;
+    drmModeEncoder *enc = conn->encoder_id ? drmModeGetEncoder(drm_fd, conn->encoder_id) : NULL;
+    for (int i = 0; enc && i < res->count_crtcs; i++)
+        if (res->crtcs[i] == enc->crtc_id && !(taken & (1u << i))) found = i;
+    drmModeFreeEncoder(enc);
+    for (int e = 0; e < conn->count_encoders && found < 0; e++) {
+        enc = drmModeGetEncoder(drm_fd, conn->encoders[e]);
+        if (!enc) continue;
+        for (int i = 0; i < res->count_crtcs && found < 0; i++)
+            if ((enc->possible_crtcs & (1u << i)) && !(taken & (1u << i))) found = i;
+        drmModeFreeEncoder(enc);
+    }
+    return found;
+}
+
+// Startup: the shader catalog is scanned on its own thread while the main
+// thread creates the Vulkan instance
+typedef struct {
+    const char *bundle_path;  // Or NULL for the shader directories
+    int compile;
+    int failed;
+} CatalogScan;
 
-        strncpy(shaders[shader_count].name, entry->d_name, base_len);
-        shaders[shader_count].name[base_len] = '\0';
+static void *catalog_thread(void *arg) {
+    CatalogScan *c = arg;
+    phase_begin(PHASE_SCAN);
+    if (c->bundle_path) {
+        c->failed = bundle_open(c->bundle_path) != 0;
+        if (!c->failed) scan_bundle(c->bundle_path);
+    } else {
+        scan_all_shaders(c->compile);
+    }
+    phase_end(PHASE_SCAN);
+    return NULL;
+}
 
-        // Build paths
-        snprintf(shaders[shader_count].vert_path, sizeof(shaders[0].vert_path),
-                 "%s/%s.vert.spv", shader_dir, shaders[shader_count].name);
-        snprintf(shaders[shader_count].frag_path, sizeof(shaders[0].frag_path),
-                 "%s/%s.frag.spv", shader_dir, shaders[shader_count].name);
+// DRM/GBM setup, on a thread of its own for the same reason: every
+// connected connector with a CRTC of its own becomes an output. None
+// leaves output_count at 0.
+typedef struct {
+    int drm_fd;
+    struct gbm_device *gbm;
+} DisplaySetup;
 
-        // Check if compiled shaders exist
-        struct stat st;
-        if (stat(shaders[shader_count].vert_path, &st) == 0 &&
-            stat(shaders[shader_count].frag_path, &st) == 0) {
-            shader_count++;
+static void *display_thread(void *arg) {
+    DisplaySetup *d = arg;
+    phase_begin(PHASE_DISPLAY);
+    d->drm_fd = open("/dev/dri/card0", O_RDWR);
+    drmSetMaster(d->drm_fd);
+    drmModeRes *res = drmModeGetResources(d->drm_fd);
+    uint32_t crtcs_taken = 0;
+    for (int i = 0; res && i < res->count_connectors && output_count < MAX_OUTPUTS; i++) {
+        drmModeConnector *conn = drmModeGetConnector(d->drm_fd, res->connectors[i]);
+        int crtc = conn && conn->connection == DRM_MODE_CONNECTED && conn->count_modes > 0 ?
+                   pick_crtc(d->drm_fd, res, conn, crtcs_taken) : -1;
+        if (crtc < 0) {
+            if (conn) drmModeFreeConnector(conn);
+            continue;
         }
+        crtcs_taken |= 1u << crtc;
+        Output *o = &outputs[output_count++];
+        o->conn = conn;
+        o->mode = &conn->modes[0];
+        o->crtc_id = res->crtcs[crtc];
+        o->W = o->mode->hdisplay;
+        o->H = o->mode->vdisplay;
+        if (output_mode == OUTPUTS_FIRST) break;
     }
-    closedir(dir);
+    if (output_count > 0) {
+        if (output_mode == OUTPUTS_FIRST) output_mode = OUTPUTS_MIRROR;
+        d->gbm = gbm_create_device(d->drm_fd);
+    }
+    phase_end(PHASE_DISPLAY);
+    return NULL;
 }
 
-// Scan multiple directories for shaders
-static void scan_all_shaders() {
-    const char *search_dirs[] = {
-        ".",                           // Current directory
-        "./shaders",                   // ./shaders subdirectory
-        "/root/metalshade/shaders",    // Default metalshade location
-        NULL
-    };
-
-    shader_count = 0;
-    for (int i = 0; search_dirs[i] != NULL; i++) {
-        scan_shaders(search_dirs[i]);
+int main(int argc, char **argv) {
+    startup.t0 = monotonic_seconds();
+    // Default to "example" shader if no argument provided
+    const char *shader_arg = "example";
+    int force_copy = 0, use_flip = 1, prewarm_all = 0, compile = 0;
+    int rgb565 = 0, blit_threads = 0, blit_bench = 0;
+    int headless = 0, headless_frames = 300;
+    uint32_t headless_w = 1280, headless_h = 720;
+    double headless_fps = 60.0;
+    int use_compute = 0;
+    uint32_t workgroup[2] = {8, 8};
+    float render_scale = 1.0f;
+    int auto_scale = 0;
+    double target_fps = 60.0;
+    double max_fps = -1;  // Unset: uncapped with page flips, the refresh rate without
+    const char *gpu_arg = NULL;
+    int split_frame = 0;
+    const char *output_path = NULL;
+    const char *csv_path = "bench.csv";
+    const char *telemetry_path = NULL;
+    const char *bundle_path = NULL, *bundle_out = NULL;
+    double timestep_fps = 0, seek_time = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--copy") == 0) force_copy = 1;
+        else if (strcmp(argv[i], "--no-flip") == 0) use_flip = 0;
+        else if (strcmp(argv[i], "--rgb565") == 0) rgb565 = 1;
+        else if (strcmp(argv[i], "--blit-threads") == 0 && i + 1 < argc) blit_threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bench-blit") == 0) blit_bench = 1;
+        else if (strcmp(argv[i], "--prewarm-all") == 0) prewarm_all = 1;
+        else if (strcmp(argv[i], "--compile") == 0) compile = 1;
+        else if (strcmp(argv[i], "--headless") == 0) headless = 1;
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%ux%u", &headless_w, &headless_h) != 2 || !headless_w || !headless_h) {
+                printf("Invalid --size '%s', expected WxH\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) headless_frames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) headless_fps = atof(argv[++i]);
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) output_path = argv[++i];
+        else if (strcmp(argv[i], "--bench") == 0) bench.active = 1;
+        else if (strcmp(argv[i], "--compute") == 0) use_compute = 1;
+        else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            if (strcmp(argv[++i], "auto") == 0) auto_scale = 1;
+            else render_scale = atof(argv[i]);
+            if (!auto_scale && !(render_scale >= MIN_RENDER_SCALE && render_scale <= 1.0f)) {
+                printf("Invalid --scale '%s', expected %.2f-1 or auto\n", argv[i], MIN_RENDER_SCALE);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--target-fps") == 0 && i + 1 < argc) target_fps = atof(argv[++i]);
+        else if (strcmp(argv[i], "--max-fps") == 0 && i + 1 < argc) max_fps = atof(argv[++i]);
+        else if (strcmp(argv[i], "--gpu") == 0 && i + 1 < argc) gpu_arg = argv[++i];
+        else if (strcmp(argv[i], "--split-frame") == 0) split_frame = 1;
+        else if (strcmp(argv[i], "--outputs") == 0 && i + 1 < argc) {
+            static const char *modes[] = {"mirror", "span", "each", "first"};
+            output_mode = -1;
+            for (int m = 0; m < 4; m++)
+                if (strcmp(argv[i + 1], modes[m]) == 0) output_mode = m;
+            if (output_mode < 0) {
+                printf("Invalid --outputs '%s', expected mirror, span, each or first\n", argv[i + 1]);
+                return 1;
+            }
+            i++;
+        }
+        else if (strcmp(argv[i], "--workgroup") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%ux%u", &workgroup[0], &workgroup[1]) != 2 || !workgroup[0] || !workgroup[1]) {
+                printf("Invalid --workgroup '%s', expected WxH\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) bench.warmup = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--measure") == 0 && i + 1 < argc) bench.measure = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc) csv_path = argv[++i];
+        else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) telemetry_path = argv[++i];
+        else if (strcmp(argv[i], "--timestep") == 0 && i + 1 < argc) timestep_fps = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seek") == 0 && i + 1 < argc) seek_time = atof(argv[++i]);
+        else if (strcmp(argv[i], "--bundle") == 0 && i + 1 < argc) bundle_path = argv[++i];
+        else if (strcmp(argv[i], "--quality") == 0 && i + 1 < argc) {
+            quality.automatic = strcmp(argv[++i], "auto") == 0;
+            int tier = quality.automatic ? QUALITY_ULTRA : -1;
+            for (int t = 0; t < QUALITY_TIERS; t++)
+                if (strcmp(argv[i], quality_tier_names[t]) == 0) tier = t;
+            if (tier < 0) {
+                printf("Invalid --quality '%s', expected low, medium, high, ultra or auto\n", argv[i]);
+                return 1;
+            }
+            quality.tier = tier;
+        }
+        else if (strcmp(argv[i], "--make-bundle") == 0 && i + 1 < argc) bundle_out = argv[++i];
+        else shader_arg = argv[i];
     }
 
-    printf("Found %d compiled shader(s)\n", shader_count);
-    for (int i = 0; i < shader_count; i++) {
-        printf("  [%d] %s\n", i, shaders[i].name);
+    if (blit_bench) {
+        blit_start(blit_threads);
+        int err = bench_blit(headless_w, headless_h, headless_frames);
+        blit_stop();
+        return err ? 1 : 0;
     }
-}
 
-// Find shader by name
-static int find_shader_by_name(const char *name) {
-    for (int i = 0; i < shader_count; i++) {
-        if (strcmp(shaders[i].name, name) == 0) return i;
+    // Building a bundle needs the GPU but no display
+    if (bundle_out) {
+        headless = 1;
+        output_path = "/dev/null";
     }
-    return -1;
-}
 
-// Open keyboard input device
-static int open_keyboard() {
-    for (int i = 0; i < 10; i++) {
-        char path[64];
-        snprintf(path, sizeof(path), "/dev/input/event%d", i);
-        int fd = open(path, O_RDONLY | O_NONBLOCK);
-        if (fd >= 0) {
-            // Try to grab it (ignore failure, not critical)
-            char name[256] = {0};
-            ioctl(fd, EVIOCGNAME(sizeof(name)), name);
-            if (strstr(name, "keyboard") || strstr(name, "Keyboard")) {
-                printf("Using input: %s (%s)\n", path, name);
-                return fd;
-            }
-            close(fd);
+    // Headless frames may go to stdout, so move everything else to stderr
+    FILE *out = NULL;
+    if (headless) {
+        if (headless_fps <= 0) headless_fps = 60.0;
+        if (!output_path) output_path = bench.active ? "/dev/null" : "-";
+        if (strcmp(output_path, "-") == 0) {
+            out = fdopen(dup(STDOUT_FILENO), "wb");
+            dup2(STDERR_FILENO, STDOUT_FILENO);
+        } else {
+            out = fopen(output_path, "wb");
+        }
+        if (!out) {
+            printf("Cannot open output '%s': %s\n", output_path, strerror(errno));
+            return 1;
         }
     }
-    return -1;
-}
 
-// Check for keyboard events (non-blocking)
-static void check_keyboard(int kbd_fd) {
-    if (kbd_fd < 0) return;
+    // Extract basename from shader argument (handles "shaders/plasma" -> "plasma")
+    const char *requested = get_basename(shader_arg);
 
-    struct input_event ev;
-    while (read(kbd_fd, &ev, sizeof(ev)) == sizeof(ev)) {
-        if (ev.type != EV_KEY || ev.value != 1) continue;  // Only key press
+    // The shader catalog (directories or the bundle's index) and the display
+    // come up on threads of their own while this one creates the Vulkan
+    // instance. Each is joined when something first needs it.
+    CatalogScan catalog = {bundle_path, compile, 0};
+    pthread_t catalog_tid;
+    int scanning = pthread_create(&catalog_tid, NULL, catalog_thread, &catalog) == 0;
+    if (!scanning) catalog_thread(&catalog);
 
-        switch (ev.code) {
-            case KEY_LEFT:
-                current_shader = (current_shader - 1 + shader_count) % shader_count;
-                reload_requested = 1;
-                printf("\n<< Previous shader: %s\n", shaders[current_shader].name);
-                break;
-            case KEY_RIGHT:
-                current_shader = (current_shader + 1) % shader_count;
-                reload_requested = 1;
-                printf("\n>> Next shader: %s\n", shaders[current_shader].name);
-                break;
-            case KEY_F:
-                // Signal host to toggle fullscreen via virtio-serial
-                printf("\n[F] Toggling host fullscreen...\n");
-                const char *port = find_display_port();
-                if (port) {
-                    FILE *f = fopen(port, "w");
-                    if (f) {
-                        fprintf(f, "FULLSCREEN\n");
-                        fflush(f);
-                        fclose(f);
-                    } else {
-                        printf("    (Can't open %s, press Ctrl+Alt+F on Mac host)\n", port);
-                    }
-                } else {
-                    printf("    (No display port found, press Ctrl+Alt+F on Mac host)\n");
+    // Keyboards and pointers, including ones plugged in later
+    if (!headless && input_start() != 0)
+        printf("Warning: input thread failed (%s), navigation disabled\n", strerror(errno));
+
+    // Headless renders one output at --size and never touches /dev/dri
+    DisplaySetup display = {-1, NULL};
+    pthread_t display_tid;
+    int opening = 0;
+    if (headless) {
+        outputs[0].W = headless_w;
+        outputs[0].H = headless_h;
+        output_count = 1;
+        output_mode = OUTPUTS_MIRROR;
+    } else {
+        opening = pthread_create(&display_tid, NULL, display_thread, &display) == 0;
+        if (!opening) display_thread(&display);
+    }
+
+    // Vulkan Setup (1.1 for vkGetPhysicalDeviceFormatProperties2 and dedicated allocations)
+    phase_begin(PHASE_INSTANCE);
+    VkInstance instance;
+    VK_CHECK(vkCreateInstance(&(VkInstanceCreateInfo){
+        .sType=VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+        .pApplicationInfo=&(VkApplicationInfo){
+            .sType=VK_STRUCTURE_TYPE_APPLICATION_INFO,.apiVersion=VK_API_VERSION_1_1}
+    }, NULL, &instance));
+
+    VkPhysicalDevice gpu;
+    if (select_gpu(instance, gpu_arg, &gpu) != 0) return 1;
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(gpu, &props);
+    VkPhysicalDeviceMemoryProperties memProps;
+    vkGetPhysicalDeviceMemoryProperties(gpu, &memProps);
+    phase_end(PHASE_INSTANCE);
+
+    if (opening) pthread_join(display_tid, NULL);
+    if (output_count == 0) {
+        printf("No connected display found\n");
+        return 1;
+    }
+    int drm_fd = display.drm_fd;
+    struct gbm_device *gbm = display.gbm;
+    // --outputs span: side by side in connector order, top edges aligned
+    uint32_t canvas_w = 0, canvas_h = 0;
+    for (int i = 0; i < output_count; i++) {
+        outputs[i].x = canvas_w;
+        canvas_w += outputs[i].W;
+        if (outputs[i].H > canvas_h) canvas_h = outputs[i].H;
+    }
+    int slot_count = output_count * FRAMES_IN_FLIGHT;
+    // Relative pointer moves are in pixels of what the pointer moves across
+    mouse.w = output_mode == OUTPUTS_SPAN ? canvas_w : outputs[0].W;
+    mouse.h = output_mode == OUTPUTS_SPAN ? canvas_h : outputs[0].H;
+    printf("Metalshader on %s (%ux%u)\n", props.deviceName, outputs[0].W, outputs[0].H);
+    for (int i = 0; i < output_count && output_count > 1; i++)
+        printf("  Output %d: connector %u, %ux%u@%u\n", i, outputs[i].conn->connector_id,
+               outputs[i].W, outputs[i].H, outputs[i].mode->vrefresh);
+
+    // Zero-copy scanout imports GBM BOs as dma-bufs with explicit modifiers
+    const char *zeroCopyExts[] = {
+        VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME,
+        VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME,
+        VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME,
+        VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME,
+        VK_EXT_QUEUE_FAMILY_FOREIGN_EXTENSION_NAME
+    };
+    uint32_t zeroCopyExtCount = sizeof(zeroCopyExts) / sizeof(zeroCopyExts[0]);
+    uint32_t extCount = 0;
+    vkEnumerateDeviceExtensionProperties(gpu, NULL, &extCount, NULL);
+    VkExtensionProperties *exts = calloc(extCount, sizeof(*exts));
+    vkEnumerateDeviceExtensionProperties(gpu, NULL, &extCount, exts);
+    // The compute backend stores through an RGBA view of the BGRA render
+    // target (the shader swizzles), which needs 1.1's extended usage and
+    // RGBA8 storage images
+    if (use_compute) {
+        VkFormatProperties rgba;
+        vkGetPhysicalDeviceFormatProperties(gpu, VK_FORMAT_R8G8B8A8_UNORM, &rgba);
+        if (props.apiVersion < VK_API_VERSION_1_1 ||
+            !(rgba.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)) {
+            printf("Compute: RGBA8 storage images unsupported, using the graphics pipeline\n");
+            use_compute = 0;
+        }
+    }
+
+    // --split-frame: the GPUs of the selected one's device group share one
+    // VkDevice and render a horizontal band of every frame each
+    VkPhysicalDevice splitGpus[VK_MAX_DEVICE_GROUP_SIZE];
+    uint32_t split_count = 1;
+    if (split_frame) {
+        uint32_t groupCount = 0;
+        vkEnumeratePhysicalDeviceGroups(instance, &groupCount, NULL);
+        VkPhysicalDeviceGroupProperties *groups = calloc(groupCount ? groupCount : 1, sizeof(*groups));
+        for (uint32_t i = 0; i < groupCount; i++) groups[i].sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES;
+        vkEnumeratePhysicalDeviceGroups(instance, &groupCount, groups);
+        for (uint32_t i = 0; i < groupCount; i++)
+            for (uint32_t k = 0; k < groups[i].physicalDeviceCount; k++)
+                if (groups[i].physicalDevices[k] == gpu) {
+                    split_count = groups[i].physicalDeviceCount;
+                    memcpy(splitGpus, groups[i].physicalDevices, split_count * sizeof(VkPhysicalDevice));
                 }
-                break;
-            case KEY_ESC:
-            case KEY_Q:
-                printf("\nExiting...\n");
-                exit(0);
-                break;
+        free(groups);
+        const char *why = split_count < 2 ? "no other GPU in the device group" :
+                          use_compute ? "not supported with --compute" :
+                          !split_memory_ok(&memProps) ? "no per-GPU device memory" : NULL;
+        if (why) {
+            printf("Split frame: %s, rendering on one GPU\n", why);
+            split_count = 1;
+        } else {
+            printf("Split frame: %u GPUs, one band each\n", split_count);
         }
     }
-}
+    uint32_t split_mask = (1u << split_count) - 1;
 
-int main(int argc, char **argv) {
-    // Default to "example" shader if no argument provided
-    const char *shader_arg = (argc < 2) ? "example" : argv[1];
+    // Render scale < 1 renders into a smaller image and blits up into the render target
+    int scaling = auto_scale || render_scale < 1.0f;
+    if (scaling && split_count > 1) {
+        printf("Render scale: not supported with --split-frame, rendering at native size\n");
+        scaling = auto_scale = 0;
+    }
+    if (scaling && use_compute) {
+        printf("Render scale: not supported with --compute, rendering at native size\n");
+        scaling = auto_scale = 0;
+    }
+    if (scaling) {
+        VkFormatProperties bgra;
+        vkGetPhysicalDeviceFormatProperties(gpu, VK_FORMAT_B8G8R8A8_UNORM, &bgra);
+        VkFormatFeatureFlags need = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT|VK_FORMAT_FEATURE_BLIT_SRC_BIT|
+                                    VK_FORMAT_FEATURE_BLIT_DST_BIT|VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        if ((bgra.optimalTilingFeatures & need) != need) {
+            printf("Render scale: linear blits unsupported, rendering at native size\n");
+            scaling = auto_scale = 0;
+        }
+    }
+    if (!scaling) render_scale = 1.0f;
+    if (target_fps <= 0) target_fps = 60.0;
 
-    // Extract basename from shader argument (handles "shaders/plasma" -> "plasma")
-    const char *shader_name = get_basename(shader_arg);
+    // Span: each output's viewport covers the whole canvas, shifted left by
+    // the output's position, so the fullscreen vertex shader's fragCoord runs
+    // across all of them. The compute backend indexes pixels directly.
+    if (output_mode == OUTPUTS_SPAN && output_count > 1 &&
+        (use_compute || canvas_w > props.limits.maxViewportDimensions[0] ||
+         canvas_h > props.limits.maxViewportDimensions[1] ||
+         -(float)outputs[output_count - 1].x < props.limits.viewportBoundsRange[0])) {
+        printf("Outputs: can't span a %ux%u canvas%s, mirroring\n", canvas_w, canvas_h,
+               use_compute ? " with --compute" : "");
+        output_mode = OUTPUTS_MIRROR;
+    }
 
-    // Scan available shaders in multiple directories
-    scan_all_shaders();
+    if (scanning) pthread_join(catalog_tid, NULL);
+    if (catalog.failed) return 1;
+    if (bundle_path && shader_count == 0) {
+        printf("No shaders in bundle '%s'\n", bundle_path);
+        return 1;
+    }
     if (shader_count == 0) {
         printf("No compiled shaders found.\n");
         printf("Searched: . ./shaders /root/metalshade/shaders\n");
         printf("Compile shaders with: glslangValidator -V <shader>.vert -o <shader>.vert.spv\n");
+        printf("or run with --compile to build every .frag found\n");
         return 1;
     }
 
-    // Find requested shader
-    current_shader = find_shader_by_name(shader_name);
+    // Find requested shader (the benchmark and --make-bundle always start at
+    // the first one)
+    current_shader = bench.active || bundle_out ? 0 : find_shader_by_name(requested);
     if (current_shader < 0) {
-        printf("Shader '%s' not found. Available shaders:\n", shader_name);
+        printf("Shader '%s' not found. Available shaders:\n", requested);
         for (int i = 0; i < shader_count; i++) {
-            printf("  %s\n", shaders[i].name);
+            printf("  %s\n", shader_name(i));
         }
         return 1;
     }
 
-    printf("Starting with shader: %s\n", shaders[current_shader].name);
-
-    // Open keyboard
-    int kbd_fd = open_keyboard();
-    if (kbd_fd < 0) {
-        printf("Warning: No keyboard input found, arrow key navigation disabled\n");
-    }
+    printf("Starting with shader: %s\n", shader_name(current_shader));
+    prewarm.queue = malloc(shader_count * sizeof(int));
+    prewarm.ready = malloc(shader_count * sizeof(CachedPipeline));
 
-    // DRM/GBM Setup
-    int drm_fd = open("/dev/dri/card0", O_RDWR);
-    drmSetMaster(drm_fd);
-    drmModeRes *res = drmModeGetResources(drm_fd);
-    drmModeConnector *conn = NULL;
-    for(int i=0; i<res->count_connectors; i++) {
-        conn = drmModeGetConnector(drm_fd, res->connectors[i]);
-        if(conn && conn->connection == DRM_MODE_CONNECTED) break;
-        drmModeFreeConnector(conn); conn = NULL;
+    if (bench.active) {
+        if (bench.measure <= 0) bench.measure = 1;
+        if (bench.warmup < 0) bench.warmup = 0;
+        bench.csv = fopen(csv_path, "w");
+        if (!bench.csv) {
+            printf("Cannot open '%s': %s\n", csv_path, strerror(errno));
+            return 1;
+        }
+        fprintf(bench.csv, "shader");
+        for (int s = 0; s < STAGE_COUNT; s++)
+            fprintf(bench.csv, ",%s_min_ms,%s_median_ms,%s_p99_ms", stage_names[s], stage_names[s], stage_names[s]);
+        fprintf(bench.csv, ",quality\n");
+        // Every tier gets measured, from the bottom up
+        bench.budget_ms = 0.9 * 1000.0 / target_fps;
+        quality.tier = QUALITY_LOW;
+        quality.automatic = 0;
+        for (int s = 0; s < STAGE_COUNT; s++) bench.samples[s] = malloc(bench.measure * sizeof(double));
+        printf("Bench: %d shaders, %d warm-up + %d measured frames each -> %s\n",
+               shader_count, bench.warmup, bench.measure, csv_path);
     }
-    drmModeModeInfo *mode = &conn->modes[0];
-    uint32_t W = mode->hdisplay, H = mode->vdisplay;
-    drmModeEncoder *enc = drmModeGetEncoder(drm_fd, conn->encoder_id);
-    uint32_t crtc_id = enc ? enc->crtc_id : res->crtcs[0];
 
-    struct gbm_device *gbm = gbm_create_device(drm_fd);
-    struct gbm_bo *bo = gbm_bo_create(gbm, W, H, GBM_FORMAT_XRGB8888,
-                                       GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
-    uint32_t stride = gbm_bo_get_stride(bo);
-    uint32_t handles[4] = {gbm_bo_get_handle(bo).u32, 0, 0, 0};
-    uint32_t strides[4] = {stride, 0, 0, 0};
-    uint32_t offsets[4] = {0, 0, 0, 0};
-    uint32_t fb_id;
-    drmModeAddFB2(drm_fd, W, H, GBM_FORMAT_XRGB8888, handles, strides, offsets, &fb_id, 0);
+    // Multipass: buffers are the output's own size and drawn with the
+    // graphics pipeline, one GPU and one viewport per output
+    int multipass_shaders = 0;
+    for (int i = 0; i < shader_count; i++) multipass_shaders += shaders[i].buffers != 0;
+    const char *no_multipass = use_compute ? "--compute" : split_count > 1 ? "--split-frame" :
+                               scaling ? "--scale" : output_mode == OUTPUTS_SPAN ? "spanned outputs" : NULL;
+    multipass.enabled = !no_multipass;
+    int tunable_shaders = 0;
+    for (int i = 0; i < shader_count; i++) tunable_shaders += shaders[i].quality_count != 0;
+    // Headless renders stay reproducible: no --quality auto
+    if (headless && !bench.active) quality.automatic = 0;
+    if (tunable_shaders)
+        printf("Quality: %s%s, %d shader(s) with tunables\n", quality.automatic ? "auto, from " : "",
+               bench.active ? "every tier" : quality_tier_names[quality.tier], tunable_shaders);
+    if (multipass_shaders)
+        printf(no_multipass ? "Multipass: %d shader(s) with buffers, not supported with %s; Image passes only\n" :
+                              "Multipass: %d shader(s) with Buffer A-D passes\n", multipass_shaders, no_multipass);
 
-    // Vulkan Setup
-    VkInstance instance;
-    VK_CHECK(vkCreateInstance(&(VkInstanceCreateInfo){
-        .sType=VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO}, NULL, &instance));
+    // Split frame composites in host memory, which is the copy path
+    int zero_copy = !force_copy && !rgb565 && !headless && !use_compute && split_count == 1 &&
+                    props.apiVersion >= VK_API_VERSION_1_1;
+    for (uint32_t i = 0; i < zeroCopyExtCount && zero_copy; i++)
+        zero_copy = has_device_ext(exts, extCount, zeroCopyExts[i]);
+    free(exts);
 
-    uint32_t gpuCount = 1; VkPhysicalDevice gpu;
-    vkEnumeratePhysicalDevices(instance, &gpuCount, &gpu);
-    VkPhysicalDeviceProperties props;
-    vkGetPhysicalDeviceProperties(gpu, &props);
-    VkPhysicalDeviceMemoryProperties memProps;
-    vkGetPhysicalDeviceMemoryProperties(gpu, &memProps);
-    printf("Metalshader on %s (%ux%u)\n", props.deviceName, W, H);
+    // Graphics on the first family that can also run the compute backend.
+    // A transfer-only family is usually a DMA engine, which reads frames
+    // back without taking time from rendering; split frame copies per GPU
+    // on the graphics queue instead.
+    phase_begin(PHASE_DEVICE);
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, NULL);
+    VkQueueFamilyProperties *families = calloc(familyCount ? familyCount : 1, sizeof(*families));
+    vkGetPhysicalDeviceQueueFamilyProperties(gpu, &familyCount, families);
+    uint32_t gfxFamily = UINT32_MAX, xferFamily = UINT32_MAX;
+    for (uint32_t i = 0; i < familyCount; i++) {
+        VkQueueFlags flags = families[i].queueFlags, gc = VK_QUEUE_GRAPHICS_BIT|VK_QUEUE_COMPUTE_BIT;
+        if (gfxFamily == UINT32_MAX && (flags & gc) == gc) gfxFamily = i;
+        if (xferFamily == UINT32_MAX && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & gc)) xferFamily = i;
+    }
+    if (gfxFamily == UINT32_MAX) gfxFamily = 0;
+    if (split_count > 1) xferFamily = UINT32_MAX;
+    uint32_t timestampBits = familyCount ? families[gfxFamily].timestampValidBits : 0;
+    free(families);
 
     VkDevice device;
     VK_CHECK(vkCreateDevice(gpu, &(VkDeviceCreateInfo){
         .sType=VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .queueCreateInfoCount=1,
-        .pQueueCreateInfos=&(VkDeviceQueueCreateInfo){
-            .sType=VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-            .queueCount=1,.pQueuePriorities=&(float){1.0f}
-        }
+        .pNext=split_count > 1 ? &(VkDeviceGroupDeviceCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_DEVICE_GROUP_DEVICE_CREATE_INFO,
+            .physicalDeviceCount=split_count,.pPhysicalDevices=splitGpus
+        } : NULL,
+        .queueCreateInfoCount=xferFamily != UINT32_MAX ? 2 : 1,
+        .pQueueCreateInfos=(VkDeviceQueueCreateInfo[]){
+            {.sType=VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+             .queueFamilyIndex=gfxFamily,.queueCount=1,.pQueuePriorities=&(float){1.0f}},
+            {.sType=VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+             .queueFamilyIndex=xferFamily,.queueCount=1,.pQueuePriorities=&(float){1.0f}}
+        },
+        .enabledExtensionCount=zero_copy ? zeroCopyExtCount : 0,
+        .ppEnabledExtensionNames=zeroCopyExts
     }, NULL, &device));
 
-    VkQueue queue;
-    vkGetDeviceQueue(device, 0, 0, &queue);
+    VkQueue queue, xferQueue = VK_NULL_HANDLE;
+    vkGetDeviceQueue(device, gfxFamily, 0, &queue);
+    if (xferFamily != UINT32_MAX) vkGetDeviceQueue(device, xferFamily, 0, &xferQueue);
+    gpu_memory.device = device;
+    gpu_memory.props = memProps;
 
-    // Render target image (LINEAR + HOST_VISIBLE)
-    VkImage rtImg;
-    VK_CHECK(vkCreateImage(device, &(VkImageCreateInfo){
-        .sType=VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .imageType=VK_IMAGE_TYPE_2D,.format=VK_FORMAT_B8G8R8A8_UNORM,
-        .extent={W,H,1},.mipLevels=1,.arrayLayers=1,
-        .samples=VK_SAMPLE_COUNT_1_BIT,.tiling=VK_IMAGE_TILING_LINEAR,
-        .usage=VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
-    }, NULL, &rtImg));
-    VkMemoryRequirements rtReq;
-    vkGetImageMemoryRequirements(device, rtImg, &rtReq);
-    VkDeviceMemory rtMem;
-    VK_CHECK(vkAllocateMemory(device, &(VkMemoryAllocateInfo){
-        .sType=VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize=rtReq.size,
-        .memoryTypeIndex=find_mem(&memProps, rtReq.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
-    }, NULL, &rtMem));
-    VK_CHECK(vkBindImageMemory(device, rtImg, rtMem, 0));
-    void *rtPtr; VK_CHECK(vkMapMemory(device, rtMem, 0, VK_WHOLE_SIZE, 0, &rtPtr));
+    char cachePath[600] = "";
+    pipeline_cache_path(&props, cachePath, sizeof(cachePath));
+    VkPipelineCache pipelineCache = load_pipeline_cache(device, &props, cachePath);
+    phase_end(PHASE_DEVICE);
+    phase_begin(PHASE_RESOURCES);
 
-    VkImageView rtView;
-    VK_CHECK(vkCreateImageView(device, &(VkImageViewCreateInfo){
-        .sType=VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image=rtImg,.viewType=VK_IMAGE_VIEW_TYPE_2D,
-        .format=VK_FORMAT_B8G8R8A8_UNORM,
-        .subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
-    }, NULL, &rtView));
+    // Zero-copy: every ring slot of every output renders into its own
+    // scanout BO. Any slot failing to import drops them all back to the copy path.
+    if (zero_copy) {
+        PFN_vkGetMemoryFdPropertiesKHR getMemoryFdProperties =
+            (PFN_vkGetMemoryFdPropertiesKHR)vkGetDeviceProcAddr(device, "vkGetMemoryFdPropertiesKHR");
+        uint64_t mods[64];
+        VkFormatFeatureFlags required = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT |
+                                        (scaling ? VK_FORMAT_FEATURE_BLIT_DST_BIT : 0);
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                  (scaling ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0);
+        uint32_t mod_count = query_render_modifiers(gpu, required, mods, 64);
+        int imported = 0;
+        while (mod_count && getMemoryFdProperties && imported < slot_count) {
+            Output *o = &outputs[imported / FRAMES_IN_FLIGHT];
+            if (import_scanout_slot(device, &memProps, getMemoryFdProperties, gbm, drm_fd, o->W, o->H,
+                                    mods, mod_count, usage, &o->slots[imported % FRAMES_IN_FLIGHT]) != 0)
+                break;
+            imported++;
+        }
+        if (imported < slot_count) {
+            while (imported > 0) {
+                imported--;
+                release_scanout_slot(device, drm_fd,
+                                     &outputs[imported / FRAMES_IN_FLIGHT].slots[imported % FRAMES_IN_FLIGHT]);
+            }
+            zero_copy = 0;
+        }
+    }
+    // Zero-copy frames never leave the GPU
+    int use_xfer = xferQueue != VK_NULL_HANDLE && !zero_copy;
+    if (headless) {
+        printf("Headless: %d frames at %ux%u, %.2f fps -> %s\n", headless_frames, outputs[0].W, outputs[0].H,
+               headless_fps, strcmp(output_path, "-") == 0 ? "stdout" : output_path);
+    } else {
+        printf("Scanout: %s%s\n", zero_copy ? "zero-copy (dma-buf import)" : "copy via host memory",
+               use_xfer ? ", read back on a transfer queue" : "");
+        if (output_count > 1)
+            printf("Outputs: %d, %s\n", output_count,
+                   output_mode == OUTPUTS_SPAN ? "spanned" : output_mode == OUTPUTS_EACH ? "one shader each" : "mirrored");
+    }
+
+    // Copy path: finished slots are blitted into a scanout BO. Page flipping
+    // uses a second one so the copy never lands in the buffer on screen.
+    if (headless) use_flip = 0;
+    uint32_t scanout_format = rgb565 ? GBM_FORMAT_RGB565 : GBM_FORMAT_XRGB8888;
+    for (int k = 0; k < output_count * (use_flip ? 2 : 1) && !zero_copy && !headless; k++) {
+        Output *o = &outputs[k / (use_flip ? 2 : 1)];
+        int i = k % (use_flip ? 2 : 1);
+        o->copy_bo[i] = gbm_bo_create(gbm, o->W, o->H, scanout_format,
+                                      GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
+        uint32_t stride = gbm_bo_get_stride(o->copy_bo[i]);
+        uint32_t handles[4] = {gbm_bo_get_handle(o->copy_bo[i]).u32, 0, 0, 0};
+        uint32_t strides[4] = {stride, 0, 0, 0};
+        uint32_t offsets[4] = {0, 0, 0, 0};
+        drmModeAddFB2(drm_fd, o->W, o->H, scanout_format, handles, strides, offsets, &o->copy_fb[i], 0);
+        if (use_flip) o->copy_back = 1;
+    }
+    if (!zero_copy && !headless) {
+        blit_start(blit_threads);
+        printf("Blit: %d thread(s), %s rows%s\n", blit.count + 1, blit.row == blit_row_plain ? "plain" : "SIMD",
+               rgb565 ? ", converted to RGB565" : "");
+    }
+
+    // Copy path render targets, one per ring slot: OPTIMAL in device-local
+    // memory, copied after every frame into a host-visible readback buffer
+    // (cached where available, since the CPU reads it back)
+    for (int k = 0; k < slot_count && !zero_copy; k++) {
+        Output *o = &outputs[k / FRAMES_IN_FLIGHT];
+        uint32_t W = o->W, H = o->H;
+        FrameSlot *s = &o->slots[k % FRAMES_IN_FLIGHT];
+        VK_CHECK(vkCreateImage(device, &(VkImageCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType=VK_IMAGE_TYPE_2D,.format=VK_FORMAT_B8G8R8A8_UNORM,
+            .extent={W,H,1},.mipLevels=1,.arrayLayers=1,
+            .samples=VK_SAMPLE_COUNT_1_BIT,.tiling=VK_IMAGE_TILING_OPTIMAL,
+            .flags=use_compute ? VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT|VK_IMAGE_CREATE_EXTENDED_USAGE_BIT : 0,
+            .usage=VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT|VK_IMAGE_USAGE_TRANSFER_SRC_BIT|
+                   (use_compute ? VK_IMAGE_USAGE_STORAGE_BIT : 0)|(scaling ? VK_IMAGE_USAGE_TRANSFER_DST_BIT : 0),
+            .sharingMode=use_xfer ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE,
+            .queueFamilyIndexCount=use_xfer ? 2 : 0,.pQueueFamilyIndices=(uint32_t[]){gfxFamily, xferFamily}
+        }, NULL, &s->rtImg));
+        memory_bind_image(s->rtImg, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        VK_CHECK(vkCreateBuffer(device, &(VkBufferCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size=(VkDeviceSize)W * H * 4,.usage=VK_BUFFER_USAGE_TRANSFER_DST_BIT
+        }, NULL, &s->readBuf));
+        s->rtPtr = memory_bind_buffer(s->readBuf, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                      VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+        o->rowPitch = (VkDeviceSize)W * 4;
+
+        VK_CHECK(vkCreateImageView(device, &(VkImageViewCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image=s->rtImg,.viewType=VK_IMAGE_VIEW_TYPE_2D,
+            .format=VK_FORMAT_B8G8R8A8_UNORM,
+            .subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+        }, NULL, &s->rtView));
+        if (use_compute)
+            VK_CHECK(vkCreateImageView(device, &(VkImageViewCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                .image=s->rtImg,.viewType=VK_IMAGE_VIEW_TYPE_2D,
+                .format=VK_FORMAT_R8G8B8A8_UNORM,
+                .subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+            }, NULL, &s->storageView));
+    }
 
-    // Create texture
+    // Create texture (device-local; uploaded through a staging buffer below)
     VkImage texImg;
     VK_CHECK(vkCreateImage(device, &(VkImageCreateInfo){
         .sType=VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType=VK_IMAGE_TYPE_2D,.format=VK_FORMAT_R8G8B8A8_UNORM,
         .extent={256,256,1},.mipLevels=1,.arrayLayers=1,
-        .samples=VK_SAMPLE_COUNT_1_BIT,.tiling=VK_IMAGE_TILING_LINEAR,
-        .usage=VK_IMAGE_USAGE_SAMPLED_BIT,.initialLayout=VK_IMAGE_LAYOUT_PREINITIALIZED
+        .samples=VK_SAMPLE_COUNT_1_BIT,.tiling=VK_IMAGE_TILING_OPTIMAL,
+        .usage=VK_IMAGE_USAGE_SAMPLED_BIT|VK_IMAGE_USAGE_TRANSFER_DST_BIT
     }, NULL, &texImg));
-    VkMemoryRequirements texReq;
-    vkGetImageMemoryRequirements(device, texImg, &texReq);
-    VkDeviceMemory texMem;
-    VK_CHECK(vkAllocateMemory(device, &(VkMemoryAllocateInfo){
-        .sType=VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize=texReq.size,
-        .memoryTypeIndex=find_mem(&memProps, texReq.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
-    }, NULL, &texMem));
-    VK_CHECK(vkBindImageMemory(device, texImg, texMem, 0));
-
-    // Upload texture data
-    void *texPtr; VK_CHECK(vkMapMemory(device, texMem, 0, VK_WHOLE_SIZE, 0, &texPtr));
-    VkSubresourceLayout texLayout;
-    vkGetImageSubresourceLayout(device, texImg, &(VkImageSubresource){
-        VK_IMAGE_ASPECT_COLOR_BIT,0,0}, &texLayout);
-    uint8_t *texData = malloc(256*256*4);
-    generate_texture(texData);
-    for (int y = 0; y < 256; y++)
-        memcpy((char*)texPtr + y * texLayout.rowPitch, texData + y * 256 * 4, 256 * 4);
-    free(texData);
-    vkUnmapMemory(device, texMem);
+    memory_bind_image(texImg, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    VkBuffer texStaging;
+    VK_CHECK(vkCreateBuffer(device, &(VkBufferCreateInfo){
+        .sType=VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size=256*256*4,.usage=VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+    }, NULL, &texStaging));
+    generate_texture(memory_bind_buffer(texStaging, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0));
 
     VkImageView texView;
     VK_CHECK(vkCreateImageView(device, &(VkImageViewCreateInfo){
@@ -389,7 +4946,8 @@ int main(int argc, char **argv) {
     VkSampler sampler;
     VK_CHECK(vkCreateSampler(device, &(VkSamplerCreateInfo){
         .sType=VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-        .magFilter=VK_FILTER_LINEAR,.minFilter=VK_FILTER_LINEAR,
+        .magFilter=VK_FILTER_LINEAR,.minFilter=VK_FILTER_LINEAR,.mipmapMode=VK_SAMPLER_MIPMAP_MODE_LINEAR,
+        .maxLod=VK_LOD_CLAMP_NONE,
         .addressModeU=VK_SAMPLER_ADDRESS_MODE_REPEAT,
         .addressModeV=VK_SAMPLER_ADDRESS_MODE_REPEAT,
         .addressModeW=VK_SAMPLER_ADDRESS_MODE_REPEAT
@@ -414,40 +4972,106 @@ int main(int argc, char **argv) {
         }
     }, NULL, &renderPass));
 
-    VkFramebuffer framebuffer;
-    VK_CHECK(vkCreateFramebuffer(device, &(VkFramebufferCreateInfo){
-        .sType=VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-        .renderPass=renderPass,.attachmentCount=1,.pAttachments=&rtView,
-        .width=W,.height=H,.layers=1
-    }, NULL, &framebuffer));
-
-    // Uniform buffer
-    VkBuffer uboBuf;
+    // Multipass: buffer passes draw into RGBA16F targets, which every pass
+    // samples. Barriers between them are recorded by the graph, so the
+    // attachment stays in COLOR_ATTACHMENT_OPTIMAL across the render pass.
+    multipass.device = device;
+    multipass.sampler = sampler;
+    if (multipass.enabled) {
+        VK_CHECK(vkCreateRenderPass(device, &(VkRenderPassCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+            .attachmentCount=1,
+            .pAttachments=&(VkAttachmentDescription){
+                .format=VK_FORMAT_R16G16B16A16_SFLOAT,.samples=VK_SAMPLE_COUNT_1_BIT,
+                .loadOp=VK_ATTACHMENT_LOAD_OP_CLEAR,.storeOp=VK_ATTACHMENT_STORE_OP_STORE,
+                .initialLayout=VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                .finalLayout=VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+            },
+            .subpassCount=1,
+            .pSubpasses=&(VkSubpassDescription){
+                .pipelineBindPoint=VK_PIPELINE_BIND_POINT_GRAPHICS,
+                .colorAttachmentCount=1,
+                .pColorAttachments=&(VkAttachmentReference){0,VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL}
+            }
+        }, NULL, &multipass.renderPass));
+        VK_CHECK(vkCreateSampler(device, &(VkSamplerCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .magFilter=VK_FILTER_LINEAR,.minFilter=VK_FILTER_LINEAR,
+            .addressModeU=VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeV=VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeW=VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE
+        }, NULL, &multipass.bufferSampler));
+    }
+
+    // Per-slot framebuffer and uniform buffer, so the UBO written for frame
+    // N+1 never overwrites the one frame N is still reading
+    for (int k = 0; k < slot_count; k++) {
+        uint32_t W = outputs[k / FRAMES_IN_FLIGHT].W, H = outputs[k / FRAMES_IN_FLIGHT].H;
+        FrameSlot *s = &outputs[k / FRAMES_IN_FLIGHT].slots[k % FRAMES_IN_FLIGHT];
+        VK_CHECK(vkCreateFramebuffer(device, &(VkFramebufferCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass=renderPass,.attachmentCount=1,.pAttachments=&s->rtView,
+            .width=W,.height=H,.layers=1
+        }, NULL, &s->framebuffer));
+
+        // Render scale < 1: full-size offscreen target, of which only the
+        // scaled corner is drawn, so the scale can change every frame
+        if (scaling) {
+            VK_CHECK(vkCreateImage(device, &(VkImageCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+                .imageType=VK_IMAGE_TYPE_2D,.format=VK_FORMAT_B8G8R8A8_UNORM,
+                .extent={W,H,1},.mipLevels=1,.arrayLayers=1,
+                .samples=VK_SAMPLE_COUNT_1_BIT,.tiling=VK_IMAGE_TILING_OPTIMAL,
+                .usage=VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT|VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+            }, NULL, &s->lowImg));
+            memory_bind_image(s->lowImg, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+            VK_CHECK(vkCreateImageView(device, &(VkImageViewCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+                .image=s->lowImg,.viewType=VK_IMAGE_VIEW_TYPE_2D,
+                .format=VK_FORMAT_B8G8R8A8_UNORM,
+                .subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+            }, NULL, &s->lowView));
+            VK_CHECK(vkCreateFramebuffer(device, &(VkFramebufferCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+                .renderPass=renderPass,.attachmentCount=1,.pAttachments=&s->lowView,
+                .width=W,.height=H,.layers=1
+            }, NULL, &s->lowFramebuffer));
+        }
+
+    }
+
+    // UBO ring: one persistently mapped buffer with an aligned entry per ring
+    // slot, selected by dynamic offset, so frame N+1's entry never overlaps
+    // the one frame N is still reading
+    VkDeviceSize uboAlign = props.limits.minUniformBufferOffsetAlignment ? props.limits.minUniformBufferOffsetAlignment : 1;
+    VkDeviceSize uboStride = (sizeof(ShaderToyUBO) + uboAlign - 1) / uboAlign * uboAlign;
+    VkBuffer uboRing;
     VK_CHECK(vkCreateBuffer(device, &(VkBufferCreateInfo){
         .sType=VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size=64,.usage=VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-    }, NULL, &uboBuf));
-    VkMemoryRequirements uboReq;
-    vkGetBufferMemoryRequirements(device, uboBuf, &uboReq);
-    VkDeviceMemory uboMem;
-    VK_CHECK(vkAllocateMemory(device, &(VkMemoryAllocateInfo){
-        .sType=VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-        .allocationSize=uboReq.size,
-        .memoryTypeIndex=find_mem(&memProps, uboReq.memoryTypeBits,
-            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
-    }, NULL, &uboMem));
-    VK_CHECK(vkBindBufferMemory(device, uboBuf, uboMem, 0));
-    void *uboPtr; vkMapMemory(device, uboMem, 0, 64, 0, &uboPtr);
-
-    // Descriptor setup
-    VkDescriptorSetLayoutBinding bindings[2] = {
-        {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT},
-        {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT}
+        .size=uboStride * slot_count,.usage=VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
+    }, NULL, &uboRing));
+    uint8_t *uboMapping = memory_bind_buffer(uboRing, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT|VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0);
+    for (int k = 0; k < slot_count; k++) {
+        FrameSlot *s = &outputs[k / FRAMES_IN_FLIGHT].slots[k % FRAMES_IN_FLIGHT];
+        s->uboOffset = (uint32_t)(uboStride * k);
+        s->uboPtr = uboMapping + s->uboOffset;
+    }
+
+    // Descriptor setup: iChannel0-3 at bindings 1 and 3-5
+    // (binding 2, the compute backend's output image, only exists with --compute)
+    VkDescriptorSetLayoutBinding bindings[6] = {
+        {0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1,
+         VK_SHADER_STAGE_VERTEX_BIT|VK_SHADER_STAGE_FRAGMENT_BIT|VK_SHADER_STAGE_COMPUTE_BIT},
+        {1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT|VK_SHADER_STAGE_COMPUTE_BIT},
+        {3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT|VK_SHADER_STAGE_COMPUTE_BIT},
+        {4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT|VK_SHADER_STAGE_COMPUTE_BIT},
+        {5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT|VK_SHADER_STAGE_COMPUTE_BIT},
+        {2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT}
     };
     VkDescriptorSetLayout descLayout;
     VK_CHECK(vkCreateDescriptorSetLayout(device, &(VkDescriptorSetLayoutCreateInfo){
         .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .bindingCount=2,.pBindings=bindings
+        .bindingCount=use_compute ? 6 : 5,.pBindings=bindings
     }, NULL, &descLayout));
 
     VkPipelineLayout pipelineLayout;
@@ -456,207 +5080,658 @@ int main(int argc, char **argv) {
         .setLayoutCount=1,.pSetLayouts=&descLayout
     }, NULL, &pipelineLayout));
 
-    // Descriptor pool
+    // Everything a pipeline needs exists now, so the first frame's start
+    // building on the pre-warm worker while the rest is set up
+    prewarm.builder = (PipelineBuilder){device, pipelineCache, pipelineLayout, renderPass,
+                                        use_compute, {workgroup[0], workgroup[1]}, multipass.renderPass};
+    if (bundle_out) {
+        int failed = make_bundle(bundle_out, &prewarm.builder) != 0;
+        save_pipeline_cache(device, pipelineCache, cachePath);
+        return failed;
+    }
+    phase_begin(PHASE_PIPELINES);
+    for (int i = 0; i < output_count; i++) {
+        outputs[i].shader = output_shader(i, current_shader);
+        if (!prewarm_pending(outputs[i].shader)) prewarm.queue[prewarm.queue_len++] = outputs[i].shader;
+    }
+    int prewarm_err = pthread_create(&prewarm.thread, NULL, prewarm_thread, NULL);
+    if (prewarm_err != 0)
+        printf("Warning: pre-warm thread failed (%s), building the first shaders here\n", strerror(prewarm_err));
+
+    // Descriptor pool: one set per ring slot, plus one per buffer pass with
+    // multipass. All of them start out with the texture on every channel.
+    int sets_per_slot = multipass.enabled ? PASS_COUNT : 1;
     VkDescriptorPoolSize poolSizes[] = {
-        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
-        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1}
+        {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, slot_count * sets_per_slot},
+        {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, slot_count * sets_per_slot * 4},
+        {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, slot_count}
     };
     VkDescriptorPool descPool;
     VK_CHECK(vkCreateDescriptorPool(device, &(VkDescriptorPoolCreateInfo){
         .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-        .maxSets=1,.poolSizeCount=2,.pPoolSizes=poolSizes
+        .maxSets=slot_count * sets_per_slot,.poolSizeCount=use_compute ? 3 : 2,.pPoolSizes=poolSizes
     }, NULL, &descPool));
-    VkDescriptorSet descSet;
-    VK_CHECK(vkAllocateDescriptorSets(device, &(VkDescriptorSetAllocateInfo){
-        .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        .descriptorPool=descPool,.descriptorSetCount=1,.pSetLayouts=&descLayout
-    }, &descSet));
-
-    VkWriteDescriptorSet writes[2] = {
-        {.sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-         .dstSet=descSet,.dstBinding=0,.descriptorCount=1,
-         .descriptorType=VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-         .pBufferInfo=&(VkDescriptorBufferInfo){uboBuf,0,64}},
-        {.sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-         .dstSet=descSet,.dstBinding=1,.descriptorCount=1,
-         .descriptorType=VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-         .pImageInfo=&(VkDescriptorImageInfo){sampler,texView,VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL}}
-    };
-    vkUpdateDescriptorSets(device, 2, writes, 0, NULL);
+    for (int k = 0; k < slot_count * sets_per_slot; k++) {
+        FrameSlot *s = &outputs[k / sets_per_slot / FRAMES_IN_FLIGHT].slots[k / sets_per_slot % FRAMES_IN_FLIGHT];
+        int pass = k % sets_per_slot == 0 ? IMAGE_PASS : k % sets_per_slot - 1;
+        VkDescriptorSet *set = pass == IMAGE_PASS ? &s->descSet : &s->passSets[pass];
+        VK_CHECK(vkAllocateDescriptorSets(device, &(VkDescriptorSetAllocateInfo){
+            .sType=VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+            .descriptorPool=descPool,.descriptorSetCount=1,.pSetLayouts=&descLayout
+        }, set));
+
+        VkDescriptorImageInfo channel = {sampler, texView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+        VkWriteDescriptorSet writes[6] = {
+            {.sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+             .dstSet=*set,.dstBinding=0,.descriptorCount=1,
+             .descriptorType=VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+             .pBufferInfo=&(VkDescriptorBufferInfo){uboRing,0,sizeof(ShaderToyUBO)}},
+            [5]={.sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+             .dstSet=*set,.dstBinding=2,.descriptorCount=1,
+             .descriptorType=VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+             .pImageInfo=&(VkDescriptorImageInfo){VK_NULL_HANDLE,s->storageView,VK_IMAGE_LAYOUT_GENERAL}}
+        };
+        for (int c = 0; c < 4; c++) {
+            writes[1 + c] = (VkWriteDescriptorSet){
+                .sType=VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet=*set,.dstBinding=channel_bindings[c],.descriptorCount=1,
+                .descriptorType=VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,.pImageInfo=&channel
+            };
+            s->channelViews[pass][c] = texView;
+        }
+        vkUpdateDescriptorSets(device, use_compute ? 6 : 5, writes, 0, NULL);
+    }
 
-    // Command pool
-    VkCommandPool cmdPool;
+    // Command pool. Slots keep their command buffer from frame to frame and
+    // re-record it on their own, see the render loop.
+    VkCommandPool cmdPool, xferPool = VK_NULL_HANDLE;
     VK_CHECK(vkCreateCommandPool(device, &(VkCommandPoolCreateInfo){
-        .sType=VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO}, NULL, &cmdPool));
-    VkCommandBuffer cmd;
-    VK_CHECK(vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo){
-        .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool=cmdPool,.level=VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount=1
-    }, &cmd));
+        .sType=VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags=VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,.queueFamilyIndex=gfxFamily}, NULL, &cmdPool));
+    if (use_xfer)
+        VK_CHECK(vkCreateCommandPool(device, &(VkCommandPoolCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,.queueFamilyIndex=xferFamily}, NULL, &xferPool));
+    for (int k = 0; k < slot_count; k++) {
+        FrameSlot *s = &outputs[k / FRAMES_IN_FLIGHT].slots[k % FRAMES_IN_FLIGHT];
+        VK_CHECK(vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo){
+            .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool=cmdPool,.level=VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount=1
+        }, &s->cmd));
+        VK_CHECK(vkCreateFence(device, &(VkFenceCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_FENCE_CREATE_INFO}, NULL, &s->fence));
+        // Transfer queue: the copy is the same every frame, so record it once
+        if (!use_xfer) continue;
+        Output *o = &outputs[k / FRAMES_IN_FLIGHT];
+        VK_CHECK(vkAllocateCommandBuffers(device, &(VkCommandBufferAllocateInfo){
+            .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool=xferPool,.level=VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount=1
+        }, &s->xferCmd));
+        VK_CHECK(vkCreateSemaphore(device, &(VkSemaphoreCreateInfo){
+            .sType=VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO}, NULL, &s->rendered));
+        vkBeginCommandBuffer(s->xferCmd, &(VkCommandBufferBeginInfo){
+            .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO});
+        readback_copy(s->xferCmd, s, o->W, &(VkRect2D){{0,0},{o->W,o->H}}, 1, 0);
+        vkEndCommandBuffer(s->xferCmd);
+    }
+
+    // --bench and --scale auto: two GPU timestamps per ring slot, around the frame's work
+    VkQueryPool queryPool = VK_NULL_HANDLE;
+    if (bench.active || auto_scale) {
+        if (timestampBits) {
+            VK_CHECK(vkCreateQueryPool(device, &(VkQueryPoolCreateInfo){
+                .sType=VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+                .queryType=VK_QUERY_TYPE_TIMESTAMP,.queryCount=2 * slot_count
+            }, NULL, &queryPool));
+            timestamp_mask = timestampBits >= 64 ? ~0ull : (1ull << timestampBits) - 1;
+        } else {
+            printf("Queue has no timestamps:%s%s\n", bench.active ? " GPU times left empty" : "",
+                   auto_scale ? " fixed render scale" : "");
+            auto_scale = 0;
+        }
+    }
 
-    // Transition texture
+    // Upload the texture. Split frame: on every GPU, into its own instance.
+    VkCommandBuffer cmd = outputs[0].slots[0].cmd;
+    VkFence fence = outputs[0].slots[0].fence;
     vkBeginCommandBuffer(cmd, &(VkCommandBufferBeginInfo){
         .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO});
-    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-        0, NULL, 0, NULL, 1, &(VkImageMemoryBarrier){
-            .sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-            .srcAccessMask=VK_ACCESS_HOST_WRITE_BIT,
-            .dstAccessMask=VK_ACCESS_SHADER_READ_BIT,
-            .oldLayout=VK_IMAGE_LAYOUT_PREINITIALIZED,
-            .newLayout=VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            .image=texImg,
-            .subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
-        });
+    textures_init(device, gpu, queue, cmdPool, split_count > 1 ? split_mask : 0, texView, cmd);
+    VkImageMemoryBarrier texBarrier = {
+        .sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .dstAccessMask=VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout=VK_IMAGE_LAYOUT_UNDEFINED,.newLayout=VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,.dstQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,
+        .image=texImg,.subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+        0, NULL, 0, NULL, 1, &texBarrier);
+    vkCmdCopyBufferToImage(cmd, texStaging, texImg, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &(VkBufferImageCopy){
+        .imageSubresource={VK_IMAGE_ASPECT_COLOR_BIT,0,0,1},.imageExtent={256,256,1}});
+    texBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    texBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    texBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    texBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT|VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+        0, NULL, 0, NULL, 1, &texBarrier);
     vkEndCommandBuffer(cmd);
-    VkFence fence;
-    VK_CHECK(vkCreateFence(device, &(VkFenceCreateInfo){
-        .sType=VK_STRUCTURE_TYPE_FENCE_CREATE_INFO}, NULL, &fence));
     VK_CHECK(vkQueueSubmit(queue, 1, &(VkSubmitInfo){
         .sType=VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext=split_count > 1 ? &(VkDeviceGroupSubmitInfo){
+            .sType=VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO,
+            .commandBufferCount=1,.pCommandBufferDeviceMasks=&split_mask
+        } : NULL,
         .commandBufferCount=1,.pCommandBuffers=&cmd
     }, fence));
     VK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
     vkResetFences(device, 1, &fence);
+    memory_report();
 
-    // Get render target layout
-    VkSubresourceLayout rtLayout;
-    vkGetImageSubresourceLayout(device, rtImg, &(VkImageSubresource){
-        VK_IMAGE_ASPECT_COLOR_BIT,0,0}, &rtLayout);
+    uint32_t vrefresh = 0;  // Of the fastest output
+    for (int i = 0; i < output_count && !headless; i++) {
+        Output *o = &outputs[i];
+        o->screen_fb = zero_copy ? o->slots[0].fb_id : o->copy_fb[0];
+        drmModeSetCrtc(drm_fd, o->crtc_id, o->screen_fb, 0, 0, &o->conn->connector_id, 1, o->mode);
+        if (o->mode->vrefresh > vrefresh) vrefresh = o->mode->vrefresh;
+    }
 
-    drmModeSetCrtc(drm_fd, crtc_id, fb_id, 0, 0, &conn->connector_id, 1, mode);
+    if (auto_scale)
+        printf("Render scale: auto, targeting %.1f FPS\n", target_fps);
+    else if (scaling)
+        printf("Render scale: %.2f (%ux%u)\n", render_scale,
+               (uint32_t)(outputs[0].W * render_scale + 0.5f), (uint32_t)(outputs[0].H * render_scale + 0.5f));
+    if (use_compute) printf("Compute backend: %ux%u workgroups\n", workgroup[0], workgroup[1]);
+    phase_end(PHASE_RESOURCES);
 
-    // Load initial shader
-    VkPipeline pipeline = VK_NULL_HANDLE;
-    VkShaderModule vm = VK_NULL_HANDLE, fm = VK_NULL_HANDLE;
+    // There is nothing to show until the initial shaders exist: wait for
+    // the worker to finish them, or build them here without one
+    for (int i = 0; i < output_count && prewarm_err != 0; i++) {
+        if (lru_ready(outputs[i].shader)) continue;
+        CachedPipeline built = build_pipeline(&prewarm.builder, outputs[i].shader, quality_tier());
+        if (built.pipeline == VK_NULL_HANDLE) {
+            printf("Failed to load shaders for '%s'\n", shader_name(outputs[i].shader));
+            return 1;
+        }
+        lru_insert(device, built, 0);
+    }
+    for (;;) {
+        int missing = 0;
+        for (int i = 0; i < output_count; i++) missing |= !lru_ready(outputs[i].shader);
+        if (!missing) break;
+        prewarm_wait();
+        int failed = prewarm_collect(device, 0);
+        if (failed >= 0) {
+            printf("Failed to load shaders for '%s'\n", shader_name(failed));
+            return 1;
+        }
+    }
+    phase_end(PHASE_PIPELINES);
+    int bound_shader = current_shader;
+    printf("Loaded shader: %s\n", shader_name(current_shader));
+    // Offline, only --bench switches shaders (and quality tiers)
+    if (!headless || bench.active) prewarm_neighbours(prewarm_all);
+    // A bundle's shaders have no sources to watch
+    if (!headless && !bench.active && !bundle_path) start_live_reload();
+
+    // Everything the loop waits on goes into one epoll set
+    events.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (events.epfd < 0) {
+        printf("epoll_create1 failed: %s\n", strerror(errno));
+        return 1;
+    }
+    events.drm_fd = headless ? -1 : drm_fd;
+    watch_event_fd(input.wake_fd, EVENT_INPUT, EPOLLIN);
+    watch_event_fd(events.drm_fd, EVENT_DRM, EPOLLIN);
+    watch_event_fd(live.fd, EVENT_INOTIFY, EPOLLIN | EPOLLET);
+    // Page flips pace the loop to vblank; without them it would spin, so
+    // it defaults to the fastest output's refresh rate. Offline modes run flat out.
+    int free_running = headless || bench.active;
+    if (max_fps < 0) max_fps = use_flip || free_running ? 0 : vrefresh;
+    if (!headless) start_frame_timer(max_fps);
+    playback.offline = free_running;
+    if (timestep_fps > 0 && !free_running) {
+        playback.step = 1.0 / timestep_fps;
+        printf("Timestep: %.4fs\n", playback.step);
+    }
+    if (telemetry_path) {
+        if (telemetry_start(telemetry_path) == 0)
+            printf("Telemetry: %s\n", telemetry_path);
+        else
+            printf("Telemetry socket '%s' failed: %s\n", telemetry_path, strerror(errno));
+    }
 
     // Main loop
+    phase_begin(PHASE_FIRST_FRAME);
     struct timespec start, now;
     clock_gettime(CLOCK_MONOTONIC, &start);
-    int frames = 0;
-
-    while(1) {
-        // Check for shader reload
-        if (reload_requested || pipeline == VK_NULL_HANDLE) {
-            // Clean up old shaders/pipeline
-            if (pipeline != VK_NULL_HANDLE) vkDestroyPipeline(device, pipeline, NULL);
-            if (vm != VK_NULL_HANDLE) vkDestroyShaderModule(device, vm, NULL);
-            if (fm != VK_NULL_HANDLE) vkDestroyShaderModule(device, fm, NULL);
-
-            // Load new shaders
-            size_t vsz, fsz;
-            uint32_t *vc = load_spv(shaders[current_shader].vert_path, &vsz);
-            uint32_t *fc = load_spv(shaders[current_shader].frag_path, &fsz);
-            if (!vc || !fc) {
-                printf("Failed to load shaders for '%s'\n", shaders[current_shader].name);
-                sleep(1);
-                continue;
-            }
+    uint64_t frame_index = 0;       // Frames submitted for all outputs, in queue order
+    uint64_t frames_completed = 0;  // Every frame before this one has finished on the GPU
+    double reload_since = 0;        // When the pending shader switch was first seen
+    float date[4] = {0, 0, 1, 0};
+    double scale_gpu_ms = 0;        // --scale auto: GPU time summed over the current window
+    int scale_samples = 0;
 
-            VK_CHECK(vkCreateShaderModule(device, &(VkShaderModuleCreateInfo){
-                .sType=VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,.codeSize=vsz,.pCode=vc}, NULL, &vm));
-            VK_CHECK(vkCreateShaderModule(device, &(VkShaderModuleCreateInfo){
-                .sType=VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,.codeSize=fsz,.pCode=fc}, NULL, &fm));
-            free(vc); free(fc);
-
-            // Create pipeline
-            VK_CHECK(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &(VkGraphicsPipelineCreateInfo){
-                .sType=VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-                .stageCount=2,
-                .pStages=(VkPipelineShaderStageCreateInfo[]){
-                    {.sType=VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                     .stage=VK_SHADER_STAGE_VERTEX_BIT,.module=vm,.pName="main"},
-                    {.sType=VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                     .stage=VK_SHADER_STAGE_FRAGMENT_BIT,.module=fm,.pName="main"}
-                },
-                .pVertexInputState=&(VkPipelineVertexInputStateCreateInfo){
-                    .sType=VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO
-                },
-                .pInputAssemblyState=&(VkPipelineInputAssemblyStateCreateInfo){
-                    .sType=VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-                    .topology=VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST
-                },
-                .pViewportState=&(VkPipelineViewportStateCreateInfo){
-                    .sType=VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-                    .viewportCount=1,.pViewports=&(VkViewport){0,0,W,H,0,1},
-                    .scissorCount=1,.pScissors=&(VkRect2D){{0,0},{W,H}}
-                },
-                .pRasterizationState=&(VkPipelineRasterizationStateCreateInfo){
-                    .sType=VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-                    .polygonMode=VK_POLYGON_MODE_FILL,.cullMode=VK_CULL_MODE_NONE,.lineWidth=1.0f
-                },
-                .pMultisampleState=&(VkPipelineMultisampleStateCreateInfo){
-                    .sType=VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-                    .rasterizationSamples=VK_SAMPLE_COUNT_1_BIT
-                },
-                .pColorBlendState=&(VkPipelineColorBlendStateCreateInfo){
-                    .sType=VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-                    .attachmentCount=1,
-                    .pAttachments=&(VkPipelineColorBlendAttachmentState){.colorWriteMask=0xF}
-                },
-                .layout=pipelineLayout,.renderPass=renderPass
-            }, NULL, &pipeline));
-
-            printf("Loaded shader: %s\n", shaders[current_shader].name);
+    // Leave the loop on ESC/Q or SIGINT/SIGTERM so the pipeline cache gets saved
+    signal(SIGINT, handle_quit_signal);
+    signal(SIGTERM, handle_quit_signal);
+
+    // The first shader's clock starts here, at --seek
+    playback_seek(seek_time, monotonic_seconds());
+
+    while(!quit_requested && !(headless && !bench.active && frame_index >= (uint64_t)headless_frames)) {
+        // Adopt pipelines the worker finished, then swap to the requested
+        // shader once it is among them (with --outputs each, once all of the
+        // outputs' shaders are). Until then the current pipelines keep
+        // rendering; the old ones stay in the LRU, so frames still in flight
+        // with them are simply presented.
+        double loop_start = monotonic_seconds();
+        telemetry_tick(loop_start);
+        if (reload_requested && reload_since == 0) reload_since = loop_start;
+        if (!headless) {
+            input_drain();
+            live_poll(device, loop_start);
+        }
+        int failed = prewarm_collect(device, frame_index);
+        textures_upload();
+        if (failed >= 0) {
+            if (shader_on_screen(failed))
+                printf("Rebuild of '%s' failed, keeping the running pipeline\n", shader_name(failed));
+            else
+                printf("Failed to load shaders for '%s', staying on '%s'\n",
+                       shader_name(failed), shader_name(bound_shader));
+            current_shader = bound_shader;
             reload_requested = 0;
-            clock_gettime(CLOCK_MONOTONIC, &start);
-            frames = 0;
+            reload_since = 0;
+            if (bench.active) bench_next_shader(1);
+        }
+        if (reload_requested) {
+            int missing = 0;
+            for (int i = output_count - 1; i >= 0; i--) {
+                int s = output_shader(i, current_shader);
+                if (!lru_ready(s)) {
+                    prewarm_urgent(s);
+                    missing = 1;
+                }
+            }
+            if (!missing) {
+                bound_shader = current_shader;
+                for (int i = 0; i < output_count; i++) {
+                    outputs[i].shader = output_shader(i, bound_shader);
+                    outputs[i].frames = 0;
+                    outputs[i].iframe = 0;
+                    outputs[i].last_time = 0;
+                    outputs[i].graph.clear = 1;
+                }
+                printf("Loaded shader: %s\n", shader_name(current_shader));
+                reload_requested = 0;
+                telemetry_record(TM_RELOAD, (monotonic_seconds() - reload_since) * 1000.0);
+                reload_since = 0;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                playback_seek(0, monotonic_seconds());
+                prewarm_neighbours(prewarm_all);
+            }
         }
 
         clock_gettime(CLOCK_MONOTONIC, &now);
         float t = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9f;
+        // Headless time is a pure function of the frame number, so renders
+        // are reproducible. Otherwise the playback clock decides, and with
+        // --timestep says whether a frame is due at all.
+        double clock_time = 0;
+        int due = headless || playback_due(monotonic_seconds(), &clock_time);
+        float shader_time = headless ? (float)(seek_time + frame_index / headless_fps) : (float)clock_time;
+        // iDate: local date and seconds since midnight, held while paused;
+        // headless counts from a fixed midnight
+        if (headless) {
+            date[3] = shader_time;
+        } else if (!playback.paused) {
+            struct timespec wall;
+            struct tm tm;
+            clock_gettime(CLOCK_REALTIME, &wall);
+            localtime_r(&wall.tv_sec, &tm);
+            date[0] = tm.tm_year + 1900;
+            date[1] = tm.tm_mon;
+            date[2] = tm.tm_mday;
+            date[3] = tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec + wall.tv_nsec / 1e9f;
+        }
 
-        // Check keyboard
-        check_keyboard(kbd_fd);
+        // --max-fps: sleep until the frame timer ticks. Otherwise only
+        // handle the input that is already there.
+        if (events.timer_fd >= 0) {
+            while (!events.ticked && !quit_requested)
+                if (wait_events(-1) < 0) break;
+            events.ticked = 0;
+        } else {
+            wait_events(0);
+        }
+        // Outputs still waiting for their flip sit this round out
+        if (use_flip) wait_for_output();
 
-        // Update UBO
-        ShaderToyUBO ubo = {
-            .iResolution = {W, H, 1.0f},
-            .iTime = t,
-            .iMouse = {0, 0, 0, 0}
-        };
-        memcpy(uboPtr, &ubo, sizeof(ubo));
+        int rendered = 0;
+        for (int oi = 0; oi < output_count; oi++) {
+            Output *o = &outputs[oi];
+            uint32_t W = o->W, H = o->H;
+            if (o->flip.pending) continue;
 
-        // Record
-        vkBeginCommandBuffer(cmd, &(VkCommandBufferBeginInfo){
-            .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-            .flags=VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT});
-        vkCmdBeginRenderPass(cmd, &(VkRenderPassBeginInfo){
-            .sType=VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-            .renderPass=renderPass,.framebuffer=framebuffer,
-            .renderArea={{0,0},{W,H}},.clearValueCount=1,
-            .pClearValues=&(VkClearValue){.color={.float32={0,0,0,1}}}
-        }, VK_SUBPASS_CONTENTS_INLINE);
-        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                pipelineLayout, 0, 1, &descSet, 0, NULL);
-        vkCmdDraw(cmd, 6, 1, 0, 0);
-        vkCmdEndRenderPass(cmd);
-        vkEndCommandBuffer(cmd);
+            // Retire the oldest frame in the ring; its fence has usually
+            // signalled already. The copy path retires the slot we are about to
+            // reuse. Zero-copy keeps one slot on screen, so it retires the next
+            // one instead, which takes the screen off the slot we render into
+            // once its flip lands.
+            FrameSlot *slot = &o->slots[o->frame % FRAMES_IN_FLIGHT];
+            FrameSlot *done = zero_copy ? &o->slots[(o->frame + 1) % FRAMES_IN_FLIGHT] : slot;
+            if (o->render_next) {
+                o->render_next = 0;
+            } else if (done->pending) {
+                double wait_start = monotonic_seconds();
+                telemetry_wait(1);
+                VK_CHECK(vkWaitForFences(device, 1, &done->fence, VK_TRUE, UINT64_MAX));
+                telemetry_wait(0);
+                telemetry_record(TM_FENCE, (monotonic_seconds() - wait_start) * 1000.0);
+                vkResetFences(device, 1, &done->fence);
+                done->pending = 0;
+                if (done->frame + 1 > frames_completed) frames_completed = done->frame + 1;
+                destroy_retired(device, frames_completed);
+                double copy_ms = 0, present_ms = 0, stage_start = monotonic_seconds();
+
+                // Headless: write the frame out while the GPU renders the next ones
+                if (headless) {
+                    if (write_frame(out, done, o->rowPitch, W, H) != 0) {
+                        printf("Write to '%s' failed: %s\n", output_path, strerror(errno));
+                        quit_requested = 1;
+                    }
+                    copy_ms = (monotonic_seconds() - stage_start) * 1000.0;
+                } else {
+                    // Zero-copy: the frame is already in its BO
+                    uint32_t present_fb = zero_copy ? done->fb_id : o->copy_fb[o->copy_back];
+                    if (!zero_copy) {
+                        // Copy to GBM while the GPU keeps rendering the other slots
+                        struct gbm_bo *bo = o->copy_bo[o->copy_back];
+                        void *gbmPtr = NULL; uint32_t gbmStride; void *mapData = NULL;
+                        gbmPtr = gbm_bo_map(bo, 0, 0, W, H, GBM_BO_TRANSFER_WRITE, &gbmStride, &mapData);
+                        if (gbmPtr) {
+                            blit_frame(&(BlitJob){gbmPtr, done->rtPtr, gbmStride, o->rowPitch, W, H,
+                                                  rgb565 ? BLIT_RGB565 : BLIT_XRGB8888});
+                            gbm_bo_unmap(bo, mapData);
+                        }
+                    }
+                    copy_ms = (monotonic_seconds() - stage_start) * 1000.0;
+                    stage_start = monotonic_seconds();
 
-        // Submit and wait
-        VK_CHECK(vkQueueSubmit(queue, 1, &(VkSubmitInfo){
-            .sType=VK_STRUCTURE_TYPE_SUBMIT_INFO,
-            .commandBufferCount=1,.pCommandBuffers=&cmd
-        }, fence));
-        VK_CHECK(vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
-        vkResetFences(device, 1, &fence);
+                    if (use_flip) {
+                        if (page_flip(drm_fd, o, present_fb) == 0) {
+                            if (!zero_copy) o->copy_back ^= 1;
+                        } else {
+                            printf("Page flip failed (%s), updating the CRTC in place\n", strerror(errno));
+                            use_flip = 0;
+                            if (!free_running) start_frame_timer(vrefresh);
+                        }
+                    }
+                    if (!use_flip) {
+                        // Unsynchronized: retarget the CRTC only when the buffer changes
+                        if (present_fb != o->screen_fb)
+                            drmModeSetCrtc(drm_fd, o->crtc_id, present_fb, 0, 0, &o->conn->connector_id, 1, o->mode);
+                        drmModeDirtyFB(drm_fd, present_fb, NULL, 0);
+                    }
+                    o->screen_fb = present_fb;
+                    present_ms = (monotonic_seconds() - stage_start) * 1000.0;
+                }
+
+                double gpu_ms = slot_gpu_ms(device, queryPool, oi * FRAMES_IN_FLIGHT + (done - o->slots),
+                                            props.limits.timestampPeriod);
+                telemetry_record(TM_COPY, copy_ms);
+                if (!headless) telemetry_record(TM_PRESENT, present_ms);
+                telemetry_record(TM_GPU, gpu_ms);
+                startup_report();
+                if (done->bench) {
+                    bench_record(gpu_ms, done->cpu_ms, copy_ms, present_ms);
+                    if (bench.collected == bench.measure) bench_next_shader(0);
+                }
+                if ((auto_scale || quality.automatic) && !isnan(gpu_ms)) {
+                    // Timestamps bracket the upscale blit as well, which is
+                    // part of the cost of the chosen scale. The outputs share
+                    // the GPU, so each frame gets its share of the budget.
+                    scale_gpu_ms += gpu_ms;
+                    if (++scale_samples == SCALE_WINDOW) {
+                        double budget_ms = 0.9 * 1000.0 / target_fps / output_count;
+                        if (auto_scale)
+                            render_scale = adjust_render_scale(render_scale, scale_gpu_ms / scale_samples, budget_ms);
+                        if (quality.automatic)
+                            adjust_quality(scale_gpu_ms / scale_samples, budget_ms,
+                                           !auto_scale || render_scale <= MIN_RENDER_SCALE,
+                                           !auto_scale || render_scale >= 1.0f, prewarm_all);
+                        scale_gpu_ms = 0;
+                        scale_samples = 0;
+                    }
+                }
+
+                // Zero-copy: the slot we render into stays on screen until
+                // the flip lands, so it gets rendered on the output's next turn
+                if (zero_copy && o->flip.pending) {
+                    o->render_next = 1;
+                    continue;
+                }
+            }
+
+            // --timestep: the clock hasn't reached the next step yet
+            if (!due) continue;
+
+            // Update UBO
+            double record_start = monotonic_seconds();
+            uint32_t rw = scaling ? (uint32_t)(W * render_scale + 0.5f) : W;
+            uint32_t rh = scaling ? (uint32_t)(H * render_scale + 0.5f) : H;
+            if (rw == 0) rw = 1;
+            if (rh == 0) rh = 1;
+            // Span: the viewport is the whole canvas, shifted so this output's
+            // part of it covers the render target
+            VkViewport viewport = {0, 0, rw, rh, 0, 1};
+            if (output_mode == OUTPUTS_SPAN) {
+                float scale = scaling ? render_scale : 1.0f;
+                viewport = (VkViewport){-(float)o->x * scale, 0, canvas_w * scale, canvas_h * scale, 0, 1};
+            }
+            ShaderToyUBO ubo = {
+                .iResolution = {viewport.width, viewport.height, 1.0f},
+                .iTime = shader_time,
+                .iTimeDelta = o->frames && shader_time > o->last_time ? shader_time - o->last_time : 0,
+                .iFrame = o->iframe,
+            };
+            memcpy(ubo.iDate, date, sizeof(date));
+            mouse_ubo(ubo.iMouse, viewport.width, viewport.height);
+            if (headless || bench.active) textures_finish(o->shader);
+
+            // Bind whatever the LRU holds for the shader, so a live reload's
+            // rebuild takes effect here
+            CachedPipeline *bound = &pipeline_lru[lru_find(o->shader)];
+            bound->last_used = frame_index;
+            VkPipeline pipeline = bound->pipeline;
+
+            // Record, unless the slot's command buffer already holds this
+            // frame: everything per frame comes from its UBO entry, so only a
+            // new pipeline, render size or texture needs a new recording.
+            // Buffer passes ping-pong, so their shaders record every frame.
+            VkCommandBuffer cmd = slot->cmd;
+            int buffered = !use_compute && multipass.enabled && shaders[bound->shader].buffers;
+            int channels_changed = !use_compute && !buffered && bind_image_channels(slot, bound->shader);
+            int rerecord = buffered || channels_changed || slot->recorded != pipeline || slot->recorded_w != rw ||
+                           slot->recorded_h != rh || slot->recorded_generation != pipeline_generation;
+            // Paused on a still scene: the slot would render exactly the
+            // frame it holds, which has been presented, so leave the GPU be.
+            // Buffer passes feed back into themselves, so they keep going.
+            if (playback.paused && !rerecord && memcmp(&slot->ubo, &ubo, sizeof(ubo)) == 0) continue;
+            memcpy(slot->uboPtr, &ubo, sizeof(ubo));
+            slot->ubo = ubo;
+            o->last_time = shader_time;
+            if (rerecord) {
+                slot->recorded = buffered ? VK_NULL_HANDLE : pipeline;
+                slot->recorded_w = rw;
+                slot->recorded_h = rh;
+                slot->recorded_generation = pipeline_generation;
+                recordings++;
+                vkBeginCommandBuffer(cmd, &(VkCommandBufferBeginInfo){
+                    .sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO});
+                // Split frame: GPU k renders rows [k*rh/n, (k+1)*rh/n)
+                VkRect2D bands[VK_MAX_DEVICE_GROUP_SIZE];
+                for (uint32_t k = 0; k < split_count; k++) {
+                    uint32_t y0 = rh * k / split_count, y1 = rh * (k + 1) / split_count;
+                    bands[k] = (VkRect2D){{0, (int32_t)y0}, {rw, y1 - y0}};
+                }
+                uint32_t query = (oi * FRAMES_IN_FLIGHT + (slot - o->slots)) * 2;
+                if (queryPool != VK_NULL_HANDLE) {
+                    vkCmdResetQueryPool(cmd, queryPool, query, 2);
+                    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, queryPool, query);
+                }
+                if (zero_copy) scanout_ownership_barrier(cmd, slot->rtImg, gfxFamily, 1);
+                if (use_compute) {
+                    // One invocation per pixel; every pixel is written, so the old
+                    // contents can be discarded
+                    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                        0, NULL, 0, NULL, 1, &(VkImageMemoryBarrier){
+                            .sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+                            .dstAccessMask=VK_ACCESS_SHADER_WRITE_BIT,
+                            .oldLayout=VK_IMAGE_LAYOUT_UNDEFINED,.newLayout=VK_IMAGE_LAYOUT_GENERAL,
+                            .srcQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,.dstQueueFamilyIndex=VK_QUEUE_FAMILY_IGNORED,
+                            .image=slot->rtImg,.subresourceRange={VK_IMAGE_ASPECT_COLOR_BIT,0,1,0,1}
+                        });
+                    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+                    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                                            pipelineLayout, 0, 1, &slot->descSet, 1, &slot->uboOffset);
+                    vkCmdDispatch(cmd, (W + workgroup[0] - 1) / workgroup[0], (H + workgroup[1] - 1) / workgroup[1], 1);
+                } else {
+                    record_buffer_passes(cmd, o, slot, bound, pipelineLayout);
+                    vkCmdBeginRenderPass(cmd, &(VkRenderPassBeginInfo){
+                        .sType=VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+                        .pNext=split_count > 1 ? &(VkDeviceGroupRenderPassBeginInfo){
+                            .sType=VK_STRUCTURE_TYPE_DEVICE_GROUP_RENDER_PASS_BEGIN_INFO,
+                            .deviceMask=split_mask,.deviceRenderAreaCount=split_count,.pDeviceRenderAreas=bands
+                        } : NULL,
+                        .renderPass=renderPass,
+                        .framebuffer=scaling ? slot->lowFramebuffer : slot->framebuffer,
+                        .renderArea={{0,0},{rw,rh}},.clearValueCount=1,
+                        .pClearValues=&(VkClearValue){.color={.float32={0,0,0,1}}}
+                    }, VK_SUBPASS_CONTENTS_INLINE);
+                    vkCmdSetViewport(cmd, 0, 1, &viewport);
+                    if (split_count > 1) {
+                        // The render area only bounds what each GPU must keep;
+                        // the scissor keeps it from shading the other bands
+                        for (uint32_t k = 0; k < split_count; k++) {
+                            vkCmdSetDeviceMask(cmd, 1u << k);
+                            vkCmdSetScissor(cmd, 0, 1, &bands[k]);
+                        }
+                        vkCmdSetDeviceMask(cmd, split_mask);
+                    } else {
+                        vkCmdSetScissor(cmd, 0, 1, &(VkRect2D){{0,0},{rw,rh}});
+                    }
+                    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+                    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                            pipelineLayout, 0, 1, &slot->descSet, 1, &slot->uboOffset);
+                    vkCmdDraw(cmd, 6, 1, 0, 0);
+                    vkCmdEndRenderPass(cmd);
+                    if (scaling) upscale_blit(cmd, slot, rw, rh, W, H, zero_copy);
+                }
+                if (!zero_copy && !use_xfer)
+                    readback_copy(cmd, slot, W, split_count > 1 ? bands : &(VkRect2D){{0,0},{W,H}}, split_count, 1);
+                if (zero_copy) scanout_ownership_barrier(cmd, slot->rtImg, gfxFamily, 0);
+                if (queryPool != VK_NULL_HANDLE)
+                    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, queryPool, query + 1);
+                vkEndCommandBuffer(cmd);
+            }
+
+            // Submit without waiting; the fence is collected when the slot comes
+            // around again (and, split across GPUs, signals once all are done).
+            // With a transfer queue the readback signals it instead.
+            VK_CHECK(vkQueueSubmit(queue, 1, &(VkSubmitInfo){
+                .sType=VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                .pNext=split_count > 1 ? &(VkDeviceGroupSubmitInfo){
+                    .sType=VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO,
+                    .commandBufferCount=1,.pCommandBufferDeviceMasks=&split_mask
+                } : NULL,
+                .commandBufferCount=1,.pCommandBuffers=&cmd,
+                .signalSemaphoreCount=use_xfer ? 1 : 0,.pSignalSemaphores=&slot->rendered
+            }, use_xfer ? VK_NULL_HANDLE : slot->fence));
+            if (use_xfer)
+                VK_CHECK(vkQueueSubmit(xferQueue, 1, &(VkSubmitInfo){
+                    .sType=VK_STRUCTURE_TYPE_SUBMIT_INFO,
+                    .waitSemaphoreCount=1,.pWaitSemaphores=&slot->rendered,
+                    .pWaitDstStageMask=&(VkPipelineStageFlags){VK_PIPELINE_STAGE_TRANSFER_BIT},
+                    .commandBufferCount=1,.pCommandBuffers=&slot->xferCmd
+                }, slot->fence));
+            slot->pending = 1;
+            slot->frame = frame_index;
+            double submitted = monotonic_seconds();
+            slot->cpu_ms = (submitted - record_start) * 1000.0;
+            telemetry_record(TM_RECORD, slot->cpu_ms);
+            if (oi == 0) {
+                if (telemetry.last_frame > 0) telemetry_record(TM_FRAME, (submitted - telemetry.last_frame) * 1000.0);
+                telemetry.last_frame = submitted;
+            }
 
-        // Copy to GBM
-        void *gbmPtr = NULL; uint32_t gbmStride; void *mapData = NULL;
-        gbmPtr = gbm_bo_map(bo, 0, 0, W, H, GBM_BO_TRANSFER_WRITE, &gbmStride, &mapData);
-        if (gbmPtr) {
-            for (uint32_t y = 0; y < H; y++)
-                memcpy((char*)gbmPtr + y * gbmStride,
-                       (char*)rtPtr + y * rtLayout.rowPitch, W * 4);
-            gbm_bo_unmap(bo, mapData);
+            // --bench: measure once the shader is bound and warmed up
+            slot->bench = 0;
+            if (bench.active && o->shader == bench.shader &&
+                (!shaders[o->shader].quality_count || bound->tier == quality_tier())) {
+                bench.submitted++;
+                slot->bench = bench.submitted > bench.warmup &&
+                              bench.submitted <= bench.warmup + bench.measure;
+            }
+            frame_index++;
+            o->frame++;
+            if (!playback.paused) o->iframe++;
+            rendered = 1;
+
+            // Status line every 60 frames of the first output, covering all of them
+            if (++o->frames % 60 || oi != 0) continue;
+            printf("%.1fs: %d frames (%.1f FPS) - %s", t, o->frames, o->frames/t, shader_name(o->shader));
+            for (int k = 0; k < output_count; k++) {
+                Output *p = &outputs[k];
+                if (k > 0) printf(" | output %d: %.1f FPS - %s", k, p->frames/t, shader_name(p->shader));
+                if (p->flip.count) printf(" - flip %.2f ms", 1000.0 * p->flip.latency_sum / p->flip.count);
+                p->flip.latency_sum = 0;
+                p->flip.count = 0;
+            }
+            if (scaling) printf(" - scale %.2f (%ux%u)", render_scale,
+                                (uint32_t)(W * render_scale + 0.5f), (uint32_t)(H * render_scale + 0.5f));
+            if (playback.skipped) printf(" - skipped %llu steps", (unsigned long long)playback.skipped);
+            playback.skipped = 0;
+            printf("\n");
         }
-        drmModeDirtyFB(drm_fd, fb_id, NULL, 0);
+        // Nothing was due or everything is still: sleep, but keep handling input
+        if (!rendered && !headless) wait_events(playback_idle_ms(monotonic_seconds()));
+        if (rendered) mouse.clicked = 0;
+    }
 
-        frames++;
-        if (frames % 60 == 0) printf("%.1fs: %d frames (%.1f FPS) - %s\n",
-                                      t, frames, frames/t, shaders[current_shader].name);
+    // Headless: the last frames are still in the ring, oldest first
+    for (int i = 0; i < FRAMES_IN_FLIGHT && headless; i++) {
+        Output *o = &outputs[0];
+        FrameSlot *s = &o->slots[(o->frame + i) % FRAMES_IN_FLIGHT];
+        if (!s->pending) continue;
+        VK_CHECK(vkWaitForFences(device, 1, &s->fence, VK_TRUE, UINT64_MAX));
+        s->pending = 0;
+        if (!quit_requested && write_frame(out, s, o->rowPitch, o->W, o->H) != 0)
+            printf("Write to '%s' failed: %s\n", output_path, strerror(errno));
+    }
+    if (headless) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double elapsed = (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+        printf("Rendered %llu frames in %.2fs (%.1f FPS), %llu recorded\n", (unsigned long long)frame_index,
+               elapsed, frame_index / elapsed, (unsigned long long)recordings);
+        fclose(out);
+    }
+    if (bench.active) {
+        fclose(bench.csv);
+        printf("Bench results written to %s\n", csv_path);
     }
 
+    if (prewarm_err == 0) stop_prewarm();
+    if (!headless) {
+        stop_live_reload();
+        blit_stop();
+    }
+    textures_stop();
+    telemetry_stop();
+    input_stop();
+    vkDeviceWaitIdle(device);
+    save_pipeline_cache(device, pipelineCache, cachePath);
     return 0;
 }
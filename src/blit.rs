@@ -0,0 +1,495 @@
+// Copy path blit: frames go from the renderer's readback buffer into the
+// display's buffer in bands of rows on several threads (long-lived
+// workers, woken once per frame), each row copied
+// with streaming SIMD loads and stores (SSE4.1 on x86_64, LDNP/STNP and
+// NEON on AArch64) so the frame doesn't go through the caches. The C
+// viewer (old/metalshader.c) has the same engine.
+//
+// Render targets are BGRA, which is XRGB8888's byte order, so only RGB565
+// needs an actual conversion, done in the same pass.
+
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Condvar, Mutex, OnceLock};
+use std::time::Instant;
+
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum PixelFormat {
+    Xrgb8888,
+    Rgb565,
+}
+
+impl PixelFormat {
+    fn bytes_per_pixel(self) -> usize {
+        match self {
+            PixelFormat::Xrgb8888 => 4,
+            PixelFormat::Rgb565 => 2,
+        }
+    }
+}
+
+/// Bands per frame: half the cores, since a few threads already saturate
+/// the memory bus
+fn default_threads() -> usize {
+    static THREADS: OnceLock<usize> = OnceLock::new();
+    *THREADS.get_or_init(|| {
+        std::thread::available_parallelism()
+            .map(|n| (n.get() / 2).clamp(1, 8))
+            .unwrap_or(1)
+    })
+}
+
+/// One frame's copy, shared with the workers. Raw pointers, since the
+/// workers outlive any borrow: the caller waits for every band before
+/// returning, so the buffers stay valid while they are in use.
+#[derive(Clone, Copy)]
+struct Job {
+    dst: *mut u8,
+    dst_len: usize,
+    dst_stride: usize,
+    src: *const u8,
+    src_len: usize,
+    src_stride: usize,
+    width: usize,
+    rows: usize,
+    bands: usize,
+    format: PixelFormat,
+    simd: bool,
+}
+
+unsafe impl Send for Job {}
+
+impl Job {
+    /// Copy band `band` of `bands`; their rows and dst bytes don't overlap
+    unsafe fn run(&self, band: usize) {
+        let y0 = self.rows * band / self.bands;
+        let y1 = self.rows * (band + 1) / self.bands;
+        let start = y0 * self.dst_stride;
+        let len = if band + 1 == self.bands { self.dst_len - start } else { (y1 - y0) * self.dst_stride };
+        let dst = std::slice::from_raw_parts_mut(self.dst.add(start), len);
+        let src_start = y0 * self.src_stride;
+        let src = std::slice::from_raw_parts(self.src.add(src_start), self.src_len - src_start);
+        blit_rows(dst, self.dst_stride, src, self.src_stride, self.width, y1 - y0, self.format, self.simd);
+    }
+}
+
+struct PoolState {
+    job: Option<Job>,
+    generation: u64,
+    /// Worker bands of the current job not done yet
+    remaining: usize,
+}
+
+/// Worker n takes band n of each job, the caller the last one
+struct Pool {
+    state: Mutex<PoolState>,
+    wake: Condvar,
+    done: Condvar,
+    /// One job at a time
+    busy: Mutex<()>,
+    /// Started, set once before the first job
+    workers: AtomicUsize,
+}
+
+fn pool() -> &'static Pool {
+    static POOL: OnceLock<&'static Pool> = OnceLock::new();
+    POOL.get_or_init(|| {
+        let pool: &'static Pool = Box::leak(Box::new(Pool {
+            state: Mutex::new(PoolState { job: None, generation: 0, remaining: 0 }),
+            wake: Condvar::new(),
+            done: Condvar::new(),
+            busy: Mutex::new(()),
+            workers: AtomicUsize::new(0),
+        }));
+        let mut workers = 0;
+        while workers + 1 < default_threads() {
+            let index = workers;
+            let spawned = std::thread::Builder::new()
+                .name(format!("blit-{}", index + 1))
+                .spawn(move || worker(pool, index));
+            if spawned.is_err() {
+                break;
+            }
+            workers += 1;
+        }
+        pool.workers.store(workers, Ordering::Relaxed);
+        pool
+    })
+}
+
+fn worker(pool: &'static Pool, index: usize) {
+    let mut seen = 0;
+    let mut state = pool.state.lock().unwrap();
+    loop {
+        while state.generation == seen {
+            state = pool.wake.wait(state).unwrap();
+        }
+        seen = state.generation;
+        let job = state.job.unwrap();
+        if index + 1 >= job.bands {
+            continue;
+        }
+        drop(state);
+        unsafe { job.run(index) };
+        state = pool.state.lock().unwrap();
+        state.remaining -= 1;
+        if state.remaining == 0 {
+            pool.done.notify_one();
+        }
+    }
+}
+
+/// Copy `height` rows of `width` BGRA pixels from `src` into `dst` as
+/// `format`. Rows that don't fit either buffer are skipped.
+pub fn blit(
+    dst: &mut [u8],
+    dst_stride: usize,
+    src: &[u8],
+    src_stride: usize,
+    width: usize,
+    height: usize,
+    format: PixelFormat,
+) {
+    blit_with(dst, dst_stride, src, src_stride, width, height, format, default_threads(), true);
+}
+
+#[allow(clippy::too_many_arguments)]
+fn blit_with(
+    dst: &mut [u8],
+    dst_stride: usize,
+    src: &[u8],
+    src_stride: usize,
+    width: usize,
+    height: usize,
+    format: PixelFormat,
+    threads: usize,
+    simd: bool,
+) {
+    let rows = height
+        .min(rows_fitting(dst.len(), dst_stride, width * format.bytes_per_pixel()))
+        .min(rows_fitting(src.len(), src_stride, width * 4));
+    let bands = threads.clamp(1, rows.max(1));
+    if bands == 1 {
+        blit_rows(dst, dst_stride, src, src_stride, width, rows, format, simd);
+        return;
+    }
+
+    let pool = pool();
+    let bands = bands.min(pool.workers.load(Ordering::Relaxed) + 1);
+    let job = Job {
+        dst: dst.as_mut_ptr(),
+        dst_len: dst.len(),
+        dst_stride,
+        src: src.as_ptr(),
+        src_len: src.len(),
+        src_stride,
+        width,
+        rows,
+        bands,
+        format,
+        simd,
+    };
+    let _busy = pool.busy.lock().unwrap();
+    {
+        let mut state = pool.state.lock().unwrap();
+        state.job = Some(job);
+        state.generation += 1;
+        state.remaining = bands - 1;
+        pool.wake.notify_all();
+    }
+    // The caller takes the last band itself
+    unsafe { job.run(bands - 1) };
+    let mut state = pool.state.lock().unwrap();
+    while state.remaining > 0 {
+        state = pool.done.wait(state).unwrap();
+    }
+}
+
+/// Number of whole rows of `row_len` bytes a buffer of `len` bytes holds.
+/// A stride shorter than a row (0 included) only holds the first one: the
+/// next would overlap it, and the bands split across threads must not.
+fn rows_fitting(len: usize, stride: usize, row_len: usize) -> usize {
+    if len < row_len {
+        0
+    } else if stride < row_len || stride == 0 {
+        1
+    } else {
+        (len - row_len) / stride + 1
+    }
+}
+
+#[allow(clippy::too_many_arguments)]
+fn blit_rows(
+    dst: &mut [u8],
+    dst_stride: usize,
+    src: &[u8],
+    src_stride: usize,
+    width: usize,
+    rows: usize,
+    format: PixelFormat,
+    simd: bool,
+) {
+    let dst_len = width * format.bytes_per_pixel();
+    for y in 0..rows {
+        let d = &mut dst[y * dst_stride..y * dst_stride + dst_len];
+        let s = &src[y * src_stride..y * src_stride + width * 4];
+        if simd {
+            simd_row(d, s, format);
+        } else {
+            plain_row(d, s, format);
+        }
+    }
+
+    // Non-temporal stores are weakly ordered
+    #[cfg(target_arch = "x86_64")]
+    if simd && is_x86_feature_detected!("sse4.1") {
+        unsafe { std::arch::x86_64::_mm_sfence() };
+    }
+}
+
+fn plain_row(d: &mut [u8], s: &[u8], format: PixelFormat) {
+    match format {
+        PixelFormat::Xrgb8888 => d.copy_from_slice(s),
+        PixelFormat::Rgb565 => {
+            for (out, p) in d.chunks_exact_mut(2).zip(s.chunks_exact(4)) {
+                let v = ((p[2] as u16 >> 3) << 11) | ((p[1] as u16 >> 2) << 5) | (p[0] as u16 >> 3);
+                out.copy_from_slice(&v.to_le_bytes());
+            }
+        }
+    }
+}
+
+fn simd_row(d: &mut [u8], s: &[u8], format: PixelFormat) {
+    #[cfg(target_arch = "x86_64")]
+    if is_x86_feature_detected!("sse4.1") {
+        return unsafe { row_sse41(d, s, format) };
+    }
+    #[cfg(target_arch = "aarch64")]
+    return unsafe { row_neon(d, s, format) };
+    #[allow(unreachable_code)]
+    plain_row(d, s, format)
+}
+
+#[cfg(target_arch = "x86_64")]
+#[target_feature(enable = "sse4.1")]
+unsafe fn row_sse41(d: &mut [u8], s: &[u8], format: PixelFormat) {
+    use std::arch::x86_64::*;
+
+    // Streaming accesses need 16-byte alignment, which mapped rows have
+    if (d.as_ptr() as usize | s.as_ptr() as usize) & 15 != 0 {
+        return plain_row(d, s, format);
+    }
+    let width = s.len() / 4;
+    let mut x = 0;
+    match format {
+        PixelFormat::Xrgb8888 => {
+            // One cache line per iteration
+            while x + 16 <= width {
+                let sp = s.as_ptr().add(x * 4) as *const __m128i;
+                let dp = d.as_mut_ptr().add(x * 4) as *mut __m128i;
+                let a = _mm_stream_load_si128(sp);
+                let b = _mm_stream_load_si128(sp.add(1));
+                let c = _mm_stream_load_si128(sp.add(2));
+                let e = _mm_stream_load_si128(sp.add(3));
+                _mm_stream_si128(dp, a);
+                _mm_stream_si128(dp.add(1), b);
+                _mm_stream_si128(dp.add(2), c);
+                _mm_stream_si128(dp.add(3), e);
+                x += 16;
+            }
+        }
+        PixelFormat::Rgb565 => {
+            let r = _mm_set1_epi32(0xf800);
+            let g = _mm_set1_epi32(0x07e0);
+            let b = _mm_set1_epi32(0x001f);
+            let pack = |px: __m128i| {
+                _mm_or_si128(
+                    _mm_or_si128(
+                        _mm_and_si128(_mm_srli_epi32::<8>(px), r),
+                        _mm_and_si128(_mm_srli_epi32::<5>(px), g),
+                    ),
+                    _mm_and_si128(_mm_srli_epi32::<3>(px), b),
+                )
+            };
+            while x + 8 <= width {
+                let sp = s.as_ptr().add(x * 4) as *const __m128i;
+                let lo = pack(_mm_stream_load_si128(sp));
+                let hi = pack(_mm_stream_load_si128(sp.add(1)));
+                _mm_stream_si128(d.as_mut_ptr().add(x * 2) as *mut __m128i, _mm_packus_epi32(lo, hi));
+                x += 8;
+            }
+        }
+    }
+    plain_row(&mut d[x * format.bytes_per_pixel()..], &s[x * 4..], format);
+}
+
+#[cfg(target_arch = "aarch64")]
+unsafe fn row_neon(d: &mut [u8], s: &[u8], format: PixelFormat) {
+    use std::arch::aarch64::*;
+
+    let width = s.len() / 4;
+    let mut x = 0;
+    match format {
+        PixelFormat::Xrgb8888 => {
+            // One cache line per iteration
+            while x + 16 <= width {
+                std::arch::asm!(
+                    "ldnp q0, q1, [{s}]",
+                    "ldnp q2, q3, [{s}, #32]",
+                    "stnp q0, q1, [{d}]",
+                    "stnp q2, q3, [{d}, #32]",
+                    s = in(reg) s.as_ptr().add(x * 4),
+                    d = in(reg) d.as_mut_ptr().add(x * 4),
+                    out("v0") _, out("v1") _, out("v2") _, out("v3") _,
+                    options(nostack),
+                );
+                x += 16;
+            }
+        }
+        PixelFormat::Rgb565 => {
+            while x + 8 <= width {
+                // Deinterleaved B, G, R, A
+                let p = vld4_u8(s.as_ptr().add(x * 4));
+                let mut v = vshlq_n_u16::<11>(vmovl_u8(vshr_n_u8::<3>(p.2)));
+                v = vorrq_u16(v, vshlq_n_u16::<5>(vmovl_u8(vshr_n_u8::<2>(p.1))));
+                v = vorrq_u16(v, vmovl_u8(vshr_n_u8::<3>(p.0)));
+                vst1q_u16(d.as_mut_ptr().add(x * 2) as *mut u16, v);
+                x += 8;
+            }
+        }
+    }
+    plain_row(&mut d[x * format.bytes_per_pixel()..], &s[x * 4..], format);
+}
+
+/// `--bench-blit`: time the plain row copy against the SIMD and threaded
+/// blit on a frame in ordinary memory; uncached or write-combined mappings
+/// favour the streaming version even more
+pub fn bench(width: usize, height: usize, iterations: u32) {
+    let stride = (width * 4 + 63) & !63;
+    // u128 storage keeps the rows 16-byte aligned
+    let mut src_words = vec![0u128; stride * height / 16];
+    let mut dst_words = vec![0u128; stride * height / 16];
+    let src = as_bytes(&mut src_words);
+    for (i, byte) in src.iter_mut().enumerate() {
+        *byte = ((i as u32).wrapping_mul(2654435761) >> 24) as u8;
+    }
+    let src: &[u8] = src;
+    let dst = as_bytes(&mut dst_words);
+
+    println!(
+        "Blit benchmark: {}x{}, {} iterations, {} thread(s)",
+        width, height, iterations, default_threads()
+    );
+    for format in [PixelFormat::Xrgb8888, PixelFormat::Rgb565] {
+        let dst_stride = (width * format.bytes_per_pixel() + 63) & !63;
+        let runs = [("plain", 1, false), ("simd", 1, true), ("simd+threads", default_threads(), true)];
+        for (name, threads, simd) in runs {
+            for _ in 0..3 {
+                blit_with(dst, dst_stride, src, stride, width, height, format, threads, simd);
+            }
+            let start = Instant::now();
+            for _ in 0..iterations {
+                blit_with(dst, dst_stride, src, stride, width, height, format, threads, simd);
+            }
+            let ms = start.elapsed().as_secs_f64() * 1000.0 / iterations.max(1) as f64;
+            let format_name = if format == PixelFormat::Rgb565 { "rgb565" } else { "xrgb8888" };
+            println!(
+                "  {:<8} {:<13} {:7.3} ms/frame  {:6.2} GB/s",
+                format_name, name, ms, (width * 4 * height) as f64 / (ms * 1e6)
+            );
+        }
+    }
+}
+
+fn as_bytes(words: &mut [u128]) -> &mut [u8] {
+    unsafe { std::slice::from_raw_parts_mut(words.as_mut_ptr() as *mut u8, words.len() * 16) }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn pattern(len: usize, seed: u32) -> Vec<u128> {
+        let mut words = vec![0u128; (len + 15) / 16];
+        for (i, byte) in as_bytes(&mut words).iter_mut().enumerate() {
+            *byte = ((i as u32 ^ seed).wrapping_mul(2654435761) >> 24) as u8;
+        }
+        words
+    }
+
+    #[test]
+    fn test_rows_fitting() {
+        assert_eq!(rows_fitting(15, 16, 16), 0);
+        assert_eq!(rows_fitting(16, 16, 16), 1);
+        assert_eq!(rows_fitting(16 + 63, 64, 16), 1);
+        assert_eq!(rows_fitting(16 + 64, 64, 16), 2);
+        assert_eq!(rows_fitting(64 * 10, 64, 64), 10);
+        // Rows that would overlap the first one
+        assert_eq!(rows_fitting(1000, 0, 16), 1);
+        assert_eq!(rows_fitting(1000, 8, 16), 1);
+        assert_eq!(rows_fitting(1000, 0, 0), 1);
+    }
+
+    #[test]
+    fn test_plain_row_rgb565() {
+        // BGRA in, little-endian RGB565 out
+        let src = [
+            0xff, 0xff, 0xff, 0xff, // white
+            0x00, 0x00, 0xff, 0xff, // red
+            0x00, 0xff, 0x00, 0xff, // green
+            0xff, 0x00, 0x00, 0xff, // blue
+            0x07, 0x03, 0x87, 0x00, // low bits dropped
+        ];
+        let mut dst = [0u8; 10];
+        plain_row(&mut dst, &src, PixelFormat::Rgb565);
+        let out: Vec<u16> = dst.chunks_exact(2).map(|p| u16::from_le_bytes([p[0], p[1]])).collect();
+        assert_eq!(out, [0xffff, 0xf800, 0x07e0, 0x001f, 0x8000]);
+    }
+
+    #[test]
+    fn test_simd_row_matches_plain() {
+        for format in [PixelFormat::Xrgb8888, PixelFormat::Rgb565] {
+            let bpp = format.bytes_per_pixel();
+            for width in [1, 7, 8, 9, 15, 16, 17, 31, 33, 100, 257] {
+                let mut src_words = pattern(width * 4 + 16, width as u32);
+                let src = as_bytes(&mut src_words);
+                // Aligned rows, then misaligned ones for the fallback
+                for offset in [0, 4] {
+                    let s = &src[offset..offset + width * 4];
+                    let mut want_words = vec![0u128; (width * bpp + 31) / 16];
+                    let mut got_words = want_words.clone();
+                    let want = &mut as_bytes(&mut want_words)[offset..offset + width * bpp];
+                    plain_row(want, s, format);
+                    let got = &mut as_bytes(&mut got_words)[offset..offset + width * bpp];
+                    simd_row(got, s, format);
+                    assert_eq!(got, want, "{:?}, width {}, offset {}", format, width, offset);
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn test_blit_bands_match_single_thread() {
+        let (width, height) = (37, 29);
+        let src_stride = width * 4 + 12;
+        let mut src_words = pattern(src_stride * height, 1);
+        let src: &[u8] = as_bytes(&mut src_words);
+        for format in [PixelFormat::Xrgb8888, PixelFormat::Rgb565] {
+            let dst_stride = (width * format.bytes_per_pixel() + 63) & !63;
+            let mut want_words = vec![0u128; dst_stride * height / 16];
+            let mut got_words = want_words.clone();
+            let want = as_bytes(&mut want_words);
+            let got = as_bytes(&mut got_words);
+            blit_with(want, dst_stride, src, src_stride, width, height, format, 1, false);
+            blit_with(got, dst_stride, src, src_stride, width, height, format, 4, true);
+            assert!(got == want, "{:?}", format);
+        }
+    }
+
+    #[test]
+    fn test_blit_short_stride() {
+        let src = vec![7u8; 64 * 4];
+        let mut dst = vec![0u8; 64 * 4];
+        blit_with(&mut dst, 0, &src, 0, 16, 4, PixelFormat::Xrgb8888, 4, true);
+        assert!(dst[..64].iter().all(|&b| b == 7) && dst[64..].iter().all(|&b| b == 0));
+    }
+}
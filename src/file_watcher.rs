@@ -0,0 +1,85 @@
+// Change notifications for a few files via kqueue, for live reload on macOS
+#![cfg(target_os = "macos")]
+
+use std::ffi::CString;
+use std::os::unix::ffi::OsStrExt;
+use std::path::PathBuf;
+
+pub struct FileWatcher {
+    kq: i32,
+    fds: Vec<i32>,
+}
+
+impl FileWatcher {
+    pub fn new() -> Result<Self, Box<dyn std::error::Error>> {
+        let kq = unsafe { libc::kqueue() };
+        if kq < 0 {
+            return Err(std::io::Error::last_os_error().into());
+        }
+        Ok(Self { kq, fds: Vec::new() })
+    }
+
+    /// Replace the watched set; files that don't exist are skipped. Watches
+    /// follow the inode, so call again after a change: editors and the
+    /// shader compiler may have replaced the file by rename.
+    pub fn watch(&mut self, paths: &[PathBuf]) {
+        self.clear();
+        for path in paths {
+            let c_path = match CString::new(path.as_os_str().as_bytes()) {
+                Ok(c_path) => c_path,
+                Err(_) => continue,
+            };
+            let fd = unsafe { libc::open(c_path.as_ptr(), libc::O_EVTONLY) };
+            if fd < 0 {
+                continue;
+            }
+            let change = libc::kevent {
+                ident: fd as usize,
+                filter: libc::EVFILT_VNODE,
+                flags: libc::EV_ADD | libc::EV_CLEAR,
+                fflags: libc::NOTE_WRITE | libc::NOTE_EXTEND | libc::NOTE_DELETE | libc::NOTE_RENAME,
+                data: 0,
+                udata: std::ptr::null_mut(),
+            };
+            let added = unsafe { libc::kevent(self.kq, &change, 1, std::ptr::null_mut(), 0, std::ptr::null()) };
+            if added < 0 {
+                unsafe { libc::close(fd) };
+                continue;
+            }
+            self.fds.push(fd);
+        }
+    }
+
+    /// Whether any watched file changed since the last call. Never blocks.
+    pub fn changed(&mut self) -> bool {
+        let zero = libc::timespec { tv_sec: 0, tv_nsec: 0 };
+        let mut events: [libc::kevent; 8] = unsafe { std::mem::zeroed() };
+        let mut changed = false;
+        loop {
+            let n = unsafe {
+                libc::kevent(self.kq, std::ptr::null(), 0, events.as_mut_ptr(), events.len() as i32, &zero)
+            };
+            if n <= 0 {
+                return changed;
+            }
+            changed = true;
+            if (n as usize) < events.len() {
+                return changed;
+            }
+        }
+    }
+
+    /// Closing a file descriptor also removes its kevent
+    fn clear(&mut self) {
+        for fd in self.fds.drain(..) {
+            unsafe { libc::close(fd) };
+        }
+    }
+}
+
+impl Drop for FileWatcher {
+    fn drop(&mut self) {
+        self.clear();
+        unsafe { libc::close(self.kq) };
+    }
+}
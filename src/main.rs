@@ -13,13 +13,17 @@ use std::io::{Read, Write};
 #[cfg(any(target_os = "linux", target_os = "redox"))]
 use std::time::Instant;
 
+mod pipeline_cache;
 mod shader;
 mod shader_compiler;
+mod telemetry;
 
 #[cfg(not(target_os = "macos"))]
 mod renderer;
 #[cfg(not(target_os = "macos"))]
 mod platform;
+#[cfg(not(target_os = "macos"))]
+mod blit;
 
 #[cfg(target_os = "macos")]
 mod main_macos;
@@ -27,6 +31,8 @@ mod main_macos;
 mod renderer_swapchain;
 #[cfg(target_os = "macos")]
 mod macos_resolution;
+#[cfg(target_os = "macos")]
+mod file_watcher;
 
 // Platform-conditional imports
 #[cfg(target_os = "linux")]
@@ -71,6 +77,10 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
 fn main() -> Result<(), Box<dyn std::error::Error>> {
     // Parse command line arguments
     let args: Vec<String> = std::env::args().collect();
+    if args.get(1).map(String::as_str) == Some("--bench-blit") {
+        blit::bench(1920, 1080, 300);
+        return Ok(());
+    }
     let shader_name = if args.len() < 2 {
         "example"
     } else {
@@ -116,26 +126,35 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
     let mut keyboard = Input::new()?;
 
     // Initialize Vulkan renderer
-    let mut renderer = VulkanRenderer::new(width, height)?;
+    let mut renderer = VulkanRenderer::new(width, height, display.export_scanout())?;
     println!(
         "Metalshader on {} ({}x{})",
         renderer.get_device_name(),
         width,
         height
     );
+    println!(
+        "Scanout: {}",
+        if renderer.is_zero_copy() { "zero-copy (dma-buf import)" } else { "copy via host memory" }
+    );
+
+    let _telemetry = telemetry::start_from_env();
 
     // Main loop state
     let mut current_shader_idx = current_shader_idx;
     let mut reload_requested = true;
     let start_time = Instant::now();
     let mut frame_count = 0u32;
+    let mut last_frame = Instant::now();
 
     loop {
         // Handle shader reload
         if reload_requested {
             let shader_info = shader_manager.get(current_shader_idx).unwrap();
+            let load_start = Instant::now();
             match renderer.load_shader(&shader_info.vert_path, &shader_info.frag_path) {
                 Ok(_) => {
+                    telemetry::record(telemetry::Stage::Reload, load_start.elapsed());
                     println!("Loaded shader: {}", shader_info.name);
                     reload_requested = false;
                 }
@@ -174,7 +193,7 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
                     match display.set_mode(mode_num) {
                         Ok((new_width, new_height)) => {
                             // Recreate renderer at new resolution
-                            renderer = VulkanRenderer::new(new_width, new_height)?;
+                            renderer = VulkanRenderer::new(new_width, new_height, display.export_scanout())?;
                             width = new_width;
                             height = new_height;
                             reload_requested = true;
@@ -218,21 +237,39 @@ fn main() -> Result<(), Box<dyn std::error::Error>> {
         }
 
         // Render frame
+        telemetry::tick();
         renderer.render_frame(&ubo)?;
 
-        // Copy to display (with correct row pitch)
-        display.present(renderer.get_frame_buffer(), renderer.get_row_pitch())?;
+        let present_start = Instant::now();
+        if renderer.is_zero_copy() {
+            // Frame is already in a scanout buffer
+            display.present_scanout(renderer.target_index())?;
+        } else {
+            // Copy to display (with correct row pitch); the readback runs two
+            // frames behind, so there is nothing to show for the first two
+            if let Some(frame) = renderer.get_frame_buffer() {
+                display.present(frame, renderer.get_row_pitch())?;
+            }
+        }
+        telemetry::record(telemetry::Stage::Present, present_start.elapsed());
+        telemetry::record(telemetry::Stage::Frame, last_frame.elapsed());
+        last_frame = Instant::now();
 
         // Print FPS
         frame_count += 1;
         if frame_count % 600 == 0 {
             let fps = frame_count as f32 / elapsed;
+            let flip = display
+                .flip_latency()
+                .map(|d| format!(" - flip {:.2} ms", d.as_secs_f64() * 1000.0))
+                .unwrap_or_default();
             println!(
-                "{:.1}s: {} frames ({:.1} FPS) - {}",
+                "{:.1}s: {} frames ({:.1} FPS) - {}{}",
                 elapsed,
                 frame_count,
                 fps,
-                shader_manager.get(current_shader_idx).unwrap().name
+                shader_manager.get(current_shader_idx).unwrap().name,
+                flip
             );
         }
     }
@@ -1,8 +1,10 @@
 // macOS-specific main with windowed swapchain support
 #![cfg(target_os = "macos")]
 
+use std::path::Path;
 use std::sync::{Arc, Mutex};
-use std::time::Instant;
+use std::thread::JoinHandle;
+use std::time::{Instant, SystemTime};
 use winit::application::ApplicationHandler;
 use winit::event::{ElementState, WindowEvent};
 use winit::event_loop::{ActiveEventLoop, ControlFlow, EventLoop};
@@ -12,10 +14,12 @@ use winit::window::{Window, WindowId};
 use objc2::runtime::{AnyObject, AnyClass};
 use objc2::sel;
 
+use crate::file_watcher::FileWatcher;
 use crate::macos_resolution::ResolutionManager;
 use crate::renderer_swapchain::SwapchainRenderer;
 use crate::shader::ShaderManager;
 use crate::shader_compiler::ShaderCompiler;
+use crate::telemetry::{self, Stage};
 
 // Pending file path from Finder "Open With" → shader switcher
 static PENDING_FILE: Mutex<Option<String>> = Mutex::new(None);
@@ -87,11 +91,18 @@ struct MetalshaderApp {
     shader_manager: ShaderManager,
     #[allow(dead_code)]
     shader_compiler: ShaderCompiler,
+    // Live reload of the current shader's files
+    watcher: Option<FileWatcher>,
+    watched_shader: Option<usize>,
+    // Background recompile, with the source's mtime when it started
+    live_compile: Option<(JoinHandle<bool>, Option<SystemTime>)>,
     resolution_manager: ResolutionManager,
     current_shader_idx: usize,
     start_time: Instant,
     frame_count: u32,
     reload_requested: bool,
+    // Shader whose pipeline is being built in the background
+    loading_shader: Option<usize>,
     // Mouse and scroll state
     mouse_x: f64,
     mouse_y: f64,
@@ -200,20 +211,24 @@ impl MetalshaderApp {
             .unwrap_or(0);
 
         println!("Starting with shader: {}",
-            shader_manager.get(current_shader_idx)
-                .map(|s| s.name.as_str())
-                .unwrap_or("(none)"));
+            shader_manager.name(current_shader_idx).unwrap_or("(none)"));
 
         Self {
             window: None,
             renderer: None,
             shader_manager,
+            watcher: FileWatcher::new()
+                .map_err(|e| eprintln!("Live reload unavailable: {}", e))
+                .ok(),
+            watched_shader: None,
+            live_compile: None,
             shader_compiler,
             resolution_manager: ResolutionManager::new(),
             current_shader_idx,
             start_time: Instant::now(),
             frame_count: 0,
             reload_requested: true,
+            loading_shader: None,
             mouse_x: 0.0,
             mouse_y: 0.0,
             mouse_smooth_x: 0.0,
@@ -380,7 +395,8 @@ impl ApplicationHandler for MetalshaderApp {
                 }
             }
             WindowEvent::RedrawRequested => {
-                // Handle shader reload
+                // Handle shader reload: the pipeline is built in the
+                // background while the current shader keeps rendering
                 if self.reload_requested {
                     if let Some(renderer) = &mut self.renderer {
                         if let Some(shader_info) = self.shader_manager.get(self.current_shader_idx) {
@@ -388,20 +404,34 @@ impl ApplicationHandler for MetalshaderApp {
                                 shader_info.vert_path.to_str().unwrap(),
                                 shader_info.frag_path.to_str().unwrap()
                             ) {
+                                Ok(_) => self.loading_shader = Some(self.current_shader_idx),
+                                Err(e) => {
+                                    eprintln!("Failed to load shader '{}': {}", shader_info.name, e);
+                                }
+                            }
+                        } else {
+                            eprintln!("No shaders available to load");
+                        }
+                        self.reload_requested = false;
+                    }
+                }
+
+                // Swap in the new pipeline once its build has finished
+                if let (Some(renderer), Some(idx)) = (&mut self.renderer, self.loading_shader) {
+                    if let Some(result) = renderer.poll_shader() {
+                        self.loading_shader = None;
+                        if let Some(shader_info) = self.shader_manager.get(idx) {
+                            match result {
                                 Ok(_) => {
                                     println!("Loaded shader: {}", shader_info.name);
                                     if let Some(window) = &self.window {
                                         window.set_title(&format!("Metalshader - {}", shader_info.name));
                                     }
-                                    self.reload_requested = false;
                                 }
                                 Err(e) => {
                                     eprintln!("Failed to load shader '{}': {}", shader_info.name, e);
                                 }
                             }
-                        } else {
-                            eprintln!("No shaders available to load");
-                            self.reload_requested = false;
                         }
                     }
                 }
@@ -414,6 +444,7 @@ impl ApplicationHandler for MetalshaderApp {
 
                         // Update button press durations
                         let now = Instant::now();
+                        telemetry::record(Stage::Frame, now.duration_since(self.last_frame_time));
                         let delta_time = now.duration_since(self.last_frame_time).as_secs_f32();
                         self.last_frame_time = now;
 
@@ -585,13 +616,81 @@ impl ApplicationHandler for MetalshaderApp {
                 }
             }
         }
+        self.check_live_reload();
         if let Some(window) = &self.window {
             window.request_redraw();
         }
     }
 }
 
+fn modified(path: &Path) -> Option<SystemTime> {
+    std::fs::metadata(path).and_then(|m| m.modified()).ok()
+}
+
 impl MetalshaderApp {
+    /// Live reload: when the current shader's source or SPIR-V changes on
+    /// disk, recompile the source on a worker thread if it is newer than its
+    /// SPIR-V, then rebuild the pipeline through the usual background load.
+    /// The clock keeps running.
+    fn check_live_reload(&mut self) {
+        let info = match self.shader_manager.get(self.current_shader_idx) {
+            Some(info) => info,
+            None => return,
+        };
+        let source = info.frag_path.with_extension("");
+        let files = [source.clone(), info.vert_path.clone(), info.frag_path.clone()];
+
+        if self.live_compile.as_ref().map_or(false, |(build, _)| build.is_finished()) {
+            let (build, started) = self.live_compile.take().unwrap();
+            if build.join().unwrap_or(false) {
+                self.reload_requested = true;
+            }
+            // The compile rewrote the SPIR-V; edits made meanwhile are
+            // caught by the mtime check and compiled next
+            self.watched_shader = None;
+            if modified(&source) > started {
+                self.start_live_compile(&source);
+            }
+        }
+        if self.live_compile.is_some() {
+            return;
+        }
+
+        let watcher = match &mut self.watcher {
+            Some(watcher) => watcher,
+            None => return,
+        };
+        if self.watched_shader != Some(self.current_shader_idx) {
+            watcher.watch(&files);
+            self.watched_shader = Some(self.current_shader_idx);
+            return;
+        }
+        if !watcher.changed() {
+            return;
+        }
+        watcher.watch(&files);
+
+        println!("\nShader changed on disk: {}", info.name);
+        if modified(&source) > modified(&info.frag_path) {
+            self.start_live_compile(&source);
+        } else {
+            self.reload_requested = true;
+        }
+    }
+
+    fn start_live_compile(&mut self, source: &Path) {
+        let started = modified(source);
+        let path = source.to_string_lossy().into_owned();
+        let build = std::thread::spawn(move || match ShaderCompiler::new().compile_if_needed(&path) {
+            Ok(_) => true,
+            Err(e) => {
+                eprintln!("Recompile failed, keeping the running version: {}", e);
+                false
+            }
+        });
+        self.live_compile = Some((build, started));
+    }
+
     fn shader_name_from_path(path: &str) -> String {
         let stem1 = std::path::Path::new(path)
             .file_stem().and_then(|s| s.to_str()).unwrap_or(path);
@@ -637,9 +736,12 @@ pub fn run_macos(shader_path: &str) -> Result<(), Box<dyn std::error::Error>> {
     // Retry after EventLoop::new() in case WinitApplicationDelegate wasn't registered yet
     inject_open_file_handler();
     event_loop.set_control_flow(ControlFlow::Poll);
+    let telemetry = telemetry::start_from_env();
 
     let mut app = MetalshaderApp::new(shader_path);
-    event_loop.run_app(&mut app)?;
+    let result = event_loop.run_app(&mut app);
+    drop(telemetry);
+    result?;
 
     Ok(())
 }
@@ -0,0 +1,116 @@
+// On-disk Vulkan pipeline cache, shared by both renderers and the C viewer
+//
+// Lives in $XDG_CACHE_HOME/metalshader (default ~/.cache/metalshader) in a
+// file named after the vendor, device, driver version and pipeline cache
+// UUID, so a driver update simply starts a fresh file.
+
+use ash::vk;
+use std::fs;
+use std::path::PathBuf;
+
+/// Size of VkPipelineCacheHeaderVersionOne
+const HEADER_SIZE: usize = 32;
+
+pub struct PipelineCache {
+    cache: vk::PipelineCache,
+    path: Option<PathBuf>,
+}
+
+impl PipelineCache {
+    /// Create the device's pipeline cache, seeded from disk when a matching file exists
+    pub fn load(
+        instance: &ash::Instance,
+        physical_device: vk::PhysicalDevice,
+        device: &ash::Device,
+    ) -> Result<Self, Box<dyn std::error::Error>> {
+        let props = unsafe { instance.get_physical_device_properties(physical_device) };
+        let path = cache_path(&props);
+
+        let data = path
+            .as_ref()
+            .and_then(|p| fs::read(p).ok())
+            .filter(|data| header_matches(data, &props))
+            .unwrap_or_default();
+        if let Some(p) = &path {
+            if !data.is_empty() {
+                println!("Pipeline cache: {} bytes from {}", data.len(), p.display());
+            }
+        }
+
+        let create_info = vk::PipelineCacheCreateInfo::default()
+            .initial_data(&data);
+        let cache = unsafe { device.create_pipeline_cache(&create_info, None)? };
+
+        Ok(Self { cache, path })
+    }
+
+    pub fn handle(&self) -> vk::PipelineCache {
+        self.cache
+    }
+
+    /// Write the cache to disk via a temp file + rename, so a crash
+    /// mid-write never leaves a truncated cache behind
+    pub fn save(&self, device: &ash::Device) -> Result<(), Box<dyn std::error::Error>> {
+        let path = match &self.path {
+            Some(path) => path,
+            None => return Ok(()),
+        };
+
+        let data = unsafe { device.get_pipeline_cache_data(self.cache)? };
+        if data.is_empty() {
+            return Ok(());
+        }
+
+        if let Some(dir) = path.parent() {
+            fs::create_dir_all(dir)?;
+        }
+        let tmp = path.with_extension("tmp");
+        fs::write(&tmp, &data)?;
+        fs::rename(&tmp, path)?;
+
+        println!("Pipeline cache: saved {} bytes to {}", data.len(), path.display());
+        Ok(())
+    }
+
+    /// Save to disk, then destroy the Vulkan object
+    pub fn destroy(&self, device: &ash::Device) {
+        if let Err(e) = self.save(device) {
+            eprintln!("Failed to save pipeline cache: {}", e);
+        }
+        unsafe {
+            device.destroy_pipeline_cache(self.cache, None);
+        }
+    }
+}
+
+fn cache_path(props: &vk::PhysicalDeviceProperties) -> Option<PathBuf> {
+    let base = std::env::var_os("XDG_CACHE_HOME")
+        .filter(|dir| !dir.is_empty())
+        .map(PathBuf::from)
+        .or_else(|| std::env::var_os("HOME").map(|home| PathBuf::from(home).join(".cache")))?;
+
+    let uuid: String = props
+        .pipeline_cache_uuid
+        .iter()
+        .map(|b| format!("{:02x}", b))
+        .collect();
+
+    Some(base.join("metalshader").join(format!(
+        "pipeline-{:04x}-{:04x}-{:08x}-{}.bin",
+        props.vendor_id, props.device_id, props.driver_version, uuid
+    )))
+}
+
+/// Drivers should reject foreign cache data themselves, but not all do
+fn header_matches(data: &[u8], props: &vk::PhysicalDeviceProperties) -> bool {
+    if data.len() < HEADER_SIZE {
+        return false;
+    }
+    let word = |i: usize| u32::from_ne_bytes([data[i], data[i + 1], data[i + 2], data[i + 3]]);
+
+    word(0) as usize >= HEADER_SIZE
+        && word(4) == vk::PipelineCacheHeaderVersion::ONE.as_raw() as u32
+        && word(8) == props.vendor_id
+        && word(12) == props.device_id
+        && data[16..HEADER_SIZE] == props.pipeline_cache_uuid[..]
+}
@@ -6,6 +6,21 @@
 // display presentation and keyboard input.
 
 use std::error::Error;
+use std::os::fd::OwnedFd;
+use std::time::Duration;
+
+/// A display scanout buffer exported as a dma-buf
+///
+/// Lets the renderer draw straight into the memory the display scans out,
+/// instead of handing each frame to `present()` for a CPU copy
+#[allow(dead_code)]
+pub struct ScanoutBuffer {
+    pub fd: OwnedFd,
+    pub width: u32,
+    pub height: u32,
+    /// Bytes per row (linear layout)
+    pub pitch: u32,
+}
 
 /// Platform-agnostic display backend trait
 ///
@@ -35,6 +50,27 @@ pub trait DisplayBackend {
     /// `data` contains the pixel data in BGRA format
     /// `row_pitch` is the number of bytes per row (may differ from width * 4 due to alignment)
     fn present(&mut self, data: &[u8], row_pitch: usize) -> Result<(), Box<dyn Error>>;
+
+    /// Export the scanout buffers for zero-copy rendering
+    ///
+    /// Returns an empty list when the backend can't share its buffers;
+    /// callers then fall back to `present()`. Must be called again after
+    /// `set_mode()`.
+    fn export_scanout(&self) -> Vec<ScanoutBuffer> {
+        Vec::new()
+    }
+
+    /// Present a frame the renderer drew directly into exported buffer `index`
+    fn present_scanout(&mut self, _index: usize) -> Result<(), Box<dyn Error>> {
+        Err("Zero-copy presentation not supported by this display backend".into())
+    }
+
+    /// Time from queueing the last page flip until it landed on a vblank
+    ///
+    /// None for backends that don't page flip
+    fn flip_latency(&self) -> Option<Duration> {
+        None
+    }
 }
 
 /// Platform-agnostic input backend trait
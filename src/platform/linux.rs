@@ -1,7 +1,8 @@
 // Linux platform implementation using DRM/KMS and evdev
 #![cfg(target_os = "linux")]
 
-use crate::platform::{DisplayBackend, InputBackend, KeyEvent};
+use crate::platform::{DisplayBackend, InputBackend, KeyEvent, ScanoutBuffer};
+use crate::blit::{blit, PixelFormat};
 use std::error::Error;
 
 // ============================================================================
@@ -9,10 +10,15 @@ use std::error::Error;
 // ============================================================================
 
 use drm::control::{connector, crtc, framebuffer, Device as ControlDevice, dumbbuffer::DumbBuffer};
+use drm::control::{ClipRect, Event, PageFlipFlags};
 use drm::buffer::{Buffer, DrmFourcc};
 use drm::Device;
 use std::fs::{File, OpenOptions};
 use std::os::unix::io::{AsFd, AsRawFd, BorrowedFd, RawFd};
+use std::time::{Duration, Instant};
+
+/// Scanout buffers to flip between: one on screen, one being drawn
+const SCANOUT_BUFFERS: usize = 2;
 
 /// Wrapper for DRM device that implements required traits
 #[derive(Debug)]
@@ -27,11 +33,21 @@ impl AsFd for DrmCard {
 impl Device for DrmCard {}
 impl ControlDevice for DrmCard {}
 
+/// A dumb buffer plus the DRM framebuffer that scans it out
+struct Surface {
+    dumb_buffer: DumbBuffer,
+    fb_id: framebuffer::Handle,
+}
+
 pub struct LinuxDisplay {
     drm_fd: RawFd,
     drm_card: DrmCard,
-    dumb_buffer: DumbBuffer,
-    fb_id: framebuffer::Handle,
+    surfaces: Vec<Surface>,
+    /// Surface currently on screen
+    front: usize,
+    /// Cleared if the driver rejects page flips; we then update in place
+    page_flip: bool,
+    flip_latency: Option<Duration>,
     crtc_id: crtc::Handle,
     connector_handle: connector::Handle,
     modes: Vec<drm::control::Mode>,
@@ -40,6 +56,83 @@ pub struct LinuxDisplay {
     height: u32,
 }
 
+impl LinuxDisplay {
+    fn create_surfaces(drm_card: &DrmCard, width: u32, height: u32) -> Result<Vec<Surface>, Box<dyn Error>> {
+        let mut surfaces = Vec::with_capacity(SCANOUT_BUFFERS);
+        for _ in 0..SCANOUT_BUFFERS {
+            // Create DumbBuffer (CPU-accessible buffer for virtio-gpu)
+            let dumb_buffer = drm_card.create_dumb_buffer(
+                (width, height),
+                DrmFourcc::Xrgb8888,
+                32 // bpp
+            ).map_err(|e| format!("Failed to create dumb buffer {}x{}: {}", width, height, e))?;
+
+            let fb_id = drm_card.add_framebuffer(&dumb_buffer, 24, 32)
+                .map_err(|e| format!("Failed to add framebuffer: {}", e))?;
+
+            surfaces.push(Surface { dumb_buffer, fb_id });
+        }
+        Ok(surfaces)
+    }
+
+    fn destroy_surfaces(&mut self) {
+        for surface in self.surfaces.drain(..) {
+            let _ = self.drm_card.destroy_framebuffer(surface.fb_id);
+            let _ = self.drm_card.destroy_dumb_buffer(surface.dumb_buffer);
+        }
+    }
+
+    /// Put surface `index` on screen, synced to vblank when page flips work
+    fn show(&mut self, index: usize) -> Result<(), Box<dyn Error>> {
+        let fb_id = self.surfaces[index].fb_id;
+
+        if self.page_flip {
+            let queued = Instant::now();
+            match self.drm_card.page_flip(self.crtc_id, fb_id, PageFlipFlags::EVENT, None) {
+                Ok(()) => {
+                    self.wait_for_flip()?;
+                    self.flip_latency = Some(queued.elapsed());
+                    self.front = index;
+                    return Ok(());
+                }
+                Err(e) => {
+                    eprintln!("Page flip failed ({}), updating the CRTC in place", e);
+                    self.page_flip = false;
+                }
+            }
+        }
+
+        // Unsynchronized fallback: retarget the CRTC only when the buffer changes
+        if index != self.front {
+            self.drm_card.set_crtc(
+                self.crtc_id,
+                Some(fb_id),
+                (0, 0),
+                &[self.connector_handle],
+                Some(self.modes[self.current_mode_idx]),
+            )?;
+            self.front = index;
+        }
+
+        // Mark framebuffer as dirty so DRM actually displays it!
+        let clip = ClipRect::new(0, 0, self.width as u16, self.height as u16);
+        self.drm_card.dirty_framebuffer(fb_id, &[clip])?;
+        Ok(())
+    }
+
+    /// Block on the DRM fd until the queued flip's completion event arrives,
+    /// after which the previous front buffer is free to draw into
+    fn wait_for_flip(&self) -> Result<(), Box<dyn Error>> {
+        loop {
+            for event in self.drm_card.receive_events()? {
+                if let Event::PageFlip(_) = event {
+                    return Ok(());
+                }
+            }
+        }
+    }
+}
+
 impl DisplayBackend for LinuxDisplay {
     fn new() -> Result<Self, Box<dyn Error>> {
         // Open DRM device
@@ -94,24 +187,14 @@ impl DisplayBackend for LinuxDisplay {
             .or_else(|| res.crtcs().first().copied())
             .ok_or("No CRTC found")?;
 
-        eprintln!("Creating dumb buffer: {}x{}", width, height);
-        // Create DumbBuffer (CPU-accessible buffer for virtio-gpu)
-        let dumb_buffer = drm_card.create_dumb_buffer(
-            (width as u32, height as u32),
-            DrmFourcc::Xrgb8888,
-            32 // bpp
-        ).map_err(|e| format!("Failed to create dumb buffer {}x{}: {}", width, height, e))?;
-
-        eprintln!("Creating framebuffer");
-        // Create framebuffer
-        let fb_id = drm_card.add_framebuffer(&dumb_buffer, 24, 32)
-            .map_err(|e| format!("Failed to add framebuffer: {}", e))?;
+        eprintln!("Creating {} scanout buffers: {}x{}", SCANOUT_BUFFERS, width, height);
+        let surfaces = Self::create_surfaces(&drm_card, width as u32, height as u32)?;
 
         eprintln!("Setting CRTC");
         // Set CRTC
         drm_card.set_crtc(
             crtc_id,
-            Some(fb_id),
+            Some(surfaces[0].fb_id),
             (0, 0),
             &[connector_handle],
             Some(*mode),
@@ -120,8 +203,10 @@ impl DisplayBackend for LinuxDisplay {
         Ok(Self {
             drm_fd,
             drm_card,
-            dumb_buffer,
-            fb_id,
+            surfaces,
+            front: 0,
+            page_flip: true,
+            flip_latency: None,
             crtc_id,
             connector_handle,
             modes,
@@ -141,34 +226,25 @@ impl DisplayBackend for LinuxDisplay {
             return Err(format!("Mode {} not available (only {} modes)", mode_number, self.modes.len()).into());
         }
 
-        let mode = &self.modes[mode_idx];
+        let mode = self.modes[mode_idx];
         let (width, height) = mode.size();
 
         eprintln!("\nSwitching to mode [{}]: {}x{}", mode_number, width, height);
 
-        // Remove old framebuffer
-        let _ = self.drm_card.destroy_framebuffer(self.fb_id);
-
-        // Destroy old dumb buffer
-        let _ = self.drm_card.destroy_dumb_buffer(self.dumb_buffer);
-
-        // Create new dumb buffer at new resolution
-        self.dumb_buffer = self.drm_card.create_dumb_buffer(
-            (width as u32, height as u32),
-            DrmFourcc::Xrgb8888,
-            32
-        )?;
+        // Remove old framebuffers and dumb buffers
+        self.destroy_surfaces();
 
-        // Create new framebuffer
-        self.fb_id = self.drm_card.add_framebuffer(&self.dumb_buffer, 24, 32)?;
+        // Create new ones at the new resolution
+        self.surfaces = Self::create_surfaces(&self.drm_card, width as u32, height as u32)?;
+        self.front = 0;
 
         // Set CRTC to new mode
         self.drm_card.set_crtc(
             self.crtc_id,
-            Some(self.fb_id),
+            Some(self.surfaces[0].fb_id),
             (0, 0),
             &[self.connector_handle],
-            Some(*mode),
+            Some(mode),
         )?;
 
         self.current_mode_idx = mode_idx;
@@ -181,10 +257,14 @@ impl DisplayBackend for LinuxDisplay {
     fn present(&mut self, frame_data: &[u8], src_row_pitch: usize) -> Result<(), Box<dyn Error>> {
         let bytes_per_pixel = 4;
         let row_size = self.width as usize * bytes_per_pixel;
-        let dst_stride = self.dumb_buffer.pitch() as usize;
+
+        // Draw into the buffer that is not on screen, then flip to it
+        let back = (self.front + 1) % self.surfaces.len();
+        let dumb_buffer = &mut self.surfaces[back].dumb_buffer;
+        let dst_stride = dumb_buffer.pitch() as usize;
 
         // Map DumbBuffer for CPU access
-        let mut mapping = self.drm_card.map_dumb_buffer(&mut self.dumb_buffer)?;
+        let mut mapping = self.drm_card.map_dumb_buffer(dumb_buffer)?;
         let buffer_slice = mapping.as_mut();
 
         static mut DEBUG_COUNT: u32 = 0;
@@ -198,15 +278,16 @@ impl DisplayBackend for LinuxDisplay {
             }
         }
 
-        for y in 0..self.height as usize {
-            let dst_offset = y * dst_stride;
-            let src_offset = y * src_row_pitch;  // Use Vulkan's row pitch
-            let copy_len = row_size;
-            if dst_offset + copy_len <= buffer_slice.len() && src_offset + copy_len <= frame_data.len() {
-                buffer_slice[dst_offset..dst_offset + copy_len]
-                    .copy_from_slice(&frame_data[src_offset..src_offset + copy_len]);
-            }
-        }
+        // Vulkan's row pitch on the source side; BGRA is XRGB8888's byte order
+        blit(
+            buffer_slice,
+            dst_stride,
+            frame_data,
+            src_row_pitch,
+            self.width as usize,
+            self.height as usize,
+            PixelFormat::Xrgb8888,
+        );
 
         unsafe {
             if DEBUG_COUNT == 0 {
@@ -215,13 +296,37 @@ impl DisplayBackend for LinuxDisplay {
             }
         }
 
-        // CRITICAL: Mark framebuffer as dirty so DRM actually displays it!
-        drop(mapping);  // Unmap before dirty call
-        use drm::control::ClipRect;
-        let clip = ClipRect::new(0, 0, self.width as u16, self.height as u16);
-        self.drm_card.dirty_framebuffer(self.fb_id, &[clip])?;
+        drop(mapping);  // Unmap before flipping
+        self.show(back)
+    }
 
-        Ok(())
+    fn export_scanout(&self) -> Vec<ScanoutBuffer> {
+        let flags = (libc::O_CLOEXEC | libc::O_RDWR) as u32;
+        let mut buffers = Vec::with_capacity(self.surfaces.len());
+        for surface in &self.surfaces {
+            match self.drm_card.buffer_to_prime_fd(surface.dumb_buffer.handle(), flags) {
+                Ok(fd) => buffers.push(ScanoutBuffer {
+                    fd,
+                    width: self.width,
+                    height: self.height,
+                    pitch: surface.dumb_buffer.pitch(),
+                }),
+                Err(e) => {
+                    eprintln!("Can't export dumb buffer as dma-buf: {}", e);
+                    return Vec::new();
+                }
+            }
+        }
+        buffers
+    }
+
+    fn present_scanout(&mut self, index: usize) -> Result<(), Box<dyn Error>> {
+        // The renderer already wrote the frame; only put it on screen
+        self.show(index)
+    }
+
+    fn flip_latency(&self) -> Option<Duration> {
+        self.flip_latency
     }
 }
 
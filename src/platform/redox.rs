@@ -2,6 +2,7 @@
 #![cfg(target_os = "redox")]
 
 use crate::platform::{DisplayBackend, InputBackend, KeyEvent};
+use crate::blit::{blit, PixelFormat};
 use std::error::Error;
 use std::fs::File;
 
@@ -106,15 +107,7 @@ impl DisplayBackend for RedoxDisplay {
             let fb = std::slice::from_raw_parts_mut(self.fb_ptr, self.fb_size);
 
             // Handle row pitch differences
-            for y in 0..self.height as usize {
-                let dst_offset = y * row_size;
-                let src_offset = y * row_pitch;
-
-                if dst_offset + row_size <= fb.len() && src_offset + row_size <= data.len() {
-                    fb[dst_offset..dst_offset + row_size]
-                        .copy_from_slice(&data[src_offset..src_offset + row_size]);
-                }
-            }
+            blit(fb, row_size, data, row_pitch, self.width as usize, self.height as usize, PixelFormat::Xrgb8888);
         }
 
         // Write damage region to trigger update
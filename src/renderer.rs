@@ -4,7 +4,53 @@ use ash::vk;
 use std::ffi::CStr;
 use std::fs::File;
 use std::io::Read;
+use std::os::fd::{AsRawFd, FromRawFd, IntoRawFd, OwnedFd};
 use std::path::Path;
+use std::time::Instant;
+
+use crate::pipeline_cache::PipelineCache;
+use crate::platform::ScanoutBuffer;
+use crate::telemetry::{self, Stage};
+
+/// Dumb buffers are always linear
+const DRM_FORMAT_MOD_LINEAR: u64 = 0;
+
+/// Frames in flight on the copy path: the CPU reads back frame N-2 while
+/// the GPU renders frame N
+const READBACK_DEPTH: usize = 3;
+
+/// A color attachment frames can be rendered into
+struct RenderTarget {
+    image: vk::Image,
+    memory: vk::DeviceMemory,
+    view: vk::ImageView,
+    framebuffer: vk::Framebuffer,
+}
+
+/// Everything one frame in flight touches, so the CPU can fill in the
+/// next frame while the GPU still works on the previous ones
+struct FrameSlot {
+    command_buffer: vk::CommandBuffer,
+    fence: vk::Fence,
+    uniform_buffer: vk::Buffer,
+    uniform_memory: vk::DeviceMemory,
+    uniform_ptr: *mut u8,
+    descriptor_set: vk::DescriptorSet,
+    /// Copy path only
+    readback: Option<Readback>,
+    /// Submitted, fence not yet waited for
+    pending: bool,
+}
+
+/// Persistently mapped buffer the slot's render target is copied into
+struct Readback {
+    buffer: vk::Buffer,
+    memory: vk::DeviceMemory,
+    ptr: *mut u8,
+    /// Dedicated transfer queue: the pre-recorded copy and the semaphore
+    /// the frame's render signals to start it
+    transfer: Option<(vk::CommandBuffer, vk::Semaphore)>,
+}
 
 pub struct VulkanRenderer {
     #[allow(dead_code)]
@@ -13,12 +59,22 @@ pub struct VulkanRenderer {
     device: ash::Device,
     physical_device: vk::PhysicalDevice,
     queue: vk::Queue,
-
-    render_target_image: vk::Image,
-    render_target_memory: vk::DeviceMemory,
-    render_target_view: vk::ImageView,
-    render_target_ptr: *mut u8,
-    render_target_size: usize,
+    /// Transfer-only queue family (a DMA engine) for the readback copies
+    transfer_queue: Option<vk::Queue>,
+    transfer_pool: Option<vk::CommandPool>,
+
+    /// One device-local target per frame slot, or one per imported scanout buffer
+    render_targets: Vec<RenderTarget>,
+    /// Target the last frame was rendered into
+    target_index: usize,
+    /// Render targets are the display's scanout buffers, imported as dma-bufs
+    zero_copy: bool,
+
+    /// One slot with zero-copy (frames are presented as soon as they are
+    /// done), READBACK_DEPTH on the copy path
+    slots: Vec<FrameSlot>,
+    /// Slot whose readback holds the newest finished frame
+    ready_slot: Option<usize>,
 
     texture_image: vk::Image,
     texture_memory: vk::DeviceMemory,
@@ -26,21 +82,14 @@ pub struct VulkanRenderer {
     sampler: vk::Sampler,
 
     render_pass: vk::RenderPass,
-    framebuffer: vk::Framebuffer,
 
     descriptor_pool: vk::DescriptorPool,
     descriptor_set_layout: vk::DescriptorSetLayout,
-    descriptor_set: vk::DescriptorSet,
     pipeline_layout: vk::PipelineLayout,
 
-    uniform_buffer: vk::Buffer,
-    uniform_memory: vk::DeviceMemory,
-    uniform_ptr: *mut u8,
-
     pipeline: Option<vk::Pipeline>,
+    pipeline_cache: PipelineCache,
     command_pool: vk::CommandPool,
-    command_buffer: vk::CommandBuffer,
-    fence: vk::Fence,
 
     width: u32,
     height: u32,
@@ -48,7 +97,13 @@ pub struct VulkanRenderer {
 }
 
 impl VulkanRenderer {
-    pub fn new(width: u32, height: u32) -> Result<Self, Box<dyn std::error::Error>> {
+    /// Create the renderer. When `scanout` buffers are given and the driver
+    /// can import dma-bufs, frames are rendered straight into them in turn;
+    /// otherwise into device memory, copied back into host memory for
+    /// `get_frame_buffer()`.
+    pub fn new(width: u32, height: u32, scanout: Vec<ScanoutBuffer>)
+        -> Result<Self, Box<dyn std::error::Error>>
+    {
         unsafe {
             let entry = ash::Entry::load()?;
 
@@ -85,83 +140,109 @@ impl VulkanRenderer {
 
             let mem_properties = instance.get_physical_device_memory_properties(physical_device);
 
+            // Rendering wants graphics and compute on one queue, like the C
+            // viewer. A transfer-only family is usually a DMA engine, which
+            // copies frames out without taking time from rendering
+            let families = instance.get_physical_device_queue_family_properties(physical_device);
+            let graphics_family = families
+                .iter()
+                .position(|f| f.queue_flags.contains(vk::QueueFlags::GRAPHICS | vk::QueueFlags::COMPUTE))
+                .ok_or("No graphics+compute queue family")? as u32;
+            let transfer_family = families
+                .iter()
+                .position(|f| {
+                    f.queue_flags.contains(vk::QueueFlags::TRANSFER)
+                        && !f.queue_flags.intersects(vk::QueueFlags::GRAPHICS | vk::QueueFlags::COMPUTE)
+                })
+                .map(|i| i as u32);
+
             // Create device with portability subset for MoltenVK
-            let queue_info = vk::DeviceQueueCreateInfo::default()
-                .queue_family_index(0)
-                .queue_priorities(&[1.0]);
+            let mut queue_infos = vec![vk::DeviceQueueCreateInfo::default()
+                .queue_family_index(graphics_family)
+                .queue_priorities(&[1.0])];
+            if let Some(family) = transfer_family {
+                queue_infos.push(vk::DeviceQueueCreateInfo::default()
+                    .queue_family_index(family)
+                    .queue_priorities(&[1.0]));
+            }
 
             #[cfg(target_os = "macos")]
-            let device_extensions = vec![
+            let mut device_extensions = vec![
                 b"VK_KHR_portability_subset\0".as_ptr() as *const i8,
             ];
 
             #[cfg(not(target_os = "macos"))]
-            let device_extensions: Vec<*const i8> = vec![];
+            let mut device_extensions: Vec<*const i8> = vec![];
+
+            // Zero-copy scanout imports the display's dma-buf as the render target
+            let zero_copy_extensions = [
+                ash::khr::external_memory_fd::NAME,
+                ash::ext::external_memory_dma_buf::NAME,
+                ash::ext::image_drm_format_modifier::NAME,
+                ash::khr::image_format_list::NAME,
+            ];
+            let zero_copy = !scanout.is_empty()
+                && has_device_extensions(&instance, physical_device, &zero_copy_extensions)?;
+            if zero_copy {
+                device_extensions.extend(zero_copy_extensions.iter().map(|name| name.as_ptr()));
+            }
 
             let device_create_info = vk::DeviceCreateInfo::default()
-                .queue_create_infos(std::slice::from_ref(&queue_info))
+                .queue_create_infos(&queue_infos)
                 .enabled_extension_names(&device_extensions);
 
             let device = instance.create_device(physical_device, &device_create_info, None)?;
-            let queue = device.get_device_queue(0, 0);
-
-            // Create render target image (LINEAR + HOST_VISIBLE)
-            let rt_image_info = vk::ImageCreateInfo::default()
-                .image_type(vk::ImageType::TYPE_2D)
-                .format(vk::Format::B8G8R8A8_UNORM)
-                .extent(vk::Extent3D { width, height, depth: 1 })
-                .mip_levels(1)
-                .array_layers(1)
-                .samples(vk::SampleCountFlags::TYPE_1)
-                .tiling(vk::ImageTiling::LINEAR)
-                .usage(vk::ImageUsageFlags::COLOR_ATTACHMENT)
-                .initial_layout(vk::ImageLayout::UNDEFINED);
-
-            let render_target_image = device.create_image(&rt_image_info, None)?;
-            let rt_mem_req = device.get_image_memory_requirements(render_target_image);
-
-            let rt_mem_type = find_memory_type(
-                &mem_properties,
-                rt_mem_req.memory_type_bits,
-                vk::MemoryPropertyFlags::HOST_VISIBLE | vk::MemoryPropertyFlags::HOST_COHERENT,
-            )?;
-
-            let rt_alloc_info = vk::MemoryAllocateInfo::default()
-                .allocation_size(rt_mem_req.size)
-                .memory_type_index(rt_mem_type);
-
-            let render_target_memory = device.allocate_memory(&rt_alloc_info, None)?;
-            device.bind_image_memory(render_target_image, render_target_memory, 0)?;
-
-            let render_target_ptr = device.map_memory(
-                render_target_memory,
-                0,
-                vk::WHOLE_SIZE,
-                vk::MemoryMapFlags::empty(),
-            )? as *mut u8;
-
-            let rt_view_info = vk::ImageViewCreateInfo::default()
-                .image(render_target_image)
-                .view_type(vk::ImageViewType::TYPE_2D)
-                .format(vk::Format::B8G8R8A8_UNORM)
-                .subresource_range(vk::ImageSubresourceRange {
-                    aspect_mask: vk::ImageAspectFlags::COLOR,
-                    base_mip_level: 0,
-                    level_count: 1,
-                    base_array_layer: 0,
-                    layer_count: 1,
-                });
-
-            let render_target_view = device.create_image_view(&rt_view_info, None)?;
-
-            // Get layout for row pitch
-            let subresource = vk::ImageSubresource {
-                aspect_mask: vk::ImageAspectFlags::COLOR,
-                mip_level: 0,
-                array_layer: 0,
-            };
-            let layout = device.get_image_subresource_layout(render_target_image, subresource);
-            let row_pitch = layout.row_pitch as usize;
+            let queue = device.get_device_queue(graphics_family, 0);
+
+            let pipeline_cache = PipelineCache::load(&instance, physical_device, &device)?;
+
+            // Render targets: the imported scanout buffers, or one OPTIMAL
+            // device-local image per frame slot
+            let mut targets: Vec<(vk::Image, vk::DeviceMemory)> = Vec::new();
+            if zero_copy {
+                for buffer in scanout {
+                    match Self::import_scanout(&instance, &device, &mem_properties, width, height, buffer) {
+                        Ok(target) => targets.push(target),
+                        Err(e) => {
+                            eprintln!("dma-buf import failed ({}), falling back to copy path", e);
+                            for (image, memory) in targets.drain(..) {
+                                device.destroy_image(image, None);
+                                device.free_memory(memory, None);
+                            }
+                            break;
+                        }
+                    }
+                }
+            }
+            let zero_copy = !targets.is_empty();
+            let transfer_family = transfer_family.filter(|_| !zero_copy);
+
+            let slot_count = if zero_copy { 1 } else { READBACK_DEPTH };
+            let target_families = [graphics_family, transfer_family.unwrap_or(graphics_family)];
+            if !zero_copy {
+                for _ in 0..slot_count {
+                    targets.push(Self::create_render_target(&device, &mem_properties, width, height, &target_families)?);
+                }
+            }
+            // The readback buffers are tightly packed
+            let row_pitch = if zero_copy { 0 } else { width as usize * 4 };
+
+            let mut render_target_views = Vec::with_capacity(targets.len());
+            for &(image, _) in &targets {
+                let rt_view_info = vk::ImageViewCreateInfo::default()
+                    .image(image)
+                    .view_type(vk::ImageViewType::TYPE_2D)
+                    .format(vk::Format::B8G8R8A8_UNORM)
+                    .subresource_range(vk::ImageSubresourceRange {
+                        aspect_mask: vk::ImageAspectFlags::COLOR,
+                        base_mip_level: 0,
+                        level_count: 1,
+                        base_array_layer: 0,
+                        layer_count: 1,
+                    });
+
+                render_target_views.push(device.create_image_view(&rt_view_info, None)?);
+            }
 
             // Create texture
             let (texture_image, texture_memory, texture_view) =
@@ -200,44 +281,19 @@ impl VulkanRenderer {
 
             let render_pass = device.create_render_pass(&render_pass_info, None)?;
 
-            // Create framebuffer
-            let fb_info = vk::FramebufferCreateInfo::default()
-                .render_pass(render_pass)
-                .attachments(std::slice::from_ref(&render_target_view))
-                .width(width)
-                .height(height)
-                .layers(1);
-
-            let framebuffer = device.create_framebuffer(&fb_info, None)?;
-
-            // Create uniform buffer
-            let ubo_size = 64;
-            let ubo_info = vk::BufferCreateInfo::default()
-                .size(ubo_size)
-                .usage(vk::BufferUsageFlags::UNIFORM_BUFFER);
-
-            let uniform_buffer = device.create_buffer(&ubo_info, None)?;
-            let ubo_req = device.get_buffer_memory_requirements(uniform_buffer);
-
-            let ubo_mem_type = find_memory_type(
-                &mem_properties,
-                ubo_req.memory_type_bits,
-                vk::MemoryPropertyFlags::HOST_VISIBLE | vk::MemoryPropertyFlags::HOST_COHERENT,
-            )?;
-
-            let ubo_alloc = vk::MemoryAllocateInfo::default()
-                .allocation_size(ubo_req.size)
-                .memory_type_index(ubo_mem_type);
-
-            let uniform_memory = device.allocate_memory(&ubo_alloc, None)?;
-            device.bind_buffer_memory(uniform_buffer, uniform_memory, 0)?;
-
-            let uniform_ptr = device.map_memory(
-                uniform_memory,
-                0,
-                ubo_size,
-                vk::MemoryMapFlags::empty(),
-            )? as *mut u8;
+            // Create a framebuffer per render target
+            let mut render_targets = Vec::with_capacity(targets.len());
+            for (&(image, memory), &view) in targets.iter().zip(&render_target_views) {
+                let fb_info = vk::FramebufferCreateInfo::default()
+                    .render_pass(render_pass)
+                    .attachments(std::slice::from_ref(&view))
+                    .width(width)
+                    .height(height)
+                    .layers(1);
+
+                let framebuffer = device.create_framebuffer(&fb_info, None)?;
+                render_targets.push(RenderTarget { image, memory, view, framebuffer });
+            }
 
             // Create descriptors
             let bindings = [
@@ -263,82 +319,67 @@ impl VulkanRenderer {
 
             let pipeline_layout = device.create_pipeline_layout(&pipeline_layout_info, None)?;
 
-            // Create descriptor pool
+            // Create descriptor pool: one set per slot
             let pool_sizes = [
                 vk::DescriptorPoolSize {
                     ty: vk::DescriptorType::UNIFORM_BUFFER,
-                    descriptor_count: 1,
+                    descriptor_count: slot_count as u32,
                 },
                 vk::DescriptorPoolSize {
                     ty: vk::DescriptorType::COMBINED_IMAGE_SAMPLER,
-                    descriptor_count: 1,
+                    descriptor_count: slot_count as u32,
                 },
             ];
 
             let pool_info = vk::DescriptorPoolCreateInfo::default()
-                .max_sets(1)
+                .max_sets(slot_count as u32)
                 .pool_sizes(&pool_sizes);
 
             let descriptor_pool = device.create_descriptor_pool(&pool_info, None)?;
 
-            let alloc_info = vk::DescriptorSetAllocateInfo::default()
-                .descriptor_pool(descriptor_pool)
-                .set_layouts(std::slice::from_ref(&descriptor_set_layout));
-
-            let descriptor_sets = device.allocate_descriptor_sets(&alloc_info)?;
-            let descriptor_set = descriptor_sets[0];
-
-            // Update descriptors
-            let buffer_info = vk::DescriptorBufferInfo::default()
-                .buffer(uniform_buffer)
-                .offset(0)
-                .range(64);
-
-            let image_info = vk::DescriptorImageInfo::default()
-                .sampler(sampler)
-                .image_view(texture_view)
-                .image_layout(vk::ImageLayout::SHADER_READ_ONLY_OPTIMAL);
-
-            let writes = [
-                vk::WriteDescriptorSet::default()
-                    .dst_set(descriptor_set)
-                    .dst_binding(0)
-                    .descriptor_type(vk::DescriptorType::UNIFORM_BUFFER)
-                    .buffer_info(std::slice::from_ref(&buffer_info)),
-                vk::WriteDescriptorSet::default()
-                    .dst_set(descriptor_set)
-                    .dst_binding(1)
-                    .descriptor_type(vk::DescriptorType::COMBINED_IMAGE_SAMPLER)
-                    .image_info(std::slice::from_ref(&image_info)),
-            ];
-
-            device.update_descriptor_sets(&writes, &[]);
-
-            // Create command pool
+            // Create command pools; command buffers are re-recorded every frame
             let pool_info = vk::CommandPoolCreateInfo::default()
-                .queue_family_index(0);
+                .flags(vk::CommandPoolCreateFlags::RESET_COMMAND_BUFFER)
+                .queue_family_index(graphics_family);
 
             let command_pool = device.create_command_pool(&pool_info, None)?;
 
-            let alloc_info = vk::CommandBufferAllocateInfo::default()
-                .command_pool(command_pool)
-                .level(vk::CommandBufferLevel::PRIMARY)
-                .command_buffer_count(1);
+            let transfer_queue = transfer_family.map(|family| device.get_device_queue(family, 0));
+            let transfer_pool = match transfer_family {
+                Some(family) => Some(device.create_command_pool(
+                    &vk::CommandPoolCreateInfo::default().queue_family_index(family),
+                    None,
+                )?),
+                None => None,
+            };
 
-            let command_buffers = device.allocate_command_buffers(&alloc_info)?;
-            let command_buffer = command_buffers[0];
+            let slots = (0..slot_count)
+                .map(|i| Self::create_slot(
+                    &device,
+                    &mem_properties,
+                    descriptor_pool,
+                    descriptor_set_layout,
+                    command_pool,
+                    transfer_pool,
+                    sampler,
+                    texture_view,
+                    (!zero_copy).then(|| render_targets[i].image),
+                    width,
+                    height,
+                ))
+                .collect::<Result<Vec<_>, _>>()?;
 
             // Transition texture to shader read
             Self::transition_texture_layout(
                 &device,
-                command_buffer,
+                slots[0].command_buffer,
                 queue,
                 texture_image,
             )?;
 
-            // Create fence
-            let fence_info = vk::FenceCreateInfo::default();
-            let fence = device.create_fence(&fence_info, None)?;
+            if let Some(family) = transfer_family {
+                println!("Readback: transfer queue family {}", family);
+            }
 
             Ok(Self {
                 entry,
@@ -346,28 +387,24 @@ impl VulkanRenderer {
                 device,
                 physical_device,
                 queue,
-                render_target_image,
-                render_target_memory,
-                render_target_view,
-                render_target_ptr,
-                render_target_size: (height as usize * row_pitch),
+                transfer_queue,
+                transfer_pool,
+                render_targets,
+                target_index: 0,
+                zero_copy,
+                slots,
+                ready_slot: None,
                 texture_image,
                 texture_memory,
                 texture_view,
                 sampler,
                 render_pass,
-                framebuffer,
                 descriptor_pool,
                 descriptor_set_layout,
-                descriptor_set,
                 pipeline_layout,
-                uniform_buffer,
-                uniform_memory,
-                uniform_ptr,
                 pipeline: None,
+                pipeline_cache,
                 command_pool,
-                command_buffer,
-                fence,
                 width,
                 height,
                 row_pitch,
@@ -388,8 +425,14 @@ impl VulkanRenderer {
         -> Result<(), Box<dyn std::error::Error>>
     {
         unsafe {
-            // Destroy old pipeline if exists
+            // Destroy old pipeline if exists, once the frames still in
+            // flight with it are done. They stay pending, so render_frame
+            // collects them as usual (their fences are signalled by then).
             if let Some(pipeline) = self.pipeline.take() {
+                let fences: Vec<vk::Fence> = self.slots.iter().filter(|s| s.pending).map(|s| s.fence).collect();
+                if !fences.is_empty() {
+                    self.device.wait_for_fences(&fences, true, u64::MAX)?;
+                }
                 self.device.destroy_pipeline(pipeline, None);
             }
 
@@ -472,7 +515,7 @@ impl VulkanRenderer {
                 .subpass(0);
 
             let pipelines = self.device.create_graphics_pipelines(
-                vk::PipelineCache::null(),
+                self.pipeline_cache.handle(),
                 std::slice::from_ref(&pipeline_info),
                 None,
             ).map_err(|e| e.1)?;
@@ -492,11 +535,21 @@ impl VulkanRenderer {
     {
         unsafe {
             let pipeline = self.pipeline.ok_or("No shader loaded")?;
-
-            // Update UBO
+            let record_start = Instant::now();
+
+            // Rotate through the targets; with imported scanout buffers this
+            // keeps us off the one currently on screen. On the copy path
+            // target and slot go together.
+            self.target_index = (self.target_index + 1) % self.render_targets.len();
+            let framebuffer = self.render_targets[self.target_index].framebuffer;
+            let slot_index = self.target_index % self.slots.len();
+            let slot = &mut self.slots[slot_index];
+            let command_buffer = slot.command_buffer;
+
+            // Update UBO; the slot's last frame has already been waited for
             std::ptr::copy_nonoverlapping(
                 ubo as *const _ as *const u8,
-                self.uniform_ptr,
+                slot.uniform_ptr,
                 std::mem::size_of::<crate::ShaderToyUBO>(),
             );
 
@@ -504,7 +557,7 @@ impl VulkanRenderer {
             let begin_info = vk::CommandBufferBeginInfo::default()
                 .flags(vk::CommandBufferUsageFlags::ONE_TIME_SUBMIT);
 
-            self.device.begin_command_buffer(self.command_buffer, &begin_info)?;
+            self.device.begin_command_buffer(command_buffer, &begin_info)?;
 
             let clear_value = vk::ClearValue {
                 color: vk::ClearColorValue {
@@ -514,7 +567,7 @@ impl VulkanRenderer {
 
             let render_pass_info = vk::RenderPassBeginInfo::default()
                 .render_pass(self.render_pass)
-                .framebuffer(self.framebuffer)
+                .framebuffer(framebuffer)
                 .render_area(vk::Rect2D {
                     offset: vk::Offset2D { x: 0, y: 0 },
                     extent: vk::Extent2D {
@@ -525,45 +578,117 @@ impl VulkanRenderer {
                 .clear_values(std::slice::from_ref(&clear_value));
 
             self.device.cmd_begin_render_pass(
-                self.command_buffer,
+                command_buffer,
                 &render_pass_info,
                 vk::SubpassContents::INLINE,
             );
 
             self.device.cmd_bind_pipeline(
-                self.command_buffer,
+                command_buffer,
                 vk::PipelineBindPoint::GRAPHICS,
                 pipeline,
             );
 
             self.device.cmd_bind_descriptor_sets(
-                self.command_buffer,
+                command_buffer,
                 vk::PipelineBindPoint::GRAPHICS,
                 self.pipeline_layout,
                 0,
-                &[self.descriptor_set],
+                &[slot.descriptor_set],
                 &[],
             );
 
-            self.device.cmd_draw(self.command_buffer, 6, 1, 0, 0);
-            self.device.cmd_end_render_pass(self.command_buffer);
-            self.device.end_command_buffer(self.command_buffer)?;
+            self.device.cmd_draw(command_buffer, 6, 1, 0, 0);
+            self.device.cmd_end_render_pass(command_buffer);
+
+            // Copy path without a transfer queue: read back in the same submit
+            let image = self.render_targets[self.target_index].image;
+            if let Some(readback) = slot.readback.as_ref().filter(|r| r.transfer.is_none()) {
+                let barrier = vk::ImageMemoryBarrier::default()
+                    .src_access_mask(vk::AccessFlags::COLOR_ATTACHMENT_WRITE)
+                    .dst_access_mask(vk::AccessFlags::TRANSFER_READ)
+                    .old_layout(vk::ImageLayout::GENERAL)
+                    .new_layout(vk::ImageLayout::GENERAL)
+                    .src_queue_family_index(vk::QUEUE_FAMILY_IGNORED)
+                    .dst_queue_family_index(vk::QUEUE_FAMILY_IGNORED)
+                    .image(image)
+                    .subresource_range(color_range());
+                self.device.cmd_pipeline_barrier(
+                    command_buffer,
+                    vk::PipelineStageFlags::COLOR_ATTACHMENT_OUTPUT,
+                    vk::PipelineStageFlags::TRANSFER,
+                    vk::DependencyFlags::empty(),
+                    &[],
+                    &[],
+                    &[barrier],
+                );
+                record_readback(&self.device, command_buffer, image, readback.buffer, self.width, self.height);
+            }
+            self.device.end_command_buffer(command_buffer)?;
 
-            // Submit and wait
+            // Submit without waiting. With a transfer queue the render
+            // signals the slot's semaphore and the copy signals the fence.
+            let graphics_semaphores = match slot.readback.as_ref().and_then(|r| r.transfer) {
+                Some((_, semaphore)) => vec![semaphore],
+                None => vec![],
+            };
             let submit_info = vk::SubmitInfo::default()
-                .command_buffers(std::slice::from_ref(&self.command_buffer));
-
-            self.device.queue_submit(self.queue, &[submit_info], self.fence)?;
-            self.device.wait_for_fences(&[self.fence], true, u64::MAX)?;
-            self.device.reset_fences(&[self.fence])?;
+                .command_buffers(std::slice::from_ref(&command_buffer))
+                .signal_semaphores(&graphics_semaphores);
+
+            match (self.transfer_queue, slot.readback.as_ref().and_then(|r| r.transfer)) {
+                (Some(transfer_queue), Some((transfer_command, semaphore))) => {
+                    self.device.queue_submit(self.queue, &[submit_info], vk::Fence::null())?;
+                    let wait_stage = vk::PipelineStageFlags::TRANSFER;
+                    let transfer_info = vk::SubmitInfo::default()
+                        .wait_semaphores(std::slice::from_ref(&semaphore))
+                        .wait_dst_stage_mask(std::slice::from_ref(&wait_stage))
+                        .command_buffers(std::slice::from_ref(&transfer_command));
+                    self.device.queue_submit(transfer_queue, &[transfer_info], slot.fence)?;
+                }
+                _ => self.device.queue_submit(self.queue, &[submit_info], slot.fence)?,
+            }
+            slot.pending = true;
+            telemetry::record(Stage::Record, record_start.elapsed());
+
+            // Collect the oldest frame in flight: N-2 on the copy path, the
+            // one just submitted with a single (zero-copy) slot
+            let oldest = (slot_index + 1) % self.slots.len();
+            let slot = &mut self.slots[oldest];
+            if slot.pending {
+                let wait_start = Instant::now();
+                telemetry::fence_wait_begin();
+                let waited = self.device.wait_for_fences(&[slot.fence], true, u64::MAX);
+                telemetry::fence_wait_end();
+                waited?;
+                telemetry::record(Stage::Fence, wait_start.elapsed());
+                self.device.reset_fences(&[slot.fence])?;
+                slot.pending = false;
+                self.ready_slot = Some(oldest);
+            }
 
             Ok(())
         }
     }
 
-    pub fn get_frame_buffer(&self) -> &[u8] {
+    /// True when frames land directly in the display's scanout buffer,
+    /// so there is nothing to copy out with `get_frame_buffer()`
+    pub fn is_zero_copy(&self) -> bool {
+        self.zero_copy
+    }
+
+    /// Index of the render target (scanout buffer) the last frame went to
+    pub fn target_index(&self) -> usize {
+        self.target_index
+    }
+
+    /// The newest frame read back into host memory: the one rendered two
+    /// `render_frame()` calls ago. None until the first one is done.
+    pub fn get_frame_buffer(&self) -> Option<&[u8]> {
+        assert!(!self.zero_copy, "zero-copy render target has no host mapping");
+        let readback = self.slots[self.ready_slot?].readback.as_ref()?;
         unsafe {
-            let buffer = std::slice::from_raw_parts(self.render_target_ptr, self.render_target_size);
+            let buffer = std::slice::from_raw_parts(readback.ptr, self.height as usize * self.row_pitch);
 
             // Debug: check first few pixels
             if buffer.len() >= 16 {
@@ -573,7 +698,7 @@ impl VulkanRenderer {
                     self.row_pitch, self.width, self.width * 4);
             }
 
-            buffer
+            Some(buffer)
         }
     }
 
@@ -581,10 +706,17 @@ impl VulkanRenderer {
         self.row_pitch
     }
 
-    // DEBUG: Fill framebuffer with test pattern
+    // DEBUG: Fill the newest readback with a test pattern
     pub fn fill_test_pattern(&mut self) {
+        if self.zero_copy {
+            return;
+        }
+        let readback = match self.slots[self.ready_slot.unwrap_or(0)].readback.as_ref() {
+            Some(readback) => readback,
+            None => return,
+        };
         unsafe {
-            let buffer = std::slice::from_raw_parts_mut(self.render_target_ptr, self.render_target_size);
+            let buffer = std::slice::from_raw_parts_mut(readback.ptr, self.height as usize * self.row_pitch);
             for y in 0..self.height as usize {
                 for x in 0..self.width as usize {
                     let offset = y * self.row_pitch + x * 4;
@@ -602,6 +734,266 @@ impl VulkanRenderer {
         }
     }
 
+    /// Copy path render target: OPTIMAL in device-local memory, shared
+    /// with the transfer queue family when that reads it back
+    fn create_render_target(
+        device: &ash::Device,
+        mem_props: &vk::PhysicalDeviceMemoryProperties,
+        width: u32,
+        height: u32,
+        families: &[u32; 2],
+    ) -> Result<(vk::Image, vk::DeviceMemory), Box<dyn std::error::Error>> {
+        unsafe {
+            let rt_image_info = vk::ImageCreateInfo::default()
+                .image_type(vk::ImageType::TYPE_2D)
+                .format(vk::Format::B8G8R8A8_UNORM)
+                .extent(vk::Extent3D { width, height, depth: 1 })
+                .mip_levels(1)
+                .array_layers(1)
+                .samples(vk::SampleCountFlags::TYPE_1)
+                .tiling(vk::ImageTiling::OPTIMAL)
+                .usage(vk::ImageUsageFlags::COLOR_ATTACHMENT | vk::ImageUsageFlags::TRANSFER_SRC)
+                .initial_layout(vk::ImageLayout::UNDEFINED);
+            let rt_image_info = if families[0] != families[1] {
+                rt_image_info
+                    .sharing_mode(vk::SharingMode::CONCURRENT)
+                    .queue_family_indices(families)
+            } else {
+                rt_image_info
+            };
+
+            let image = device.create_image(&rt_image_info, None)?;
+            let rt_mem_req = device.get_image_memory_requirements(image);
+
+            let rt_mem_type = find_memory_type(
+                mem_props,
+                rt_mem_req.memory_type_bits,
+                vk::MemoryPropertyFlags::DEVICE_LOCAL,
+            )?;
+
+            let rt_alloc_info = vk::MemoryAllocateInfo::default()
+                .allocation_size(rt_mem_req.size)
+                .memory_type_index(rt_mem_type);
+
+            let memory = device.allocate_memory(&rt_alloc_info, None)?;
+            device.bind_image_memory(image, memory, 0)?;
+
+            Ok((image, memory))
+        }
+    }
+
+    /// A frame slot: its uniform buffer and descriptor set, command buffer
+    /// and fence, and on the copy path (`image` given) the readback buffer
+    /// plus, with a transfer pool, the copy out of `image` recorded once
+    fn create_slot(
+        device: &ash::Device,
+        mem_props: &vk::PhysicalDeviceMemoryProperties,
+        descriptor_pool: vk::DescriptorPool,
+        descriptor_set_layout: vk::DescriptorSetLayout,
+        command_pool: vk::CommandPool,
+        transfer_pool: Option<vk::CommandPool>,
+        sampler: vk::Sampler,
+        texture_view: vk::ImageView,
+        image: Option<vk::Image>,
+        width: u32,
+        height: u32,
+    ) -> Result<FrameSlot, Box<dyn std::error::Error>> {
+        unsafe {
+            let ubo_size = 64;
+            let (uniform_buffer, uniform_memory, uniform_ptr) = create_mapped_buffer(
+                device,
+                mem_props,
+                ubo_size,
+                vk::BufferUsageFlags::UNIFORM_BUFFER,
+                vk::MemoryPropertyFlags::empty(),
+            )?;
+
+            let alloc_info = vk::DescriptorSetAllocateInfo::default()
+                .descriptor_pool(descriptor_pool)
+                .set_layouts(std::slice::from_ref(&descriptor_set_layout));
+            let descriptor_set = device.allocate_descriptor_sets(&alloc_info)?[0];
+
+            let buffer_info = vk::DescriptorBufferInfo::default()
+                .buffer(uniform_buffer)
+                .offset(0)
+                .range(ubo_size);
+
+            let image_info = vk::DescriptorImageInfo::default()
+                .sampler(sampler)
+                .image_view(texture_view)
+                .image_layout(vk::ImageLayout::SHADER_READ_ONLY_OPTIMAL);
+
+            let writes = [
+                vk::WriteDescriptorSet::default()
+                    .dst_set(descriptor_set)
+                    .dst_binding(0)
+                    .descriptor_type(vk::DescriptorType::UNIFORM_BUFFER)
+                    .buffer_info(std::slice::from_ref(&buffer_info)),
+                vk::WriteDescriptorSet::default()
+                    .dst_set(descriptor_set)
+                    .dst_binding(1)
+                    .descriptor_type(vk::DescriptorType::COMBINED_IMAGE_SAMPLER)
+                    .image_info(std::slice::from_ref(&image_info)),
+            ];
+            device.update_descriptor_sets(&writes, &[]);
+
+            let alloc_info = vk::CommandBufferAllocateInfo::default()
+                .command_pool(command_pool)
+                .level(vk::CommandBufferLevel::PRIMARY)
+                .command_buffer_count(1);
+            let command_buffer = device.allocate_command_buffers(&alloc_info)?[0];
+            let fence = device.create_fence(&vk::FenceCreateInfo::default(), None)?;
+
+            let readback = match image {
+                None => None,
+                Some(image) => {
+                    // The CPU reads this, so prefer cached memory
+                    let (buffer, memory, ptr) = create_mapped_buffer(
+                        device,
+                        mem_props,
+                        width as u64 * height as u64 * 4,
+                        vk::BufferUsageFlags::TRANSFER_DST,
+                        vk::MemoryPropertyFlags::HOST_CACHED,
+                    )?;
+
+                    // The copy never changes, so record it once. The
+                    // semaphore wait makes the render's writes visible.
+                    let transfer = match transfer_pool {
+                        None => None,
+                        Some(pool) => {
+                            let alloc_info = vk::CommandBufferAllocateInfo::default()
+                                .command_pool(pool)
+                                .level(vk::CommandBufferLevel::PRIMARY)
+                                .command_buffer_count(1);
+                            let cmd = device.allocate_command_buffers(&alloc_info)?[0];
+                            device.begin_command_buffer(cmd, &vk::CommandBufferBeginInfo::default())?;
+                            record_readback(device, cmd, image, buffer, width, height);
+                            device.end_command_buffer(cmd)?;
+                            let semaphore = device.create_semaphore(&vk::SemaphoreCreateInfo::default(), None)?;
+                            Some((cmd, semaphore))
+                        }
+                    };
+                    Some(Readback { buffer, memory, ptr, transfer })
+                }
+            };
+
+            Ok(FrameSlot {
+                command_buffer,
+                fence,
+                uniform_buffer,
+                uniform_memory,
+                uniform_ptr,
+                descriptor_set,
+                readback,
+                pending: false,
+            })
+        }
+    }
+
+    /// Import a linear dma-buf scanout buffer as a color attachment
+    fn import_scanout(
+        instance: &ash::Instance,
+        device: &ash::Device,
+        mem_props: &vk::PhysicalDeviceMemoryProperties,
+        width: u32,
+        height: u32,
+        buffer: ScanoutBuffer,
+    ) -> Result<(vk::Image, vk::DeviceMemory), Box<dyn std::error::Error>> {
+        if buffer.width != width || buffer.height != height {
+            return Err("scanout buffer size doesn't match the render size".into());
+        }
+
+        unsafe {
+            let plane_layout = vk::SubresourceLayout {
+                offset: 0,
+                size: 0,
+                row_pitch: buffer.pitch as u64,
+                array_pitch: 0,
+                depth_pitch: 0,
+            };
+            let mut modifier_info = vk::ImageDrmFormatModifierExplicitCreateInfoEXT::default()
+                .drm_format_modifier(DRM_FORMAT_MOD_LINEAR)
+                .plane_layouts(std::slice::from_ref(&plane_layout));
+            let mut external_info = vk::ExternalMemoryImageCreateInfo::default()
+                .handle_types(vk::ExternalMemoryHandleTypeFlags::DMA_BUF_EXT);
+
+            let image_info = vk::ImageCreateInfo::default()
+                .image_type(vk::ImageType::TYPE_2D)
+                .format(vk::Format::B8G8R8A8_UNORM)
+                .extent(vk::Extent3D { width, height, depth: 1 })
+                .mip_levels(1)
+                .array_layers(1)
+                .samples(vk::SampleCountFlags::TYPE_1)
+                .tiling(vk::ImageTiling::DRM_FORMAT_MODIFIER_EXT)
+                .usage(vk::ImageUsageFlags::COLOR_ATTACHMENT)
+                .initial_layout(vk::ImageLayout::UNDEFINED)
+                .push_next(&mut external_info)
+                .push_next(&mut modifier_info);
+
+            let image = device.create_image(&image_info, None)?;
+
+            let memory = Self::import_dma_buf(instance, device, mem_props, image, buffer.fd);
+            let memory = match memory {
+                Ok(memory) => memory,
+                Err(e) => {
+                    device.destroy_image(image, None);
+                    return Err(e);
+                }
+            };
+
+            if let Err(e) = device.bind_image_memory(image, memory, 0) {
+                device.destroy_image(image, None);
+                device.free_memory(memory, None);
+                return Err(e.into());
+            }
+
+            Ok((image, memory))
+        }
+    }
+
+    fn import_dma_buf(
+        instance: &ash::Instance,
+        device: &ash::Device,
+        mem_props: &vk::PhysicalDeviceMemoryProperties,
+        image: vk::Image,
+        fd: OwnedFd,
+    ) -> Result<vk::DeviceMemory, Box<dyn std::error::Error>> {
+        unsafe {
+            let external_memory_fd = ash::khr::external_memory_fd::Device::new(instance, device);
+            let mut fd_props = vk::MemoryFdPropertiesKHR::default();
+            external_memory_fd.get_memory_fd_properties(
+                vk::ExternalMemoryHandleTypeFlags::DMA_BUF_EXT,
+                fd.as_raw_fd(),
+                &mut fd_props,
+            )?;
+
+            let mem_req = device.get_image_memory_requirements(image);
+            let mem_type = find_memory_type(
+                mem_props,
+                mem_req.memory_type_bits & fd_props.memory_type_bits,
+                vk::MemoryPropertyFlags::empty(),
+            )?;
+
+            // A successful import takes ownership of the fd
+            let raw_fd = fd.into_raw_fd();
+            let mut import_info = vk::ImportMemoryFdInfoKHR::default()
+                .handle_type(vk::ExternalMemoryHandleTypeFlags::DMA_BUF_EXT)
+                .fd(raw_fd);
+            let mut dedicated_info = vk::MemoryDedicatedAllocateInfo::default()
+                .image(image);
+            let alloc_info = vk::MemoryAllocateInfo::default()
+                .allocation_size(mem_req.size)
+                .memory_type_index(mem_type)
+                .push_next(&mut import_info)
+                .push_next(&mut dedicated_info);
+
+            device.allocate_memory(&alloc_info, None).map_err(|e| {
+                drop(OwnedFd::from_raw_fd(raw_fd));
+                e.into()
+            })
+        }
+    }
+
     fn create_texture(
         device: &ash::Device,
         mem_props: &vk::PhysicalDeviceMemoryProperties,
@@ -748,22 +1140,37 @@ impl Drop for VulkanRenderer {
                 self.device.destroy_pipeline(pipeline, None);
             }
 
-            self.device.destroy_fence(self.fence, None);
+            self.pipeline_cache.destroy(&self.device);
+            for slot in &self.slots {
+                self.device.destroy_fence(slot.fence, None);
+                self.device.destroy_buffer(slot.uniform_buffer, None);
+                self.device.free_memory(slot.uniform_memory, None);
+                if let Some(readback) = &slot.readback {
+                    self.device.destroy_buffer(readback.buffer, None);
+                    self.device.free_memory(readback.memory, None);
+                    if let Some((_, semaphore)) = readback.transfer {
+                        self.device.destroy_semaphore(semaphore, None);
+                    }
+                }
+            }
+            if let Some(pool) = self.transfer_pool {
+                self.device.destroy_command_pool(pool, None);
+            }
             self.device.destroy_command_pool(self.command_pool, None);
             self.device.destroy_descriptor_pool(self.descriptor_pool, None);
             self.device.destroy_pipeline_layout(self.pipeline_layout, None);
             self.device.destroy_descriptor_set_layout(self.descriptor_set_layout, None);
-            self.device.destroy_buffer(self.uniform_buffer, None);
-            self.device.free_memory(self.uniform_memory, None);
-            self.device.destroy_framebuffer(self.framebuffer, None);
             self.device.destroy_render_pass(self.render_pass, None);
             self.device.destroy_sampler(self.sampler, None);
             self.device.destroy_image_view(self.texture_view, None);
             self.device.destroy_image(self.texture_image, None);
             self.device.free_memory(self.texture_memory, None);
-            self.device.destroy_image_view(self.render_target_view, None);
-            self.device.destroy_image(self.render_target_image, None);
-            self.device.free_memory(self.render_target_memory, None);
+            for target in &self.render_targets {
+                self.device.destroy_framebuffer(target.framebuffer, None);
+                self.device.destroy_image_view(target.view, None);
+                self.device.destroy_image(target.image, None);
+                self.device.free_memory(target.memory, None);
+            }
             self.device.destroy_device(None);
             self.instance.destroy_instance(None);
         }
@@ -785,6 +1192,96 @@ fn find_memory_type(
     Err("No suitable memory type found".into())
 }
 
+/// Host-visible, coherent buffer mapped for its whole lifetime, in memory
+/// that also has `preferred` when there is such a type
+fn create_mapped_buffer(
+    device: &ash::Device,
+    mem_props: &vk::PhysicalDeviceMemoryProperties,
+    size: u64,
+    usage: vk::BufferUsageFlags,
+    preferred: vk::MemoryPropertyFlags,
+) -> Result<(vk::Buffer, vk::DeviceMemory, *mut u8), Box<dyn std::error::Error>> {
+    unsafe {
+        let buffer_info = vk::BufferCreateInfo::default()
+            .size(size)
+            .usage(usage);
+        let buffer = device.create_buffer(&buffer_info, None)?;
+        let req = device.get_buffer_memory_requirements(buffer);
+
+        let required = vk::MemoryPropertyFlags::HOST_VISIBLE | vk::MemoryPropertyFlags::HOST_COHERENT;
+        let mem_type = find_memory_type(mem_props, req.memory_type_bits, required | preferred)
+            .or_else(|_| find_memory_type(mem_props, req.memory_type_bits, required))?;
+
+        let alloc_info = vk::MemoryAllocateInfo::default()
+            .allocation_size(req.size)
+            .memory_type_index(mem_type);
+        let memory = device.allocate_memory(&alloc_info, None)?;
+        device.bind_buffer_memory(buffer, memory, 0)?;
+
+        let ptr = device.map_memory(memory, 0, vk::WHOLE_SIZE, vk::MemoryMapFlags::empty())? as *mut u8;
+        Ok((buffer, memory, ptr))
+    }
+}
+
+/// Copy a finished render target into its readback buffer and make the
+/// copy visible to the host once the fence signals
+fn record_readback(
+    device: &ash::Device,
+    cmd: vk::CommandBuffer,
+    image: vk::Image,
+    buffer: vk::Buffer,
+    width: u32,
+    height: u32,
+) {
+    unsafe {
+        let region = vk::BufferImageCopy::default()
+            .image_subresource(vk::ImageSubresourceLayers {
+                aspect_mask: vk::ImageAspectFlags::COLOR,
+                mip_level: 0,
+                base_array_layer: 0,
+                layer_count: 1,
+            })
+            .image_extent(vk::Extent3D { width, height, depth: 1 });
+        device.cmd_copy_image_to_buffer(cmd, image, vk::ImageLayout::GENERAL, buffer, &[region]);
+
+        let barrier = vk::MemoryBarrier::default()
+            .src_access_mask(vk::AccessFlags::TRANSFER_WRITE)
+            .dst_access_mask(vk::AccessFlags::HOST_READ);
+        device.cmd_pipeline_barrier(
+            cmd,
+            vk::PipelineStageFlags::TRANSFER,
+            vk::PipelineStageFlags::HOST,
+            vk::DependencyFlags::empty(),
+            &[barrier],
+            &[],
+            &[],
+        );
+    }
+}
+
+fn color_range() -> vk::ImageSubresourceRange {
+    vk::ImageSubresourceRange {
+        aspect_mask: vk::ImageAspectFlags::COLOR,
+        base_mip_level: 0,
+        level_count: 1,
+        base_array_layer: 0,
+        layer_count: 1,
+    }
+}
+
+fn has_device_extensions(
+    instance: &ash::Instance,
+    physical_device: vk::PhysicalDevice,
+    names: &[&CStr],
+) -> Result<bool, Box<dyn std::error::Error>> {
+    let available = unsafe { instance.enumerate_device_extension_properties(physical_device)? };
+    Ok(names.iter().all(|name| {
+        available
+            .iter()
+            .any(|ext| ext.extension_name_as_c_str().map_or(false, |n| n == *name))
+    }))
+}
+
 fn load_shader_code(path: &Path) -> Result<Vec<u32>, Box<dyn std::error::Error>> {
     let mut file = File::open(path)?;
     let mut bytes = Vec::new();
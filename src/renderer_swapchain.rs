@@ -5,9 +5,15 @@ use ash::vk;
 use std::ffi::CStr;
 use std::fs::File;
 use std::io::Read;
+use std::sync::mpsc::{self, Receiver, Sender};
 use std::sync::Arc;
+use std::thread::JoinHandle;
+use std::time::Instant;
 use winit::window::Window;
 
+use crate::pipeline_cache::PipelineCache;
+use crate::telemetry::{self, Stage};
+
 pub struct SwapchainRenderer {
     #[allow(dead_code)]
     entry: ash::Entry,
@@ -36,6 +42,16 @@ pub struct SwapchainRenderer {
     descriptor_set_layout: vk::DescriptorSetLayout,
     pipeline_layout: vk::PipelineLayout,
     pipeline: Option<vk::Pipeline>,
+    pipeline_cache: PipelineCache,
+
+    // Background pipeline builds, tagged with the load_shader call they answer
+    shader_tx: Sender<ShaderBuild>,
+    shader_rx: Receiver<ShaderBuild>,
+    shader_generation: u64,
+    shader_builds: Vec<JoinHandle<()>>,
+    // Replaced pipelines and the frame_count at which they were swapped out
+    retired_pipelines: Vec<(vk::Pipeline, u64)>,
+    frame_count: u64,
 
     uniform_buffer: vk::Buffer,
     uniform_memory: vk::DeviceMemory,
@@ -64,6 +80,8 @@ pub struct SwapchainRenderer {
 
 const MAX_FRAMES_IN_FLIGHT: usize = 2;
 
+type ShaderBuild = (u64, Result<vk::Pipeline, String>);
+
 impl SwapchainRenderer {
     pub fn new(window: Arc<Window>) -> Result<Self, Box<dyn std::error::Error>> {
         unsafe {
@@ -143,6 +161,8 @@ impl SwapchainRenderer {
             let device = instance.create_device(physical_device, &device_create_info, None)?;
             let queue = device.get_device_queue(queue_family_index, 0);
 
+            let pipeline_cache = PipelineCache::load(&instance, physical_device, &device)?;
+
             let swapchain_loader = ash::khr::swapchain::Device::new(&instance, &device);
 
             // Create swapchain
@@ -370,6 +390,8 @@ impl SwapchainRenderer {
                 in_flight_fences.push(device.create_fence(&fence_info, None)?);
             }
 
+            let (shader_tx, shader_rx) = mpsc::channel();
+
             Ok(Self {
                 entry,
                 instance,
@@ -390,6 +412,13 @@ impl SwapchainRenderer {
                 descriptor_set_layout,
                 pipeline_layout,
                 pipeline: None,
+                pipeline_cache,
+                shader_tx,
+                shader_rx,
+                shader_generation: 0,
+                shader_builds: Vec::new(),
+                retired_pipelines: Vec::new(),
+                frame_count: 0,
                 uniform_buffer,
                 uniform_memory,
                 uniform_ptr,
@@ -489,23 +518,83 @@ impl SwapchainRenderer {
         }
     }
 
+    /// Start building the pipeline for a shader on a background thread. The
+    /// current pipeline keeps rendering until `poll_shader` swaps it out.
     pub fn load_shader(
         &mut self,
         vert_path: &str,
         frag_path: &str,
     ) -> Result<(), Box<dyn std::error::Error>> {
-        unsafe {
-            self.device.device_wait_idle()?;
+        self.shader_generation += 1;
+        let generation = self.shader_generation;
+        let device = self.device.clone();
+        let cache = self.pipeline_cache.handle();
+        let layout = self.pipeline_layout;
+        let render_pass = self.render_pass;
+        let vert_path = vert_path.to_string();
+        let frag_path = frag_path.to_string();
+        let tx = self.shader_tx.clone();
+
+        self.shader_builds.retain(|build| !build.is_finished());
+        let build = std::thread::Builder::new()
+            .name("shader-build".into())
+            .spawn(move || {
+                let result = Self::build_pipeline(&device, cache, layout, render_pass, &vert_path, &frag_path)
+                    .map_err(|e| e.to_string());
+                let _ = tx.send((generation, result));
+            })?;
+        self.shader_builds.push(build);
+
+        Ok(())
+    }
 
-            if let Some(pipeline) = self.pipeline.take() {
-                self.device.destroy_pipeline(pipeline, None);
+    /// Swap in the pipeline from the latest `load_shader` once it is built.
+    /// Returns None while it is still building; builds superseded by a later
+    /// call are dropped. The old pipeline is destroyed once no frame in
+    /// flight can still be using it.
+    pub fn poll_shader(&mut self) -> Option<Result<(), Box<dyn std::error::Error>>> {
+        let mut latest = None;
+        while let Ok((generation, result)) = self.shader_rx.try_recv() {
+            if generation != self.shader_generation {
+                if let Ok(pipeline) = result {
+                    // Never bound
+                    unsafe { self.device.destroy_pipeline(pipeline, None) };
+                }
+                continue;
             }
+            latest = Some(match result {
+                Ok(pipeline) => {
+                    if let Some(old) = self.pipeline.replace(pipeline) {
+                        self.retired_pipelines.push((old, self.frame_count));
+                    }
+                    Ok(())
+                }
+                Err(e) => Err(e.into()),
+            });
+        }
+        latest
+    }
 
+    fn build_pipeline(
+        device: &ash::Device,
+        cache: vk::PipelineCache,
+        layout: vk::PipelineLayout,
+        render_pass: vk::RenderPass,
+        vert_path: &str,
+        frag_path: &str,
+    ) -> Result<vk::Pipeline, Box<dyn std::error::Error>> {
+        unsafe {
             let vert_code = Self::read_shader_file(vert_path)?;
             let frag_code = Self::read_shader_file(frag_path)?;
 
-            let vert_module = Self::create_shader_module(&self.device, &vert_code)?;
-            let frag_module = Self::create_shader_module(&self.device, &frag_code)?;
+            let vert_module = Self::create_shader_module(device, &vert_code)?;
+            let frag_module = match Self::create_shader_module(device, &frag_code) {
+                Ok(module) => module,
+                Err(e) => {
+                    device.destroy_shader_module(vert_module, None);
+                    return Err(e);
+                }
+            };
 
             let entry_name = std::ffi::CString::new("main").unwrap();
 
@@ -560,22 +649,17 @@ impl SwapchainRenderer {
                 .multisample_state(&multisampling)
                 .color_blend_state(&color_blending)
                 .dynamic_state(&dynamic_state)
-                .layout(self.pipeline_layout)
-                .render_pass(self.render_pass)
+                .layout(layout)
+                .render_pass(render_pass)
                 .subpass(0);
 
-            let pipelines = self.device.create_graphics_pipelines(
-                vk::PipelineCache::null(),
-                &[pipeline_info],
-                None,
-            ).map_err(|(_, e)| e)?;
-
-            self.pipeline = Some(pipelines[0]);
+            let result = device.create_graphics_pipelines(cache, &[pipeline_info], None);
 
-            self.device.destroy_shader_module(vert_module, None);
-            self.device.destroy_shader_module(frag_module, None);
+            device.destroy_shader_module(vert_module, None);
+            device.destroy_shader_module(frag_module, None);
 
-            Ok(())
+            let pipelines = result.map_err(|(_, e)| e)?;
+            Ok(pipelines[0])
         }
     }
 
@@ -661,8 +745,26 @@ impl SwapchainRenderer {
 
     pub fn render_frame<T: Copy>(&mut self, ubo_data: &T) -> Result<(), Box<dyn std::error::Error>> {
         unsafe {
+            telemetry::tick();
             let fence = self.in_flight_fences[self.current_frame];
-            self.device.wait_for_fences(&[fence], true, u64::MAX)?;
+            let wait_start = Instant::now();
+            telemetry::fence_wait_begin();
+            let waited = self.device.wait_for_fences(&[fence], true, u64::MAX);
+            telemetry::fence_wait_end();
+            waited?;
+            telemetry::record(Stage::Fence, wait_start.elapsed());
+
+            // Every frame submitted before a pipeline was replaced has
+            // finished once the ring has come around past it
+            let device = &self.device;
+            let frame_count = self.frame_count;
+            self.retired_pipelines.retain(|&(pipeline, retired_at)| {
+                let done = retired_at + MAX_FRAMES_IN_FLIGHT as u64 <= frame_count;
+                if done {
+                    device.destroy_pipeline(pipeline, None);
+                }
+                !done
+            });
 
             let (image_index, _suboptimal) = match self.swapchain_loader.acquire_next_image(
                 self.swapchain,
@@ -681,6 +783,7 @@ impl SwapchainRenderer {
             self.device.reset_fences(&[fence])?;
 
             // Update uniform buffer
+            let record_start = Instant::now();
             std::ptr::copy_nonoverlapping(
                 ubo_data as *const T as *const u8,
                 self.uniform_ptr,
@@ -768,6 +871,8 @@ impl SwapchainRenderer {
                 .signal_semaphores(&signal_semaphores);
 
             self.device.queue_submit(self.queue, &[submit_info], fence)?;
+            self.frame_count += 1;
+            telemetry::record(Stage::Record, record_start.elapsed());
 
             // Present
             let swapchains = [self.swapchain];
@@ -778,7 +883,10 @@ impl SwapchainRenderer {
                 .swapchains(&swapchains)
                 .image_indices(&image_indices);
 
-            match self.swapchain_loader.queue_present(self.queue, &present_info) {
+            let present_start = Instant::now();
+            let presented = self.swapchain_loader.queue_present(self.queue, &present_info);
+            telemetry::record(Stage::Present, present_start.elapsed());
+            match presented {
                 Ok(_) => {}
                 Err(vk::Result::ERROR_OUT_OF_DATE_KHR | vk::Result::SUBOPTIMAL_KHR) => {
                     self.recreate_swapchain()?;
@@ -940,9 +1048,23 @@ impl Drop for SwapchainRenderer {
             self.swapchain_loader
                 .destroy_swapchain(self.swapchain, None);
 
+            // Builds still running use the device and pipeline cache
+            for build in self.shader_builds.drain(..) {
+                let _ = build.join();
+            }
+            while let Ok((_, result)) = self.shader_rx.try_recv() {
+                if let Ok(pipeline) = result {
+                    self.device.destroy_pipeline(pipeline, None);
+                }
+            }
+            for (pipeline, _) in self.retired_pipelines.drain(..) {
+                self.device.destroy_pipeline(pipeline, None);
+            }
+
             if let Some(pipeline) = self.pipeline {
                 self.device.destroy_pipeline(pipeline, None);
             }
+            self.pipeline_cache.destroy(&self.device);
 
             self.device.destroy_descriptor_pool(self.descriptor_pool, None);
             self.device.destroy_sampler(self.sampler, None);
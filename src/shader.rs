@@ -1,4 +1,8 @@
 // Shader discovery and management
+//
+// The catalog keeps every shader name in one string arena and refers to it by
+// offset, sorted by name for navigation, with an open-addressed hash index for
+// lookups by name. The C viewer (old/metalshader.c) uses the same layout.
 
 use std::fs;
 use std::path::{Path, PathBuf};
@@ -10,21 +14,43 @@ pub struct ShaderInfo {
     pub frag_path: PathBuf,
 }
 
+/// Catalog entry; `name` is a range of the arena, `dir` an index into `dirs`
+#[derive(Clone, Copy)]
+struct Entry {
+    name: u32,
+    name_len: u32,
+    dir: u32,
+}
+
+/// Marks an unused slot of the name index
+const EMPTY: u32 = u32::MAX;
+
 pub struct ShaderManager {
-    shaders: Vec<ShaderInfo>,
+    arena: String,
+    dirs: Vec<PathBuf>,
+    shaders: Vec<Entry>,
+    index: Vec<u32>,
 }
 
 impl ShaderManager {
     pub fn new() -> Self {
         Self {
+            arena: String::new(),
+            dirs: Vec::new(),
             shaders: Vec::new(),
+            index: Vec::new(),
         }
     }
 
     pub fn scan_shaders(&mut self, dirs: &[&str]) -> Result<(), Box<dyn std::error::Error>> {
+        self.arena.clear();
+        self.dirs.clear();
         self.shaders.clear();
 
         for dir in dirs {
+            let dir_index = self.dirs.len() as u32;
+            self.dirs.push(PathBuf::from(dir));
+
             if let Ok(entries) = fs::read_dir(dir) {
                 for entry in entries.flatten() {
                     if !entry.file_type().map(|t| t.is_file()).unwrap_or(false) {
@@ -53,19 +79,41 @@ impl ShaderManager {
 
                     // Check if both compiled shaders exist
                     if vert_path.exists() && frag_path.exists() {
-                        self.shaders.push(ShaderInfo {
-                            name: base_name.to_string(),
-                            vert_path,
-                            frag_path,
+                        self.shaders.push(Entry {
+                            name: self.arena.len() as u32,
+                            name_len: base_name.len() as u32,
+                            dir: dir_index,
                         });
+                        self.arena.push_str(base_name);
                     }
                 }
             }
         }
 
+        // Sort by name; the sort is stable, so of several directories with the
+        // same name the first in search order survives the dedup
+        let arena = &self.arena;
+        self.shaders.sort_by(|a, b| entry_name(arena, a).cmp(entry_name(arena, b)));
+        self.shaders.dedup_by(|a, b| entry_name(arena, a) == entry_name(arena, b));
+        self.build_index();
+
         Ok(())
     }
 
+    fn build_index(&mut self) {
+        let size = (self.shaders.len() * 2).next_power_of_two().max(16);
+        let mask = size - 1;
+        self.index.clear();
+        self.index.resize(size, EMPTY);
+        for (i, entry) in self.shaders.iter().enumerate() {
+            let mut slot = hash_name(entry_name(&self.arena, entry)) as usize & mask;
+            while self.index[slot] != EMPTY {
+                slot = (slot + 1) & mask;
+            }
+            self.index[slot] = i as u32;
+        }
+    }
+
     pub fn is_empty(&self) -> bool {
         self.shaders.is_empty()
     }
@@ -75,12 +123,36 @@ impl ShaderManager {
         self.shaders.len()
     }
 
-    pub fn get(&self, index: usize) -> Option<&ShaderInfo> {
-        self.shaders.get(index)
+    /// The shader's name, without building its paths
+    pub fn name(&self, index: usize) -> Option<&str> {
+        self.shaders.get(index).map(|entry| entry_name(&self.arena, entry))
+    }
+
+    pub fn get(&self, index: usize) -> Option<ShaderInfo> {
+        let entry = self.shaders.get(index)?;
+        let name = entry_name(&self.arena, entry);
+        let dir = &self.dirs[entry.dir as usize];
+        Some(ShaderInfo {
+            name: name.to_string(),
+            vert_path: dir.join(format!("{}.vert.spv", name)),
+            frag_path: dir.join(format!("{}.frag.spv", name)),
+        })
     }
 
     pub fn find_by_name(&self, name: &str) -> Option<usize> {
-        self.shaders.iter().position(|s| s.name == name)
+        if self.index.is_empty() {
+            return None;
+        }
+        let mask = self.index.len() - 1;
+        let mut slot = hash_name(name) as usize & mask;
+        while self.index[slot] != EMPTY {
+            let i = self.index[slot] as usize;
+            if entry_name(&self.arena, &self.shaders[i]) == name {
+                return Some(i);
+            }
+            slot = (slot + 1) & mask;
+        }
+        None
     }
 
     pub fn next(&self, current: usize) -> usize {
@@ -97,8 +169,17 @@ impl ShaderManager {
 
     pub fn print_available(&self) {
         println!("Found {} compiled shader(s)", self.shaders.len());
-        for (i, shader) in self.shaders.iter().enumerate() {
-            println!("  [{}] {}", i, shader.name);
+        for (i, entry) in self.shaders.iter().enumerate() {
+            println!("  [{}] {}", i, entry_name(&self.arena, entry));
         }
     }
 }
+
+fn entry_name<'a>(arena: &'a str, entry: &Entry) -> &'a str {
+    &arena[entry.name as usize..(entry.name + entry.name_len) as usize]
+}
+
+/// FNV-1a, as in the C viewer
+fn hash_name(name: &str) -> u32 {
+    name.bytes().fold(2166136261u32, |hash, byte| (hash ^ byte as u32).wrapping_mul(16777619))
+}
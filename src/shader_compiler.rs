@@ -1,17 +1,46 @@
 // Automatic shader compilation support
+//
+// Compiled SPIR-V is cached in $XDG_CACHE_HOME/metalshader/spirv (default
+// ~/.cache/metalshader/spirv), named after a hash of the exact GLSL text that
+// was compiled plus the stage and WRAPPER_VERSION. Editing a shader therefore
+// always recompiles it, and unchanged shaders never invoke the compiler.
+//
+// Built with `--features shaderc`, GLSL is compiled in-process through
+// libshaderc; otherwise glslangValidator is run once per cache miss.
 use std::path::{Path, PathBuf};
 use std::process::Command;
 use std::fs;
+use std::io;
+
+/// Bump whenever the wrappers in `wrap_glsl` (or the generated vertex
+/// shader) change, so cached SPIR-V built from the old text is not reused
+const WRAPPER_VERSION: u32 = 2;
+
+/// Which wrapper `wrap_glsl` puts around a ShaderToy-style body
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub enum GlslVariant {
+    /// Fragment shader for the fullscreen draw
+    Fragment,
+    /// Compute shader writing one pixel per invocation to a storage image
+    /// (the C viewer's --compute backend)
+    Compute,
+}
 
 pub struct ShaderCompiler {
     #[allow(dead_code)]
     shader_dir: PathBuf,
+    cache_dir: Option<PathBuf>,
+    #[cfg(feature = "shaderc")]
+    compiler: Option<shaderc::Compiler>,
 }
 
 impl ShaderCompiler {
     pub fn new() -> Self {
         Self {
             shader_dir: PathBuf::from("."),
+            cache_dir: spirv_cache_dir(),
+            #[cfg(feature = "shaderc")]
+            compiler: shaderc::Compiler::new(),
         }
     }
 
@@ -36,21 +65,12 @@ impl ShaderCompiler {
             .parent()
             .unwrap_or_else(|| Path::new("."));
 
-        // Check if we have SPIR-V files already
-        let vert_spv = shader_dir.join(format!("{}.vert.spv", base_name));
-        let frag_spv = shader_dir.join(format!("{}.frag.spv", base_name));
-
-        if vert_spv.exists() && frag_spv.exists() {
-            println!("✓ Using existing SPIR-V: {}", frag_spv.display());
-            return Ok(base_name);
-        }
-
-        // Need to compile - check if input is a GLSL file
+        // Sources always go through the SPIR-V cache: existing .spv files
+        // may be older than the source, and a cache hit costs one hash
         if let Some(ext) = input.extension().and_then(|s| s.to_str()) {
             match ext {
                 "frag" | "glsl" | "fsh" => {
                     // Fragment shader source
-                    println!("Compiling shader: {} -> {}", input_path, frag_spv.display());
                     self.compile_glsl_to_spirv(input, &base_name, shader_dir)?;
                     return Ok(base_name);
                 }
@@ -74,12 +94,15 @@ impl ShaderCompiler {
         output_dir: &Path,
     ) -> Result<(), Box<dyn std::error::Error>> {
         // Step 1: Convert to Vulkan GLSL if needed
-        let vulkan_glsl = if self.is_vulkan_ready(input)? {
-            input.to_path_buf()
+        let content = fs::read_to_string(input)?;
+        let vulkan_ready = is_vulkan_ready(&content);
+        let (frag_glsl, frag_source) = if vulkan_ready {
+            (input.to_path_buf(), content.clone())
         } else {
             let temp_glsl = output_dir.join(format!("{}.glsl", base_name));
-            self.convert_to_vulkan_glsl(input, &temp_glsl)?;
-            temp_glsl
+            let wrapped = wrap_glsl(&content, GlslVariant::Fragment);
+            fs::write(&temp_glsl, &wrapped)?;
+            (temp_glsl, wrapped)
         };
 
         // Step 2: Generate vertex shader if not present
@@ -87,60 +110,125 @@ impl ShaderCompiler {
         if !vert_glsl.exists() {
             self.generate_fullscreen_vertex_shader(&vert_glsl)?;
         }
+        let vert_source = fs::read_to_string(&vert_glsl)?;
 
         // Step 3: Compile to SPIR-V
         let frag_spv = output_dir.join(format!("{}.frag.spv", base_name));
         let vert_spv = output_dir.join(format!("{}.vert.spv", base_name));
 
-        self.compile_glslang(&vulkan_glsl, &frag_spv, "frag")?;
-        self.compile_glslang(&vert_glsl, &vert_spv, "vert")?;
-
-        println!("✓ Compiled: {}", frag_spv.display());
-        println!("✓ Compiled: {}", vert_spv.display());
+        self.compile_cached(&frag_source, &frag_glsl, &frag_spv, "frag")?;
+        self.compile_cached(&vert_source, &vert_glsl, &vert_spv, "vert")?;
+
+        // Step 4: Compute variant, optional since not every shader can run
+        // as compute (derivatives, discard). Only wrapped sources have one.
+        if !vulkan_ready {
+            let comp_glsl = output_dir.join(format!("{}.comp", base_name));
+            let comp_spv = output_dir.join(format!("{}.comp.spv", base_name));
+            let wrapped = wrap_glsl(&content, GlslVariant::Compute);
+            fs::write(&comp_glsl, &wrapped)?;
+            if let Err(e) = self.compile_cached(&wrapped, &comp_glsl, &comp_spv, "comp") {
+                println!("  No compute variant: {}", e);
+            }
+        }
 
         Ok(())
     }
 
-    fn is_vulkan_ready(&self, path: &Path) -> Result<bool, Box<dyn std::error::Error>> {
-        let content = fs::read_to_string(path)?;
-        Ok(content.contains("#version 450"))
-    }
-
-    fn convert_to_vulkan_glsl(
+    /// Write the SPIR-V for `source` to `output`, from the cache when this
+    /// exact text was compiled before. `path` is the same text on disk, for
+    /// error messages and the glslangValidator fallback.
+    fn compile_cached(
         &self,
-        input: &Path,
+        source: &str,
+        path: &Path,
         output: &Path,
+        stage: &str,
     ) -> Result<(), Box<dyn std::error::Error>> {
-        let content = fs::read_to_string(input)?;
-
-        // Basic conversion: wrap in Vulkan boilerplate
-        let vulkan_shader = format!(
-            r#"#version 450
-
-layout(location = 0) in vec2 fragCoord;
-layout(location = 0) out vec4 fragColor;
-
-layout(binding = 0, set = 0) uniform UniformBufferObject {{
-    vec3 iResolution;
-    float iTime;
-    vec4 iMouse;
-}} ubo;
+        let cached = self
+            .cache_dir
+            .as_ref()
+            .map(|dir| dir.join(format!("{:016x}.{}.spv", source_hash(source, stage), stage)));
+
+        if let Some(spirv) = cached.as_ref().and_then(|p| fs::read(p).ok()) {
+            if fs::read(output).ok().as_deref() != Some(&spirv[..]) {
+                fs::write(output, &spirv)?;
+            }
+            println!("✓ Cached: {}", output.display());
+            return Ok(());
+        }
 
-layout(binding = 1, set = 0) uniform sampler2D iChannel0;
+        let spirv = self.compile_stage(source, path, output, stage)?;
+        println!("✓ Compiled: {}", output.display());
+
+        // Temp file + rename, so a concurrent run never reads half a module
+        if let Some(cached) = cached {
+            let stored = cached.parent().map_or(Ok(()), fs::create_dir_all).and_then(|_| {
+                let tmp = cached.with_extension(format!("tmp{}", std::process::id()));
+                fs::write(&tmp, &spirv)?;
+                fs::rename(&tmp, &cached)
+            });
+            if let Err(e) = stored {
+                eprintln!("Failed to cache {}: {}", cached.display(), e);
+            }
+        }
+        Ok(())
+    }
 
-{}
-"#,
-            content
-        );
+    /// Compile one stage in-process, writing `output` and returning its contents
+    #[cfg(feature = "shaderc")]
+    fn compile_stage(
+        &self,
+        source: &str,
+        path: &Path,
+        output: &Path,
+        stage: &str,
+    ) -> Result<Vec<u8>, Box<dyn std::error::Error>> {
+        let compiler = match &self.compiler {
+            Some(compiler) => compiler,
+            None => {
+                self.compile_glslang(path, output, stage)?;
+                return Ok(fs::read(output)?);
+            }
+        };
+        let kind = match stage {
+            "vert" => shaderc::ShaderKind::Vertex,
+            "frag" => shaderc::ShaderKind::Fragment,
+            "comp" => shaderc::ShaderKind::Compute,
+            _ => return Err(format!("Unknown shader stage: {}", stage).into()),
+        };
+        let mut options = shaderc::CompileOptions::new().ok_or("Failed to create shaderc options")?;
+        options.set_target_env(shaderc::TargetEnv::Vulkan, shaderc::EnvVersion::Vulkan1_0 as u32);
+
+        let name = path.to_string_lossy();
+        let artifact = compiler
+            .compile_into_spirv(source, kind, &name, "main", Some(&options))
+            .map_err(|e| {
+                eprintln!("Compilation error:\n{}", e);
+                format!("Failed to compile {} shader", stage)
+            })?;
+        let spirv = artifact.as_binary_u8().to_vec();
+        fs::write(output, &spirv)?;
+        Ok(spirv)
+    }
 
-        fs::write(output, vulkan_shader)?;
-        Ok(())
+    /// Compile one stage with glslangValidator, writing `output` and returning its contents
+    #[cfg(not(feature = "shaderc"))]
+    fn compile_stage(
+        &self,
+        _source: &str,
+        path: &Path,
+        output: &Path,
+        stage: &str,
+    ) -> Result<Vec<u8>, Box<dyn std::error::Error>> {
+        self.compile_glslang(path, output, stage)?;
+        Ok(fs::read(output)?)
     }
 
     fn generate_fullscreen_vertex_shader(
         &self,
         output: &Path,
     ) -> Result<(), Box<dyn std::error::Error>> {
+        // Same text as fullscreen_vert in old/metalshader.c
         let vert_shader = r#"#version 450
 
 layout(location = 0) out vec2 fragCoord;
@@ -171,21 +259,22 @@ void main() {
         output: &Path,
         stage: &str,
     ) -> Result<(), Box<dyn std::error::Error>> {
-        // Check if glslangValidator exists
-        let check = Command::new("which")
-            .arg("glslangValidator")
-            .output()?;
-
-        if !check.status.success() {
-            return Err("glslangValidator not found. Install with: brew install glslang".into());
-        }
-
-        let output_result = Command::new("glslangValidator")
+        // The stage is explicit since wrapped sources are written as .glsl
+        let output_result = match Command::new("glslangValidator")
             .arg("-V")
+            .arg("-S")
+            .arg(stage)
             .arg(input)
             .arg("-o")
             .arg(output)
-            .output()?;
+            .output()
+        {
+            Ok(result) => result,
+            Err(e) if e.kind() == io::ErrorKind::NotFound => {
+                return Err("glslangValidator not found. Install with: brew install glslang".into());
+            }
+            Err(e) => return Err(e.into()),
+        };
 
         if !output_result.status.success() {
             let stderr = String::from_utf8_lossy(&output_result.stderr);
@@ -197,6 +286,97 @@ void main() {
     }
 }
 
+fn is_vulkan_ready(content: &str) -> bool {
+    content.contains("#version 450")
+}
+
+fn spirv_cache_dir() -> Option<PathBuf> {
+    let base = std::env::var_os("XDG_CACHE_HOME")
+        .filter(|dir| !dir.is_empty())
+        .map(PathBuf::from)
+        .or_else(|| std::env::var_os("HOME").map(|home| PathBuf::from(home).join(".cache")))?;
+    Some(base.join("metalshader").join("spirv"))
+}
+
+/// 64-bit FNV-1a over the wrapper version, stage and source text. Unlike
+/// std's DefaultHasher it is stable across Rust releases, which matters for
+/// names that outlive the binary.
+fn source_hash(source: &str, stage: &str) -> u64 {
+    let version = WRAPPER_VERSION.to_le_bytes();
+    let parts: [&[u8]; 4] = [&version, stage.as_bytes(), &[0], source.as_bytes()];
+    parts.iter().flat_map(|part| part.iter()).fold(0xcbf29ce484222325, |hash, &byte| {
+        (hash ^ byte as u64).wrapping_mul(0x100000001b3)
+    })
+}
+
+/// Put the Vulkan boilerplate for `variant` around a ShaderToy-style body.
+/// `#line 1` ahead of the body keeps compiler errors on its own line numbers.
+/// The C viewer has its own copy of the fragment wrapper (frag_wrapper in
+/// old/metalshader.c); change both together.
+fn wrap_glsl(content: &str, variant: GlslVariant) -> String {
+    // Basic conversion: wrap in Vulkan boilerplate
+    match variant {
+        GlslVariant::Fragment => format!(
+            r#"#version 450
+
+layout(location = 0) in vec2 fragCoord;
+layout(location = 0) out vec4 fragColor;
+
+layout(binding = 0, set = 0) uniform UniformBufferObject {{
+    vec3 iResolution;
+    float iTime;
+    vec4 iMouse;
+}} ubo;
+
+layout(binding = 1, set = 0) uniform sampler2D iChannel0;
+
+#line 1
+{}
+"#,
+            content
+        ),
+        // The body keeps its own main(), renamed, and reads/writes the
+        // same fragCoord/fragColor names as plain globals. The render
+        // target is BGRA behind an RGBA storage view, hence the swizzle.
+        GlslVariant::Compute => format!(
+            r#"#version 450
+
+// Workgroup size comes from specialization constants 0 and 1
+layout(local_size_x_id = 0, local_size_y_id = 1) in;
+
+layout(binding = 0, set = 0) uniform UniformBufferObject {{
+    vec3 iResolution;
+    float iTime;
+    vec4 iMouse;
+}} ubo;
+
+layout(binding = 1, set = 0) uniform sampler2D iChannel0;
+layout(binding = 2, set = 0, rgba8) uniform writeonly image2D outImage;
+
+vec2 fragCoord;
+vec4 fragColor;
+
+#define main shadertoy_main
+#line 1
+{}
+#undef main
+
+void main() {{
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, ivec2(ubo.iResolution.xy)))) {{
+        return;
+    }}
+    fragCoord = vec2(pixel) + 0.5;
+    fragColor = vec4(0.0);
+    shadertoy_main();
+    imageStore(outImage, pixel, fragColor.bgra);
+}}
+"#,
+            content
+        ),
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -206,4 +386,28 @@ mod tests {
         let compiler = ShaderCompiler::new();
         // Test would go here
     }
+
+    #[test]
+    fn test_source_hash() {
+        let body = "void mainImage(out vec4 c, in vec2 p) { c = vec4(1.0); }";
+        assert_eq!(source_hash(body, "frag"), source_hash(body, "frag"));
+        assert_ne!(source_hash(body, "frag"), source_hash(&body.replace("1.0", "0.5"), "frag"));
+        assert_ne!(source_hash(body, "frag"), source_hash(&format!("{} ", body), "frag"));
+        assert_ne!(source_hash(body, "frag"), source_hash(body, "comp"));
+    }
+
+    #[test]
+    fn test_wrap_glsl() {
+        let body = "void main() {\n    fragColor = vec4(fragCoord / iResolution.xy, 0.0, 1.0);\n}";
+        let frag = wrap_glsl(body, GlslVariant::Fragment);
+        assert!(frag.starts_with("#version 450\n"));
+        assert!(frag.contains(&format!("#line 1\n{}", body)));
+        assert!(is_vulkan_ready(&frag));
+
+        // The body's main() is renamed; the wrapper's own runs it
+        let comp = wrap_glsl(body, GlslVariant::Compute);
+        assert!(comp.contains(&format!("#define main shadertoy_main\n#line 1\n{}\n#undef main", body)));
+        assert!(comp.contains("void main() {"));
+        assert!(comp.contains("shadertoy_main();"));
+    }
 }
@@ -0,0 +1,269 @@
+// Per-stage frame timings, served on a Unix socket like the C viewer's
+// --telemetry (same histograms, same Prometheus text format)
+//
+// Enabled by setting METALSHADER_TELEMETRY to the socket path. Each stage
+// keeps a log-linear histogram of microseconds: exact below 64, then 32
+// buckets per power of two. The render loop only does relaxed atomic adds;
+// the server thread reads whatever is there when a scraper connects.
+// Quantiles cover the current and the previous window, count/sum/max the
+// whole run. A fence wait still in progress is exported as a gauge, so a
+// hung GPU shows up while the loop is stuck in it.
+
+use std::io::Write;
+use std::os::unix::net::UnixListener;
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Mutex, OnceLock};
+use std::time::{Duration, Instant};
+
+const SUB_BITS: u32 = 5;
+const BUCKETS: usize = ((33 - SUB_BITS) << SUB_BITS) as usize;
+const WINDOW: Duration = Duration::from_secs(60);
+/// Pause after a failed accept (EMFILE and the like) before trying again
+const ACCEPT_BACKOFF: Duration = Duration::from_millis(100);
+
+// Not every viewer reports every stage
+#[allow(dead_code)]
+#[derive(Clone, Copy)]
+pub enum Stage {
+    /// Waiting for a frame slot's fence
+    Fence,
+    /// Recording and submitting a frame
+    Record,
+    /// Handing the frame to the display (copy or present)
+    Present,
+    /// Interval between frames
+    Frame,
+    /// Loading a shader
+    Reload,
+}
+
+const STAGES: usize = 5;
+const NAMES: [&str; STAGES] = ["fence", "record", "present", "frame", "reload"];
+
+struct Histogram {
+    buckets: [[AtomicU64; BUCKETS]; 2],
+    count: AtomicU64,
+    sum_us: AtomicU64,
+    max_us: AtomicU64,
+}
+
+struct Telemetry {
+    stages: [Histogram; STAGES],
+    window: AtomicUsize,
+}
+
+const ZERO: AtomicU64 = AtomicU64::new(0);
+const ROW: [AtomicU64; BUCKETS] = [ZERO; BUCKETS];
+const EMPTY: Histogram = Histogram {
+    buckets: [ROW; 2],
+    count: ZERO,
+    sum_us: ZERO,
+    max_us: ZERO,
+};
+
+static TELEMETRY: Telemetry = Telemetry {
+    stages: [EMPTY; STAGES],
+    window: AtomicUsize::new(0),
+};
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static EPOCH: OnceLock<Instant> = OnceLock::new();
+static WINDOW_START_MS: AtomicU64 = AtomicU64::new(0);  // Since EPOCH
+/// Start of the fence wait in progress, microseconds since EPOCH plus one; 0 when none
+static FENCE_SINCE_US: AtomicU64 = AtomicU64::new(0);
+static SOCKET_PATH: Mutex<Option<std::ffi::OsString>> = Mutex::new(None);
+
+fn bucket(us: u32) -> usize {
+    if us < 2 << SUB_BITS {
+        return us as usize;
+    }
+    let shift = 31 - us.leading_zeros() - SUB_BITS;
+    ((shift << SUB_BITS) + (us >> shift)) as usize
+}
+
+/// Highest value that lands in the bucket
+fn bucket_value(bucket: usize) -> u64 {
+    if bucket < 2 << SUB_BITS {
+        return bucket as u64;
+    }
+    let shift = (bucket >> SUB_BITS) as u32 - 1;
+    (((bucket - ((shift as usize) << SUB_BITS)) as u64) << shift) + (1u64 << shift) - 1
+}
+
+/// Bucket holding the `q` quantile of the counts, None when they are all 0
+fn quantile_bucket(counts: &[u64], q: f64) -> Option<usize> {
+    let total: u64 = counts.iter().sum();
+    if total == 0 {
+        return None;
+    }
+    let rank = (q * total as f64).ceil() as u64;
+    let mut seen = 0;
+    Some(
+        counts
+            .iter()
+            .position(|&n| {
+                seen += n;
+                seen >= rank
+            })
+            .unwrap_or(counts.len() - 1),
+    )
+}
+
+/// Removes the socket when dropped, however the viewer leaves main()
+#[must_use]
+pub struct Running;
+
+impl Drop for Running {
+    fn drop(&mut self) {
+        stop();
+    }
+}
+
+/// Start serving if METALSHADER_TELEMETRY names a socket path
+pub fn start_from_env() -> Running {
+    let Some(path) = std::env::var_os("METALSHADER_TELEMETRY") else {
+        return Running;
+    };
+    // A previous run's socket
+    let _ = std::fs::remove_file(&path);
+    match UnixListener::bind(&path) {
+        Ok(listener) => {
+            EPOCH.get_or_init(Instant::now);
+            ENABLED.store(true, Ordering::Relaxed);
+            println!("Telemetry: {}", path.to_string_lossy());
+            *SOCKET_PATH.lock().unwrap() = Some(path);
+            std::thread::spawn(move || {
+                for client in listener.incoming() {
+                    match client {
+                        Ok(mut client) => {
+                            let _ = client.write_all(report().as_bytes());
+                        }
+                        Err(_) => std::thread::sleep(ACCEPT_BACKOFF),
+                    }
+                }
+            });
+        }
+        Err(e) => eprintln!("Telemetry socket {:?} failed: {}", path, e),
+    }
+    Running
+}
+
+/// Remove the socket file at exit
+fn stop() {
+    if let Some(path) = SOCKET_PATH.lock().unwrap().take() {
+        let _ = std::fs::remove_file(path);
+    }
+}
+
+/// Around a fence wait, for the in-progress gauge
+pub fn fence_wait_begin() {
+    if ENABLED.load(Ordering::Relaxed) {
+        let us = EPOCH.get().unwrap().elapsed().as_micros() as u64;
+        FENCE_SINCE_US.store(us + 1, Ordering::Relaxed);
+    }
+}
+
+pub fn fence_wait_end() {
+    FENCE_SINCE_US.store(0, Ordering::Relaxed);
+}
+
+pub fn record(stage: Stage, elapsed: Duration) {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let h = &TELEMETRY.stages[stage as usize];
+    let us = elapsed.as_micros().min(u32::MAX as u128) as u32;
+    let window = TELEMETRY.window.load(Ordering::Relaxed);
+    h.buckets[window][bucket(us)].fetch_add(1, Ordering::Relaxed);
+    h.count.fetch_add(1, Ordering::Relaxed);
+    h.sum_us.fetch_add(us as u64, Ordering::Relaxed);
+    h.max_us.fetch_max(us as u64, Ordering::Relaxed);
+}
+
+/// Once per frame: retire the older window when the current one is full
+pub fn tick() {
+    if !ENABLED.load(Ordering::Relaxed) {
+        return;
+    }
+    let now_ms = EPOCH.get().unwrap().elapsed().as_millis() as u64;
+    if now_ms - WINDOW_START_MS.load(Ordering::Relaxed) < WINDOW.as_millis() as u64 {
+        return;
+    }
+    let older = TELEMETRY.window.load(Ordering::Relaxed) ^ 1;
+    for h in &TELEMETRY.stages {
+        for b in &h.buckets[older] {
+            b.store(0, Ordering::Relaxed);
+        }
+    }
+    TELEMETRY.window.store(older, Ordering::Relaxed);
+    WINDOW_START_MS.store(now_ms, Ordering::Relaxed);
+}
+
+fn report() -> String {
+    let mut out = String::from("# TYPE metalshader_stage_ms summary\n");
+    for (h, name) in TELEMETRY.stages.iter().zip(NAMES) {
+        let merged: Vec<u64> = (0..BUCKETS)
+            .map(|i| h.buckets[0][i].load(Ordering::Relaxed) + h.buckets[1][i].load(Ordering::Relaxed))
+            .collect();
+        let max_us = h.max_us.load(Ordering::Relaxed);
+        for q in [0.5, 0.99, 0.999] {
+            let value = match quantile_bucket(&merged, q) {
+                Some(i) => format!("{:.3}", bucket_value(i).min(max_us) as f64 / 1000.0),
+                None => "NaN".to_string(),
+            };
+            out += &format!("metalshader_stage_ms{{stage=\"{}\",quantile=\"{}\"}} {}\n", name, q, value);
+        }
+        out += &format!(
+            "metalshader_stage_ms_sum{{stage=\"{name}\"}} {:.3}\n\
+             metalshader_stage_ms_count{{stage=\"{name}\"}} {}\n\
+             metalshader_stage_ms_max{{stage=\"{name}\"}} {:.3}\n",
+            h.sum_us.load(Ordering::Relaxed) as f64 / 1000.0,
+            h.count.load(Ordering::Relaxed),
+            max_us as f64 / 1000.0,
+        );
+    }
+    let since = FENCE_SINCE_US.load(Ordering::Relaxed);
+    let waiting_us = if since == 0 {
+        0
+    } else {
+        (EPOCH.get().unwrap().elapsed().as_micros() as u64).saturating_sub(since - 1)
+    };
+    out += &format!(
+        "# TYPE metalshader_fence_waiting_ms gauge\nmetalshader_fence_waiting_ms {:.3}\n",
+        waiting_us as f64 / 1000.0
+    );
+    out
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bucket_round_trip() {
+        assert!(bucket(u32::MAX) < BUCKETS);
+        let mut us = 0u32;
+        while us < u32::MAX / 2 {
+            let b = bucket(us);
+            let top = bucket_value(b);
+            // Exact at first, then within 1/32 of the value
+            assert!(top >= us as u64 && top - us as u64 <= (us >> SUB_BITS) as u64, "{}", us);
+            assert_eq!(bucket(top as u32), b);
+            assert_eq!(bucket(top as u32 + 1), b + 1);
+            us += 1 + us / 7;
+        }
+    }
+
+    #[test]
+    fn test_quantile_bucket() {
+        assert_eq!(quantile_bucket(&[0; BUCKETS], 0.5), None);
+        let mut counts = [0u64; BUCKETS];
+        counts[bucket(10)] = 90;
+        counts[bucket(100)] = 9;
+        counts[bucket(5000)] = 1;
+        assert_eq!(quantile_bucket(&counts, 0.5), Some(bucket(10)));
+        assert_eq!(quantile_bucket(&counts, 0.9), Some(bucket(10)));
+        assert_eq!(quantile_bucket(&counts, 0.99), Some(bucket(100)));
+        assert_eq!(quantile_bucket(&counts, 0.999), Some(bucket(5000)));
+        assert_eq!(bucket_value(bucket(5000)), 5119);
+    }
+}